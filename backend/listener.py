@@ -34,6 +34,14 @@ TEE_API_TIMEOUT = int(os.getenv('TEE_API_TIMEOUT', '30'))  # Timeout in seconds
 TEE_API_MAX_RETRIES = int(os.getenv('TEE_API_MAX_RETRIES', '3'))  # Maximum number of retry attempts
 TEE_API_RETRY_DELAY = int(os.getenv('TEE_API_RETRY_DELAY', '5'))  # Delay between retries in seconds
 
+# Credit the tokens locked by each order to the enclave ledger (App started with --ledger)
+TEE_LEDGER = os.getenv('TEE_LEDGER', '0') == '1'
+# Quote token of the market; any other token is credited as base
+TST_TOKEN_ADDRESS = os.getenv('TST_TOKEN_ADDRESS', '0x77f369477a0140b30d359741f8720ee23f03ebd7')
+
+# One keep-alive connection to the TEE API instead of a TCP handshake per request
+tee_session = requests.Session()
+
 ABI_JSON = '''[{"inputs":[],"stateMutability":"nonpayable","type":"constructor"},{"anonymous":false,"inputs":[{"indexed":true,"internalType":"address","name":"token","type":"address"},{"indexed":true,"internalType":"address","name":"recipient","type":"address"},{"indexed":false,"internalType":"uint256","name":"amount","type":"uint256"}],"name":"AssetWithdrawn","type":"event"},{"anonymous":false,"inputs":[{"indexed":true,"internalType":"address","name":"sender","type":"address"},{"indexed":true,"internalType":"address","name":"token","type":"address"},{"indexed":false,"internalType":"uint256","name":"amount","type":"uint256"},{"indexed":false,"internalType":"uint8","name":"orderType","type":"uint8"},{"indexed":false,"internalType":"uint256","name":"size","type":"uint256"},{"indexed":false,"internalType":"string","name":"side","type":"string"},{"indexed":false,"internalType":"string","name":"marketCode","type":"string"}],"name":"OrderPlaced","type":"event"},{"stateMutability":"payable","type":"fallback"},{"inputs":[],"name":"owner","outputs":[{"internalType":"address","name":"","type":"address"}],"stateMutability":"view","type":"function"},{"inputs":[{"internalType":"uint8","name":"orderType","type":"uint8"},{"internalType":"uint256","name":"size","type":"uint256"},{"internalType":"string","name":"side","type":"string"},{"internalType":"string","name":"marketCode","type":"string"}],"name":"placeEthOrder","outputs":[],"stateMutability":"payable","type":"function"},{"inputs":[{"internalType":"address","name":"token","type":"address"},{"internalType":"uint256","name":"amount","type":"uint256"},{"internalType":"uint8","name":"orderType","type":"uint8"},{"internalType":"uint256","name":"size","type":"uint256"},{"internalType":"string","name":"side","type":"string"},{"internalType":"string","name":"marketCode","type":"string"}],"name":"placeTokenOrder","outputs":[],"stateMutability":"nonpayable","type":"function"},{"inputs":[{"internalType":"address","name":"token","type":"address"},{"internalType":"address","name":"recipient","type":"address"},{"internalType":"uint256","name":"amount","type":"uint256"}],"name":"withdraw","outputs":[],"stateMutability":"nonpayable","type":"function"},{"stateMutability":"payable","type":"receive"}]'''
 ABI = json.loads(ABI_JSON)
 
@@ -146,6 +154,9 @@ def handle_order_placed(event, w3):
     try:
         # Validate event data before forwarding
         validate_order_event(event)
+        # Fund the order first, or the ledger rejects it
+        if TEE_LEDGER:
+            forward_deposit_to_tee(event)
         # Forward to TEE
         order_id = forward_order_to_tee(event)
         logger.info(f"Successfully forwarded order to TEE. Order ID: {order_id}")
@@ -211,6 +222,29 @@ def retry_request(func, *args, max_retries=TEE_API_MAX_RETRIES, retry_delay=TEE_
     raise last_exception
 
 
+def forward_deposit_to_tee(event):
+    """Credit the tokens an order locked in the contract to the sender's enclave account."""
+    token = 'quote' if event['args']['token'].lower() == TST_TOKEN_ADDRESS.lower() else 'base'
+    # The enclave credits each deposit ID once, so replaying a block cannot pay twice
+    deposit_id = f"{event['transactionHash'].hex()}-{event['logIndex']}"
+    params = {
+        'user': event['args']['sender'],
+        'token': token,
+        'amount': str(Decimal(str(event['args']['amount']))),
+        'deposit': deposit_id
+    }
+    
+    def make_api_call():
+        response = tee_session.post(f"{TEE_API_ENDPOINT}/deposit", params=params, timeout=TEE_API_TIMEOUT)
+        response.raise_for_status()
+        return response.json()
+    
+    result = retry_request(make_api_call)
+    if not result.get('credited'):
+        logger.info(f"Deposit {deposit_id} was already credited")
+    return result
+
+
 def forward_order_to_tee(event):
     """Forward an order from the blockchain to the TEE."""
     # Map order_type from the contract to what the TEE expects
@@ -231,8 +265,13 @@ def forward_order_to_tee(event):
     size = event['args']['size']
     quantity = str(Decimal(str(size)))
     
+    # The event's position on chain keys the order, so a retry after a lost
+    # response returns the order already booked instead of adding it again
+    client_key = f"{event['transactionHash'].hex()}-{event['logIndex']}"
+    
     # Build the base URL with common parameters
-    url = f"{TEE_API_ENDPOINT}/order?user={sender}&type={order_type}&side={side}&quantity={quantity}"
+    url = (f"{TEE_API_ENDPOINT}/order?user={sender}&type={order_type}&side={side}&quantity={quantity}"
+           f"&client_key={client_key}")
     
     # Only add price for limit orders
     if order_type == 'limit':
@@ -255,7 +294,7 @@ def forward_order_to_tee(event):
     
     # Define a function to make the API call
     def make_api_call():
-        response = requests.post(url, timeout=TEE_API_TIMEOUT)
+        response = tee_session.post(url, timeout=TEE_API_TIMEOUT)
         response.raise_for_status()
         result = response.json()
         return result
@@ -263,7 +302,10 @@ def forward_order_to_tee(event):
     # Use the retry mechanism to make the API call
     try:
         result = retry_request(make_api_call)
-        logger.info(f"Order successfully forwarded to TEE. Order ID: {result.get('order_id')}")
+        if result.get('duplicate'):
+            logger.info(f"Order {client_key} was already in the TEE. Order ID: {result.get('order_id')}")
+        else:
+            logger.info(f"Order successfully forwarded to TEE. Order ID: {result.get('order_id')}")
         return result.get('order_id')
     except Exception as e:
         logger.error(f"Failed to forward order to TEE after retries: {str(e)}")
@@ -362,7 +404,7 @@ def check_tee_connection():
     """Check if the TEE endpoint is reachable."""
     try:
         # Try to connect to the TEE API endpoint
-        response = requests.get(f"{TEE_API_ENDPOINT}/trades", timeout=TEE_API_TIMEOUT)
+        response = tee_session.get(f"{TEE_API_ENDPOINT}/trades", timeout=TEE_API_TIMEOUT)
         response.raise_for_status()
         logger.info(f"TEE API connection successful at {TEE_API_ENDPOINT}")
         return True
@@ -24,6 +24,11 @@ load_dotenv()
 
 TEE_API_ENDPOINT = os.getenv('TEE_API_ENDPOINT', 'http://172.191.42.99:8080')
 TEE_API_TIMEOUT = int(os.getenv('TEE_API_TIMEOUT', '30'))
+TEE_API_MAX_RETRIES = int(os.getenv('TEE_API_MAX_RETRIES', '3'))  # Maximum number of retry attempts
+TEE_API_RETRY_DELAY = int(os.getenv('TEE_API_RETRY_DELAY', '5'))  # Delay between retries in seconds
+
+# One keep-alive connection to the TEE API instead of a TCP handshake per request
+tee_session = requests.Session()
 RPC_URL = os.getenv('SEPOLIA_RPC_URL')
 PRIVATE_KEY = os.getenv('PRIVATE_KEY')
 CONTRACT_ADDRESS = os.getenv('CONTRACT_ADDRESS')
@@ -32,22 +37,63 @@ DB_PATH = './backend/order_events.db'
 # Add the TST token address constant
 TST_TOKEN_ADDRESS = os.getenv('TST_TOKEN_ADDRESS', '0x77f369477a0140b30d359741f8720ee23f03ebd7')
 
+# Every market trades a base token (ETH by default) against a quote token (TST)
+BASE_TOKEN_ADDRESS = os.getenv('BASE_TOKEN_ADDRESS', '0x0000000000000000000000000000000000000000')
+
+# Enclave markets to settle, comma-separated
+SETTLEMENT_MARKETS = [int(m) for m in os.getenv('SETTLEMENT_MARKETS', '0').split(',') if m.strip()]
+
+def retry_request(func, *args, max_retries=TEE_API_MAX_RETRIES, retry_delay=TEE_API_RETRY_DELAY, **kwargs):
+    """Retry a function call with exponential backoff."""
+    last_exception = None
+    for attempt in range(max_retries):
+        try:
+            return func(*args, **kwargs)
+        except Exception as e:
+            last_exception = e
+            delay = retry_delay * (2 ** attempt)  # Exponential backoff
+            logger.warning(f"Attempt {attempt + 1}/{max_retries} failed: {str(e)}. Retrying in {delay} seconds...")
+            time.sleep(delay)
+    
+    # If we've exhausted all retries, raise the last exception
+    logger.error(f"All {max_retries} attempts failed. Last error: {str(last_exception)}")
+    raise last_exception
+
 def init_settlement_db():
-    """Initialize the settlement database to track processed trades."""
+    """Initialize the settlement database to track settlement batches and their transfers.
+    
+    Batches are keyed by their digest: batch numbers start again at 1 when
+    the enclave restarts, while a digest chains onto every batch before it.
+    """
     conn = sqlite3.connect(DB_PATH)
     cursor = conn.cursor()
     
     cursor.execute('''
-    CREATE TABLE IF NOT EXISTS processed_trades (
-        id TEXT PRIMARY KEY,
-        maker TEXT,
-        taker TEXT,
-        taker_side TEXT,
-        price TEXT,
-        quantity TEXT,
-        timestamp INTEGER,
+    CREATE TABLE IF NOT EXISTS settlement_batches (
+        batch_id TEXT,
+        market INTEGER,
+        number INTEGER,
+        first_seq INTEGER,
+        last_seq INTEGER,
+        trade_count INTEGER,
+        previous_digest TEXT,
+        digest TEXT,
+        processed_at INTEGER,
+        acknowledged_at INTEGER,
+        PRIMARY KEY (digest)
+    )
+    ''')
+    
+    cursor.execute('''
+    CREATE TABLE IF NOT EXISTS settlement_transfers (
+        digest TEXT,
+        market INTEGER,
+        number INTEGER,
+        user TEXT,
+        token TEXT,
+        amount TEXT,
         settlement_tx_hash TEXT,
-        processed_at INTEGER
+        PRIMARY KEY (digest, user, token)
     )
     ''')
     
@@ -55,144 +101,201 @@ def init_settlement_db():
     conn.close()
     logger.info("Settlement database initialized successfully.")
 
-def get_processed_trade_ids():
-    """Get a list of already processed trade IDs to avoid duplicate settlements."""
+def record_batch(batch):
+    """Store a settlement batch before any of its transfers is executed.
+    
+    The enclave returns a batch again until it is acknowledged, so a batch
+    already stored is left as it is, payouts included.
+    """
     conn = sqlite3.connect(DB_PATH)
     cursor = conn.cursor()
     
-    cursor.execute('SELECT id FROM processed_trades')
-    result = cursor.fetchall()
+    cursor.execute('''
+    INSERT OR IGNORE INTO settlement_batches (
+        batch_id, market, number, first_seq, last_seq, trade_count,
+        previous_digest, digest, processed_at
+    ) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)
+    ''', (
+        batch['batch_id'],
+        batch['market'],
+        batch['number'],
+        batch['first_seq'],
+        batch['last_seq'],
+        batch['trade_count'],
+        batch['previous_digest'],
+        batch['digest'],
+        int(time.time())
+    ))
+    recorded = cursor.rowcount > 0
+    
+    for transfer in batch['transfers']:
+        cursor.execute('''
+        INSERT OR IGNORE INTO settlement_transfers (digest, market, number, user, token, amount, settlement_tx_hash)
+        VALUES (?, ?, ?, ?, ?, ?, NULL)
+        ''', (batch['digest'], batch['market'], batch['number'], transfer['user'], transfer['token'],
+              repr(transfer['amount'])))
     
+    conn.commit()
     conn.close()
     
-    return [row[0] for row in result]
+    if recorded:
+        logger.info(f"Batch {batch['batch_id']} of market {batch['market']} recorded: trades "
+                    f"{batch['first_seq']}-{batch['last_seq']}, {len(batch['transfers'])} transfers")
+    else:
+        logger.info(f"Batch {batch['batch_id']} of market {batch['market']} was already recorded")
 
-def mark_trade_as_processed(trade, tx_hash=None):
-    """Mark a trade as processed in the database."""
+def settled_transfers(batch):
+    """The (user, token) pairs of a batch that were already paid out."""
     conn = sqlite3.connect(DB_PATH)
     cursor = conn.cursor()
     
     cursor.execute('''
-    INSERT INTO processed_trades (
-        id, maker, taker, taker_side, price, quantity, timestamp, 
-        settlement_tx_hash, processed_at
-    ) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)
-    ''', (
-        trade['id'],
-        trade.get('maker', ''),
-        trade.get('taker', ''),
-        trade.get('taker_side', ''),
-        str(trade.get('price', '0')),
-        str(trade.get('quantity', '0')),
-        trade.get('timestamp', 0),
-        tx_hash,
-        int(time.time())
-    ))
+    SELECT user, token FROM settlement_transfers
+    WHERE digest = ? AND settlement_tx_hash IS NOT NULL
+    ''', (batch['digest'],))
+    settled = set(cursor.fetchall())
+    
+    conn.close()
+    return settled
+
+def mark_transfer_as_settled(batch, transfer, tx_hash):
+    """Store the transaction that paid out a transfer."""
+    conn = sqlite3.connect(DB_PATH)
+    cursor = conn.cursor()
+    
+    cursor.execute('''
+    UPDATE settlement_transfers SET settlement_tx_hash = ?
+    WHERE digest = ? AND user = ? AND token = ?
+    ''', (tx_hash, batch['digest'], transfer['user'], transfer['token']))
     
     conn.commit()
     conn.close()
+
+def mark_batch_as_acknowledged(batch):
+    """Store that the TEE let the batch go."""
+    conn = sqlite3.connect(DB_PATH)
+    cursor = conn.cursor()
     
-    logger.info(f"Trade {trade['id']} marked as processed with tx_hash: {tx_hash}")
+    cursor.execute('''
+    UPDATE settlement_batches SET acknowledged_at = ? WHERE digest = ?
+    ''', (int(time.time()), batch['digest']))
+    
+    conn.commit()
+    conn.close()
 
-def fetch_trades():
-    """Fetch trades from the TEE API."""
+def close_settlement_batch(market):
+    """Ask the TEE to close the market's settlement window; None when it has no new trades.
+    
+    Until a batch is acknowledged the TEE returns it again instead of
+    closing another, so retrying after a lost reply loses no batch.
+    """
+    def make_api_call():
+        response = tee_session.post(f"{TEE_API_ENDPOINT}/settlement", params={'market': market},
+                                    timeout=TEE_API_TIMEOUT)
+        response.raise_for_status()
+        return response.json()
+    
     try:
-        response = requests.get(f"{TEE_API_ENDPOINT}/trades", timeout=TEE_API_TIMEOUT)
+        batch = retry_request(make_api_call)
+        if batch.get('batch_id') is None:
+            return None
+        logger.info(f"Closed batch {batch['batch_id']} with {batch['trade_count']} trades")
+        return batch
+    except Exception as e:
+        logger.error(f"Error closing settlement batch for market {market}: {str(e)}")
+        return None
+
+def acknowledge_settlement_batch(batch):
+    """Tell the TEE the batch is stored and paid out, so it closes the next one."""
+    params = {'market': batch['market'], 'number': batch['number'], 'digest': batch['digest']}
+    
+    def make_api_call():
+        response = tee_session.post(f"{TEE_API_ENDPOINT}/settlement-ack", params=params,
+                                    timeout=TEE_API_TIMEOUT)
         response.raise_for_status()
-        trades = response.json()
-        logger.info(f"Fetched {len(trades)} trades from TEE API")
-        return trades
+        return response.json()
+    
+    try:
+        retry_request(make_api_call)
+        mark_batch_as_acknowledged(batch)
+        return True
     except Exception as e:
-        logger.error(f"Error fetching trades from TEE API: {str(e)}")
-        return []
+        logger.error(f"Error acknowledging batch {batch['batch_id']}: {str(e)}")
+        return False
 
-def execute_settlement(trade):
-    """Execute on-chain settlement for a trade match."""
+def execute_transfer(batch, transfer):
+    """Pay out one net transfer on-chain."""
     try:
-        logger.info(f"Processing settlement for trade {trade['id']}")
-        
-        # Determine the recipient (based on who is receiving the tokens)
-        maker = trade.get('maker', '')
-        taker = trade.get('taker', '')
-        taker_side = trade.get('taker_side', '').lower()
-        
-        # Calculate settlement amount (price * quantity)
-        price = float(trade.get('price', 0))
-        quantity = float(trade.get('quantity', 0))
-        settlement_amount = price * quantity
-        
-        # If price is 0 or very small, use a reasonable default for market orders
-        if settlement_amount < 0.0001:
-            # For market orders, use a reasonable price (e.g., 100 tokens per ETH)
-            settlement_amount = quantity * 100
-        
-        logger.info(f"Trade details: maker={maker}, taker={taker}, taker_side={taker_side}, price={price}, quantity={quantity}")
-        
-        # Use Web3 to get checksummed addresses
         w3 = Web3()
+        token_address = w3.to_checksum_address(
+            BASE_TOKEN_ADDRESS if transfer['token'] == 'base' else TST_TOKEN_ADDRESS)
+        recipient = transfer['user']
+        amount = transfer['amount']
         
-        # Determine token and recipient based on trade side
-        if taker_side == 'buy':
-            # Taker is buying ETH with TST tokens
-            # Maker is selling ETH and receiving TST tokens
-            token_address = w3.to_checksum_address(TST_TOKEN_ADDRESS)  # TST token
-            recipient = maker  # Maker receives tokens
-            logger.info(f"Buy side: Maker {maker} sells ETH and receives {settlement_amount} TST tokens")
-        else:  # sell
-            # Taker is selling ETH for TST tokens
-            # Maker is buying ETH and sending TST tokens
-            token_address = w3.to_checksum_address(TST_TOKEN_ADDRESS)  # TST token
-            recipient = taker  # Taker receives tokens
-            logger.info(f"Sell side: Taker {taker} sells ETH and receives {settlement_amount} TST tokens")
-        
-        logger.info(f"Settlement: {settlement_amount} {token_address} tokens to {recipient}")
+        logger.info(f"Settlement: {amount} {token_address} tokens to {recipient} (batch {batch['batch_id']})")
         
         # Execute the on-chain transaction
         tx_hash = execute(
             private_key=PRIVATE_KEY,
             token_address=token_address,
-            recipient=recipient, 
-            amount=settlement_amount
+            recipient=recipient,
+            amount=amount
         )
         
         if tx_hash:
-            logger.info(f"Settlement successful for trade {trade['id']}, tx_hash: {tx_hash}")
-            return tx_hash
+            logger.info(f"Transfer to {recipient} successful, tx_hash: {tx_hash}")
         else:
-            logger.error(f"Settlement failed for trade {trade['id']}")
-            return None
+            logger.error(f"Transfer to {recipient} failed in batch {batch['batch_id']}")
+        return tx_hash
     except Exception as e:
-        logger.error(f"Error executing settlement for trade {trade['id']}: {str(e)}")
+        logger.error(f"Error executing transfer to {transfer['user']} in batch {batch['batch_id']}: {str(e)}")
         return None
 
+def settle_batch(batch):
+    """Execute the transfers of a batch; True once every one is paid out.
+    
+    Debits are covered by the users' deposits in the contract, so only users
+    with a positive net amount receive a withdrawal: one per user and token,
+    however many trades the batch nets. A batch returned again pays only
+    the transfers that have no tx hash yet.
+    """
+    record_batch(batch)
+    settled = settled_transfers(batch)
+    paid = True
+    for transfer in batch['transfers']:
+        if transfer['amount'] <= 0 or (transfer['user'], transfer['token']) in settled:
+            continue
+        tx_hash = execute_transfer(batch, transfer)
+        
+        # Failed transfers stay in the database without a tx hash and are
+        # retried when the TEE returns the batch again
+        if tx_hash:
+            mark_transfer_as_settled(batch, transfer, tx_hash)
+        else:
+            paid = False
+    return paid
+
 def process_new_trades():
-    """Process new trades that haven't been settled yet."""
+    """Settle the trades each market executed since its last batch."""
     # Initialize the settlement database
     init_settlement_db()
     
-    # Get already processed trade IDs
-    processed_trade_ids = get_processed_trade_ids()
-    logger.info(f"Found {len(processed_trade_ids)} previously processed trades")
-    
-    # Fetch current trades from TEE
-    trades = fetch_trades()
-    
-    # Filter for new trades
-    new_trades = [trade for trade in trades if trade['id'] not in processed_trade_ids]
-    logger.info(f"Found {len(new_trades)} new trades to process")
-    
-    # Process each new trade
-    for trade in new_trades:
-        logger.info(f"Processing trade {trade['id']}")
-        
-        # Execute settlement
-        tx_hash = execute_settlement(trade)
-        
-        # Mark as processed regardless of success (to avoid retrying failed trades)
-        # In a production system, you might want to retry or have manual intervention
-        mark_trade_as_processed(trade, tx_hash)
+    settled_trades = 0
+    for market in SETTLEMENT_MARKETS:
+        # A batch holds as many trades as its transfers have room for; keep
+        # closing until the market has nothing pending. A batch not paid out
+        # in full stays unacknowledged, and the next round gets it again.
+        while True:
+            batch = close_settlement_batch(market)
+            if batch is None:
+                break
+            if not settle_batch(batch) or not acknowledge_settlement_batch(batch):
+                break
+            settled_trades += batch['trade_count']
+            if batch['pending_trades'] == 0:
+                break
     
-    return len(new_trades)
+    return settled_trades
 
 def start_settlement_monitoring(interval_seconds=30, duration_seconds=None):
     """Start monitoring for trades and executing settlements.
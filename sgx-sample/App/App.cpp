@@ -5,20 +5,38 @@
 #include <unistd.h>
 #include <pwd.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <ctype.h>
 #include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <string>
+#include <thread>
 
 #define MAX_PATH FILENAME_MAX
-#define HTTP_PORT 8080
-#define BUFFER_SIZE 10240
+#define EXPORT_CHUNK_SIZE 16384
+#define SETTLEMENT_MAX_TRANSFERS 4096
+
+// TCSNum of the enclave's config file; the Makefile passes it in
+#ifndef ENCLAVE_TCS_NUM
+#define ENCLAVE_TCS_NUM 14
+#endif
 
 #include "sgx_urts.h"
 #include "App.h"
 #include "Enclave_u.h"
+#include "Metrics.h"
+#include "EcallProfiler.h"
+#include "HttpParser.h"
+#include "HttpServer.h"
+#include "OrderEntryServer.h"
+#include "MatchingThread.h"
+#include "Replica.h"
 
 /* Global EID shared by multiple threads */
 sgx_enclave_id_t global_eid = 0;
@@ -26,6 +44,15 @@ sgx_enclave_id_t global_eid = 0;
 // Flag to control server loop
 volatile sig_atomic_t keep_running = 1;
 
+// Path of the request being handled, attributed to every response it sends
+static __thread int request_path = METRIC_PATH_OTHER;
+
+// Whether the response to the current request keeps the connection open
+static __thread bool response_keep_alive = false;
+
+// Whether streamed bodies use chunked framing (HTTP/1.1) or end at close (HTTP/1.0)
+static __thread bool response_chunked = false;
+
 // Signal handler for graceful shutdown
 void handle_signal(int sig) {
     keep_running = 0;
@@ -158,6 +185,71 @@ int initialize_enclave(void)
     return 0;
 }
 
+/* Startup phase durations in ms, reported by /ready */
+static struct {
+    double start;             /* Monotonic ms when main was entered */
+    double bind_start;
+    double enclave_create;    /* sgx_create_enclave */
+    double restore;           /* Book brought to its serving state */
+    double bind;              /* Listeners opened until connections are accepted */
+    double total;             /* main to ready */
+    bool ready;
+} startup;
+
+static double monotonic_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec * 1000.0 + (double)now.tv_nsec / 1e6;
+}
+
+// HTTP server callback: both listeners accept connections from here on
+static void startup_ready(void)
+{
+    double now = monotonic_ms();
+    startup.bind = now - startup.bind_start;
+    startup.total = now - startup.start;
+    __atomic_store_n(&startup.ready, true, __ATOMIC_RELEASE);
+    printf("[DEBUG] Ready in %.1f ms (enclave create %.1f ms, restore %.1f ms, bind %.1f ms)\n",
+           startup.total, startup.enclave_create, startup.restore, startup.bind);
+}
+
+/* Once a second until shutdown, expire the orders due in every market, so
+ * a book nobody trades in still drops its stale quotes on time */
+static void run_expiry_clock(void)
+{
+    for (;;) {
+        for (int i = 0; i < 10 && keep_running; i++) {
+            usleep(100000);
+        }
+        if (!keep_running) {
+            return;
+        }
+        ReplicaGuard guard;
+        sgx_status_t status = ecall_expire_orders(global_eid);
+        if (status != SGX_SUCCESS) {
+            printf("[ERROR] Failed to expire orders. Error code: %d\n", status);
+        }
+    }
+}
+
+/* TSC frequency used to convert cycle counts to time */
+double tsc_hz = 0;
+
+void calibrate_tsc(void)
+{
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t tsc_start = read_tsc();
+    usleep(20000);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    uint64_t tsc_end = read_tsc();
+
+    double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+    tsc_hz = (double)(tsc_end - tsc_start) / seconds;
+    printf("[DEBUG] TSC frequency: %.0f MHz\n", tsc_hz / 1e6);
+}
+
 /* OCall functions */
 void ocall_print_string(const char *str)
 {
@@ -181,105 +273,514 @@ void ocall_log_message(const char* message)
     }
 }
 
-// Function to parse HTTP request and extract parameters
-int parse_http_request(char* buffer, char* method, char* path, char* query_string) {
-    // Extract method
-    char* token = strtok(buffer, " ");
-    if (token == NULL) return -1;
-    strcpy(method, token);
-    
-    // Extract path with potential query string
-    token = strtok(NULL, " ");
-    if (token == NULL) return -1;
-    
-    // Split path and query string
-    char* query_start = strchr(token, '?');
-    if (query_start) {
-        *query_start = '\0';
-        strcpy(path, token);
-        strcpy(query_string, query_start + 1);
-    } else {
-        strcpy(path, token);
-        query_string[0] = '\0';
+// Copy a request field: 1 when present, 0 when absent, -1 when it does not
+// fit or is badly encoded. Query string values are percent-decoded.
+static int read_field(http_slice_t value, bool from_query, char* out, size_t out_size)
+{
+    if (value.data == NULL) {
+        return 0;
     }
-    
-    return 0;
+    int copied = from_query ? http_query_decode(value, out, out_size)
+                            : http_slice_copy(value, out, out_size);
+    return copied < 0 ? -1 : 1;
+}
+
+// Strict decimal parsing: the whole field must be a finite number
+static bool parse_number(const char* text, double* value)
+{
+    char* end = NULL;
+    *value = strtod(text, &end);
+    return end != text && *end == '\0' && isfinite(*value);
+}
+
+// Strict non-negative integer parsing, used for sequence numbers and timestamps
+static bool parse_count(const char* text, uint64_t* value)
+{
+    char* end = NULL;
+    errno = 0;
+    *value = strtoull(text, &end, 10);
+    return text[0] >= '0' && text[0] <= '9' && *end == '\0' && errno == 0;
+}
+
+// Exactly size bytes of hex digits, either case
+static bool parse_hex(const char* text, uint8_t* out, size_t size)
+{
+    if (strlen(text) != 2 * size) {
+        return false;
+    }
+    for (size_t i = 0; i < 2 * size; i++) {
+        char c = text[i];
+        int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 :
+                    c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+        if (digit < 0) {
+            return false;
+        }
+        out[i / 2] = (uint8_t)(i % 2 ? out[i / 2] | digit : digit << 4);
+    }
+    return true;
+}
+
+// Optional expires field of an order: a unix time for a good-till-time
+// order, "day" for one that expires when its market's session closes, and
+// good till cancelled when absent
+static bool read_expiry(http_slice_t value, bool from_query, int64_t* expires)
+{
+    char text[24] = {0};
+    uint64_t number = 0;
+    int found = read_field(value, from_query, text, sizeof(text));
+    if (found == 0) {
+        *expires = ORDER_EXPIRES_NEVER;
+        return true;
+    }
+    if (found > 0 && strcmp(text, "day") == 0) {
+        *expires = ORDER_EXPIRES_SESSION_CLOSE;
+        return true;
+    }
+    if (found < 0 || !parse_count(text, &number) || number == 0 || number > (uint64_t)INT64_MAX) {
+        return false;
+    }
+    *expires = (int64_t)number;
+    return true;
+}
+
+// Optional market field, 0 when absent; false if it names no market
+static bool read_market(http_slice_t value, bool from_query, int* market)
+{
+    char text[8] = {0};
+    uint64_t number = 0;
+    int found = read_field(value, from_query, text, sizeof(text));
+    if (found == 0) {
+        *market = 0;
+        return true;
+    }
+    if (found < 0 || !parse_count(text, &number) || number >= MARKET_COUNT) {
+        return false;
+    }
+    *market = (int)number;
+    return true;
 }
 
-// Function to extract value from query string
-int get_query_param(const char* query_string, const char* param_name, char* value, size_t value_size) {
-    char query_copy[BUFFER_SIZE];
-    strncpy(query_copy, query_string, BUFFER_SIZE - 1);
-    query_copy[BUFFER_SIZE - 1] = '\0';
+// Read the range and filter parameters of GET /trades into query. Returns
+// NULL, or the message of a 400 response. paged reports whether any of them
+// was given, which switches the response to the paged object format.
+static const char* read_trade_query(http_slice_t query_string, char* user_address, size_t user_size,
+                                    trade_query_t* query, bool* paged)
+{
+    static const char* const trades_fields[] = {
+        "user", "since_seq", "until_seq", "from_ts", "to_ts", "limit", "side", "market"
+    };
+    enum { FIELD_USER, FIELD_SINCE_SEQ, FIELD_UNTIL_SEQ, FIELD_FROM_TS, FIELD_TO_TS,
+           FIELD_LIMIT, FIELD_SIDE, FIELD_MARKET, FIELD_COUNT };
+    http_slice_t fields[FIELD_COUNT];
+    http_query_fields(query_string, trades_fields, fields, FIELD_COUNT);
     
-    char* token = strtok(query_copy, "&");
-    while (token != NULL) {
-        char* equals = strchr(token, '=');
-        if (equals) {
-            *equals = '\0';
-            if (strcmp(token, param_name) == 0) {
-                strncpy(value, equals + 1, value_size - 1);
-                value[value_size - 1] = '\0';
-                return 0;
-            }
+    memset(query, 0, sizeof(*query));
+    query->side = -1;
+    *paged = false;
+    
+    if (read_field(fields[FIELD_USER], true, user_address, user_size) < 0) {
+        return "Invalid user parameter";
+    }
+    if (!read_market(fields[FIELD_MARKET], true, &query->market)) {
+        return "Invalid market parameter";
+    }
+    
+    uint64_t* numbers[] = { &query->since_seq, &query->until_seq, (uint64_t*)&query->from_ts,
+                            (uint64_t*)&query->to_ts, &query->limit };
+    for (int i = FIELD_SINCE_SEQ; i <= FIELD_LIMIT; i++) {
+        char text[24] = {0};
+        int found = read_field(fields[i], true, text, sizeof(text));
+        if (found == 0) {
+            continue;
+        }
+        // Timestamps are signed on the enclave side
+        uint64_t value = 0;
+        if (found < 0 || !parse_count(text, &value) ||
+            ((i == FIELD_FROM_TS || i == FIELD_TO_TS) && value > (uint64_t)INT64_MAX)) {
+            return (i == FIELD_LIMIT) ? "Invalid limit parameter" : "Invalid range parameter";
         }
-        token = strtok(NULL, "&");
+        *numbers[i - FIELD_SINCE_SEQ] = value;
+        *paged = true;
     }
     
-    return -1;
+    char side_str[8] = {0};
+    int side_found = read_field(fields[FIELD_SIDE], true, side_str, sizeof(side_str));
+    if (side_found != 0) {
+        if (side_found > 0 && strcmp(side_str, "buy") == 0) {
+            query->side = 0; // BUY
+        } else if (side_found > 0 && strcmp(side_str, "sell") == 0) {
+            query->side = 1; // SELL
+        } else {
+            return "Invalid side parameter (must be 'buy' or 'sell')";
+        }
+        *paged = true;
+    }
+    return NULL;
+}
+
+static const char* http_status_text(int status_code) {
+    return (status_code == 200) ? "OK" : 
+           (status_code == 400) ? "Bad Request" : 
+           (status_code == 404) ? "Not Found" : 
+           (status_code == 409) ? "Conflict" : 
+           (status_code == 500) ? "Internal Server Error" : 
+           (status_code == 503) ? "Service Unavailable" : "Unknown";
 }
 
 // Function to send HTTP response
 void send_http_response(int client_socket, int status_code, const char* content_type, const char* body) {
-    char response[BUFFER_SIZE];
-    const char* status_text = (status_code == 200) ? "OK" : 
-                             (status_code == 400) ? "Bad Request" : 
-                             (status_code == 404) ? "Not Found" : 
-                             (status_code == 500) ? "Internal Server Error" : "Unknown";
+    char header[512];
+    const char* status_text = http_status_text(status_code);
+    size_t body_length = strlen(body);
     
-    snprintf(response, BUFFER_SIZE,
+    int header_length = snprintf(header, sizeof(header),
              "HTTP/1.1 %d %s\r\n"
              "Content-Type: %s\r\n"
              "Content-Length: %zu\r\n"
-             "Connection: close\r\n"
+             "Connection: %s\r\n"
              "Access-Control-Allow-Origin: *\r\n"
-             "\r\n"
-             "%s",
-             status_code, status_text, content_type, strlen(body), body);
+             "\r\n",
+             status_code, status_text, content_type, body_length,
+             response_keep_alive ? "keep-alive" : "close");
+    
+    // Header and body go out together without copying the body
+    struct iovec iov[2];
+    iov[0].iov_base = header;
+    iov[0].iov_len = (size_t)header_length;
+    iov[1].iov_base = const_cast<char*>(body);
+    iov[1].iov_len = body_length;
+    http_send_all(client_socket, iov, 2);
     
-    send(client_socket, response, strlen(response), 0);
+    metrics_record_request(request_path, status_code);
     printf("[DEBUG] Sent response: %d %s\n", status_code, status_text);
 }
 
-// Function to handle HTTP requests
-void handle_http_request(int client_socket) {
-    char buffer[BUFFER_SIZE] = {0};
-    int bytes_received = recv(client_socket, buffer, BUFFER_SIZE - 1, 0);
+// Start a response whose body is streamed with send_body_chunk. HTTP/1.0
+// clients cannot take chunked framing, so their body ends when we close.
+static bool send_streamed_response_header(int client_socket, int status_code, const char* content_type,
+                                          int minor_version)
+{
+    response_chunked = minor_version >= 1;
+    if (!response_chunked) {
+        response_keep_alive = false;
+    }
     
-    if (bytes_received <= 0) {
-        printf("[ERROR] Failed to receive data from client: %d\n", bytes_received);
-        close(client_socket);
-        return;
+    char header[512];
+    int header_length = snprintf(header, sizeof(header),
+             "HTTP/1.1 %d %s\r\n"
+             "Content-Type: %s\r\n"
+             "%s"
+             "Connection: %s\r\n"
+             "Access-Control-Allow-Origin: *\r\n"
+             "\r\n",
+             status_code, http_status_text(status_code), content_type,
+             response_chunked ? "Transfer-Encoding: chunked\r\n" : "",
+             response_keep_alive ? "keep-alive" : "close");
+    
+    struct iovec iov;
+    iov.iov_base = header;
+    iov.iov_len = (size_t)header_length;
+    metrics_record_request(request_path, status_code);
+    return http_send_all(client_socket, &iov, 1);
+}
+
+// Send prefix + data as one chunk with a single gather write; last also
+// writes the terminating zero-length chunk
+static bool send_body_chunk(int client_socket, const char* prefix, const char* data, size_t length, bool last)
+{
+    size_t prefix_length = prefix ? strlen(prefix) : 0;
+    size_t chunk_length = prefix_length + length;
+    char size_line[24];
+    struct iovec iov[5];
+    int count = 0;
+    
+    if (response_chunked && chunk_length > 0) {
+        iov[count].iov_base = size_line;
+        iov[count].iov_len = (size_t)snprintf(size_line, sizeof(size_line), "%zx\r\n", chunk_length);
+        count++;
     }
+    if (prefix_length > 0) {
+        iov[count].iov_base = const_cast<char*>(prefix);
+        iov[count].iov_len = prefix_length;
+        count++;
+    }
+    if (length > 0) {
+        iov[count].iov_base = const_cast<char*>(data);
+        iov[count].iov_len = length;
+        count++;
+    }
+    if (response_chunked && chunk_length > 0) {
+        iov[count].iov_base = const_cast<char*>("\r\n");
+        iov[count].iov_len = 2;
+        count++;
+    }
+    if (response_chunked && last) {
+        iov[count].iov_base = const_cast<char*>("0\r\n\r\n");
+        iov[count].iov_len = 5;
+        count++;
+    }
+    return count == 0 || http_send_all(client_socket, iov, count);
+}
+
+// Stream trades as a JSON array, one ECALL per chunk of EXPORT_CHUNK_SIZE
+// bytes, so memory stays bounded however long the trade log grows. A paged
+// export wraps the array in an object carrying the cursor of the next page.
+// Returns false when the connection has to be dropped mid-body.
+static bool send_trades(int client_socket, const char* user_address, const trade_query_t* query,
+                        bool paged, int minor_version)
+{
+    char chunk[EXPORT_CHUNK_SIZE];
+    trade_query_t remaining = *query;
+    trade_export_t progress;
+    uint64_t cursor = 0;
+    size_t length = 0;
     
-    // Parse HTTP request
-    char method[16] = {0};
-    char path[256] = {0};
-    char query_string[256] = {0};
+    sgx_status_t status = ecall_export_trades(global_eid, &length, user_address, &remaining, cursor,
+                                              chunk, sizeof(chunk), &progress);
+    if (status != SGX_SUCCESS) {
+        char error_msg[100];
+        snprintf(error_msg, sizeof(error_msg), "Error: Failed to get trades. Error code: %d", status);
+        printf("[ERROR] %s\n", error_msg);
+        send_http_response(client_socket, 500, "text/plain", error_msg);
+        return true;
+    }
     
-    if (parse_http_request(buffer, method, path, query_string) < 0) {
-        printf("[ERROR] Failed to parse HTTP request\n");
-        send_http_response(client_socket, 400, "text/plain", "Bad Request");
-        close(client_socket);
-        return;
+    if (!send_streamed_response_header(client_socket, 200, "application/json", minor_version)) {
+        return false;
     }
     
-    printf("[DEBUG] Method: %s, Path: %s, Query: %s\n", method, path, query_string);
+    // The enclave separates trades within a chunk; the App separates chunks
+    const char* opening = paged ? "{\"trades\":[" : "[";
+    const char* prefix = opening;
+    for (;;) {
+        // A satisfied limit ends the page; the cursor is where the next one starts
+        bool last = progress.next_cursor == TRADE_EXPORT_END;
+        if (remaining.limit != 0) {
+            remaining.limit = progress.count < remaining.limit ? remaining.limit - progress.count : 0;
+            last = last || remaining.limit == 0;
+        }
+        if (length > 0) {
+            if (!send_body_chunk(client_socket, prefix, chunk, length, false)) {
+                return false;
+            }
+            prefix = ",";
+        } else if (!last && progress.next_cursor == cursor) {
+            // A single trade larger than the chunk buffer can never be sent
+            printf("[ERROR] Trade export made no progress at cursor %llu\n", (unsigned long long)cursor);
+            return false;
+        }
+        if (last) {
+            break;
+        }
+        
+        cursor = progress.next_cursor;
+        status = ecall_export_trades(global_eid, &length, user_address, &remaining, cursor,
+                                     chunk, sizeof(chunk), &progress);
+        if (status != SGX_SUCCESS) {
+            // Headers are out; dropping the connection is the only way to signal failure
+            printf("[ERROR] Trade export failed mid-stream. Error code: %d\n", status);
+            return false;
+        }
+    }
+    
+    // Closing bracket and the terminating chunk go out together
+    char closing[64];
+    if (!paged) {
+        snprintf(closing, sizeof(closing), "]");
+    } else if (progress.next_cursor == TRADE_EXPORT_END) {
+        snprintf(closing, sizeof(closing), "],\"next_since_seq\":null}");
+    } else {
+        snprintf(closing, sizeof(closing), "],\"next_since_seq\":%llu}",
+                 (unsigned long long)progress.next_cursor);
+    }
+    bool empty = prefix == opening;
+    return send_body_chunk(client_socket, empty ? opening : NULL, closing, strlen(closing), true) &&
+           response_keep_alive;
+}
+
+// Append a histogram summary as a JSON object; scale converts raw values to output units
+static int format_histogram_json(char* out, size_t out_size, const char* name,
+                                 const enclave_histogram_t* hist, double scale)
+{
+    static const double percentiles[] = { 50.0, 90.0, 99.0, 99.9 };
+    static const char* labels[] = { "p50", "p90", "p99", "p999" };
+    
+    int len = snprintf(out, out_size, "\"%s\":{\"count\":%llu,\"mean\":%.3f", name,
+                       (unsigned long long)hist->count,
+                       hist->count ? (double)hist->sum / (double)hist->count * scale : 0.0);
+    for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++) {
+        uint64_t value = log_hist_percentile(hist->buckets, ENCLAVE_STATS_BUCKETS,
+                                             ENCLAVE_STATS_SUB_BITS, percentiles[i]);
+        len += snprintf(out + len, out_size - (size_t)len, ",\"%s\":%.3f", labels[i], (double)value * scale);
+    }
+    len += snprintf(out + len, out_size - (size_t)len, ",\"max\":%.3f}", (double)hist->max * scale);
+    return len;
+}
+
+// Function to format enclave statistics as JSON
+void format_enclave_stats(const enclave_stats_t* stats, char* out, size_t out_size)
+{
+    // Cycle histograms are reported in microseconds
+    double us_per_cycle = tsc_hz > 0 ? 1e6 / tsc_hz : 0.0;
+    
+    int len = snprintf(out, out_size, "{\"interval_ms\":%.3f,", (double)stats->interval_cycles * us_per_cycle / 1000.0);
+    len += format_histogram_json(out + len, out_size - (size_t)len, "add_order_us", &stats->add_order_cycles, us_per_cycle);
+    len += snprintf(out + len, out_size - (size_t)len, ",");
+    len += format_histogram_json(out + len, out_size - (size_t)len, "fills_per_order", &stats->fills_per_order, 1.0);
+    len += snprintf(out + len, out_size - (size_t)len, ",");
+    len += format_histogram_json(out + len, out_size - (size_t)len, "levels_swept", &stats->levels_swept, 1.0);
+    len += snprintf(out + len, out_size - (size_t)len, ",");
+    len += format_histogram_json(out + len, out_size - (size_t)len, "json_export_us", &stats->json_export_cycles, us_per_cycle);
+    snprintf(out + len, out_size - (size_t)len, "}");
+}
+
+// Structures of memory_stats_t, in the order of its fields and of the memory gauges
+#define MEMORY_STRUCTURE_COUNT 9
+
+static const char* const memory_structure_names[MEMORY_STRUCTURE_COUNT] = {
+    "resting_orders", "open_order_records", "terminal_order_records",
+    "trades", "user_index", "accounts", "client_keys", "batch_commitments", "order_timers"
+};
+
+static const memory_usage_t* memory_structures(const memory_stats_t* stats, int index)
+{
+    const memory_usage_t* structures[MEMORY_STRUCTURE_COUNT] = {
+        &stats->resting_orders, &stats->open_order_records,
+        &stats->terminal_order_records, &stats->trades, &stats->user_index,
+        &stats->accounts, &stats->client_keys, &stats->batch_commitments, &stats->order_timers
+    };
+    return structures[index];
+}
+
+// Function to format the enclave heap breakdown as JSON
+static void format_memory_stats(const memory_stats_t* stats, char* out, size_t out_size)
+{
+    int len = snprintf(out, out_size,
+                       "{\"heap\":{\"in_use\":%llu,\"high_water\":%llu,\"budget\":%llu},"
+                       "\"allocations\":{\"interval\":%llu,\"total\":%llu},\"structures\":{",
+                       (unsigned long long)stats->heap_in_use, (unsigned long long)stats->heap_high_water,
+                       (unsigned long long)stats->heap_budget, (unsigned long long)stats->allocations,
+                       (unsigned long long)stats->allocations_total);
+    for (int i = 0; i < MEMORY_STRUCTURE_COUNT; i++) {
+        const memory_usage_t* usage = memory_structures(stats, i);
+        len += snprintf(out + len, out_size - (size_t)len, "%s\"%s\":{\"count\":%llu,\"bytes\":%llu}",
+                        i ? "," : "", memory_structure_names[i],
+                        (unsigned long long)usage->count, (unsigned long long)usage->bytes);
+    }
+    snprintf(out + len, out_size - (size_t)len, "},\"indexed_users\":%llu}",
+             (unsigned long long)stats->indexed_users);
+}
+
+static void append_hex(std::string& out, const uint8_t* bytes, size_t length)
+{
+    static const char digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < length; i++) {
+        out += digits[bytes[i] >> 4];
+        out += digits[bytes[i] & 0xf];
+    }
+}
+
+// Function to format the fields of a settlement batch, up to its signature,
+// without the closing brace
+static void format_batch_fields(const settlement_batch_t* batch, std::string& out)
+{
+    char field[256];
+    snprintf(field, sizeof(field),
+             "{\"batch_id\":\"%s\",\"market\":%d,\"number\":%llu,\"first_seq\":%llu,\"last_seq\":%llu,"
+             "\"trade_count\":%llu,\"pending_trades\":%llu,\"previous_digest\":\"",
+             batch->batch_id, batch->market, (unsigned long long)batch->number,
+             (unsigned long long)batch->first_seq, (unsigned long long)batch->last_seq,
+             (unsigned long long)batch->trade_count, (unsigned long long)batch->pending_trades);
+    out += field;
+    append_hex(out, batch->previous_digest, SETTLEMENT_DIGEST_SIZE);
+    out += "\",\"digest\":\"";
+    append_hex(out, batch->digest, SETTLEMENT_DIGEST_SIZE);
+    out += "\",\"merkle_root\":\"";
+    append_hex(out, batch->merkle_root, SETTLEMENT_DIGEST_SIZE);
+    out += "\",\"signature\":\"";
+    append_hex(out, batch->signature, COMMITMENT_SIGNATURE_SIZE);
+    out += "\"";
+}
+
+// Function to format a settlement batch and its transfers as JSON. Amounts
+// keep every digit, so they match the batch digest bit for bit.
+static void format_settlement_batch(const settlement_batch_t* batch, const settlement_transfer_t* transfers,
+                                    std::string& out)
+{
+    char field[256];
+    format_batch_fields(batch, out);
+    out += ",\"transfers\":[";
+    for (uint64_t i = 0; i < batch->transfer_count; i++) {
+        snprintf(field, sizeof(field), "%s{\"user\":\"%s\",\"token\":\"%s\",\"amount\":%.17g}",
+                 i ? "," : "", transfers[i].user_address,
+                 transfers[i].token == SETTLEMENT_TOKEN_BASE ? "base" : "quote", transfers[i].amount);
+        out += field;
+    }
+    out += "]}";
+}
+
+// Why an encrypted order was not added
+static const char* order_envelope_error(int result)
+{
+    switch (result) {
+    case ORDER_ADD_BOOK_FULL: return "Book full";
+    case ORDER_ADD_UNKNOWN_MARKET: return "Invalid market";
+    case ORDER_ADD_INSUFFICIENT_FUNDS: return "Insufficient funds";
+    case ORDER_ADD_EXPIRED: return "Expiry has passed";
+    case ORDER_ENVELOPE_INVALID: return "Invalid order";
+    case ORDER_ENVELOPE_UNKNOWN_SESSION: return "Unknown session";
+    case ORDER_ENVELOPE_REJECTED: return "Envelope rejected";
+    case ORDER_ENVELOPE_JOURNALED: return "Encrypted orders are off with --standby";
+    default: return "Enclave error";
+    }
+}
+
+// The reset query field of /stats and /memory; reading resets unless reset=0
+static int read_reset(http_slice_t query)
+{
+    static const char* const reset_fields[] = { "reset" };
+    http_slice_t reset_field;
+    http_query_fields(query, reset_fields, &reset_field, 1);
+    char reset_str[8] = {0};
+    if (read_field(reset_field, true, reset_str, sizeof(reset_str)) > 0) {
+        return atoi(reset_str) != 0;
+    }
+    return 1;
+}
+
+// Function to handle HTTP requests; runs on an HTTP server worker thread.
+// The server owns the socket; returns whether the connection stays open.
+bool handle_http_request(int client_socket, const http_request_t* request) {
+    const http_slice_t method = request->method;
+    const http_slice_t path = request->path;
+    
+    response_keep_alive = request->keep_alive;
+    request_path = metrics_path_index(path.data, path.length);
+    printf("[DEBUG] Method: %.*s, Path: %.*s, Query: %.*s\n", (int)method.length, method.data,
+           (int)path.length, path.data, (int)request->query.length,
+           request->query.data ? request->query.data : "");
     
     // Handle POST request to add order
-    if (strcmp(method, "POST") == 0 && strcmp(path, "/order") == 0) {
+    if (http_slice_equals(method, "POST") && http_slice_equals(path, "/order")) {
         printf("[DEBUG] Processing order request\n");
         
+        // Parameters come from a JSON body when one is sent, otherwise the query string
+        static const char* const order_fields[] = {
+            "user", "type", "side", "quantity", "price", "market", "client_key", "expires"
+        };
+        enum {
+            FIELD_USER, FIELD_TYPE, FIELD_SIDE, FIELD_QUANTITY, FIELD_PRICE, FIELD_MARKET, FIELD_CLIENT_KEY,
+            FIELD_EXPIRES, FIELD_COUNT
+        };
+        http_slice_t fields[FIELD_COUNT];
+        bool from_query = request->body.length == 0;
+        if (from_query) {
+            http_query_fields(request->query, order_fields, fields, FIELD_COUNT);
+        } else if (http_json_fields(request->body, order_fields, fields, FIELD_COUNT) < 0) {
+            send_http_response(client_socket, 400, "text/plain", "Invalid JSON body");
+            return response_keep_alive;
+        }
+        
         // Extract parameters
         char user_address[64] = {0};
         char type_str[16] = {0};
@@ -288,42 +789,42 @@ void handle_http_request(int client_socket) {
         char quantity_str[32] = {0};
         
         // Check required parameters
-        if (get_query_param(query_string, "user", user_address, sizeof(user_address)) < 0) {
+        if (read_field(fields[FIELD_USER], from_query, user_address, sizeof(user_address)) <= 0) {
             send_http_response(client_socket, 400, "text/plain", "Missing user parameter");
-            close(client_socket);
-            return;
+            return response_keep_alive;
         }
         
         // Default to limit order if not specified
-        if (get_query_param(query_string, "type", type_str, sizeof(type_str)) < 0) {
+        int type_found = read_field(fields[FIELD_TYPE], from_query, type_str, sizeof(type_str));
+        if (type_found == 0) {
             strcpy(type_str, "limit");
         }
         
-        if (get_query_param(query_string, "side", side_str, sizeof(side_str)) < 0) {
+        if (read_field(fields[FIELD_SIDE], from_query, side_str, sizeof(side_str)) <= 0) {
             send_http_response(client_socket, 400, "text/plain", "Missing side parameter");
-            close(client_socket);
-            return;
+            return response_keep_alive;
         }
         
-        if (get_query_param(query_string, "quantity", quantity_str, sizeof(quantity_str)) < 0) {
+        if (read_field(fields[FIELD_QUANTITY], from_query, quantity_str, sizeof(quantity_str)) <= 0) {
             send_http_response(client_socket, 400, "text/plain", "Missing quantity parameter");
-            close(client_socket);
-            return;
+            return response_keep_alive;
         }
         
         // Convert type parameter
         int order_type;
         if (strcmp(type_str, "market") == 0) {
             order_type = 1; // MARKET
-        } else {
+        } else if (type_found >= 0 && strcmp(type_str, "limit") == 0) {
             order_type = 0; // LIMIT
             
             // For limit orders, price is required
-            if (get_query_param(query_string, "price", price_str, sizeof(price_str)) < 0) {
+            if (read_field(fields[FIELD_PRICE], from_query, price_str, sizeof(price_str)) <= 0) {
                 send_http_response(client_socket, 400, "text/plain", "Price is required for limit orders");
-                close(client_socket);
-                return;
+                return response_keep_alive;
             }
+        } else {
+            send_http_response(client_socket, 400, "text/plain", "Invalid type parameter (must be 'limit' or 'market')");
+            return response_keep_alive;
         }
         
         // Convert side parameter
@@ -334,32 +835,67 @@ void handle_http_request(int client_socket) {
             order_side = 1; // SELL
         } else {
             send_http_response(client_socket, 400, "text/plain", "Invalid side parameter (must be 'buy' or 'sell')");
-            close(client_socket);
-            return;
+            return response_keep_alive;
         }
         
         // Convert price and quantity
-        double price = (order_type == 1) ? 0.0 : atof(price_str);
-        double quantity = atof(quantity_str);
+        double price = 0.0;
+        double quantity = 0.0;
         
-        if (quantity <= 0) {
+        if (!parse_number(quantity_str, &quantity) || quantity <= 0) {
             send_http_response(client_socket, 400, "text/plain", "Quantity must be positive");
-            close(client_socket);
-            return;
+            return response_keep_alive;
         }
         
-        if (order_type == 0 && price <= 0) {
+        if (order_type == 0 && (!parse_number(price_str, &price) || price <= 0)) {
             send_http_response(client_socket, 400, "text/plain", "Price must be positive for limit orders");
-            close(client_socket);
-            return;
+            return response_keep_alive;
+        }
+        
+        int market = 0;
+        if (!read_market(fields[FIELD_MARKET], from_query, &market)) {
+            send_http_response(client_socket, 400, "text/plain", "Invalid market parameter");
+            return response_keep_alive;
+        }
+        
+        // Optional idempotency key: an order resent under it is not added twice
+        char client_key[CLIENT_KEY_SIZE] = {0};
+        if (read_field(fields[FIELD_CLIENT_KEY], from_query, client_key, sizeof(client_key)) < 0) {
+            send_http_response(client_socket, 400, "text/plain", "Invalid client_key parameter");
+            return response_keep_alive;
+        }
+        
+        int64_t expires = ORDER_EXPIRES_NEVER;
+        if (!read_expiry(fields[FIELD_EXPIRES], from_query, &expires)) {
+            send_http_response(client_socket, 400, "text/plain", "Invalid expires parameter (unix time or 'day')");
+            return response_keep_alive;
         }
         
         // Add order to the book
         char order_id[64] = {0};
-        sgx_status_t status = ecall_add_order(global_eid, user_address, order_type, order_side, 
-                                             price, quantity, order_id, sizeof(order_id));
+        int result = ORDER_ADD_OK;
+        sgx_status_t status;
+        {
+            ReplicaGuard guard;
+            status = matching_add_order(&result, market, user_address, order_type, order_side, price, quantity,
+                                        client_key, expires, order_id, sizeof(order_id), NULL, 0, NULL);
+        }
         
-        if (status != SGX_SUCCESS || order_id[0] == '\0') {
+        if (status == SGX_SUCCESS && result == ORDER_ADD_BOOK_FULL) {
+            // Out of enclave memory: refuse the order and keep serving the rest
+            send_http_response(client_socket, 503, "text/plain", "Book full");
+        } else if (status == SGX_SUCCESS && result == ORDER_ADD_INSUFFICIENT_FUNDS) {
+            send_http_response(client_socket, 400, "text/plain", "Insufficient funds");
+        } else if (status == SGX_SUCCESS && result == ORDER_ADD_EXPIRED) {
+            send_http_response(client_socket, 400, "text/plain", "Expiry has passed");
+        } else if (status == SGX_SUCCESS && result == ORDER_ADD_INVALID) {
+            send_http_response(client_socket, 400, "text/plain", "Invalid order");
+        } else if (status == SGX_SUCCESS && result == ORDER_ADD_DUPLICATE) {
+            // Already in: the same answer as the first time, so a retry is safe
+            char response_body[256];
+            snprintf(response_body, sizeof(response_body), "{\"order_id\": \"%s\", \"duplicate\": true}", order_id);
+            send_http_response(client_socket, 200, "application/json", response_body);
+        } else if (status != SGX_SUCCESS || order_id[0] == '\0') {
             char error_msg[100];
             snprintf(error_msg, sizeof(error_msg), "Error: Failed to add order. Error code: %d", status);
             send_http_response(client_socket, 500, "text/plain", error_msg);
@@ -369,62 +905,550 @@ void handle_http_request(int client_socket) {
             send_http_response(client_socket, 200, "application/json", response_body);
         }
     }
+    // Handle POST request to open an encrypted order session: an ECDH
+    // exchange between the client's key and the enclave's
+    else if (http_slice_equals(method, "POST") && http_slice_equals(path, "/order-session")) {
+        static const char* const session_fields[] = { "public_key" };
+        http_slice_t key_field;
+        bool from_query = request->body.length == 0;
+        if (from_query) {
+            http_query_fields(request->query, session_fields, &key_field, 1);
+        } else if (http_json_fields(request->body, session_fields, &key_field, 1) < 0) {
+            send_http_response(client_socket, 400, "text/plain", "Invalid JSON body");
+            return response_keep_alive;
+        }
+        
+        // An uncompressed SEC1 point: 04, then X and Y
+        char key_str[2 * ORDER_ENVELOPE_KEY_SIZE + 4] = {0};
+        uint8_t peer_key[ORDER_ENVELOPE_KEY_SIZE];
+        if (read_field(key_field, from_query, key_str, sizeof(key_str)) <= 0 || strncmp(key_str, "04", 2) != 0 ||
+            !parse_hex(key_str + 2, peer_key, sizeof(peer_key))) {
+            send_http_response(client_socket, 400, "text/plain", "Missing or invalid public_key parameter");
+            return response_keep_alive;
+        }
+        
+        uint8_t enclave_key[ORDER_ENVELOPE_KEY_SIZE];
+        uint64_t session = 0;
+        int result = ORDER_SESSION_OK;
+        sgx_status_t status = ecall_open_order_session(global_eid, &result, peer_key, sizeof(peer_key),
+                                                       enclave_key, sizeof(enclave_key), &session);
+        
+        if (status == SGX_SUCCESS && result == ORDER_SESSION_OK) {
+            char field[64];
+            snprintf(field, sizeof(field), "{\"session\":\"%016llx\",\"enclave_key\":\"04",
+                     (unsigned long long)session);
+            std::string body = field;
+            append_hex(body, enclave_key, sizeof(enclave_key));
+            body += "\"}";
+            send_http_response(client_socket, 200, "application/json", body.c_str());
+        } else if (status == SGX_SUCCESS && result == ORDER_SESSION_INVALID_KEY) {
+            send_http_response(client_socket, 400, "text/plain", "public_key is not a P-256 point");
+        } else if (status == SGX_SUCCESS && result == ORDER_SESSION_JOURNALED) {
+            // The standby's journal would give the orders away to the host
+            send_http_response(client_socket, 409, "text/plain", "Encrypted orders are off with --standby");
+        } else {
+            char error_msg[100];
+            snprintf(error_msg, sizeof(error_msg), "Error: Failed to open session. Error code: %d, result: %d",
+                     status, result);
+            send_http_response(client_socket, 500, "text/plain", error_msg);
+        }
+    }
+    // Handle POST request with encrypted orders: the body is whole
+    // order_envelope_t structs back to back, all matched in one ECALL
+    else if (http_slice_equals(method, "POST") && http_slice_equals(path, "/order-envelopes")) {
+        size_t count = request->body.length / sizeof(order_envelope_t);
+        if (count == 0 || request->body.length % sizeof(order_envelope_t) != 0) {
+            send_http_response(client_socket, 400, "text/plain", "Body must be whole order envelopes");
+            return response_keep_alive;
+        }
+        
+        // The body sits unaligned in the connection buffer
+        order_envelope_t* envelopes = (order_envelope_t*)malloc(request->body.length);
+        order_envelope_result_t* results =
+            (order_envelope_result_t*)malloc(count * sizeof(order_envelope_result_t));
+        sgx_status_t status = SGX_ERROR_OUT_OF_MEMORY;
+        if (envelopes && results) {
+            memcpy(envelopes, request->body.data, request->body.length);
+            ReplicaGuard guard;
+            status = ecall_add_order_envelopes(global_eid, envelopes, count, results);
+        }
+        
+        if (status != SGX_SUCCESS) {
+            char error_msg[100];
+            snprintf(error_msg, sizeof(error_msg), "Error: Failed to add orders. Error code: %d", status);
+            send_http_response(client_socket, 500, "text/plain", error_msg);
+        } else {
+            // One entry per envelope, in order; each order stands on its own
+            std::string body = "{\"orders\":[";
+            for (size_t i = 0; i < count; i++) {
+                const order_envelope_result_t* result = &results[i];
+                char entry[128];
+                if (result->result == ORDER_ADD_OK || result->result == ORDER_ADD_DUPLICATE) {
+                    snprintf(entry, sizeof(entry), "%s{\"order_id\":\"%s\"%s}", i ? "," : "", result->order_id,
+                             result->result == ORDER_ADD_DUPLICATE ? ",\"duplicate\":true" : "");
+                } else {
+                    snprintf(entry, sizeof(entry), "%s{\"error\":\"%s\"}", i ? "," : "",
+                             order_envelope_error(result->result));
+                }
+                body += entry;
+            }
+            body += "]}";
+            send_http_response(client_socket, 200, "application/json", body.c_str());
+        }
+        free(envelopes);
+        free(results);
+    }
     // Handle GET request to read trades
-    else if (strcmp(method, "GET") == 0 && strcmp(path, "/trades") == 0) {
+    else if (http_slice_equals(method, "GET") && http_slice_equals(path, "/trades")) {
         printf("[DEBUG] Processing trades request\n");
         
-        char trades_json[BUFFER_SIZE] = {0}; // Large buffer for trades
-        size_t json_size = sizeof(trades_json);
-        size_t result_size = 0;
-        
-        // Check if user address is provided
+        // Optional user filter, sequence/time range, limit and taker side
         char user_address[64] = {0};
+        trade_query_t query;
+        bool paged = false;
+        const char* error = read_trade_query(request->query, user_address, sizeof(user_address),
+                                             &query, &paged);
         
-        if (get_query_param(query_string, "user", user_address, sizeof(user_address)) == 0) {
-            // Get trades for specific user
-            printf("[DEBUG] Getting trades for user: %s\n", user_address);
-            sgx_status_t status = ecall_get_user_trades(global_eid, &result_size, user_address, trades_json, json_size);
-            
-            printf("[DEBUG] Enclave call completed with status: %d, result size: %zu\n", status, result_size);
-            
-            if (status != SGX_SUCCESS) {
-                char error_msg[100];
-                snprintf(error_msg, sizeof(error_msg), "Error: Failed to get user trades. Error code: %d", status);
-                printf("[ERROR] %s\n", error_msg);
-                send_http_response(client_socket, 500, "text/plain", error_msg);
-            } else if (result_size == 0) {
-                printf("[DEBUG] No user trades found, sending empty array\n");
-                send_http_response(client_socket, 200, "application/json", "[]");
-            } else {
-                printf("[DEBUG] Sending user trades: %s\n", trades_json);
-                send_http_response(client_socket, 200, "application/json", trades_json);
+        if (error != NULL) {
+            send_http_response(client_socket, 400, "text/plain", error);
+        } else {
+            return send_trades(client_socket, user_address, &query, paged, request->minor_version);
+        }
+    }
+    // Handle GET request to read enclave matching statistics
+    else if (http_slice_equals(method, "GET") && http_slice_equals(path, "/stats")) {
+        // Each read closes the current interval unless reset=0 is given
+        int reset = read_reset(request->query);
+        
+        enclave_stats_t* stats = (enclave_stats_t*)malloc(sizeof(enclave_stats_t));
+        sgx_status_t status = stats ? ecall_get_stats(global_eid, stats, reset) : SGX_ERROR_OUT_OF_MEMORY;
+        
+        if (status != SGX_SUCCESS) {
+            char error_msg[100];
+            snprintf(error_msg, sizeof(error_msg), "Error: Failed to get stats. Error code: %d", status);
+            send_http_response(client_socket, 500, "text/plain", error_msg);
+        } else {
+            char stats_json[2048];
+            format_enclave_stats(stats, stats_json, sizeof(stats_json));
+            send_http_response(client_socket, 200, "application/json", stats_json);
+        }
+        free(stats);
+    }
+    // Handle GET request for the enclave heap breakdown, for capacity planning
+    else if (http_slice_equals(method, "GET") && http_slice_equals(path, "/memory")) {
+        // Each read restarts the allocation count unless reset=0 is given
+        memory_stats_t stats;
+        sgx_status_t status = ecall_get_memory_stats(global_eid, &stats, read_reset(request->query));
+        
+        if (status != SGX_SUCCESS) {
+            char error_msg[100];
+            snprintf(error_msg, sizeof(error_msg), "Error: Failed to get memory stats. Error code: %d", status);
+            send_http_response(client_socket, 500, "text/plain", error_msg);
+        } else {
+            // The walk is too slow for every scrape, so /metrics serves
+            // the structure gauges of the last one
+            for (int i = 0; i < MEMORY_STRUCTURE_COUNT; i++) {
+                const memory_usage_t* usage = memory_structures(&stats, i);
+                metrics_set_gauge(METRIC_GAUGE_MEMORY_ENTRIES_RESTING_ORDERS + i, usage->count);
+                metrics_set_gauge(METRIC_GAUGE_MEMORY_BYTES_RESTING_ORDERS + i, usage->bytes);
             }
+            char memory_json[1024];
+            format_memory_stats(&stats, memory_json, sizeof(memory_json));
+            send_http_response(client_socket, 200, "application/json", memory_json);
+        }
+    }
+    // Handle GET request for Prometheus metrics
+    else if (http_slice_equals(method, "GET") && http_slice_equals(path, "/metrics")) {
+        // Gauges are refreshed on scrape; a failed ecall still serves the counters
+        book_stats_t book_stats;
+        memset(&book_stats, 0, sizeof(book_stats));
+        sgx_status_t status = ecall_get_book_stats(global_eid, &book_stats);
+        
+        if (status == SGX_SUCCESS) {
+            metrics_set_gauge(METRIC_GAUGE_OPEN_ORDERS_BUY, book_stats.open_orders[0]);
+            metrics_set_gauge(METRIC_GAUGE_OPEN_ORDERS_SELL, book_stats.open_orders[1]);
+            metrics_set_gauge(METRIC_GAUGE_PRICE_LEVELS_BUY, book_stats.price_levels[0]);
+            metrics_set_gauge(METRIC_GAUGE_PRICE_LEVELS_SELL, book_stats.price_levels[1]);
+            metrics_set_gauge(METRIC_GAUGE_TRADES, book_stats.trade_count);
+            metrics_set_gauge(METRIC_GAUGE_ENCLAVE_HEAP_BYTES, book_stats.heap_in_use);
+            metrics_set_gauge(METRIC_GAUGE_ENCLAVE_HEAP_BUDGET_BYTES, book_stats.heap_budget);
+            metrics_set_gauge(METRIC_GAUGE_ENCLAVE_HEAP_HIGH_WATER_BYTES, book_stats.heap_high_water);
+            metrics_set_gauge(METRIC_GAUGE_ENCLAVE_HEAP_ALLOCATIONS, book_stats.allocations_total);
+        }
+        metrics_set_gauge(METRIC_GAUGE_ORDER_RING_DEPTH, matching_ring_depth());
+        metrics_set_gauge(METRIC_GAUGE_REPLICA_LAG, replica_lag());
+        
+        // For a listening socket, TCP_INFO reports the accept queue length and backlog
+        struct tcp_info info;
+        socklen_t info_length = sizeof(info);
+        int listen_socket = http_server_listen_socket();
+        if (listen_socket >= 0 &&
+            getsockopt(listen_socket, IPPROTO_TCP, TCP_INFO, &info, &info_length) == 0) {
+            metrics_set_gauge(METRIC_GAUGE_LISTEN_QUEUE_DEPTH, info.tcpi_unacked);
+            metrics_set_gauge(METRIC_GAUGE_LISTEN_BACKLOG, info.tcpi_sacked);
+        }
+        
+        std::string exposition;
+        metrics_format(exposition);
+        send_http_response(client_socket, 200, "text/plain; version=0.0.4", exposition.c_str());
+    }
+    // Handle GET request for readiness; 503 until both listeners accept and
+    // again once shutdown has begun, so load balancers can route on it
+    else if (http_slice_equals(method, "GET") && http_slice_equals(path, "/ready")) {
+        bool ready = __atomic_load_n(&startup.ready, __ATOMIC_ACQUIRE) && keep_running;
+        char body[256];
+        snprintf(body, sizeof(body),
+                 "{\"ready\":%s,\"startup_ms\":{\"enclave_create\":%.3f,\"restore\":%.3f,"
+                 "\"bind\":%.3f,\"total\":%.3f}}",
+                 ready ? "true" : "false", startup.enclave_create, startup.restore,
+                 startup.bind, startup.total);
+        send_http_response(client_socket, ready ? 200 : 503, "application/json", body);
+    }
+    // Handle GET request for the ECALL/OCALL boundary profile
+    else if (http_slice_equals(method, "GET") && http_slice_equals(path, "/profile")) {
+        std::string report;
+        profiler_report_json(report);
+        send_http_response(client_socket, 200, "application/json", report.c_str());
+    }
+    // Handle POST request to credit a deposit to a user's account; the
+    // deposit ID (such as the transaction hash and log index) makes retries safe
+    else if (http_slice_equals(method, "POST") && http_slice_equals(path, "/deposit")) {
+        static const char* const deposit_fields[] = { "user", "token", "amount", "deposit", "market" };
+        enum { FIELD_USER, FIELD_TOKEN, FIELD_AMOUNT, FIELD_DEPOSIT, FIELD_MARKET, FIELD_COUNT };
+        http_slice_t fields[FIELD_COUNT];
+        bool from_query = request->body.length == 0;
+        if (from_query) {
+            http_query_fields(request->query, deposit_fields, fields, FIELD_COUNT);
+        } else if (http_json_fields(request->body, deposit_fields, fields, FIELD_COUNT) < 0) {
+            send_http_response(client_socket, 400, "text/plain", "Invalid JSON body");
+            return response_keep_alive;
+        }
+        
+        char user_address[64] = {0};
+        char token_str[16] = {0};
+        char amount_str[32] = {0};
+        char deposit_id[128] = {0};
+        double amount = 0.0;
+        int market = 0;
+        if (read_field(fields[FIELD_USER], from_query, user_address, sizeof(user_address)) <= 0 ||
+            read_field(fields[FIELD_DEPOSIT], from_query, deposit_id, sizeof(deposit_id)) <= 0) {
+            send_http_response(client_socket, 400, "text/plain", "Missing user or deposit parameter");
+            return response_keep_alive;
+        }
+        if (read_field(fields[FIELD_TOKEN], from_query, token_str, sizeof(token_str)) <= 0 ||
+            (strcmp(token_str, "base") != 0 && strcmp(token_str, "quote") != 0)) {
+            send_http_response(client_socket, 400, "text/plain", "Invalid token parameter (must be 'base' or 'quote')");
+            return response_keep_alive;
+        }
+        if (read_field(fields[FIELD_AMOUNT], from_query, amount_str, sizeof(amount_str)) <= 0 ||
+            !parse_number(amount_str, &amount) || amount <= 0) {
+            send_http_response(client_socket, 400, "text/plain", "Amount must be positive");
+            return response_keep_alive;
+        }
+        if (!read_market(fields[FIELD_MARKET], from_query, &market)) {
+            send_http_response(client_socket, 400, "text/plain", "Invalid market parameter");
+            return response_keep_alive;
+        }
+        
+        int result = LEDGER_OK;
+        int token = strcmp(token_str, "base") == 0 ? SETTLEMENT_TOKEN_BASE : SETTLEMENT_TOKEN_QUOTE;
+        sgx_status_t status;
+        {
+            ReplicaGuard guard;
+            status = ecall_credit_account(global_eid, &result, market, user_address, token, amount, deposit_id);
+        }
+        
+        if (status == SGX_SUCCESS && (result == LEDGER_OK || result == LEDGER_DUPLICATE_DEPOSIT)) {
+            char body[64];
+            snprintf(body, sizeof(body), "{\"credited\":%s}", result == LEDGER_OK ? "true" : "false");
+            send_http_response(client_socket, 200, "application/json", body);
+        } else if (status == SGX_SUCCESS && result == LEDGER_DISABLED) {
+            send_http_response(client_socket, 404, "text/plain", "Ledger not enabled");
+        } else if (status == SGX_SUCCESS && result == LEDGER_OUT_OF_MEMORY) {
+            send_http_response(client_socket, 503, "text/plain", "Enclave out of memory");
         } else {
-            // Get all trades
-            printf("[DEBUG] Getting all trades\n");
-            sgx_status_t status = ecall_get_trades(global_eid, &result_size, trades_json, json_size);
-            
-            printf("[DEBUG] Enclave call completed with status: %d, result size: %zu\n", status, result_size);
-            
-            if (status != SGX_SUCCESS) {
-                char error_msg[100];
-                snprintf(error_msg, sizeof(error_msg), "Error: Failed to get trades. Error code: %d", status);
-                printf("[ERROR] %s\n", error_msg);
-                send_http_response(client_socket, 500, "text/plain", error_msg);
-            } else if (result_size == 0) {
-                printf("[DEBUG] No trades found, sending empty array\n");
-                send_http_response(client_socket, 200, "application/json", "[]");
-            } else {
-                printf("[DEBUG] Sending all trades: %s\n", trades_json);
-                send_http_response(client_socket, 200, "application/json", trades_json);
+            char error_msg[100];
+            snprintf(error_msg, sizeof(error_msg), "Error: Failed to credit deposit. Error code: %d, result: %d",
+                     status, result);
+            send_http_response(client_socket, 500, "text/plain", error_msg);
+        }
+    }
+    // Handle GET request for a user's balances
+    else if (http_slice_equals(method, "GET") && http_slice_equals(path, "/account")) {
+        static const char* const account_fields[] = { "user", "market" };
+        http_slice_t fields[2];
+        http_query_fields(request->query, account_fields, fields, 2);
+        char user_address[64] = {0};
+        int market = 0;
+        if (read_field(fields[0], true, user_address, sizeof(user_address)) <= 0) {
+            send_http_response(client_socket, 400, "text/plain", "Missing user parameter");
+            return response_keep_alive;
+        }
+        if (!read_market(fields[1], true, &market)) {
+            send_http_response(client_socket, 400, "text/plain", "Invalid market parameter");
+            return response_keep_alive;
+        }
+        
+        account_balance_t balance;
+        int result = LEDGER_OK;
+        sgx_status_t status = ecall_get_account(global_eid, &result, market, user_address, &balance);
+        
+        if (status == SGX_SUCCESS && (result == LEDGER_OK || result == LEDGER_UNKNOWN_ACCOUNT)) {
+            // A user who never deposited has nothing, which is not an error
+            char body[256];
+            snprintf(body, sizeof(body),
+                     "{\"user\":\"%s\",\"market\":%d,"
+                     "\"base\":{\"total\":%.17g,\"reserved\":%.17g,\"available\":%.17g},"
+                     "\"quote\":{\"total\":%.17g,\"reserved\":%.17g,\"available\":%.17g}}",
+                     user_address, market,
+                     balance.total[SETTLEMENT_TOKEN_BASE], balance.reserved[SETTLEMENT_TOKEN_BASE],
+                     balance.total[SETTLEMENT_TOKEN_BASE] - balance.reserved[SETTLEMENT_TOKEN_BASE],
+                     balance.total[SETTLEMENT_TOKEN_QUOTE], balance.reserved[SETTLEMENT_TOKEN_QUOTE],
+                     balance.total[SETTLEMENT_TOKEN_QUOTE] - balance.reserved[SETTLEMENT_TOKEN_QUOTE]);
+            send_http_response(client_socket, 200, "application/json", body);
+        } else if (status == SGX_SUCCESS && result == LEDGER_DISABLED) {
+            send_http_response(client_socket, 404, "text/plain", "Ledger not enabled");
+        } else {
+            char error_msg[100];
+            snprintf(error_msg, sizeof(error_msg), "Error: Failed to get account. Error code: %d, result: %d",
+                     status, result);
+            send_http_response(client_socket, 500, "text/plain", error_msg);
+        }
+    }
+    // Handle GET request for the standby's position in each market's input stream
+    else if (http_slice_equals(method, "GET") && http_slice_equals(path, "/replica")) {
+        replica_report_t report;
+        replica_report(&report);
+        bool healthy = report.standby && report.result == REPLICA_OK && !report.overflowed;
+        std::string body;
+        char part[192];
+        snprintf(part, sizeof(part), "{\"standby\":%s,\"healthy\":%s,\"result\":%d,\"overflowed\":%s,\"lag\":%llu,"
+                 "\"markets\":[",
+                 report.standby ? "true" : "false", healthy ? "true" : "false", report.result,
+                 report.overflowed ? "true" : "false", (unsigned long long)replica_lag());
+        body += part;
+        for (int market = 0; market < MARKET_COUNT; market++) {
+            snprintf(part, sizeof(part), "%s{\"market\":%d,\"journaled\":%llu,\"applied\":%llu,\"state_hash\":\"%016llx\"}",
+                     market > 0 ? "," : "", market, (unsigned long long)report.journaled[market],
+                     (unsigned long long)report.applied[market].applied_seq,
+                     (unsigned long long)report.applied[market].state_hash);
+            body += part;
+        }
+        body += "]}";
+        send_http_response(client_socket, 200, "application/json", body.c_str());
+    }
+    // Handle POST request to hand the books over to the standby enclave
+    else if (http_slice_equals(method, "POST") && http_slice_equals(path, "/promote")) {
+        printf("[DEBUG] Promoting the standby enclave\n");
+        if (replica_promote() < 0) {
+            send_http_response(client_socket, 409, "text/plain", "No standby able to take over");
+        } else {
+            send_http_response(client_socket, 200, "application/json", "{\"promoted\":true}");
+        }
+    }
+    // Handle POST request to close a settlement window: the market's trades
+    // since the last batch, netted into one transfer per user and token.
+    // Until /settlement-ack, the same batch comes back again.
+    else if (http_slice_equals(method, "POST") && http_slice_equals(path, "/settlement")) {
+        static const char* const settlement_fields[] = { "market" };
+        http_slice_t market_field;
+        http_query_fields(request->query, settlement_fields, &market_field, 1);
+        int market = 0;
+        if (!read_market(market_field, true, &market)) {
+            send_http_response(client_socket, 400, "text/plain", "Invalid market parameter");
+            return response_keep_alive;
+        }
+        
+        settlement_batch_t batch;
+        settlement_transfer_t* transfers =
+            (settlement_transfer_t*)malloc(SETTLEMENT_MAX_TRANSFERS * sizeof(settlement_transfer_t));
+        int result = SETTLEMENT_OK;
+        sgx_status_t status = SGX_ERROR_OUT_OF_MEMORY;
+        if (transfers) {
+            ReplicaGuard guard;
+            status = ecall_close_settlement(global_eid, &result, market, &batch, transfers, SETTLEMENT_MAX_TRANSFERS);
+        }
+        
+        if (status == SGX_SUCCESS && (result == SETTLEMENT_OK || result == SETTLEMENT_PENDING)) {
+            std::string batch_json;
+            format_settlement_batch(&batch, transfers, batch_json);
+            send_http_response(client_socket, 200, "application/json", batch_json.c_str());
+        } else if (status == SGX_SUCCESS && result == SETTLEMENT_EMPTY) {
+            char body[128];
+            snprintf(body, sizeof(body), "{\"batch_id\":null,\"market\":%d,\"trade_count\":0,\"transfers\":[]}",
+                     market);
+            send_http_response(client_socket, 200, "application/json", body);
+        } else if (status == SGX_SUCCESS && result == SETTLEMENT_OUT_OF_MEMORY) {
+            send_http_response(client_socket, 503, "text/plain", "Enclave out of memory");
+        } else {
+            char error_msg[100];
+            snprintf(error_msg, sizeof(error_msg), "Error: Failed to close settlement. Error code: %d, result: %d",
+                     status, result);
+            send_http_response(client_socket, 500, "text/plain", error_msg);
+        }
+        free(transfers);
+    }
+    // Handle POST request to acknowledge a settlement batch the backend has
+    // stored and paid out, so the next /settlement closes a new one
+    else if (http_slice_equals(method, "POST") && http_slice_equals(path, "/settlement-ack")) {
+        static const char* const ack_fields[] = { "market", "number", "digest" };
+        http_slice_t fields[3];
+        http_query_fields(request->query, ack_fields, fields, 3);
+        char number_str[32] = {0};
+        char digest_str[2 * SETTLEMENT_DIGEST_SIZE + 2] = {0};
+        uint64_t number = 0;
+        uint8_t digest[SETTLEMENT_DIGEST_SIZE];
+        int market = 0;
+        if (!read_market(fields[0], true, &market)) {
+            send_http_response(client_socket, 400, "text/plain", "Invalid market parameter");
+            return response_keep_alive;
+        }
+        if (read_field(fields[1], true, number_str, sizeof(number_str)) <= 0 || !parse_count(number_str, &number) ||
+            number == 0) {
+            send_http_response(client_socket, 400, "text/plain", "Missing or invalid number parameter");
+            return response_keep_alive;
+        }
+        if (read_field(fields[2], true, digest_str, sizeof(digest_str)) <= 0 ||
+            !parse_hex(digest_str, digest, sizeof(digest))) {
+            send_http_response(client_socket, 400, "text/plain", "Missing or invalid digest parameter");
+            return response_keep_alive;
+        }
+        
+        int result = SETTLEMENT_OK;
+        sgx_status_t status;
+        {
+            ReplicaGuard guard;
+            status = ecall_ack_settlement(global_eid, &result, market, number, digest, sizeof(digest));
+        }
+        
+        if (status == SGX_SUCCESS && result == SETTLEMENT_OK) {
+            char body[96];
+            snprintf(body, sizeof(body), "{\"market\":%d,\"number\":%llu,\"acknowledged\":true}", market,
+                     (unsigned long long)number);
+            send_http_response(client_socket, 200, "application/json", body);
+        } else if (status == SGX_SUCCESS && result == SETTLEMENT_UNKNOWN_BATCH) {
+            send_http_response(client_socket, 404, "text/plain", "No batch of that number and digest");
+        } else {
+            char error_msg[100];
+            snprintf(error_msg, sizeof(error_msg), "Error: Failed to acknowledge settlement. Error code: %d, result: %d",
+                     status, result);
+            send_http_response(client_socket, 500, "text/plain", error_msg);
+        }
+    }
+    // Handle POST request to close a market's trading session: its day
+    // orders expire, all in one ECALL
+    else if (http_slice_equals(method, "POST") && http_slice_equals(path, "/close-session")) {
+        static const char* const session_fields[] = { "market" };
+        http_slice_t market_field;
+        http_query_fields(request->query, session_fields, &market_field, 1);
+        int market = 0;
+        if (!read_market(market_field, true, &market)) {
+            send_http_response(client_socket, 400, "text/plain", "Invalid market parameter");
+            return response_keep_alive;
+        }
+        
+        uint64_t expired = 0;
+        int result = SESSION_CLOSE_OK;
+        sgx_status_t status;
+        {
+            ReplicaGuard guard;
+            status = ecall_close_session(global_eid, &result, market, &expired);
+        }
+        
+        if (status == SGX_SUCCESS && result == SESSION_CLOSE_OK) {
+            char body[96];
+            snprintf(body, sizeof(body), "{\"market\":%d,\"expired\":%llu}", market, (unsigned long long)expired);
+            send_http_response(client_socket, 200, "application/json", body);
+        } else {
+            char error_msg[100];
+            snprintf(error_msg, sizeof(error_msg), "Error: Failed to close the session. Error code: %d, result: %d",
+                     status, result);
+            send_http_response(client_socket, 500, "text/plain", error_msg);
+        }
+    }
+    // Handle GET request for a settled trade's inclusion proof: its leaf, the
+    // sibling hashes up to the batch root and the signed batch
+    else if (http_slice_equals(method, "GET") && http_slice_equals(path, "/proof")) {
+        static const char* const proof_fields[] = { "market", "seq" };
+        http_slice_t fields[2];
+        http_query_fields(request->query, proof_fields, fields, 2);
+        char seq_str[32] = {0};
+        uint64_t trade_seq = 0;
+        int market = 0;
+        if (!read_market(fields[0], true, &market)) {
+            send_http_response(client_socket, 400, "text/plain", "Invalid market parameter");
+            return response_keep_alive;
+        }
+        if (read_field(fields[1], true, seq_str, sizeof(seq_str)) <= 0 || !parse_count(seq_str, &trade_seq) ||
+            trade_seq == 0) {
+            send_http_response(client_socket, 400, "text/plain", "Missing or invalid seq parameter");
+            return response_keep_alive;
+        }
+        
+        trade_proof_t* proof = (trade_proof_t*)malloc(sizeof(trade_proof_t));
+        int result = PROOF_OK;
+        sgx_status_t status = proof ? ecall_get_trade_proof(global_eid, &result, market, trade_seq, proof)
+                                    : SGX_ERROR_OUT_OF_MEMORY;
+        
+        if (status == SGX_SUCCESS && result == PROOF_OK) {
+            std::string body;
+            char field[160];
+            body += "{\"trade\":";
+            body += proof->trade_json;
+            snprintf(field, sizeof(field), ",\"leaf_index\":%llu,\"leaf\":\"", (unsigned long long)proof->leaf_index);
+            body += field;
+            append_hex(body, proof->leaf, SETTLEMENT_DIGEST_SIZE);
+            body += "\",\"path\":[";
+            for (uint32_t i = 0; i < proof->path_length; i++) {
+                body += i ? ",{\"hash\":\"" : "{\"hash\":\"";
+                append_hex(body, proof->path[i], SETTLEMENT_DIGEST_SIZE);
+                body += proof->path_left[i] ? "\",\"left\":true}" : "\",\"left\":false}";
             }
+            body += "],\"batch\":";
+            format_batch_fields(&proof->batch, body);
+            body += "}}";
+            send_http_response(client_socket, 200, "application/json", body.c_str());
+        } else if (status == SGX_SUCCESS && result == PROOF_UNKNOWN_TRADE) {
+            send_http_response(client_socket, 404, "text/plain", "Trade not found");
+        } else if (status == SGX_SUCCESS && result == PROOF_NOT_SETTLED) {
+            send_http_response(client_socket, 404, "text/plain", "Trade not settled yet");
+        } else if (status == SGX_SUCCESS && result == PROOF_UNAVAILABLE) {
+            send_http_response(client_socket, 404, "text/plain", "Trade no longer held by the enclave");
+        } else {
+            char error_msg[100];
+            snprintf(error_msg, sizeof(error_msg), "Error: Failed to build proof. Error code: %d, result: %d",
+                     status, result);
+            send_http_response(client_socket, 500, "text/plain", error_msg);
+        }
+        free(proof);
+    }
+    // Handle GET request for the key settlement batches are signed with
+    else if (http_slice_equals(method, "GET") && http_slice_equals(path, "/signing-key")) {
+        uint8_t key[COMMITMENT_KEY_SIZE];
+        int result = -1;
+        sgx_status_t status = ecall_get_signing_key(global_eid, &result, key, sizeof(key));
+        
+        if (status != SGX_SUCCESS || result != 0) {
+            char error_msg[100];
+            snprintf(error_msg, sizeof(error_msg), "Error: Failed to get signing key. Error code: %d", status);
+            send_http_response(client_socket, 500, "text/plain", error_msg);
+        } else {
+            // Uncompressed SEC1 point: 04, then X and Y big-endian
+            std::string body = "{\"algorithm\":\"ECDSA P-256 SHA-256\",\"public_key\":\"04";
+            append_hex(body, key, sizeof(key));
+            body += "\"}";
+            send_http_response(client_socket, 200, "application/json", body.c_str());
         }
     }
     // Handle clear request
-    else if (strcmp(path, "/clear") == 0 && strcmp(method, "POST") == 0) {
+    else if (http_slice_equals(path, "/clear") && http_slice_equals(method, "POST")) {
         printf("[DEBUG] Clearing order book\n");
         
-        sgx_status_t status = ecall_clear_order_book(global_eid);
+        sgx_status_t status;
+        {
+            ReplicaGuard guard;
+            status = ecall_clear_order_book(global_eid);
+        }
         
         if (status != SGX_SUCCESS) {
             char error_msg[100];
@@ -439,99 +1463,309 @@ void handle_http_request(int client_socket) {
         send_http_response(client_socket, 404, "text/plain", "Not Found");
     }
     
-    close(client_socket);
+    return response_keep_alive;
 }
 
-// Function to start HTTP server
-void start_http_server() {
-    int server_fd, client_socket;
-    struct sockaddr_in address;
-    int opt = 1;
-    int addrlen = sizeof(address);
-    
-    // Create socket
-    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0) {
-        perror("Socket creation failed");
-        exit(EXIT_FAILURE);
-    }
-    
-    // Set socket options
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt, sizeof(opt))) {
-        perror("Setsockopt failed");
-        exit(EXIT_FAILURE);
-    }
-    
-    // Configure address
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(HTTP_PORT);
-    
-    // Bind socket to address
-    if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
-        perror("Bind failed");
-        exit(EXIT_FAILURE);
+// Admission priority: under overload queries are shed before order entry,
+// while scrapes and readiness checks always get through
+static int classify_http_request(const http_request_t* request)
+{
+    if (http_slice_equals(request->path, "/order") || http_slice_equals(request->path, "/clear") ||
+        http_slice_equals(request->path, "/order-session") || http_slice_equals(request->path, "/order-envelopes") ||
+        http_slice_equals(request->path, "/settlement") || http_slice_equals(request->path, "/deposit") ||
+        http_slice_equals(request->path, "/promote") || http_slice_equals(request->path, "/close-session") ||
+        http_slice_equals(request->path, "/settlement-ack")) {
+        return HTTP_PRIORITY_ORDER;
     }
-    
-    // Listen for connections
-    if (listen(server_fd, 10) < 0) {
-        perror("Listen failed");
-        exit(EXIT_FAILURE);
+    if (http_slice_equals(request->path, "/metrics") || http_slice_equals(request->path, "/ready")) {
+        return HTTP_PRIORITY_CONTROL;
     }
+    return HTTP_PRIORITY_QUERY;
+}
+
+// Binary order entry: the ECALLs of POST /order, with fixed-layout replies
+// filled straight from the ECALL outputs. Runs on the session's thread.
+void handle_order_entry_message(order_entry_session_t* session, const oe_header_t* message)
+{
+    oe_ack_t ack;
+    memset(&ack, 0, sizeof(ack));
     
-    printf("HTTP server started on port %d\n", HTTP_PORT);
-    
-    // Set up signal handler for graceful shutdown
-    signal(SIGINT, handle_signal);
-    
-    // Main server loop
-    while (keep_running) {
-        // Accept connection with timeout to allow checking keep_running
-        fd_set readfds;
-        FD_ZERO(&readfds);
-        FD_SET(server_fd, &readfds);
+    if (message->type == OE_NEW_ORDER) {
+        const oe_new_order_t* order = (const oe_new_order_t*)message;
+        bool market_order = order->type == 1;
+        if (order->side > 1 || order->type > 1 || order->market >= MARKET_COUNT ||
+            order->time_in_force > OE_DAY || (order->time_in_force == OE_GOOD_TILL_TIME && order->expire_time == 0) ||
+            !isfinite(order->quantity) || order->quantity <= 0 ||
+            (!market_order && (!isfinite(order->price) || order->price <= 0))) {
+            order_entry_reject(session, message->seq, order->client_order_id, OE_REJECT_INVALID_MESSAGE);
+            return;
+        }
         
-        struct timeval timeout;
-        timeout.tv_sec = 1;  // 1 second timeout
-        timeout.tv_usec = 0;
+        int64_t expires = order->time_in_force == OE_GOOD_TILL_TIME ? (int64_t)order->expire_time :
+                          order->time_in_force == OE_DAY ? ORDER_EXPIRES_SESSION_CLOSE : ORDER_EXPIRES_NEVER;
+        order_fill_t fills[ORDER_ENTRY_MAX_FILLS];
+        order_result_t result;
+        int added = ORDER_ADD_OK;
+        sgx_status_t status;
+        {
+            ReplicaGuard guard;
+            status = matching_add_order(&added, order->market, session->user_address, order->type, order->side,
+                                        market_order ? 0.0 : order->price, order->quantity, "", expires,
+                                        ack.order_id, sizeof(ack.order_id), fills, ORDER_ENTRY_MAX_FILLS, &result);
+        }
+        if (status == SGX_SUCCESS && added == ORDER_ADD_BOOK_FULL) {
+            order_entry_reject(session, message->seq, order->client_order_id, OE_REJECT_BOOK_FULL);
+            return;
+        }
+        if (status == SGX_SUCCESS && added == ORDER_ADD_INSUFFICIENT_FUNDS) {
+            order_entry_reject(session, message->seq, order->client_order_id, OE_REJECT_INSUFFICIENT_FUNDS);
+            return;
+        }
+        if (status == SGX_SUCCESS && added == ORDER_ADD_EXPIRED) {
+            order_entry_reject(session, message->seq, order->client_order_id, OE_REJECT_EXPIRED);
+            return;
+        }
+        if (status == SGX_SUCCESS && added == ORDER_ADD_INVALID) {
+            order_entry_reject(session, message->seq, order->client_order_id, OE_REJECT_INVALID_MESSAGE);
+            return;
+        }
+        if (status != SGX_SUCCESS || ack.order_id[0] == '\0') {
+            printf("[ERROR] Order entry failed to add order. Error code: %d\n", status);
+            order_entry_reject(session, message->seq, order->client_order_id, OE_REJECT_ENCLAVE_ERROR);
+            return;
+        }
         
-        int activity = select(server_fd + 1, &readfds, NULL, NULL, &timeout);
+        uint32_t fill_count = (uint32_t)(result.fill_count < ORDER_ENTRY_MAX_FILLS ? result.fill_count
+                                                                                   : ORDER_ENTRY_MAX_FILLS);
+        ack.client_order_id = order->client_order_id;
+        ack.status = (uint8_t)result.status;
+        ack.fill_count = fill_count;
+        ack.filled_quantity = result.filled_quantity;
+        ack.remaining_quantity = result.remaining_quantity;
+        order_entry_reply(session, &ack.header, OE_ACK, sizeof(ack));
         
-        if (activity < 0 && errno != EINTR) {
-            perror("Select error");
-            break;
+        for (uint32_t i = 0; i < fill_count; i++) {
+            oe_fill_t fill;
+            memset(&fill, 0, sizeof(fill));
+            fill.client_order_id = order->client_order_id;
+            fill.trade_seq = fills[i].trade_seq;
+            fill.price = fills[i].price;
+            fill.quantity = fills[i].quantity;
+            order_entry_reply(session, &fill.header, OE_FILL, sizeof(fill));
+        }
+    } else if (message->type == OE_CANCEL) {
+        const oe_cancel_t* cancel = (const oe_cancel_t*)message;
+        if (memchr(cancel->order_id, '\0', sizeof(cancel->order_id)) == NULL) {
+            order_entry_reject(session, message->seq, cancel->client_order_id, OE_REJECT_INVALID_MESSAGE);
+            return;
         }
         
-        if (activity > 0 && FD_ISSET(server_fd, &readfds)) {
-            client_socket = accept(server_fd, (struct sockaddr *)&address, (socklen_t*)&addrlen);
-            if (client_socket < 0) {
-                if (keep_running) {
-                    perror("Accept failed");
-                }
-                continue;
-            }
-            
-            // Handle request
-            handle_http_request(client_socket);
+        int result = ORDER_CANCEL_UNKNOWN_ORDER;
+        sgx_status_t status;
+        {
+            ReplicaGuard guard;
+            status = ecall_cancel_order(global_eid, &result, session->user_address, cancel->order_id);
         }
+        if (status != SGX_SUCCESS) {
+            printf("[ERROR] Order entry failed to cancel order. Error code: %d\n", status);
+            order_entry_reject(session, message->seq, cancel->client_order_id, OE_REJECT_ENCLAVE_ERROR);
+        } else if (result != ORDER_CANCEL_OK) {
+            order_entry_reject(session, message->seq, cancel->client_order_id,
+                               result == ORDER_CANCEL_NOT_OPEN ? OE_REJECT_ORDER_NOT_OPEN
+                                                               : OE_REJECT_UNKNOWN_ORDER);
+        } else {
+            ack.client_order_id = cancel->client_order_id;
+            strcpy(ack.order_id, cancel->order_id);
+            ack.status = 3; // CANCELLED
+            order_entry_reply(session, &ack.header, OE_ACK, sizeof(ack));
+        }
+    }
+}
+
+static void usage(const char* program)
+{
+    printf("Usage: %s [options]\n"
+           "  --port P             HTTP port (default %d)\n"
+           "  --backlog N          listen() backlog (default %d)\n"
+           "  --workers N          Worker threads issuing ECALLs (default %d)\n"
+           "  --buffer-size N      Request buffer per connection in bytes (default %d)\n"
+           "  --max-connections N  Concurrent connection slots (default %d)\n"
+           "  --idle-timeout MS    Close keep-alive connections idle this long, 0 = never (default %d)\n"
+           "  --max-requests N     Requests served per connection before closing (default %d)\n"
+           "  --queue-depth N      Requests waiting for a worker before new ones get 503,\n"
+           "                       0 = never shed (default %d)\n"
+           "  --queue-target MS    p99 wait for a worker above which new requests get 503 (default %d)\n"
+           "  --order-port P       Binary order-entry port, 0 = disabled (default %d)\n"
+           "  --order-sessions N   Concurrent order-entry sessions (default %d)\n"
+           "  --matching-thread    Match orders on one thread resident in the enclave, fed\n"
+           "                       through a shared ring instead of an ECALL per order;\n"
+           "                       needs a spare core\n"
+           "  --matching-threads N Like --matching-thread with N threads (up to %d), which\n"
+           "                       share the markets and steal each other's idle ones\n"
+           "  --ledger             Keep user balances in the enclave: credit them with\n"
+           "                       POST /deposit and reject orders they cannot pay for\n"
+           "  --price-tick M:T     Lay market M's price ladders out in ticks of T\n"
+           "                       (default %g); repeat for more markets\n"
+           "  --standby            Keep a second enclave in step with the primary, fed\n"
+           "                       every input it applies, ready for POST /promote;\n"
+           "                       doubles the EPC in use\n"
+           "Workers, order-entry sessions and matching threads, plus the expiry clock,\n"
+           "the main thread and with --standby the journal feeder, must fit in the\n"
+           "enclave's %d TCS (TCSNum).\n",
+           program, DEFAULT_HTTP_PORT, DEFAULT_HTTP_BACKLOG, DEFAULT_HTTP_WORKERS,
+           DEFAULT_HTTP_BUFFER_SIZE, DEFAULT_HTTP_MAX_CONNECTIONS,
+           DEFAULT_HTTP_IDLE_TIMEOUT_MS, DEFAULT_HTTP_MAX_REQUESTS,
+           DEFAULT_HTTP_QUEUE_DEPTH, DEFAULT_HTTP_QUEUE_TARGET_MS,
+           DEFAULT_ORDER_ENTRY_PORT, DEFAULT_ORDER_ENTRY_SESSIONS, MARKET_COUNT, PRICE_TICK_DEFAULT,
+           ENCLAVE_TCS_NUM);
+}
+
+// Refuse thread settings under which more threads could be inside an
+// enclave at once than it has TCS; an ECALL beyond them fails with
+// SGX_ERROR_OUT_OF_TCS in the middle of serving
+static int check_enclave_threads(const http_server_config_t* server_config,
+                                 const order_entry_config_t* order_entry_config, int matching_threads, bool standby)
+{
+    int sessions = order_entry_config->port != 0 ? order_entry_config->max_sessions : 0;
+    // The expiry clock and the main thread, which makes the startup ECALLs;
+    // a promoted standby serves everything and still runs its feeder
+    int threads = server_config->workers + sessions + matching_threads + 2 + (standby ? 1 : 0);
+    if (threads > ENCLAVE_TCS_NUM) {
+        printf("[ERROR] %d threads may enter the enclave (%d workers, %d order-entry sessions, "
+               "%d matching threads, the expiry clock, the main thread%s), but it has %d TCS; "
+               "lower --workers, --order-sessions or --matching-threads\n",
+               threads, server_config->workers, sessions, matching_threads,
+               standby ? ", the journal feeder" : "", ENCLAVE_TCS_NUM);
+        return -1;
     }
+    return 0;
+}
+
+// Read a --price-tick value, MARKET:TICK, into price_ticks
+static bool parse_price_tick(const char* text, double* price_ticks)
+{
+    int market = 0;
+    double tick = 0;
+    int length = 0;
+    if (sscanf(text, "%d:%lf%n", &market, &tick, &length) != 2 || text[length] != '\0' ||
+        market < 0 || market >= MARKET_COUNT || !(tick > 0 && tick < INFINITY)) {
+        printf("[ERROR] Invalid --price-tick %s: expected MARKET:TICK with a positive tick\n", text);
+        return false;
+    }
+    price_ticks[market] = tick;
+    return true;
+}
+
+int set_price_ticks(sgx_enclave_id_t eid, const double* price_ticks)
+{
+    for (int market = 0; market < MARKET_COUNT; market++) {
+        if (!(price_ticks[market] > 0)) {
+            continue;
+        }
+        int result = PRICE_TICK_OK;
+        sgx_status_t status = ecall_set_price_tick(eid, &result, market, price_ticks[market]);
+        if (status != SGX_SUCCESS || result != PRICE_TICK_OK) {
+            printf("[ERROR] Failed to set the price tick of market %d. Error code: %d, result: %d\n",
+                   market, status, result);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Parse command line options into the server configurations
+static int parse_arguments(int argc, char* argv[], http_server_config_t* config,
+                           order_entry_config_t* order_entry_config, int* matching_threads,
+                           bool* ledger, bool* standby, double* price_ticks)
+{
+    static const struct option options[] = {
+        { "port", required_argument, NULL, 'p' },
+        { "backlog", required_argument, NULL, 'b' },
+        { "workers", required_argument, NULL, 'w' },
+        { "buffer-size", required_argument, NULL, 's' },
+        { "max-connections", required_argument, NULL, 'c' },
+        { "idle-timeout", required_argument, NULL, 'i' },
+        { "max-requests", required_argument, NULL, 'r' },
+        { "queue-depth", required_argument, NULL, 'q' },
+        { "queue-target", required_argument, NULL, 't' },
+        { "order-port", required_argument, NULL, 'o' },
+        { "order-sessions", required_argument, NULL, 'n' },
+        { "matching-thread", no_argument, NULL, 'm' },
+        { "matching-threads", required_argument, NULL, 'M' },
+        { "ledger", no_argument, NULL, 'l' },
+        { "standby", no_argument, NULL, 'S' },
+        { "price-tick", required_argument, NULL, 'P' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
     
-    // Close server socket
-    close(server_fd);
-    printf("HTTP server stopped\n");
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (opt) {
+        case 'p': config->port = atoi(optarg); break;
+        case 'b': config->backlog = atoi(optarg); break;
+        case 'w': config->workers = atoi(optarg); break;
+        case 's': config->buffer_size = (size_t)strtoul(optarg, NULL, 10); break;
+        case 'c': config->max_connections = atoi(optarg); break;
+        case 'i': config->idle_timeout_ms = atoi(optarg); break;
+        case 'r': config->max_requests = atoi(optarg); break;
+        case 'q': config->queue_depth = atoi(optarg); break;
+        case 't': config->queue_target_ms = atoi(optarg); break;
+        case 'o': order_entry_config->port = atoi(optarg); break;
+        case 'n': order_entry_config->max_sessions = atoi(optarg); break;
+        case 'm': *matching_threads = 1; break;
+        case 'M': *matching_threads = atoi(optarg); break;
+        case 'l': *ledger = true; break;
+        case 'S': *standby = true; break;
+        case 'P':
+            if (!parse_price_tick(optarg, price_ticks)) {
+                return -1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    return 0;
 }
 
 /* Application entry */
 int SGX_CDECL main(int argc, char *argv[])
 {
-    (void)(argc);
-    (void)(argv);
+    startup.start = monotonic_ms();
+    http_server_config_t server_config;
+    http_server_default_config(&server_config);
+    server_config.handler = handle_http_request;
+    server_config.classify = classify_http_request;
+    server_config.on_ready = startup_ready;
+    order_entry_config_t order_entry_config;
+    order_entry_default_config(&order_entry_config);
+    order_entry_config.handler = handle_order_entry_message;
+    int matching_threads = 0;
+    bool ledger = false;
+    bool standby = false;
+    double price_ticks[MARKET_COUNT] = {0};
+    if (parse_arguments(argc, argv, &server_config, &order_entry_config, &matching_threads, &ledger,
+                        &standby, price_ticks) < 0 ||
+        check_enclave_threads(&server_config, &order_entry_config, matching_threads, standby) < 0) {
+        return -1;
+    }
+
+    /* TSC calibration sleeps; let it overlap enclave creation */
+    std::thread calibration(calibrate_tsc);
 
     /* Initialize the enclave */
+    double phase_start = monotonic_ms();
     if(initialize_enclave() < 0){
         printf("Error: enclave initialization failed\n");
+        calibration.join();
         return -1;
     }
+    startup.enclave_create = monotonic_ms() - phase_start;
+    calibration.join();
  
+#ifdef SGX_SAMPLES
     /* Utilize edger8r attributes */
     edger8r_array_attributes();
     edger8r_pointer_attributes();
@@ -542,20 +1776,101 @@ int SGX_CDECL main(int argc, char *argv[])
     ecall_libc_functions();
     ecall_libcxx_functions();
     ecall_thread_functions();
+#endif
+
+    /* Restore: nothing is persisted yet, so this brings up the empty book
+     * now rather than on the first order */
+    phase_start = monotonic_ms();
+    book_stats_t book_stats;
+    sgx_status_t status = ecall_get_book_stats(global_eid, &book_stats);
+    if (status != SGX_SUCCESS) {
+        print_error_message(status);
+        sgx_destroy_enclave(global_eid);
+        return -1;
+    }
+    startup.restore = monotonic_ms() - phase_start;
+
+    /* Before any order arrives, so every resting order holds back its funds */
+    if (ledger) {
+        status = ecall_enable_ledger(global_eid);
+        if (status != SGX_SUCCESS) {
+            print_error_message(status);
+            sgx_destroy_enclave(global_eid);
+            return -1;
+        }
+    }
+
+    /* Ladders can only be laid out while they are empty */
+    if (set_price_ticks(global_eid, price_ticks) < 0) {
+        sgx_destroy_enclave(global_eid);
+        return -1;
+    }
+
+    /* Also before any order arrives: the standby has to see every input */
+    if (standby && replica_start(ledger, price_ticks) < 0) {
+        sgx_destroy_enclave(global_eid);
+        return -1;
+    }
+
+    if (matching_threads > 0 && matching_thread_start(matching_threads) < 0) {
+        sgx_destroy_enclave(global_eid);
+        replica_stop();
+        return -1;
+    }
+
+    std::thread expiry_clock(run_expiry_clock);
 
     /* Start HTTP server */
     printf("\n--- Starting HTTP Server for Order Book Access ---\n");
     printf("Available endpoints:\n");
     printf("  GET  /trades           - Get all trades\n");
     printf("  GET  /trades?user=X    - Get trades for user X\n");
+    printf("  GET  /trades?market=M  - Get trades of market M (default 0)\n");
+    printf("  GET  /stats            - Enclave matching histograms (resets the interval)\n");
+    printf("  GET  /memory           - Enclave heap use per structure (resets the allocation count)\n");
+    printf("  GET  /metrics          - Prometheus metrics\n");
+    printf("  GET  /profile          - ECALL/OCALL boundary profile\n");
+    printf("  GET  /ready            - Readiness and startup phase timings\n");
+    printf("  POST /deposit?user=X&token=T&amount=A&deposit=D - Credit a deposit once (--ledger)\n");
+    printf("           token = 'base' or 'quote'; market = 0 to %d, optional\n", MARKET_COUNT - 1);
+    printf("  GET  /account?user=X  - Balances of user X (--ledger)\n");
+    printf("  POST /settlement?market=M - Close a settlement window: net transfers since the last batch\n");
+    printf("  POST /settlement-ack?market=M&number=N&digest=H - Acknowledge a stored batch, so the next one closes\n");
+    printf("  POST /close-session?market=M - Close a trading session: expire its day orders\n");
+    printf("  GET  /replica          - Standby enclave position per market (--standby)\n");
+    printf("  POST /promote          - Hand the books over to the standby enclave (--standby)\n");
+    printf("  GET  /proof            - Inclusion proof of a settled trade (?market=M&seq=N)\n");
+    printf("  GET  /signing-key      - Public key settlement batches are signed with\n");
+    printf("  POST /order-session    - Open an encrypted order session ({\"public_key\":\"04...\"})\n");
+    printf("  POST /order-envelopes  - Add encrypted orders (order_envelope_t structs as the body)\n");
     printf("  POST /order?user=X&type=Y&side=Z&price=P&quantity=Q - Add order\n");
     printf("    where: type = 'limit' or 'market'\n");
-    printf("           side = 'buy' or 'sell'\n\n");
+    printf("           side = 'buy' or 'sell'\n");
+    printf("           market = 0 to %d, optional (default 0)\n", MARKET_COUNT - 1);
+    printf("           client_key = optional; an order resent with the same key returns the first order ID\n");
+    printf("           expires = optional; unix time a resting order expires at, or 'day' for /close-session\n");
+    printf("  POST /order with a JSON body {\"user\":X,\"type\":Y,\"side\":Z,\"price\":P,\"quantity\":Q}\n\n");
     
-    start_http_server();
+    // Set up signal handler for graceful shutdown
+    signal(SIGINT, handle_signal);
+    signal(SIGPIPE, SIG_IGN);
+    
+    startup.bind_start = monotonic_ms();
+    if (order_entry_server_start(&order_entry_config) == 0) {
+        http_server_run(&server_config);
+        // A failed HTTP server still has to take the order-entry sessions down
+        keep_running = 0;
+        order_entry_server_stop();
+    }
+    keep_running = 0;
+    expiry_clock.join();
+    matching_thread_stop();
+
+    profiler_print_report();
 
     /* Destroy the enclave */
     sgx_destroy_enclave(global_eid);
+    replica_stop();
     
     return 0;
 }
@@ -37,9 +37,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <signal.h>
 
 #include "sgx_error.h"       /* sgx_status_t */
 #include "sgx_eid.h"     /* sgx_enclave_id_t */
+#include "user_types.h"
+#include "HttpParser.h"
+#include "OrderEntryServer.h"
 
 #ifndef TRUE
 # define TRUE 1
@@ -52,6 +56,14 @@
 # define ENCLAVE_FILENAME "enclave.signed.so"
 
 extern sgx_enclave_id_t global_eid;    /* global enclave id */
+extern double tsc_hz;                  /* calibrated TSC frequency */
+
+static inline uint64_t read_tsc(void)
+{
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
 
 #if defined(__cplusplus)
 extern "C" {
@@ -66,9 +78,17 @@ void ecall_libc_functions(void);
 void ecall_libcxx_functions(void);
 void ecall_thread_functions(void);
 
+extern volatile sig_atomic_t keep_running;
+
+bool handle_http_request(int client_socket, const http_request_t* request);
+void handle_order_entry_message(order_entry_session_t* session, const oe_header_t* message);
 void send_http_response(int client_socket, int status_code, const char* content_type, const char* body);
-int parse_http_request(const char* request, char* method, char* path, char* query_string);
-int get_query_param(const char* query_string, const char* param_name, char* value, size_t value_size);
+
+void calibrate_tsc(void);
+void format_enclave_stats(const enclave_stats_t* stats, char* out, size_t out_size);
+
+/* Set the --price-tick ticks of enclave eid, 0 for a market's default */
+int set_price_ticks(sgx_enclave_id_t eid, const double* price_ticks);
 
 #if defined(__cplusplus)
 }
@@ -0,0 +1,457 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "sgx_urts.h"
+#include "App.h"
+#include "Enclave_u.h"
+#include "EcallProfiler.h"
+#include "Metrics.h"
+
+// ============================
+// Boundary profiler (untrusted side)
+// ============================
+//
+// The Makefile links the App with --wrap for every profiled ECALL proxy and
+// OCALL implementation, so calls into Enclave_u.c and the OCALL table in it
+// pass through the __wrap_ functions below. Each records the call, the TSC
+// cycles it took and the bytes edger8r marshals across the boundary. [out]
+// buffers are copied back in full whatever the enclave wrote, so the bytes
+// that actually carried data are tracked separately.
+
+typedef struct _interface_stats_t {
+    uint64_t calls;
+    uint64_t cycles;                 // Wall time seen by the App
+    uint64_t bytes_to_enclave;
+    uint64_t bytes_from_enclave;
+    uint64_t bytes_from_enclave_used;
+} interface_stats_t;
+
+static interface_stats_t ecalls[ECALL_ID_COUNT];
+static interface_stats_t ocalls[OCALL_ID_COUNT];
+
+static const char* ecall_names[ECALL_ID_COUNT] = {
+    "add_order", "export_trades", "clear_order_book", "get_stats", "get_book_stats",
+    "cancel_order", "get_memory_stats", "wake_order_ring", "close_settlement",
+    "credit_account", "get_account", "get_trade_proof", "get_signing_key", "open_order_session",
+    "add_order_envelopes", "close_session", "expire_orders", "run_order_ring",
+    "ack_settlement", "apply_inputs"
+};
+
+static const char* ocall_names[OCALL_ID_COUNT] = {
+    "print_string", "get_current_time", "log_message"
+};
+
+const char* ecall_name(int id)
+{
+    return (id >= 0 && id < ECALL_ID_COUNT) ? ecall_names[id] : "unknown";
+}
+
+const char* ocall_name(int id)
+{
+    return (id >= 0 && id < OCALL_ID_COUNT) ? ocall_names[id] : "unknown";
+}
+
+static void record(interface_stats_t* stats, uint64_t start, size_t to_enclave,
+                   size_t from_enclave, size_t from_enclave_used)
+{
+    __atomic_fetch_add(&stats->calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats->cycles, read_tsc() - start, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats->bytes_to_enclave, to_enclave, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats->bytes_from_enclave, from_enclave, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats->bytes_from_enclave_used, from_enclave_used, __ATOMIC_RELAXED);
+}
+
+static void record_ecall(int id, sgx_status_t status, uint64_t start, size_t to_enclave,
+                         size_t from_enclave, size_t from_enclave_used)
+{
+    uint64_t cycles = read_tsc() - start;
+    record(&ecalls[id], start, to_enclave, from_enclave, from_enclave_used);
+    metrics_record_ecall(id, status, tsc_hz > 0 ? (uint64_t)((double)cycles * 1e9 / tsc_hz) : 0);
+}
+
+static size_t string_bytes(const char* str)
+{
+    return str ? strlen(str) + 1 : 0;
+}
+
+extern "C" {
+
+sgx_status_t __real_ecall_add_order(sgx_enclave_id_t eid, int* retval, int market, const char* user_address,
+                                    int order_type, int order_side, double price, double quantity,
+                                    const char* client_key, int64_t expires, char* order_id, size_t id_size,
+                                    order_fill_t* fills, size_t max_fills, order_result_t* result);
+sgx_status_t __real_ecall_export_trades(sgx_enclave_id_t eid, size_t* retval, const char* user_address,
+                                        const trade_query_t* query, uint64_t cursor,
+                                        char* trades_json, size_t json_size, trade_export_t* progress);
+sgx_status_t __real_ecall_clear_order_book(sgx_enclave_id_t eid);
+sgx_status_t __real_ecall_get_stats(sgx_enclave_id_t eid, enclave_stats_t* stats, int reset);
+sgx_status_t __real_ecall_get_book_stats(sgx_enclave_id_t eid, book_stats_t* stats);
+sgx_status_t __real_ecall_cancel_order(sgx_enclave_id_t eid, int* retval, const char* user_address,
+                                       const char* order_id);
+sgx_status_t __real_ecall_get_memory_stats(sgx_enclave_id_t eid, memory_stats_t* stats, int reset);
+sgx_status_t __real_ecall_wake_order_ring(sgx_enclave_id_t eid);
+sgx_status_t __real_ecall_close_settlement(sgx_enclave_id_t eid, int* retval, int market,
+                                           settlement_batch_t* batch, settlement_transfer_t* transfers,
+                                           size_t max_transfers);
+sgx_status_t __real_ecall_credit_account(sgx_enclave_id_t eid, int* retval, int market, const char* user_address,
+                                         int token, double amount, const char* deposit_id);
+sgx_status_t __real_ecall_get_account(sgx_enclave_id_t eid, int* retval, int market, const char* user_address,
+                                      account_balance_t* balance);
+sgx_status_t __real_ecall_get_trade_proof(sgx_enclave_id_t eid, int* retval, int market, uint64_t trade_seq,
+                                          trade_proof_t* proof);
+sgx_status_t __real_ecall_get_signing_key(sgx_enclave_id_t eid, int* retval, uint8_t* public_key, size_t key_size);
+sgx_status_t __real_ecall_open_order_session(sgx_enclave_id_t eid, int* retval, const uint8_t* peer_key,
+                                             size_t key_size, uint8_t* enclave_key, size_t enclave_key_size,
+                                             uint64_t* session);
+sgx_status_t __real_ecall_add_order_envelopes(sgx_enclave_id_t eid, const order_envelope_t* envelopes, size_t count,
+                                              order_envelope_result_t* results);
+sgx_status_t __real_ecall_close_session(sgx_enclave_id_t eid, int* retval, int market, uint64_t* expired);
+sgx_status_t __real_ecall_expire_orders(sgx_enclave_id_t eid);
+sgx_status_t __real_ecall_run_order_ring(sgx_enclave_id_t eid, order_ring_t* ring, int worker);
+sgx_status_t __real_ecall_ack_settlement(sgx_enclave_id_t eid, int* retval, int market, uint64_t number,
+                                         const uint8_t* digest, size_t digest_size);
+sgx_status_t __real_ecall_apply_inputs(sgx_enclave_id_t eid, int* retval, int market, const replica_input_t* inputs,
+                                       size_t count, replica_status_t* status);
+
+void __real_ocall_print_string(const char* str);
+void __real_ocall_get_current_time(time_t* time_value);
+void __real_ocall_log_message(const char* message);
+
+sgx_status_t __wrap_ecall_add_order(sgx_enclave_id_t eid, int* retval, int market, const char* user_address,
+                                    int order_type, int order_side, double price, double quantity,
+                                    const char* client_key, int64_t expires, char* order_id, size_t id_size,
+                                    order_fill_t* fills, size_t max_fills, order_result_t* result)
+{
+    uint64_t start = read_tsc();
+    sgx_status_t status = __real_ecall_add_order(eid, retval, market, user_address, order_type, order_side,
+                                                 price, quantity, client_key, expires, order_id, id_size,
+                                                 fills, max_fills, result);
+    size_t fills_size = fills ? max_fills * sizeof(*fills) : 0;
+    size_t result_size = result ? sizeof(*result) : 0;
+    size_t used = 0;
+    if (status == SGX_SUCCESS) {
+        used = strnlen(order_id, id_size) + 1 + result_size;
+        if (fills && result) {
+            used += (size_t)(result->fill_count < max_fills ? result->fill_count : max_fills) * sizeof(*fills);
+        }
+    }
+    record_ecall(ECALL_ID_ADD_ORDER, status, start, string_bytes(user_address) + string_bytes(client_key),
+                 id_size + fills_size + result_size, used);
+    return status;
+}
+
+sgx_status_t __wrap_ecall_export_trades(sgx_enclave_id_t eid, size_t* retval, const char* user_address,
+                                        const trade_query_t* query, uint64_t cursor,
+                                        char* trades_json, size_t json_size, trade_export_t* progress)
+{
+    uint64_t start = read_tsc();
+    sgx_status_t status = __real_ecall_export_trades(eid, retval, user_address, query, cursor,
+                                                     trades_json, json_size, progress);
+    size_t used = (status == SGX_SUCCESS && retval) ? *retval + sizeof(*progress) : 0;
+    record_ecall(ECALL_ID_EXPORT_TRADES, status, start, string_bytes(user_address) + sizeof(*query),
+                 json_size + sizeof(*progress), used);
+    return status;
+}
+
+sgx_status_t __wrap_ecall_clear_order_book(sgx_enclave_id_t eid)
+{
+    uint64_t start = read_tsc();
+    sgx_status_t status = __real_ecall_clear_order_book(eid);
+    record_ecall(ECALL_ID_CLEAR_ORDER_BOOK, status, start, 0, 0, 0);
+    return status;
+}
+
+sgx_status_t __wrap_ecall_get_stats(sgx_enclave_id_t eid, enclave_stats_t* stats, int reset)
+{
+    uint64_t start = read_tsc();
+    sgx_status_t status = __real_ecall_get_stats(eid, stats, reset);
+    record_ecall(ECALL_ID_GET_STATS, status, start, 0, sizeof(*stats), sizeof(*stats));
+    return status;
+}
+
+sgx_status_t __wrap_ecall_get_book_stats(sgx_enclave_id_t eid, book_stats_t* stats)
+{
+    uint64_t start = read_tsc();
+    sgx_status_t status = __real_ecall_get_book_stats(eid, stats);
+    record_ecall(ECALL_ID_GET_BOOK_STATS, status, start, 0, sizeof(*stats), sizeof(*stats));
+    return status;
+}
+
+sgx_status_t __wrap_ecall_cancel_order(sgx_enclave_id_t eid, int* retval, const char* user_address,
+                                       const char* order_id)
+{
+    uint64_t start = read_tsc();
+    sgx_status_t status = __real_ecall_cancel_order(eid, retval, user_address, order_id);
+    record_ecall(ECALL_ID_CANCEL_ORDER, status, start, string_bytes(user_address) + string_bytes(order_id), 0, 0);
+    return status;
+}
+
+sgx_status_t __wrap_ecall_get_memory_stats(sgx_enclave_id_t eid, memory_stats_t* stats, int reset)
+{
+    uint64_t start = read_tsc();
+    sgx_status_t status = __real_ecall_get_memory_stats(eid, stats, reset);
+    record_ecall(ECALL_ID_GET_MEMORY_STATS, status, start, 0, sizeof(*stats), sizeof(*stats));
+    return status;
+}
+
+sgx_status_t __wrap_ecall_wake_order_ring(sgx_enclave_id_t eid)
+{
+    uint64_t start = read_tsc();
+    sgx_status_t status = __real_ecall_wake_order_ring(eid);
+    record_ecall(ECALL_ID_WAKE_ORDER_RING, status, start, 0, 0, 0);
+    return status;
+}
+
+sgx_status_t __wrap_ecall_close_settlement(sgx_enclave_id_t eid, int* retval, int market,
+                                           settlement_batch_t* batch, settlement_transfer_t* transfers,
+                                           size_t max_transfers)
+{
+    uint64_t start = read_tsc();
+    sgx_status_t status = __real_ecall_close_settlement(eid, retval, market, batch, transfers, max_transfers);
+    size_t used = 0;
+    if (status == SGX_SUCCESS && *retval == SETTLEMENT_OK) {
+        used = sizeof(*batch) + (size_t)batch->transfer_count * sizeof(*transfers);
+    }
+    record_ecall(ECALL_ID_CLOSE_SETTLEMENT, status, start, 0,
+                 sizeof(*batch) + max_transfers * sizeof(*transfers), used);
+    return status;
+}
+
+sgx_status_t __wrap_ecall_credit_account(sgx_enclave_id_t eid, int* retval, int market, const char* user_address,
+                                         int token, double amount, const char* deposit_id)
+{
+    uint64_t start = read_tsc();
+    sgx_status_t status = __real_ecall_credit_account(eid, retval, market, user_address, token, amount, deposit_id);
+    record_ecall(ECALL_ID_CREDIT_ACCOUNT, status, start, string_bytes(user_address) + string_bytes(deposit_id), 0, 0);
+    return status;
+}
+
+sgx_status_t __wrap_ecall_get_account(sgx_enclave_id_t eid, int* retval, int market, const char* user_address,
+                                      account_balance_t* balance)
+{
+    uint64_t start = read_tsc();
+    sgx_status_t status = __real_ecall_get_account(eid, retval, market, user_address, balance);
+    record_ecall(ECALL_ID_GET_ACCOUNT, status, start, string_bytes(user_address), sizeof(*balance),
+                 status == SGX_SUCCESS ? sizeof(*balance) : 0);
+    return status;
+}
+
+sgx_status_t __wrap_ecall_get_trade_proof(sgx_enclave_id_t eid, int* retval, int market, uint64_t trade_seq,
+                                          trade_proof_t* proof)
+{
+    uint64_t start = read_tsc();
+    sgx_status_t status = __real_ecall_get_trade_proof(eid, retval, market, trade_seq, proof);
+    record_ecall(ECALL_ID_GET_TRADE_PROOF, status, start, 0, sizeof(*proof),
+                 status == SGX_SUCCESS ? sizeof(*proof) : 0);
+    return status;
+}
+
+sgx_status_t __wrap_ecall_get_signing_key(sgx_enclave_id_t eid, int* retval, uint8_t* public_key, size_t key_size)
+{
+    uint64_t start = read_tsc();
+    sgx_status_t status = __real_ecall_get_signing_key(eid, retval, public_key, key_size);
+    record_ecall(ECALL_ID_GET_SIGNING_KEY, status, start, 0, key_size, status == SGX_SUCCESS ? key_size : 0);
+    return status;
+}
+
+sgx_status_t __wrap_ecall_open_order_session(sgx_enclave_id_t eid, int* retval, const uint8_t* peer_key,
+                                             size_t key_size, uint8_t* enclave_key, size_t enclave_key_size,
+                                             uint64_t* session)
+{
+    uint64_t start = read_tsc();
+    sgx_status_t status = __real_ecall_open_order_session(eid, retval, peer_key, key_size, enclave_key,
+                                                          enclave_key_size, session);
+    size_t returned = enclave_key_size + sizeof(*session);
+    record_ecall(ECALL_ID_OPEN_ORDER_SESSION, status, start, key_size, returned,
+                 status == SGX_SUCCESS ? returned : 0);
+    return status;
+}
+
+sgx_status_t __wrap_ecall_add_order_envelopes(sgx_enclave_id_t eid, const order_envelope_t* envelopes, size_t count,
+                                              order_envelope_result_t* results)
+{
+    uint64_t start = read_tsc();
+    sgx_status_t status = __real_ecall_add_order_envelopes(eid, envelopes, count, results);
+    size_t returned = count * sizeof(*results);
+    record_ecall(ECALL_ID_ADD_ORDER_ENVELOPES, status, start, count * sizeof(*envelopes), returned,
+                 status == SGX_SUCCESS ? returned : 0);
+    return status;
+}
+
+sgx_status_t __wrap_ecall_close_session(sgx_enclave_id_t eid, int* retval, int market, uint64_t* expired)
+{
+    uint64_t start = read_tsc();
+    sgx_status_t status = __real_ecall_close_session(eid, retval, market, expired);
+    record_ecall(ECALL_ID_CLOSE_SESSION, status, start, 0, sizeof(*expired),
+                 status == SGX_SUCCESS ? sizeof(*expired) : 0);
+    return status;
+}
+
+sgx_status_t __wrap_ecall_expire_orders(sgx_enclave_id_t eid)
+{
+    uint64_t start = read_tsc();
+    sgx_status_t status = __real_ecall_expire_orders(eid);
+    record_ecall(ECALL_ID_EXPIRE_ORDERS, status, start, 0, 0, 0);
+    return status;
+}
+
+// The ring is [user_check], so nothing is marshalled; the call lasts as
+// long as its matching thread
+sgx_status_t __wrap_ecall_run_order_ring(sgx_enclave_id_t eid, order_ring_t* ring, int worker)
+{
+    uint64_t start = read_tsc();
+    sgx_status_t status = __real_ecall_run_order_ring(eid, ring, worker);
+    record_ecall(ECALL_ID_RUN_ORDER_RING, status, start, 0, 0, 0);
+    return status;
+}
+
+sgx_status_t __wrap_ecall_ack_settlement(sgx_enclave_id_t eid, int* retval, int market, uint64_t number,
+                                         const uint8_t* digest, size_t digest_size)
+{
+    uint64_t start = read_tsc();
+    sgx_status_t status = __real_ecall_ack_settlement(eid, retval, market, number, digest, digest_size);
+    record_ecall(ECALL_ID_ACK_SETTLEMENT, status, start, digest_size, 0, 0);
+    return status;
+}
+
+// Called on the standby enclave, whose inside cycles are read only once
+// it is promoted to global_eid
+sgx_status_t __wrap_ecall_apply_inputs(sgx_enclave_id_t eid, int* retval, int market, const replica_input_t* inputs,
+                                       size_t count, replica_status_t* status)
+{
+    uint64_t start = read_tsc();
+    sgx_status_t status_code = __real_ecall_apply_inputs(eid, retval, market, inputs, count, status);
+    record_ecall(ECALL_ID_APPLY_INPUTS, status_code, start, count * sizeof(*inputs), sizeof(*status),
+                 status_code == SGX_SUCCESS ? sizeof(*status) : 0);
+    return status_code;
+}
+
+void __wrap_ocall_print_string(const char* str)
+{
+    uint64_t start = read_tsc();
+    __real_ocall_print_string(str);
+    size_t bytes = string_bytes(str);
+    record(&ocalls[OCALL_ID_PRINT_STRING], start, 0, bytes, bytes);
+}
+
+void __wrap_ocall_get_current_time(time_t* time_value)
+{
+    uint64_t start = read_tsc();
+    __real_ocall_get_current_time(time_value);
+    record(&ocalls[OCALL_ID_GET_CURRENT_TIME], start, sizeof(*time_value), 0, 0);
+}
+
+void __wrap_ocall_log_message(const char* message)
+{
+    uint64_t start = read_tsc();
+    __real_ocall_log_message(message);
+    size_t bytes = string_bytes(message);
+    record(&ocalls[OCALL_ID_LOG_MESSAGE], start, 0, bytes, bytes);
+}
+
+} // extern "C"
+
+static void append(std::string& out, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void append(std::string& out, const char* fmt, ...)
+{
+    char line[512];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if (len > 0) {
+        out.append(line, (size_t)len < sizeof(line) ? (size_t)len : sizeof(line) - 1);
+    }
+}
+
+static double cycles_to_us(uint64_t cycles)
+{
+    return tsc_hz > 0 ? (double)cycles * 1e6 / tsc_hz : 0.0;
+}
+
+static void load(const interface_stats_t* in, interface_stats_t* out)
+{
+    out->calls = __atomic_load_n(&in->calls, __ATOMIC_RELAXED);
+    out->cycles = __atomic_load_n(&in->cycles, __ATOMIC_RELAXED);
+    out->bytes_to_enclave = __atomic_load_n(&in->bytes_to_enclave, __ATOMIC_RELAXED);
+    out->bytes_from_enclave = __atomic_load_n(&in->bytes_from_enclave, __ATOMIC_RELAXED);
+    out->bytes_from_enclave_used = __atomic_load_n(&in->bytes_from_enclave_used, __ATOMIC_RELAXED);
+}
+
+// Transition overhead is the App's wall time minus what the enclave measured
+// on the other side of the boundary. Without an in-enclave cycle counter
+// (hardware builds unless SGX_RDTSC=1) the enclave side reads zero and only
+// totals are shown.
+void profiler_report_json(std::string& out)
+{
+    boundary_stats_t enclave;
+    memset(&enclave, 0, sizeof(enclave));
+    ecall_get_boundary_stats(global_eid, &enclave);
+
+    out = "{\"ecalls\":[";
+    for (int i = 0; i < ECALL_ID_COUNT; i++) {
+        interface_stats_t s;
+        load(&ecalls[i], &s);
+        uint64_t inside = enclave.ecall_inside_cycles[i];
+        uint64_t transition = s.cycles > inside ? s.cycles - inside : 0;
+        append(out, "%s{\"name\":\"%s\",\"calls\":%llu,\"total_us\":%.1f,\"inside_us\":%.1f,"
+               "\"transition_us\":%.1f,\"transition_us_per_call\":%.2f,"
+               "\"bytes_in\":%llu,\"bytes_out\":%llu,\"bytes_out_used\":%llu}",
+               i ? "," : "", ecall_names[i], (unsigned long long)s.calls,
+               cycles_to_us(s.cycles), cycles_to_us(inside), cycles_to_us(transition),
+               s.calls ? cycles_to_us(transition) / (double)s.calls : 0.0,
+               (unsigned long long)s.bytes_to_enclave, (unsigned long long)s.bytes_from_enclave,
+               (unsigned long long)s.bytes_from_enclave_used);
+    }
+    out += "],\"ocalls\":[";
+    for (int i = 0; i < OCALL_ID_COUNT; i++) {
+        interface_stats_t s;
+        load(&ocalls[i], &s);
+        uint64_t outside = enclave.ocall_outside_cycles[i];
+        uint64_t transition = outside > s.cycles ? outside - s.cycles : 0;
+        append(out, "%s{\"name\":\"%s\",\"calls\":%llu,\"host_us\":%.1f,\"outside_us\":%.1f,"
+               "\"transition_us\":%.1f,\"transition_us_per_call\":%.2f,"
+               "\"bytes_in\":%llu,\"bytes_out\":%llu}",
+               i ? "," : "", ocall_names[i], (unsigned long long)s.calls,
+               cycles_to_us(s.cycles), cycles_to_us(outside), cycles_to_us(transition),
+               s.calls ? cycles_to_us(transition) / (double)s.calls : 0.0,
+               (unsigned long long)s.bytes_to_enclave, (unsigned long long)s.bytes_from_enclave);
+    }
+    out += "]}";
+}
+
+void profiler_print_report(void)
+{
+    boundary_stats_t enclave;
+    memset(&enclave, 0, sizeof(enclave));
+    ecall_get_boundary_stats(global_eid, &enclave);
+
+    printf("\n--- ECALL/OCALL boundary report ---\n");
+    printf("%-18s %10s %12s %12s %12s %14s %14s %14s\n", "ECALL", "calls", "total_us", "inside_us",
+           "trans_us/call", "bytes_in", "bytes_out", "bytes_used");
+    for (int i = 0; i < ECALL_ID_COUNT; i++) {
+        interface_stats_t s;
+        load(&ecalls[i], &s);
+        uint64_t inside = enclave.ecall_inside_cycles[i];
+        uint64_t transition = s.cycles > inside ? s.cycles - inside : 0;
+        printf("%-18s %10llu %12.1f %12.1f %12.2f %14llu %14llu %14llu\n", ecall_names[i],
+               (unsigned long long)s.calls, cycles_to_us(s.cycles), cycles_to_us(inside),
+               s.calls ? cycles_to_us(transition) / (double)s.calls : 0.0,
+               (unsigned long long)s.bytes_to_enclave, (unsigned long long)s.bytes_from_enclave,
+               (unsigned long long)s.bytes_from_enclave_used);
+    }
+    printf("%-18s %10s %12s %12s %12s %14s %14s\n", "OCALL", "calls", "host_us", "outside_us",
+           "trans_us/call", "bytes_in", "bytes_out");
+    for (int i = 0; i < OCALL_ID_COUNT; i++) {
+        interface_stats_t s;
+        load(&ocalls[i], &s);
+        uint64_t outside = enclave.ocall_outside_cycles[i];
+        uint64_t transition = outside > s.cycles ? outside - s.cycles : 0;
+        printf("%-18s %10llu %12.1f %12.1f %12.2f %14llu %14llu\n", ocall_names[i],
+               (unsigned long long)s.calls, cycles_to_us(s.cycles), cycles_to_us(outside),
+               s.calls ? cycles_to_us(transition) / (double)s.calls : 0.0,
+               (unsigned long long)s.bytes_to_enclave, (unsigned long long)s.bytes_from_enclave);
+    }
+}
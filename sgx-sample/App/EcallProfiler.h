@@ -0,0 +1,15 @@
+#ifndef _ECALL_PROFILER_H_
+#define _ECALL_PROFILER_H_
+
+#include <string>
+
+#include "user_types.h"
+
+const char* ecall_name(int id);
+const char* ocall_name(int id);
+
+/* Per-interface boundary report combining App and enclave measurements */
+void profiler_report_json(std::string& out);
+void profiler_print_report(void);
+
+#endif /* !_ECALL_PROFILER_H_ */
@@ -0,0 +1,373 @@
+#include <string.h>
+#include <strings.h>
+
+#include "HttpParser.h"
+
+// ============================
+// Zero-copy HTTP request parser
+// ============================
+//
+// The parser never copies or modifies the connection buffer: every field of
+// http_request_t is a slice into it, valid until the server reuses the
+// buffer after the handler returns. Handlers copy only the values they keep,
+// into buffers whose size is checked.
+
+#define MAX_METHOD_LENGTH 16
+
+static bool is_space(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+static http_slice_t make_slice(const char* data, size_t length)
+{
+    http_slice_t slice;
+    slice.data = data;
+    slice.length = length;
+    return slice;
+}
+
+static http_slice_t trim(const char* begin, const char* end)
+{
+    while (begin < end && is_space(*begin)) {
+        begin++;
+    }
+    while (end > begin && is_space(end[-1])) {
+        end--;
+    }
+    return make_slice(begin, (size_t)(end - begin));
+}
+
+static bool slice_equals_nocase(http_slice_t slice, const char* text, size_t text_length)
+{
+    return slice.length == text_length && strncasecmp(slice.data, text, text_length) == 0;
+}
+
+bool http_slice_equals(http_slice_t slice, const char* text)
+{
+    size_t text_length = strlen(text);
+    return slice.data != NULL && slice.length == text_length && memcmp(slice.data, text, text_length) == 0;
+}
+
+// "METHOD /path?query HTTP/1.x"
+static bool parse_request_line(const char* line, const char* line_end, http_request_t* request)
+{
+    const char* method_end = (const char*)memchr(line, ' ', (size_t)(line_end - line));
+    if (method_end == NULL || method_end == line || method_end - line > MAX_METHOD_LENGTH) {
+        return false;
+    }
+    for (const char* c = line; c < method_end; c++) {
+        if (*c < 'A' || *c > 'Z') {
+            return false;
+        }
+    }
+
+    const char* target = method_end + 1;
+    const char* target_end = (const char*)memchr(target, ' ', (size_t)(line_end - target));
+    if (target_end == NULL || target == target_end || *target != '/') {
+        return false;
+    }
+
+    http_slice_t version = make_slice(target_end + 1, (size_t)(line_end - target_end - 1));
+    if (version.length != 8 || memcmp(version.data, "HTTP/1.", 7) != 0 ||
+        (version.data[7] != '0' && version.data[7] != '1')) {
+        return false;
+    }
+
+    request->method = make_slice(line, (size_t)(method_end - line));
+    const char* query = (const char*)memchr(target, '?', (size_t)(target_end - target));
+    if (query != NULL) {
+        request->path = make_slice(target, (size_t)(query - target));
+        request->query = make_slice(query + 1, (size_t)(target_end - query - 1));
+    } else {
+        request->path = make_slice(target, (size_t)(target_end - target));
+    }
+    request->minor_version = version.data[7] - '0';
+    request->keep_alive = request->minor_version == 1;
+    return true;
+}
+
+// Apply the tokens of a Connection header to the keep-alive decision
+static void parse_connection_header(http_slice_t value, http_request_t* request)
+{
+    const char* end = value.data + value.length;
+    const char* token = value.data;
+    while (token < end) {
+        const char* comma = (const char*)memchr(token, ',', (size_t)(end - token));
+        const char* token_end = comma != NULL ? comma : end;
+        http_slice_t option = trim(token, token_end);
+        if (slice_equals_nocase(option, "close", 5)) {
+            request->keep_alive = false;
+        } else if (slice_equals_nocase(option, "keep-alive", 10)) {
+            request->keep_alive = true;
+        }
+        token = token_end + 1;
+    }
+}
+
+static bool parse_content_length(http_slice_t value, size_t capacity, size_t* content_length)
+{
+    if (value.length == 0) {
+        return false;
+    }
+    size_t parsed = 0;
+    for (size_t i = 0; i < value.length; i++) {
+        char c = value.data[i];
+        if (c < '0' || c > '9') {
+            return false;
+        }
+        // Saturate instead of overflowing; anything past capacity is rejected anyway
+        if (parsed <= capacity) {
+            parsed = parsed * 10 + (size_t)(c - '0');
+        }
+    }
+    *content_length = parsed;
+    return true;
+}
+
+long http_parse_request(const char* buffer, size_t length, size_t capacity,
+                        size_t* scanned, http_request_t* request)
+{
+    size_t start = (scanned != NULL && *scanned < length) ? *scanned : 0;
+    const char* headers_end = (const char*)memmem(buffer + start, length - start, "\r\n\r\n", 4);
+    if (headers_end == NULL) {
+        // The terminator may straddle the next read
+        if (scanned != NULL) {
+            *scanned = length > 3 ? length - 3 : 0;
+        }
+        return HTTP_PARSE_INCOMPLETE;
+    }
+    size_t header_length = (size_t)(headers_end - buffer) + 4;
+
+    memset(request, 0, sizeof(*request));
+    const char* line_end = (const char*)memchr(buffer, '\r', header_length);
+    if (line_end[1] != '\n' || !parse_request_line(buffer, line_end, request)) {
+        return HTTP_PARSE_MALFORMED;
+    }
+
+    bool has_content_length = false;
+    size_t content_length = 0;
+    const char* line = line_end + 2;
+    while (line < headers_end + 2) {
+        line_end = (const char*)memchr(line, '\r', (size_t)(headers_end + 2 - line));
+        if (line_end[1] != '\n') {
+            return HTTP_PARSE_MALFORMED;
+        }
+
+        const char* colon = (const char*)memchr(line, ':', (size_t)(line_end - line));
+        if (colon == NULL || colon == line || is_space(colon[-1]) || is_space(*line)) {
+            return HTTP_PARSE_MALFORMED;
+        }
+        http_slice_t name = make_slice(line, (size_t)(colon - line));
+        http_slice_t value = trim(colon + 1, line_end);
+
+        if (slice_equals_nocase(name, "Content-Length", 14)) {
+            size_t parsed = 0;
+            if (!parse_content_length(value, capacity, &parsed) ||
+                (has_content_length && parsed != content_length)) {
+                return HTTP_PARSE_MALFORMED;
+            }
+            has_content_length = true;
+            content_length = parsed;
+        } else if (slice_equals_nocase(name, "Transfer-Encoding", 17)) {
+            // Chunked request bodies are not accepted
+            return HTTP_PARSE_MALFORMED;
+        } else if (slice_equals_nocase(name, "Connection", 10)) {
+            parse_connection_header(value, request);
+        } else if (slice_equals_nocase(name, "Content-Type", 12)) {
+            request->content_type = value;
+        }
+        line = line_end + 2;
+    }
+
+    // The whole request has to fit the connection buffer at once
+    if (content_length > capacity || header_length + content_length > capacity) {
+        return HTTP_PARSE_TOO_LARGE;
+    }
+    if (header_length + content_length > length) {
+        return HTTP_PARSE_INCOMPLETE;
+    }
+
+    request->body = make_slice(buffer + header_length, content_length);
+    request->length = header_length + content_length;
+    return (long)request->length;
+}
+
+static void store_field(http_slice_t name, http_slice_t value, const char* const* names,
+                        http_slice_t* values, int count)
+{
+    for (int i = 0; i < count; i++) {
+        if (values[i].data == NULL && http_slice_equals(name, names[i])) {
+            values[i] = value;
+            return;
+        }
+    }
+}
+
+void http_query_fields(http_slice_t query, const char* const* names,
+                       http_slice_t* values, int count)
+{
+    for (int i = 0; i < count; i++) {
+        values[i] = make_slice(NULL, 0);
+    }
+    if (query.data == NULL) {
+        return;
+    }
+
+    const char* end = query.data + query.length;
+    const char* field = query.data;
+    while (field < end) {
+        const char* amp = (const char*)memchr(field, '&', (size_t)(end - field));
+        const char* field_end = amp != NULL ? amp : end;
+        const char* equals = (const char*)memchr(field, '=', (size_t)(field_end - field));
+        if (equals != NULL) {
+            store_field(make_slice(field, (size_t)(equals - field)),
+                        make_slice(equals + 1, (size_t)(field_end - equals - 1)),
+                        names, values, count);
+        }
+        field = field_end + 1;
+    }
+}
+
+static const char* skip_json_space(const char* p, const char* end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+        p++;
+    }
+    return p;
+}
+
+// Scan a string starting after its opening quote; returns the closing quote
+static const char* scan_json_string(const char* p, const char* end)
+{
+    while (p < end && *p != '"') {
+        if (*p == '\\' || (unsigned char)*p < 0x20) {
+            return NULL;
+        }
+        p++;
+    }
+    return p < end ? p : NULL;
+}
+
+int http_json_fields(http_slice_t body, const char* const* names,
+                     http_slice_t* values, int count)
+{
+    for (int i = 0; i < count; i++) {
+        values[i] = make_slice(NULL, 0);
+    }
+    if (body.data == NULL) {
+        return -1;
+    }
+
+    const char* end = body.data + body.length;
+    const char* p = skip_json_space(body.data, end);
+    if (p == end || *p != '{') {
+        return -1;
+    }
+    p = skip_json_space(p + 1, end);
+    if (p < end && *p == '}') {
+        p++;
+    } else {
+        for (;;) {
+            if (p == end || *p != '"') {
+                return -1;
+            }
+            const char* key_end = scan_json_string(p + 1, end);
+            if (key_end == NULL) {
+                return -1;
+            }
+            http_slice_t key = make_slice(p + 1, (size_t)(key_end - p - 1));
+
+            p = skip_json_space(key_end + 1, end);
+            if (p == end || *p != ':') {
+                return -1;
+            }
+            p = skip_json_space(p + 1, end);
+            if (p == end) {
+                return -1;
+            }
+
+            http_slice_t value;
+            if (*p == '"') {
+                const char* value_end = scan_json_string(p + 1, end);
+                if (value_end == NULL) {
+                    return -1;
+                }
+                value = make_slice(p + 1, (size_t)(value_end - p - 1));
+                p = value_end + 1;
+            } else {
+                // Numbers and literals; nested objects and arrays are rejected
+                const char* value_start = p;
+                while (p < end && (*p == '-' || *p == '+' || *p == '.' ||
+                                   (*p >= '0' && *p <= '9') || (*p >= 'a' && *p <= 'z') ||
+                                   (*p >= 'A' && *p <= 'Z'))) {
+                    p++;
+                }
+                if (p == value_start) {
+                    return -1;
+                }
+                value = make_slice(value_start, (size_t)(p - value_start));
+            }
+            store_field(key, value, names, values, count);
+
+            p = skip_json_space(p, end);
+            if (p < end && *p == ',') {
+                p = skip_json_space(p + 1, end);
+                continue;
+            }
+            if (p < end && *p == '}') {
+                p++;
+                break;
+            }
+            return -1;
+        }
+    }
+
+    return skip_json_space(p, end) == end ? 0 : -1;
+}
+
+int http_slice_copy(http_slice_t slice, char* out, size_t out_size)
+{
+    if (out_size == 0 || slice.length >= out_size) {
+        return -1;
+    }
+    memcpy(out, slice.data, slice.length);
+    out[slice.length] = '\0';
+    return (int)slice.length;
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+int http_query_decode(http_slice_t slice, char* out, size_t out_size)
+{
+    size_t written = 0;
+    for (size_t i = 0; i < slice.length; i++) {
+        char c = slice.data[i];
+        if (c == '+') {
+            c = ' ';
+        } else if (c == '%') {
+            int high = i + 2 < slice.length ? hex_value(slice.data[i + 1]) : -1;
+            int low = i + 2 < slice.length ? hex_value(slice.data[i + 2]) : -1;
+            if (high < 0 || low < 0 || (high == 0 && low == 0)) {
+                return -1;
+            }
+            c = (char)(high << 4 | low);
+            i += 2;
+        }
+        if (written + 1 >= out_size) {
+            return -1;
+        }
+        out[written++] = c;
+    }
+    if (out_size == 0) {
+        return -1;
+    }
+    out[written] = '\0';
+    return (int)written;
+}
@@ -0,0 +1,63 @@
+#ifndef _HTTP_PARSER_H_
+#define _HTTP_PARSER_H_
+
+#include <stddef.h>
+
+/* A view into the connection buffer; nothing is copied or NUL-terminated */
+typedef struct _http_slice_t {
+    const char* data;         /* NULL when the field is absent */
+    size_t length;
+} http_slice_t;
+
+typedef struct _http_request_t {
+    http_slice_t method;
+    http_slice_t path;
+    http_slice_t query;       /* Without the leading '?' */
+    http_slice_t content_type;
+    http_slice_t body;
+    size_t length;            /* Request line, headers and body */
+    int minor_version;        /* 0 for HTTP/1.0, 1 for HTTP/1.1 */
+    bool keep_alive;          /* From the HTTP version and Connection header */
+} http_request_t;
+
+#define HTTP_PARSE_INCOMPLETE 0
+#define HTTP_PARSE_MALFORMED -1
+#define HTTP_PARSE_TOO_LARGE -2
+
+/*
+ * Parse the first request in buffer. Returns its total length once the
+ * headers and the Content-Length body are in, HTTP_PARSE_INCOMPLETE while
+ * more bytes are needed, or a negative HTTP_PARSE_* error. A request that
+ * would not fit in capacity bytes is HTTP_PARSE_TOO_LARGE.
+ *
+ * scanned, when given, carries how far the header terminator search got
+ * between calls on a growing buffer, so partial reads are not rescanned.
+ */
+long http_parse_request(const char* buffer, size_t length, size_t capacity,
+                        size_t* scanned, http_request_t* request);
+
+bool http_slice_equals(http_slice_t slice, const char* text);
+
+/*
+ * Single-pass field extraction: values[i] receives the value of names[i].
+ * Fields that are absent keep a NULL slice; a repeated field keeps the first.
+ */
+void http_query_fields(http_slice_t query, const char* const* names,
+                       http_slice_t* values, int count);
+
+/*
+ * Same for a flat JSON object of string, number, true/false and null
+ * values. String values are returned without their quotes and may not
+ * contain escapes. Returns -1 when the body is not such an object.
+ */
+int http_json_fields(http_slice_t body, const char* const* names,
+                     http_slice_t* values, int count);
+
+/*
+ * Copy a field into a NUL-terminated buffer, percent-decoding query values.
+ * Returns the copied length, or -1 when it does not fit or is badly encoded.
+ */
+int http_slice_copy(http_slice_t slice, char* out, size_t out_size);
+int http_query_decode(http_slice_t slice, char* out, size_t out_size);
+
+#endif /* !_HTTP_PARSER_H_ */
@@ -0,0 +1,702 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "App.h"
+#include "HttpParser.h"
+#include "HttpServer.h"
+#include "Metrics.h"
+#include "log_histogram.h"
+
+// ============================
+// epoll HTTP server
+// ============================
+//
+// One I/O thread owns the listening socket and an edge-triggered epoll set.
+// Client sockets are non-blocking and registered EPOLLONESHOT, so exactly one
+// thread touches a connection at a time: the I/O thread reads until a request
+// is complete, then hands the connection to the worker pool, whose threads
+// issue the ECALLs and write the response. Every connection slot and its
+// request buffer are allocated once at startup.
+//
+// Connections are persistent (HTTP/1.1 keep-alive). A worker serves every
+// complete request already in the buffer, so pipelined requests are answered
+// in order, then moves any partial request to the front of the buffer and
+// re-arms the socket. The I/O thread closes connections that sit idle in the
+// reading state longer than the idle timeout.
+//
+// Admission control happens when a request is complete and about to be
+// queued. Orders and queries wait in separate rings; workers take orders
+// first and queries never occupy the last free worker. A request is
+// answered 503 with Retry-After on the I/O thread, without reaching a
+// worker, when the queue is over its depth or the queueing delay of its
+// ring is over the target. The delay is the p99 of the last window, or the
+// wait of the oldest queued request when that is longer, so a stalled ring
+// is noticed before any request leaves it. Each ring is judged on its own
+// delay: orders overtake queries, so slow queries piling up must not get
+// orders shed. Shedding keeps the rings short, so accepted requests keep a
+// bounded wait under overload.
+
+#define MAX_EPOLL_EVENTS 256
+#define SEND_TIMEOUT_MS 5000
+
+// Queueing delay histogram, in microseconds, and the window of its p99
+#define QUEUE_DELAY_SUB_BITS 4
+#define QUEUE_DELAY_BUCKETS LOG_HIST_BUCKETS(QUEUE_DELAY_SUB_BITS)
+#define QUEUE_DELAY_WINDOW_US 100000
+
+enum connection_state_t {
+    CONN_FREE = 0,
+    CONN_READING,
+    CONN_PROCESSING
+};
+
+struct http_connection_t {
+    int fd;
+    int state;              // Shared by the I/O and worker threads; atomic access
+    uint64_t last_active;   // Monotonic ms of the last read or response
+    int requests;           // Requests served on this connection
+    uint64_t queued_us;     // Monotonic us when it entered a work ring
+    size_t length;
+    size_t scanned;         // Bytes already searched for the end of the headers
+    char* buffer;
+    http_connection_t* next_free;
+};
+
+static http_server_config_t server_config;
+static int epoll_fd = -1;
+static std::atomic<int> listen_fd(-1);
+
+static std::vector<http_connection_t> connections;
+// Left uninitialized: zero-filling every slot up front would fault in the
+// whole arena at startup, while untouched pages cost nothing
+static std::unique_ptr<char[]> buffer_arena;
+static http_connection_t* free_list = NULL;
+static std::mutex free_list_mutex;
+static std::atomic<uint64_t> open_connections(0);
+
+// Bounded rings of connections waiting for a worker: queries, then orders
+// and control requests. All of the state below is guarded by work_mutex.
+struct work_ring_t {
+    std::vector<http_connection_t*> slots;
+    size_t head;
+    size_t count;
+    uint64_t delay_counts[QUEUE_DELAY_BUCKETS];
+    uint64_t delay_p99_us;      // Of the last complete window
+};
+
+#define QUERY_RING 0
+#define ORDER_RING 1
+
+static work_ring_t work_rings[2];
+static std::mutex work_mutex;
+static std::condition_variable work_ready;
+static bool workers_stopping = false;
+static uint64_t delay_window_start = 0;
+
+// Queries being served; one worker is always left for orders
+static int running_queries = 0;
+static int max_running_queries = 1;
+
+void http_server_default_config(http_server_config_t* config)
+{
+    config->port = DEFAULT_HTTP_PORT;
+    config->backlog = DEFAULT_HTTP_BACKLOG;
+    config->workers = DEFAULT_HTTP_WORKERS;
+    config->buffer_size = DEFAULT_HTTP_BUFFER_SIZE;
+    config->max_connections = DEFAULT_HTTP_MAX_CONNECTIONS;
+    config->idle_timeout_ms = DEFAULT_HTTP_IDLE_TIMEOUT_MS;
+    config->max_requests = DEFAULT_HTTP_MAX_REQUESTS;
+    config->queue_depth = DEFAULT_HTTP_QUEUE_DEPTH;
+    config->queue_target_ms = DEFAULT_HTTP_QUEUE_TARGET_MS;
+    config->retry_after_s = DEFAULT_HTTP_RETRY_AFTER_S;
+    config->handler = NULL;
+    config->classify = NULL;
+    config->on_ready = NULL;
+}
+
+static uint64_t monotonic_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+}
+
+static uint64_t monotonic_us(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_nsec / 1000;
+}
+
+static int connection_state(const http_connection_t* conn)
+{
+    return __atomic_load_n(&conn->state, __ATOMIC_ACQUIRE);
+}
+
+static void set_connection_state(http_connection_t* conn, int state)
+{
+    __atomic_store_n(&conn->state, state, __ATOMIC_RELEASE);
+}
+
+int http_server_listen_socket(void)
+{
+    return listen_fd.load(std::memory_order_relaxed);
+}
+
+bool http_send_all(int fd, struct iovec* iov, int iovcnt)
+{
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = iov;
+    message.msg_iovlen = (size_t)iovcnt;
+
+    while (message.msg_iovlen > 0) {
+        ssize_t sent = sendmsg(fd, &message, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                return false;
+            }
+            // Socket buffer is full: wait for the client to drain it
+            struct pollfd pfd;
+            pfd.fd = fd;
+            pfd.events = POLLOUT;
+            pfd.revents = 0;
+            if (poll(&pfd, 1, SEND_TIMEOUT_MS) <= 0) {
+                return false;
+            }
+            continue;
+        }
+
+        // Skip the fully written iovecs and trim the partially written one
+        size_t remaining = (size_t)sent;
+        while (message.msg_iovlen > 0 && remaining >= message.msg_iov->iov_len) {
+            remaining -= message.msg_iov->iov_len;
+            message.msg_iov++;
+            message.msg_iovlen--;
+        }
+        if (message.msg_iovlen > 0) {
+            message.msg_iov->iov_base = (char*)message.msg_iov->iov_base + remaining;
+            message.msg_iov->iov_len -= remaining;
+        }
+    }
+    return true;
+}
+
+static http_connection_t* acquire_connection(void)
+{
+    std::lock_guard<std::mutex> lock(free_list_mutex);
+    http_connection_t* conn = free_list;
+    if (conn != NULL) {
+        free_list = conn->next_free;
+        conn->next_free = NULL;
+    }
+    return conn;
+}
+
+static void release_connection(http_connection_t* conn)
+{
+    close(conn->fd);
+    conn->fd = -1;
+    conn->length = 0;
+    set_connection_state(conn, CONN_FREE);
+
+    {
+        std::lock_guard<std::mutex> lock(free_list_mutex);
+        conn->next_free = free_list;
+        free_list = conn;
+    }
+    metrics_set_gauge(METRIC_GAUGE_OPEN_CONNECTIONS, --open_connections);
+}
+
+static bool arm_connection(http_connection_t* conn, int op)
+{
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLET | EPOLLONESHOT;
+    event.data.ptr = conn;
+    return epoll_ctl(epoll_fd, op, conn->fd, &event) == 0;
+}
+
+// Queueing delay a request entering ring now should expect. Called with work_mutex held.
+static uint64_t expected_queue_delay_us(const work_ring_t* ring, uint64_t now)
+{
+    if (now - delay_window_start >= QUEUE_DELAY_WINDOW_US) {
+        // A window that ended long ago says nothing about the current load
+        bool recent = now - delay_window_start < 2 * QUEUE_DELAY_WINDOW_US;
+        for (int i = 0; i < 2; i++) {
+            work_ring_t* window_ring = &work_rings[i];
+            window_ring->delay_p99_us = recent ? log_hist_percentile(window_ring->delay_counts, QUEUE_DELAY_BUCKETS,
+                                                                     QUEUE_DELAY_SUB_BITS, 99.0) : 0;
+            memset(window_ring->delay_counts, 0, sizeof(window_ring->delay_counts));
+        }
+        delay_window_start = now;
+        metrics_set_gauge(METRIC_GAUGE_QUEUE_DELAY_P99_US_QUERY, work_rings[QUERY_RING].delay_p99_us);
+        metrics_set_gauge(METRIC_GAUGE_QUEUE_DELAY_P99_US_ORDER, work_rings[ORDER_RING].delay_p99_us);
+    }
+
+    uint64_t delay = ring->delay_p99_us;
+    if (ring->count > 0 && now - ring->slots[ring->head]->queued_us > delay) {
+        delay = now - ring->slots[ring->head]->queued_us;
+    }
+    return delay;
+}
+
+// Queue a connection with a complete request for the workers, unless
+// admission control sheds it; returns whether it was queued
+static bool enqueue_work(http_connection_t* conn, int priority)
+{
+    {
+        std::lock_guard<std::mutex> lock(work_mutex);
+        uint64_t now = monotonic_us();
+        size_t waiting = work_rings[QUERY_RING].count + work_rings[ORDER_RING].count;
+        work_ring_t* ring = &work_rings[priority == HTTP_PRIORITY_QUERY ? QUERY_RING : ORDER_RING];
+
+        if (priority != HTTP_PRIORITY_CONTROL && server_config.queue_depth > 0) {
+            size_t depth = (size_t)server_config.queue_depth;
+            uint64_t target_us = (uint64_t)server_config.queue_target_ms * 1000;
+            if (priority == HTTP_PRIORITY_QUERY) {
+                depth = depth > 1 ? depth / 2 : 1;
+                target_us /= 2;
+            }
+            if (waiting >= depth || expected_queue_delay_us(ring, now) > target_us) {
+                return false;
+            }
+        }
+
+        // Each ring holds one slot per connection, so it can never overflow
+        conn->queued_us = now;
+        set_connection_state(conn, CONN_PROCESSING);
+        ring->slots[(ring->head + ring->count) % ring->slots.size()] = conn;
+        ring->count++;
+        metrics_set_gauge(METRIC_GAUGE_WORKER_QUEUE_DEPTH, waiting + 1);
+    }
+    work_ready.notify_one();
+    return true;
+}
+
+static void serve_connection(http_connection_t* conn);
+
+static void worker_loop(void)
+{
+    for (;;) {
+        http_connection_t* conn;
+        bool query;
+        {
+            std::unique_lock<std::mutex> lock(work_mutex);
+            // A query waits while the other workers are all on queries;
+            // when stopping, whatever is queued is drained
+            work_ready.wait(lock, [] {
+                return work_rings[ORDER_RING].count > 0 || workers_stopping ||
+                       (work_rings[QUERY_RING].count > 0 && running_queries < max_running_queries);
+            });
+            work_ring_t* ring = &work_rings[work_rings[ORDER_RING].count > 0 ? ORDER_RING : QUERY_RING];
+            if (ring->count == 0) {
+                return;
+            }
+            query = ring == &work_rings[QUERY_RING];
+            if (query) {
+                running_queries++;
+            }
+            conn = ring->slots[ring->head];
+            ring->head = (ring->head + 1) % ring->slots.size();
+            ring->count--;
+            metrics_set_gauge(METRIC_GAUGE_WORKER_QUEUE_DEPTH,
+                              work_rings[QUERY_RING].count + work_rings[ORDER_RING].count);
+            log_hist_record(ring->delay_counts, QUEUE_DELAY_SUB_BITS, monotonic_us() - conn->queued_us);
+        }
+
+        serve_connection(conn);
+
+        if (query) {
+            {
+                std::lock_guard<std::mutex> lock(work_mutex);
+                running_queries--;
+            }
+            work_ready.notify_one();
+        }
+    }
+}
+
+static void send_error_and_close(http_connection_t* conn, const char* status_line)
+{
+    char response[256];
+    int length = snprintf(response, sizeof(response),
+                          "HTTP/1.1 %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", status_line);
+    send(conn->fd, response, (size_t)length, MSG_NOSIGNAL | MSG_DONTWAIT);
+    release_connection(conn);
+}
+
+// Answer a shed request with 503 and drop it from the buffer; returns
+// whether the connection stays open
+static bool shed_request(http_connection_t* conn, const http_request_t* request, size_t request_length)
+{
+    conn->requests++;
+    bool keep_open = request->keep_alive && conn->requests < server_config.max_requests && keep_running;
+
+    char response[256];
+    int length = snprintf(response, sizeof(response),
+                          "HTTP/1.1 503 Service Unavailable\r\nRetry-After: %d\r\n"
+                          "Content-Length: 0\r\nConnection: %s\r\n\r\n",
+                          server_config.retry_after_s, keep_open ? "keep-alive" : "close");
+    bool sent = send(conn->fd, response, (size_t)length, MSG_NOSIGNAL | MSG_DONTWAIT) == length;
+    metrics_record_request(metrics_path_index(request->path.data, request->path.length), 503);
+
+    conn->length -= request_length;
+    memmove(conn->buffer, conn->buffer + request_length, conn->length);
+    conn->scanned = 0;
+    return sent && keep_open;
+}
+
+// Answer every complete request in the buffer, then wait for more
+static void serve_connection(http_connection_t* conn)
+{
+    size_t offset = 0;
+    bool keep_open = true;
+
+    while (keep_open && offset < conn->length) {
+        http_request_t request;
+        long request_length = http_parse_request(conn->buffer + offset, conn->length - offset,
+                                                 server_config.buffer_size, NULL, &request);
+        if (request_length == HTTP_PARSE_INCOMPLETE) {
+            break;
+        }
+        if (request_length == HTTP_PARSE_MALFORMED) {
+            send_error_and_close(conn, "400 Bad Request");
+            return;
+        }
+        if (request_length == HTTP_PARSE_TOO_LARGE) {
+            send_error_and_close(conn, "413 Content Too Large");
+            return;
+        }
+
+        conn->requests++;
+        if (conn->requests >= server_config.max_requests || !keep_running) {
+            request.keep_alive = false;
+        }
+
+        keep_open = server_config.handler(conn->fd, &request) && request.keep_alive;
+        offset += (size_t)request_length;
+    }
+
+    if (!keep_open) {
+        release_connection(conn);
+        return;
+    }
+
+    // Keep a pipelined partial request at the front of the buffer
+    conn->length -= offset;
+    memmove(conn->buffer, conn->buffer + offset, conn->length);
+    conn->scanned = 0;
+
+    conn->last_active = monotonic_ms();
+    set_connection_state(conn, CONN_READING);
+    if (!arm_connection(conn, EPOLL_CTL_MOD)) {
+        release_connection(conn);
+    }
+}
+
+// Drain the socket into the connection buffer; dispatch once the headers are in
+static void read_connection(http_connection_t* conn)
+{
+    bool peer_closed = false;
+    size_t capacity = server_config.buffer_size;
+
+    while (conn->length < capacity) {
+        ssize_t received = recv(conn->fd, conn->buffer + conn->length, capacity - conn->length, 0);
+        if (received > 0) {
+            conn->length += (size_t)received;
+            conn->last_active = monotonic_ms();
+            continue;
+        }
+        if (received == 0) {
+            peer_closed = true;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            peer_closed = true;
+        }
+        break;
+    }
+
+    // Shed requests are answered here, and pipelined ones after them get
+    // their own admission decision
+    http_request_t request;
+    long request_length;
+    while ((request_length = http_parse_request(conn->buffer, conn->length, server_config.buffer_size,
+                                                &conn->scanned, &request)) != HTTP_PARSE_INCOMPLETE) {
+        // Parse errors are answered by a worker without an ECALL
+        int priority = HTTP_PRIORITY_CONTROL;
+        if (request_length > 0) {
+            priority = server_config.classify != NULL ? server_config.classify(&request) : HTTP_PRIORITY_ORDER;
+        }
+        if (enqueue_work(conn, priority)) {
+            return;
+        }
+        if (!shed_request(conn, &request, (size_t)request_length)) {
+            release_connection(conn);
+            return;
+        }
+    }
+
+    if (peer_closed) {
+        release_connection(conn);
+    } else if (conn->length >= capacity) {
+        send_error_and_close(conn, "431 Request Header Fields Too Large");
+    } else if (!arm_connection(conn, EPOLL_CTL_MOD)) {
+        release_connection(conn);
+    }
+}
+
+static void accept_connections(void)
+{
+    for (;;) {
+        int fd = accept4(listen_fd.load(std::memory_order_relaxed), NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("Accept failed");
+            }
+            return;
+        }
+
+        http_connection_t* conn = acquire_connection();
+        if (conn == NULL) {
+            printf("[ERROR] Connection limit (%d) reached, rejecting client\n", server_config.max_connections);
+            close(fd);
+            continue;
+        }
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        conn->fd = fd;
+        conn->length = 0;
+        conn->scanned = 0;
+        conn->requests = 0;
+        conn->last_active = monotonic_ms();
+        set_connection_state(conn, CONN_READING);
+        metrics_set_gauge(METRIC_GAUGE_OPEN_CONNECTIONS, ++open_connections);
+
+        if (!arm_connection(conn, EPOLL_CTL_ADD)) {
+            perror("epoll_ctl failed");
+            release_connection(conn);
+        }
+    }
+}
+
+// Close connections waiting on a request that has not arrived within the
+// idle timeout. Workers stamp last_active before handing a connection back,
+// so a connection that just became READING is never considered idle.
+static void close_idle_connections(uint64_t now)
+{
+    for (size_t i = 0; i < connections.size(); i++) {
+        http_connection_t* conn = &connections[i];
+        if (connection_state(conn) == CONN_READING &&
+            now - conn->last_active >= (uint64_t)server_config.idle_timeout_ms) {
+            release_connection(conn);
+        }
+    }
+}
+
+// Thousands of clients need as many descriptors; lift the soft limit to the hard one
+static void raise_descriptor_limit(void)
+{
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+static int open_listen_socket(void)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("Socket creation failed");
+        return -1;
+    }
+
+    int opt = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt))) {
+        perror("Setsockopt failed");
+        close(fd);
+        return -1;
+    }
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons((uint16_t)server_config.port);
+
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        perror("Bind failed");
+        close(fd);
+        return -1;
+    }
+
+    if (listen(fd, server_config.backlog) < 0) {
+        perror("Listen failed");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int http_server_run(const http_server_config_t* config)
+{
+    server_config = *config;
+    if (server_config.handler == NULL || server_config.workers < 1 ||
+        server_config.max_connections < 1 || server_config.buffer_size < 256 ||
+        server_config.max_requests < 1 || server_config.queue_depth < 0 ||
+        server_config.queue_target_ms < 1 || server_config.retry_after_s < 0 ||
+        (server_config.idle_timeout_ms != 0 && server_config.idle_timeout_ms < 100)) {
+        printf("[ERROR] Invalid HTTP server configuration\n");
+        return -1;
+    }
+
+    raise_descriptor_limit();
+
+    // Preallocate every connection slot and request buffer
+    connections.assign((size_t)server_config.max_connections, http_connection_t());
+    buffer_arena.reset(new char[(size_t)server_config.max_connections * server_config.buffer_size]);
+    running_queries = 0;
+    max_running_queries = server_config.workers > 1 ? server_config.workers - 1 : 1;
+    for (int i = 0; i < 2; i++) {
+        work_rings[i].slots.assign((size_t)server_config.max_connections, NULL);
+        work_rings[i].head = 0;
+        work_rings[i].count = 0;
+        memset(work_rings[i].delay_counts, 0, sizeof(work_rings[i].delay_counts));
+        work_rings[i].delay_p99_us = 0;
+    }
+    free_list = NULL;
+    for (size_t i = connections.size(); i > 0; i--) {
+        http_connection_t* conn = &connections[i - 1];
+        conn->fd = -1;
+        conn->state = CONN_FREE;
+        conn->last_active = 0;
+        conn->requests = 0;
+        conn->queued_us = 0;
+        conn->length = 0;
+        conn->scanned = 0;
+        conn->buffer = &buffer_arena[(i - 1) * server_config.buffer_size];
+        conn->next_free = free_list;
+        free_list = conn;
+    }
+
+    int server_fd = open_listen_socket();
+    if (server_fd < 0) {
+        return -1;
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event listen_event;
+    listen_event.events = EPOLLIN | EPOLLET;
+    listen_event.data.ptr = NULL;
+    if (epoll_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_fd, &listen_event) < 0) {
+        perror("epoll setup failed");
+        close(server_fd);
+        if (epoll_fd >= 0) {
+            close(epoll_fd);
+        }
+        return -1;
+    }
+    listen_fd.store(server_fd);
+
+    workers_stopping = false;
+    std::vector<std::thread> workers;
+    for (int i = 0; i < server_config.workers; i++) {
+        workers.push_back(std::thread(worker_loop));
+    }
+
+    printf("HTTP server started on port %d (backlog %d, %d workers, %d connection slots of %zu bytes, "
+           "idle timeout %d ms, %d requests per connection, queue depth %d, queue target %d ms)\n",
+           server_config.port, server_config.backlog, server_config.workers,
+           server_config.max_connections, server_config.buffer_size,
+           server_config.idle_timeout_ms, server_config.max_requests,
+           server_config.queue_depth, server_config.queue_target_ms);
+    if (server_config.on_ready != NULL) {
+        server_config.on_ready();
+    }
+
+    // The wait timeout bounds how long a shutdown request or an idle
+    // connection goes unnoticed
+    int wait_ms = 1000;
+    if (server_config.idle_timeout_ms != 0 && server_config.idle_timeout_ms / 4 < wait_ms) {
+        wait_ms = server_config.idle_timeout_ms / 4;
+    }
+    uint64_t next_sweep = monotonic_ms() + (uint64_t)wait_ms;
+
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    int result = 0;
+    while (keep_running) {
+        int ready = epoll_wait(epoll_fd, events, MAX_EPOLL_EVENTS, wait_ms);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait error");
+            result = -1;
+            break;
+        }
+
+        for (int i = 0; i < ready; i++) {
+            http_connection_t* conn = (http_connection_t*)events[i].data.ptr;
+            if (conn == NULL) {
+                accept_connections();
+            } else {
+                read_connection(conn);
+            }
+        }
+
+        uint64_t now = monotonic_ms();
+        if (server_config.idle_timeout_ms != 0 && now >= next_sweep) {
+            close_idle_connections(now);
+            next_sweep = now + (uint64_t)wait_ms;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(work_mutex);
+        workers_stopping = true;
+    }
+    work_ready.notify_all();
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+
+    // Connections still waiting on the client are dropped
+    for (size_t i = 0; i < connections.size(); i++) {
+        if (connection_state(&connections[i]) != CONN_FREE) {
+            release_connection(&connections[i]);
+        }
+    }
+
+    listen_fd.store(-1);
+    close(server_fd);
+    close(epoll_fd);
+    epoll_fd = -1;
+    printf("HTTP server stopped\n");
+    return result;
+}
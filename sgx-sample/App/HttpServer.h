@@ -0,0 +1,70 @@
+#ifndef _HTTP_SERVER_H_
+#define _HTTP_SERVER_H_
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+#include "HttpParser.h"
+
+#define DEFAULT_HTTP_PORT 8080
+#define DEFAULT_HTTP_BACKLOG 1024
+#define DEFAULT_HTTP_WORKERS 8
+#define DEFAULT_HTTP_BUFFER_SIZE 8192
+#define DEFAULT_HTTP_MAX_CONNECTIONS 2048
+#define DEFAULT_HTTP_IDLE_TIMEOUT_MS 5000
+#define DEFAULT_HTTP_MAX_REQUESTS 1000
+#define DEFAULT_HTTP_QUEUE_DEPTH 256
+#define DEFAULT_HTTP_QUEUE_TARGET_MS 50
+#define DEFAULT_HTTP_RETRY_AFTER_S 1
+
+/*
+ * Admission priority of a request. When the worker queue is over its depth
+ * or its p99 queueing delay is over the target, new order requests get 503
+ * with Retry-After; queries are shed at half the depth and half the target,
+ * and wait behind orders. Control requests are never shed.
+ */
+enum http_priority_t {
+    HTTP_PRIORITY_QUERY = 0,
+    HTTP_PRIORITY_ORDER,
+    HTTP_PRIORITY_CONTROL
+};
+
+/*
+ * Called on a worker thread with one complete request, whose slices point
+ * into the connection buffer. request->keep_alive tells the handler whether
+ * its response may leave the connection open; it returns false when the
+ * response asked the client to close.
+ */
+typedef bool (*http_handler_t)(int client_socket, const http_request_t* request);
+
+/* Called on the I/O thread before a request is queued; returns an http_priority_t */
+typedef int (*http_classify_t)(const http_request_t* request);
+
+typedef struct _http_server_config_t {
+    int port;
+    int backlog;              /* listen() backlog */
+    int workers;              /* Threads issuing ECALLs; keep below TCSNum */
+    size_t buffer_size;       /* Preallocated request buffer per connection */
+    int max_connections;      /* Connection slots allocated at startup */
+    int idle_timeout_ms;      /* Close connections idle this long; 0 disables */
+    int max_requests;         /* Requests served per connection before closing */
+    int queue_depth;          /* Requests waiting for a worker before shedding; 0 disables shedding */
+    int queue_target_ms;      /* p99 queueing delay above which requests are shed */
+    int retry_after_s;        /* Retry-After of a shed request */
+    http_handler_t handler;
+    http_classify_t classify; /* NULL treats every request as HTTP_PRIORITY_ORDER */
+    void (*on_ready)(void);   /* Called once connections are being accepted; may be NULL */
+} http_server_config_t;
+
+void http_server_default_config(http_server_config_t* config);
+
+/* Serve until keep_running is cleared; returns 0 on a clean shutdown */
+int http_server_run(const http_server_config_t* config);
+
+/* Listening socket, or -1 when the server is not running */
+int http_server_listen_socket(void);
+
+/* Write every iovec to a non-blocking socket, waiting for buffer space as needed */
+bool http_send_all(int fd, struct iovec* iov, int iovcnt);
+
+#endif /* !_HTTP_SERVER_H_ */
@@ -0,0 +1,287 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "sgx_urts.h"
+#include "App.h"
+#include "Enclave_u.h"
+#include "MatchingThread.h"
+#include "order_ring.h"
+
+// ============================
+// Enclave matching threads
+// ============================
+//
+// Each matching thread enters the enclave through ecall_run_order_ring and
+// stays there, matching orders that any other thread publishes in the
+// shared ring (see order_ring.h). Submitting an order is a CAS on the tail
+// of its market's queue and a copy; the submitter then polls its reply
+// slot. No enclave transition happens per order unless every matching
+// thread had gone to sleep.
+
+// Polls with a pause before a submitter waiting for a reply or a free
+// queue cell starts yielding the CPU
+#define REPLY_SPIN 4000
+
+static order_ring_t* ring = NULL;
+static std::vector<std::thread> matchers;
+static std::atomic<int> matchers_running(0);
+
+// Reply slots no thread holds, and the last ticket each slot was used
+// with, so the next holder's first ticket cannot match an old reply
+static std::mutex producer_mutex;
+static std::vector<int> free_producers;
+static int next_producer = 0;
+static uint64_t producer_tickets[ORDER_RING_PRODUCERS];
+
+// Reply slot of a thread: -1 while it holds none, in which case it uses
+// direct ECALLs. Given back when the thread exits, so threads that come
+// and go, one per order-entry session, do not use the slots up.
+struct ProducerSlot {
+    int slot;
+    uint64_t ticket;
+
+    ProducerSlot() : slot(-1), ticket(0) {}
+
+    // Take a free slot if there is one
+    void claim()
+    {
+        std::lock_guard<std::mutex> lock(producer_mutex);
+        if (!free_producers.empty()) {
+            slot = free_producers.back();
+            free_producers.pop_back();
+        } else if (next_producer < ORDER_RING_PRODUCERS) {
+            slot = next_producer++;
+        } else {
+            return;
+        }
+        ticket = producer_tickets[slot];
+    }
+
+    ~ProducerSlot()
+    {
+        if (slot < 0) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(producer_mutex);
+        producer_tickets[slot] = ticket;
+        free_producers.push_back(slot);
+    }
+};
+
+static thread_local ProducerSlot producer;
+
+static void run_matcher(int worker)
+{
+    sgx_status_t status = ecall_run_order_ring(global_eid, ring, worker);
+    if (status != SGX_SUCCESS) {
+        printf("[ERROR] Matching thread %d failed to run in the enclave. Error code: %d\n", worker, status);
+    }
+    matchers_running.fetch_sub(1);
+}
+
+int matching_thread_start(int threads)
+{
+    if (threads < 1 || threads > MARKET_COUNT) {
+        printf("[ERROR] Matching threads must be between 1 and %d\n", MARKET_COUNT);
+        return -1;
+    }
+
+    void* memory = NULL;
+    if (posix_memalign(&memory, ORDER_RING_CACHE_LINE, sizeof(order_ring_t)) != 0) {
+        printf("[ERROR] Failed to allocate the order ring\n");
+        return -1;
+    }
+    ring = (order_ring_t*)memory;
+    memset(ring, 0, sizeof(*ring));
+    ring->workers = (uint32_t)threads;
+    // Room for every slot, so giving one back at thread exit cannot throw
+    free_producers.reserve(ORDER_RING_PRODUCERS);
+    for (int market = 0; market < MARKET_COUNT; market++) {
+        for (uint64_t i = 0; i < ORDER_RING_SIZE; i++) {
+            ring->queues[market].requests[i].sequence = i;
+        }
+    }
+
+    matchers_running.store(threads);
+    for (int worker = 0; worker < threads; worker++) {
+        matchers.push_back(std::thread(run_matcher, worker));
+    }
+    printf("Matching threads started (%d, %d markets of %d-order queues, %d producers)\n",
+           threads, MARKET_COUNT, ORDER_RING_SIZE, ORDER_RING_PRODUCERS);
+    return 0;
+}
+
+void matching_thread_stop(void)
+{
+    if (matchers.empty()) {
+        return;
+    }
+    __atomic_store_n(&ring->stop, 1, __ATOMIC_SEQ_CST);
+    ecall_wake_order_ring(global_eid);
+    for (size_t i = 0; i < matchers.size(); i++) {
+        matchers[i].join();
+    }
+    matchers.clear();
+    free(ring);
+    ring = NULL;
+}
+
+void matching_thread_restart(sgx_enclave_id_t previous_eid)
+{
+    if (matchers.empty()) {
+        return;
+    }
+    // Counted in before the old threads leave, so no submitter falls back
+    // to a direct ECALL with requests still queued
+    int threads = (int)matchers.size();
+    matchers_running.fetch_add(threads);
+    __atomic_store_n(&ring->stop, 1, __ATOMIC_SEQ_CST);
+    ecall_wake_order_ring(previous_eid);
+    for (size_t i = 0; i < matchers.size(); i++) {
+        matchers[i].join();
+    }
+    matchers.clear();
+
+    // The new enclave picks up each queue at the head the old one left
+    __atomic_store_n(&ring->stop, 0, __ATOMIC_SEQ_CST);
+    for (int worker = 0; worker < threads; worker++) {
+        matchers.push_back(std::thread(run_matcher, worker));
+    }
+}
+
+uint64_t matching_ring_depth(void)
+{
+    if (ring == NULL) {
+        return 0;
+    }
+    uint64_t depth = 0;
+    for (int market = 0; market < MARKET_COUNT; market++) {
+        uint64_t tail = __atomic_load_n(&ring->queues[market].tail, __ATOMIC_RELAXED);
+        uint64_t head = __atomic_load_n(&ring->queues[market].head, __ATOMIC_RELAXED);
+        depth += tail > head ? tail - head : 0;
+    }
+    return depth;
+}
+
+// Claim a cell of the market's queue and publish the request in it; false when the queue is full
+static bool publish_request(int market, const order_ring_request_t* request)
+{
+    order_ring_queue_t* queue = &ring->queues[market];
+    uint64_t position = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+    order_ring_request_t* cell;
+    for (;;) {
+        cell = &queue->requests[position & (ORDER_RING_SIZE - 1)];
+        uint64_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        int64_t turn = (int64_t)(sequence - position);
+        if (turn == 0) {
+            if (__atomic_compare_exchange_n(&queue->tail, &position, position + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (turn < 0) {
+            return false;
+        } else {
+            position = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    memcpy((char*)cell + sizeof(cell->sequence), (const char*)request + sizeof(request->sequence),
+           sizeof(*request) - sizeof(request->sequence));
+    __atomic_store_n(&cell->sequence, position + 1, __ATOMIC_SEQ_CST);
+
+    // Pairs with a matching thread counting itself in sleeping before its last look
+    if (__atomic_load_n(&ring->sleeping, __ATOMIC_SEQ_CST)) {
+        ecall_wake_order_ring(global_eid);
+    }
+    return true;
+}
+
+static bool wait_for_reply(const order_ring_reply_t* reply, uint64_t ticket)
+{
+    for (unsigned polls = 0; __atomic_load_n(&reply->done, __ATOMIC_ACQUIRE) != ticket; polls++) {
+        if (polls < REPLY_SPIN) {
+            __builtin_ia32_pause();
+        } else if (matchers_running.load(std::memory_order_relaxed) == 0) {
+            return false;
+        } else {
+            sched_yield();
+        }
+    }
+    return true;
+}
+
+sgx_status_t matching_add_order(int* retval, int market, const char* user_address, int order_type,
+                                int order_side, double price, double quantity, const char* client_key,
+                                int64_t expires, char* order_id, size_t id_size, order_fill_t* fills,
+                                size_t max_fills, order_result_t* result)
+{
+    if (producer.slot < 0 && matchers_running.load(std::memory_order_relaxed) > 0) {
+        producer.claim();
+    }
+
+    order_ring_request_t request;
+    if (matchers_running.load(std::memory_order_relaxed) == 0 || producer.slot < 0 ||
+        market < 0 || market >= MARKET_COUNT || strlen(user_address) >= sizeof(request.user_address) ||
+        strlen(client_key) >= sizeof(request.client_key)) {
+        return ecall_add_order(global_eid, retval, market, user_address, order_type, order_side, price,
+                               quantity, client_key, expires, order_id, id_size, fills, max_fills, result);
+    }
+
+    memset(&request, 0, sizeof(request));
+    request.ticket = ++producer.ticket;
+    request.producer = (uint32_t)producer.slot;
+    request.order_type = order_type;
+    request.order_side = order_side;
+    request.price = price;
+    request.quantity = quantity;
+    request.expires = expires;
+    strcpy(request.user_address, user_address);
+    strcpy(request.client_key, client_key);
+
+    // A full queue means its market is far behind. A direct ECALL would
+    // match this order ahead of those queued before it, so wait for a cell
+    for (unsigned polls = 0; !publish_request(market, &request); polls++) {
+        if (matchers_running.load(std::memory_order_relaxed) == 0) {
+            return SGX_ERROR_UNEXPECTED;
+        }
+        if (polls < REPLY_SPIN) {
+            __builtin_ia32_pause();
+        } else {
+            sched_yield();
+        }
+    }
+
+    const order_ring_reply_t* reply = &ring->replies[producer.slot];
+    if (!wait_for_reply(reply, request.ticket)) {
+        return SGX_ERROR_UNEXPECTED;
+    }
+    if (reply->result == ORDER_RING_INVALID) {
+        return SGX_ERROR_INVALID_PARAMETER;
+    }
+
+    *retval = reply->result;
+    if (id_size > 0) {
+        strncpy(order_id, reply->order_id, id_size - 1);
+        order_id[id_size - 1] = '\0';
+    }
+    if (reply->result == ORDER_ADD_OK) {
+        if (result != NULL) {
+            *result = reply->outcome;
+        }
+        size_t reported = reply->outcome.fill_count < max_fills ? (size_t)reply->outcome.fill_count : max_fills;
+        if (reported > ORDER_RING_MAX_FILLS) {
+            reported = ORDER_RING_MAX_FILLS;
+        }
+        if (fills != NULL && reported > 0) {
+            memcpy(fills, reply->fills, reported * sizeof(order_fill_t));
+        }
+    }
+    return SGX_SUCCESS;
+}
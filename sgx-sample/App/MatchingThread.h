@@ -0,0 +1,43 @@
+#ifndef _MATCHING_THREAD_H_
+#define _MATCHING_THREAD_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sgx_error.h"
+#include "sgx_eid.h"
+#include "user_types.h"
+
+/*
+ * Start threads (1 to MARKET_COUNT) enclave matching threads. Each occupies
+ * a TCS for as long as it runs, so workers + order-entry sessions + threads
+ * must stay within TCSNum.
+ */
+int matching_thread_start(int threads);
+
+/* Called once no thread submits orders any more */
+void matching_thread_stop(void);
+
+/*
+ * Move the matching threads from the enclave previous_eid to the one now
+ * in global_eid; the ring keeps what is queued in it, and submitters keep
+ * waiting for their replies meanwhile
+ */
+void matching_thread_restart(sgx_enclave_id_t previous_eid);
+
+/*
+ * ecall_add_order without the enclave id: through the market's queue in
+ * the matching threads' ring while they run, waiting for a free cell when
+ * the queue is full, and with a direct ECALL otherwise.
+ * Safe to call from any thread; at most ORDER_RING_MAX_FILLS fills are
+ * reported through the ring. client_key is empty for an order without one.
+ */
+sgx_status_t matching_add_order(int* retval, int market, const char* user_address, int order_type,
+                                int order_side, double price, double quantity, const char* client_key,
+                                int64_t expires, char* order_id, size_t id_size, order_fill_t* fills,
+                                size_t max_fills, order_result_t* result);
+
+/* Orders submitted to the ring and not yet taken by a matching thread */
+uint64_t matching_ring_depth(void);
+
+#endif /* !_MATCHING_THREAD_H_ */
@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <atomic>
+
+#include "Metrics.h"
+#include "EcallProfiler.h"
+
+#define CACHE_LINE_SIZE 64
+#define FAILURE_CODE_SLOTS 8
+
+// Counters are padded to a cache line so concurrent request handlers never
+// false-share while bumping unrelated series
+struct alignas(CACHE_LINE_SIZE) padded_counter_t {
+    std::atomic<uint64_t> value;
+};
+
+struct failure_slot_t {
+    std::atomic<uint32_t> code;   // 0 = unused slot (SGX_SUCCESS is never recorded)
+    padded_counter_t count;
+};
+
+static const int status_codes[] = { 200, 400, 404, 409, 500, 503 };
+#define STATUS_CODE_COUNT (sizeof(status_codes) / sizeof(status_codes[0]))
+#define STATUS_OTHER STATUS_CODE_COUNT
+
+static const char* path_names[METRIC_PATH_COUNT] = {
+    "/order", "/trades", "/stats", "/metrics", "/clear", "/profile", "/ready", "/memory", "/settlement", "/deposit", "/account", "/replica", "/promote", "/proof", "/signing-key",
+    "/order-session", "/order-envelopes", "/close-session", "/settlement-ack", "other"
+};
+
+// Upper bounds of the ecall duration buckets, in nanoseconds
+static const uint64_t duration_bounds_ns[] = {
+    10000, 50000, 100000, 250000, 500000, 1000000, 5000000, 10000000, 50000000, 100000000
+};
+#define DURATION_BUCKETS (sizeof(duration_bounds_ns) / sizeof(duration_bounds_ns[0]))
+
+static const struct {
+    const char* name;
+    const char* help;
+    const char* labels;
+} gauge_info[METRIC_GAUGE_COUNT] = {
+    { "enclave_open_orders", "Resting orders in the book.", "side=\"buy\"" },
+    { "enclave_open_orders", "Resting orders in the book.", "side=\"sell\"" },
+    { "enclave_price_levels", "Distinct price levels in the book.", "side=\"buy\"" },
+    { "enclave_price_levels", "Distinct price levels in the book.", "side=\"sell\"" },
+    { "enclave_trades", "Trades held in the enclave trade log.", NULL },
+    { "enclave_heap_bytes_in_use", "Enclave heap bytes allocated through operator new.", NULL },
+    { "enclave_heap_budget_bytes", "Heap bytes the book may use before orders are rejected as book full.", NULL },
+    { "enclave_heap_high_water_bytes", "Most enclave heap bytes in use since the enclave started.", NULL },
+    { "enclave_heap_allocations", "Calls to the enclave's operator new since the enclave started.", NULL },
+    { "enclave_memory_entries", "Entries held per book structure, as of the last GET /memory.", "structure=\"resting_orders\"" },
+    { "enclave_memory_entries", "Entries held per book structure, as of the last GET /memory.", "structure=\"open_order_records\"" },
+    { "enclave_memory_entries", "Entries held per book structure, as of the last GET /memory.", "structure=\"terminal_order_records\"" },
+    { "enclave_memory_entries", "Entries held per book structure, as of the last GET /memory.", "structure=\"trades\"" },
+    { "enclave_memory_entries", "Entries held per book structure, as of the last GET /memory.", "structure=\"user_index\"" },
+    { "enclave_memory_entries", "Entries held per book structure, as of the last GET /memory.", "structure=\"accounts\"" },
+    { "enclave_memory_entries", "Entries held per book structure, as of the last GET /memory.", "structure=\"client_keys\"" },
+    { "enclave_memory_entries", "Entries held per book structure, as of the last GET /memory.", "structure=\"batch_commitments\"" },
+    { "enclave_memory_entries", "Entries held per book structure, as of the last GET /memory.", "structure=\"order_timers\"" },
+    { "enclave_memory_bytes", "Estimated enclave heap bytes per book structure, as of the last GET /memory.", "structure=\"resting_orders\"" },
+    { "enclave_memory_bytes", "Estimated enclave heap bytes per book structure, as of the last GET /memory.", "structure=\"open_order_records\"" },
+    { "enclave_memory_bytes", "Estimated enclave heap bytes per book structure, as of the last GET /memory.", "structure=\"terminal_order_records\"" },
+    { "enclave_memory_bytes", "Estimated enclave heap bytes per book structure, as of the last GET /memory.", "structure=\"trades\"" },
+    { "enclave_memory_bytes", "Estimated enclave heap bytes per book structure, as of the last GET /memory.", "structure=\"user_index\"" },
+    { "enclave_memory_bytes", "Estimated enclave heap bytes per book structure, as of the last GET /memory.", "structure=\"accounts\"" },
+    { "enclave_memory_bytes", "Estimated enclave heap bytes per book structure, as of the last GET /memory.", "structure=\"client_keys\"" },
+    { "enclave_memory_bytes", "Estimated enclave heap bytes per book structure, as of the last GET /memory.", "structure=\"batch_commitments\"" },
+    { "enclave_memory_bytes", "Estimated enclave heap bytes per book structure, as of the last GET /memory.", "structure=\"order_timers\"" },
+    { "app_listen_queue_depth", "Connections waiting in the listen socket accept queue.", NULL },
+    { "app_listen_backlog", "Configured listen socket backlog.", NULL },
+    { "app_open_connections", "Client connections currently held by the HTTP server.", NULL },
+    { "app_worker_queue_depth", "Complete requests waiting for an HTTP worker.", NULL },
+    { "app_queue_delay_p99_microseconds", "p99 wait for an HTTP worker over the last admission window.", "priority=\"query\"" },
+    { "app_queue_delay_p99_microseconds", "p99 wait for an HTTP worker over the last admission window.", "priority=\"order\"" },
+    { "app_order_ring_depth", "Orders waiting in the ring for the enclave matching thread.", NULL },
+    { "app_replica_lag_inputs", "Inputs the primary journaled that the standby enclave has not applied yet.", NULL },
+};
+
+static padded_counter_t request_counts[METRIC_PATH_COUNT][STATUS_CODE_COUNT + 1];
+static padded_counter_t ecall_counts[ECALL_ID_COUNT];
+static padded_counter_t ecall_duration_sum_ns[ECALL_ID_COUNT];
+static padded_counter_t ecall_duration_buckets[ECALL_ID_COUNT][DURATION_BUCKETS + 1];
+static failure_slot_t ecall_failures[ECALL_ID_COUNT][FAILURE_CODE_SLOTS];
+static padded_counter_t ecall_failures_overflow[ECALL_ID_COUNT];
+static padded_counter_t gauges[METRIC_GAUGE_COUNT];
+
+int metrics_path_index(const char* path, size_t length)
+{
+    for (int i = 0; i < METRIC_PATH_OTHER; i++) {
+        if (strlen(path_names[i]) == length && memcmp(path, path_names[i], length) == 0) {
+            return i;
+        }
+    }
+    return METRIC_PATH_OTHER;
+}
+
+void metrics_record_request(int path, int status_code)
+{
+    if (path < 0 || path >= METRIC_PATH_COUNT) {
+        path = METRIC_PATH_OTHER;
+    }
+
+    size_t status = STATUS_OTHER;
+    for (size_t i = 0; i < STATUS_CODE_COUNT; i++) {
+        if (status_codes[i] == status_code) {
+            status = i;
+            break;
+        }
+    }
+    request_counts[path][status].value.fetch_add(1, std::memory_order_relaxed);
+}
+
+void metrics_record_ecall(int ecall, sgx_status_t status, uint64_t duration_ns)
+{
+    if (ecall < 0 || ecall >= ECALL_ID_COUNT) {
+        return;
+    }
+
+    ecall_counts[ecall].value.fetch_add(1, std::memory_order_relaxed);
+    ecall_duration_sum_ns[ecall].value.fetch_add(duration_ns, std::memory_order_relaxed);
+
+    size_t bucket = 0;
+    while (bucket < DURATION_BUCKETS && duration_ns > duration_bounds_ns[bucket]) {
+        bucket++;
+    }
+    ecall_duration_buckets[ecall][bucket].value.fetch_add(1, std::memory_order_relaxed);
+
+    if (status == SGX_SUCCESS) {
+        return;
+    }
+
+    // Failure codes claim a slot with a CAS the first time they are seen
+    uint32_t code = (uint32_t)status;
+    for (size_t i = 0; i < FAILURE_CODE_SLOTS; i++) {
+        failure_slot_t* slot = &ecall_failures[ecall][i];
+        uint32_t current = slot->code.load(std::memory_order_acquire);
+        if (current == 0) {
+            uint32_t expected = 0;
+            if (slot->code.compare_exchange_strong(expected, code, std::memory_order_acq_rel)) {
+                current = code;
+            } else {
+                current = expected;
+            }
+        }
+        if (current == code) {
+            slot->count.value.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+    ecall_failures_overflow[ecall].value.fetch_add(1, std::memory_order_relaxed);
+}
+
+void metrics_set_gauge(int gauge, uint64_t value)
+{
+    if (gauge >= 0 && gauge < METRIC_GAUGE_COUNT) {
+        gauges[gauge].value.store(value, std::memory_order_relaxed);
+    }
+}
+
+static void append(std::string& out, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void append(std::string& out, const char* fmt, ...)
+{
+    char line[256];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if (len > 0) {
+        out.append(line, (size_t)len < sizeof(line) ? (size_t)len : sizeof(line) - 1);
+    }
+}
+
+static uint64_t load(const padded_counter_t& counter)
+{
+    return counter.value.load(std::memory_order_relaxed);
+}
+
+void metrics_format(std::string& out)
+{
+    out.reserve(16384);
+
+    append(out, "# HELP app_http_requests_total HTTP requests by path and status code.\n");
+    append(out, "# TYPE app_http_requests_total counter\n");
+    for (int p = 0; p < METRIC_PATH_COUNT; p++) {
+        for (size_t s = 0; s <= STATUS_CODE_COUNT; s++) {
+            uint64_t count = load(request_counts[p][s]);
+            // Unusual status codes are only listed once they occur
+            if (s == STATUS_OTHER && count == 0) {
+                continue;
+            }
+            if (s == STATUS_OTHER) {
+                append(out, "app_http_requests_total{path=\"%s\",code=\"other\"} %llu\n",
+                       path_names[p], (unsigned long long)count);
+            } else {
+                append(out, "app_http_requests_total{path=\"%s\",code=\"%d\"} %llu\n",
+                       path_names[p], status_codes[s], (unsigned long long)count);
+            }
+        }
+    }
+
+    append(out, "# HELP app_ecall_calls_total ECALLs issued by the App.\n");
+    append(out, "# TYPE app_ecall_calls_total counter\n");
+    for (int e = 0; e < ECALL_ID_COUNT; e++) {
+        append(out, "app_ecall_calls_total{ecall=\"%s\"} %llu\n", ecall_name(e),
+               (unsigned long long)load(ecall_counts[e]));
+    }
+
+    append(out, "# HELP app_ecall_duration_seconds Wall-clock ECALL duration including the transition.\n");
+    append(out, "# TYPE app_ecall_duration_seconds histogram\n");
+    for (int e = 0; e < ECALL_ID_COUNT; e++) {
+        uint64_t cumulative = 0;
+        for (size_t b = 0; b < DURATION_BUCKETS; b++) {
+            cumulative += load(ecall_duration_buckets[e][b]);
+            append(out, "app_ecall_duration_seconds_bucket{ecall=\"%s\",le=\"%g\"} %llu\n", ecall_name(e),
+                   (double)duration_bounds_ns[b] / 1e9, (unsigned long long)cumulative);
+        }
+        cumulative += load(ecall_duration_buckets[e][DURATION_BUCKETS]);
+        append(out, "app_ecall_duration_seconds_bucket{ecall=\"%s\",le=\"+Inf\"} %llu\n", ecall_name(e),
+               (unsigned long long)cumulative);
+        append(out, "app_ecall_duration_seconds_sum{ecall=\"%s\"} %.9f\n", ecall_name(e),
+               (double)load(ecall_duration_sum_ns[e]) / 1e9);
+        append(out, "app_ecall_duration_seconds_count{ecall=\"%s\"} %llu\n", ecall_name(e),
+               (unsigned long long)cumulative);
+    }
+
+    append(out, "# HELP app_ecall_failures_total ECALLs that returned an SGX error, by sgx_status_t.\n");
+    append(out, "# TYPE app_ecall_failures_total counter\n");
+    for (int e = 0; e < ECALL_ID_COUNT; e++) {
+        for (size_t i = 0; i < FAILURE_CODE_SLOTS; i++) {
+            uint32_t code = ecall_failures[e][i].code.load(std::memory_order_acquire);
+            if (code == 0) {
+                break;
+            }
+            append(out, "app_ecall_failures_total{ecall=\"%s\",code=\"0x%04X\"} %llu\n", ecall_name(e), code,
+                   (unsigned long long)load(ecall_failures[e][i].count));
+        }
+        uint64_t overflow = load(ecall_failures_overflow[e]);
+        if (overflow != 0) {
+            append(out, "app_ecall_failures_total{ecall=\"%s\",code=\"other\"} %llu\n", ecall_name(e),
+                   (unsigned long long)overflow);
+        }
+    }
+
+    for (int g = 0; g < METRIC_GAUGE_COUNT; g++) {
+        // Series sharing a name are emitted under a single HELP/TYPE header
+        if (g == 0 || strcmp(gauge_info[g].name, gauge_info[g - 1].name) != 0) {
+            append(out, "# HELP %s %s\n", gauge_info[g].name, gauge_info[g].help);
+            append(out, "# TYPE %s gauge\n", gauge_info[g].name);
+        }
+        if (gauge_info[g].labels != NULL) {
+            append(out, "%s{%s} %llu\n", gauge_info[g].name, gauge_info[g].labels,
+                   (unsigned long long)load(gauges[g]));
+        } else {
+            append(out, "%s %llu\n", gauge_info[g].name, (unsigned long long)load(gauges[g]));
+        }
+    }
+}
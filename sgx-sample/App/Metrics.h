@@ -0,0 +1,86 @@
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <stdint.h>
+#include <string>
+
+#include "sgx_error.h"
+
+/* Request paths tracked by app_http_requests_total */
+enum metric_path_t {
+    METRIC_PATH_ORDER = 0,
+    METRIC_PATH_TRADES,
+    METRIC_PATH_STATS,
+    METRIC_PATH_METRICS,
+    METRIC_PATH_CLEAR,
+    METRIC_PATH_PROFILE,
+    METRIC_PATH_READY,
+    METRIC_PATH_MEMORY,
+    METRIC_PATH_SETTLEMENT,
+    METRIC_PATH_DEPOSIT,
+    METRIC_PATH_ACCOUNT,
+    METRIC_PATH_REPLICA,
+    METRIC_PATH_PROMOTE,
+    METRIC_PATH_PROOF,
+    METRIC_PATH_SIGNING_KEY,
+    METRIC_PATH_ORDER_SESSION,
+    METRIC_PATH_ORDER_ENVELOPES,
+    METRIC_PATH_CLOSE_SESSION,
+    METRIC_PATH_SETTLEMENT_ACK,
+    METRIC_PATH_OTHER,
+    METRIC_PATH_COUNT
+};
+
+/* Point-in-time values, set as they change or right before each scrape */
+enum metric_gauge_t {
+    METRIC_GAUGE_OPEN_ORDERS_BUY = 0,
+    METRIC_GAUGE_OPEN_ORDERS_SELL,
+    METRIC_GAUGE_PRICE_LEVELS_BUY,
+    METRIC_GAUGE_PRICE_LEVELS_SELL,
+    METRIC_GAUGE_TRADES,
+    METRIC_GAUGE_ENCLAVE_HEAP_BYTES,
+    METRIC_GAUGE_ENCLAVE_HEAP_BUDGET_BYTES,
+    METRIC_GAUGE_ENCLAVE_HEAP_HIGH_WATER_BYTES,
+    METRIC_GAUGE_ENCLAVE_HEAP_ALLOCATIONS,
+    /* One per structure of memory_stats_t, in its order */
+    METRIC_GAUGE_MEMORY_ENTRIES_RESTING_ORDERS,
+    METRIC_GAUGE_MEMORY_ENTRIES_OPEN_ORDER_RECORDS,
+    METRIC_GAUGE_MEMORY_ENTRIES_TERMINAL_ORDER_RECORDS,
+    METRIC_GAUGE_MEMORY_ENTRIES_TRADES,
+    METRIC_GAUGE_MEMORY_ENTRIES_USER_INDEX,
+    METRIC_GAUGE_MEMORY_ENTRIES_ACCOUNTS,
+    METRIC_GAUGE_MEMORY_ENTRIES_CLIENT_KEYS,
+    METRIC_GAUGE_MEMORY_ENTRIES_BATCH_COMMITMENTS,
+    METRIC_GAUGE_MEMORY_ENTRIES_ORDER_TIMERS,
+    METRIC_GAUGE_MEMORY_BYTES_RESTING_ORDERS,
+    METRIC_GAUGE_MEMORY_BYTES_OPEN_ORDER_RECORDS,
+    METRIC_GAUGE_MEMORY_BYTES_TERMINAL_ORDER_RECORDS,
+    METRIC_GAUGE_MEMORY_BYTES_TRADES,
+    METRIC_GAUGE_MEMORY_BYTES_USER_INDEX,
+    METRIC_GAUGE_MEMORY_BYTES_ACCOUNTS,
+    METRIC_GAUGE_MEMORY_BYTES_CLIENT_KEYS,
+    METRIC_GAUGE_MEMORY_BYTES_BATCH_COMMITMENTS,
+    METRIC_GAUGE_MEMORY_BYTES_ORDER_TIMERS,
+    METRIC_GAUGE_LISTEN_QUEUE_DEPTH,
+    METRIC_GAUGE_LISTEN_BACKLOG,
+    METRIC_GAUGE_OPEN_CONNECTIONS,
+    METRIC_GAUGE_WORKER_QUEUE_DEPTH,
+    METRIC_GAUGE_QUEUE_DELAY_P99_US_QUERY,
+    METRIC_GAUGE_QUEUE_DELAY_P99_US_ORDER,
+    METRIC_GAUGE_ORDER_RING_DEPTH,
+    METRIC_GAUGE_REPLICA_LAG,
+    METRIC_GAUGE_COUNT
+};
+
+int metrics_path_index(const char* path, size_t length);
+
+/* Hot path updates: lock-free, one cache line per counter */
+void metrics_record_request(int path, int status_code);
+void metrics_record_ecall(int ecall, sgx_status_t status, uint64_t duration_ns);
+
+void metrics_set_gauge(int gauge, uint64_t value);
+
+/* Render every series in the Prometheus text exposition format */
+void metrics_format(std::string& out);
+
+#endif /* !_METRICS_H_ */
@@ -0,0 +1,318 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <atomic>
+#include <thread>
+
+#include "App.h"
+#include "OrderEntryServer.h"
+
+// ============================
+// Binary order-entry server
+// ============================
+//
+// Latency-sensitive clients keep one long-lived session each, so every
+// session gets a dedicated thread that blocks in recv(), frames the messages
+// in place and issues the ECALL itself: there is no event loop or worker
+// hand-off between the socket read and the enclave. Replies to everything
+// that arrived in one read go out with a single send(). The session count is
+// small and fixed at startup, since each thread occupies a TCS while inside
+// the enclave.
+
+#define SOCKET_TIMEOUT_MS 1000
+#define SEND_TIMEOUT_MS 5000
+
+struct session_slot_t {
+    order_entry_session_t session;
+    std::thread thread;
+    std::atomic<bool> active;
+};
+
+static order_entry_config_t server_config;
+static session_slot_t* slots = NULL;
+static std::thread listener;
+static int listen_socket = -1;
+
+void order_entry_default_config(order_entry_config_t* config)
+{
+    config->port = DEFAULT_ORDER_ENTRY_PORT;
+    config->max_sessions = DEFAULT_ORDER_ENTRY_SESSIONS;
+    config->handler = NULL;
+}
+
+static void set_timeout(int fd, int option, int timeout_ms)
+{
+    struct timeval timeout;
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_usec = (timeout_ms % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, option, &timeout, sizeof(timeout));
+}
+
+// Send the queued replies; a failed send ends the session
+static bool flush_replies(order_entry_session_t* session)
+{
+    size_t sent = 0;
+    while (sent < session->out_length) {
+        ssize_t written = send(session->fd, session->out + sent, session->out_length - sent, MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            session->broken = true;
+            break;
+        }
+        sent += (size_t)written;
+    }
+    session->out_length = 0;
+    return !session->broken;
+}
+
+void order_entry_reply(order_entry_session_t* session, oe_header_t* message, uint8_t type, size_t length)
+{
+    if (session->out_length + length > sizeof(session->out) && !flush_replies(session)) {
+        return;
+    }
+    message->length = (uint16_t)length;
+    message->type = type;
+    message->reserved = 0;
+    message->seq = session->next_out_seq++;
+    memcpy(session->out + session->out_length, message, length);
+    session->out_length += length;
+}
+
+void order_entry_reject(order_entry_session_t* session, uint32_t ref_seq, uint64_t client_order_id,
+                        uint16_t reason)
+{
+    oe_reject_t reject;
+    memset(&reject, 0, sizeof(reject));
+    reject.client_order_id = client_order_id;
+    reject.ref_seq = ref_seq;
+    reject.reason = reason;
+    order_entry_reply(session, &reject.header, OE_REJECT, sizeof(reject));
+}
+
+static size_t message_size(uint8_t type)
+{
+    switch (type) {
+    case OE_LOGON: return sizeof(oe_logon_t);
+    case OE_NEW_ORDER: return sizeof(oe_new_order_t);
+    case OE_CANCEL: return sizeof(oe_cancel_t);
+    default: return 0;
+    }
+}
+
+static void logon(order_entry_session_t* session, const oe_logon_t* message)
+{
+    const char* address = message->user_address;
+    if (session->user_address[0] != '\0' || address[0] == '\0' ||
+        memchr(address, '\0', sizeof(message->user_address)) == NULL) {
+        order_entry_reject(session, message->header.seq, 0, OE_REJECT_INVALID_MESSAGE);
+        return;
+    }
+    strcpy(session->user_address, address);
+    printf("[DEBUG] Order entry session logged on for %s\n", session->user_address);
+
+    oe_logon_ack_t ack;
+    memset(&ack, 0, sizeof(ack));
+    ack.expected_seq = session->next_in_seq;
+    order_entry_reply(session, &ack.header, OE_LOGON_ACK, sizeof(ack));
+}
+
+// Handle one complete message; returns false when the session must end
+static bool process_message(order_entry_session_t* session, const oe_header_t* message)
+{
+    if (message->seq != session->next_in_seq) {
+        order_entry_reject(session, message->seq, 0, OE_REJECT_SEQUENCE_GAP);
+        return false;
+    }
+    session->next_in_seq++;
+
+    // A wrong length means the framing can no longer be trusted
+    if (message->length != message_size(message->type)) {
+        order_entry_reject(session, message->seq, 0, OE_REJECT_INVALID_MESSAGE);
+        return false;
+    }
+
+    if (message->type == OE_LOGON) {
+        logon(session, (const oe_logon_t*)message);
+    } else if (session->user_address[0] == '\0') {
+        order_entry_reject(session, message->seq, 0, OE_REJECT_NOT_LOGGED_ON);
+    } else {
+        server_config.handler(session, message);
+    }
+    return !session->broken;
+}
+
+static void run_session(session_slot_t* slot)
+{
+    order_entry_session_t* session = &slot->session;
+    // 8-byte aligned, and every message size is a multiple of 8, so each
+    // message can be used in place
+    uint64_t in_words[ORDER_ENTRY_BUFFER_SIZE / sizeof(uint64_t)];
+    char* in = (char*)in_words;
+    size_t length = 0;
+    bool open = true;
+
+    while (open && keep_running) {
+        ssize_t received = recv(session->fd, in + length, sizeof(in_words) - length, 0);
+        if (received < 0) {
+            // The receive timeout only serves to notice shutdown
+            if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) {
+                continue;
+            }
+            break;
+        }
+        if (received == 0) {
+            break;
+        }
+        length += (size_t)received;
+
+        size_t offset = 0;
+        while (open && length - offset >= sizeof(oe_header_t)) {
+            const oe_header_t* message = (const oe_header_t*)(in + offset);
+            if (message->length < sizeof(oe_header_t) || message->length > ORDER_ENTRY_MAX_MESSAGE) {
+                order_entry_reject(session, message->seq, 0, OE_REJECT_INVALID_MESSAGE);
+                open = false;
+                break;
+            }
+            if (length - offset < message->length) {
+                break;
+            }
+            open = process_message(session, message);
+            offset += message->length;
+        }
+
+        open = flush_replies(session) && open;
+        memmove(in, in + offset, length - offset);
+        length -= offset;
+    }
+
+    printf("[DEBUG] Order entry session closed%s%s\n", session->user_address[0] ? " for " : "",
+           session->user_address);
+    close(session->fd);
+    slot->active.store(false);
+}
+
+static void start_session(int fd)
+{
+    session_slot_t* slot = NULL;
+    for (int i = 0; i < server_config.max_sessions && slot == NULL; i++) {
+        if (!slots[i].active.load()) {
+            slot = &slots[i];
+        }
+    }
+    if (slot == NULL) {
+        printf("[ERROR] Order entry session limit (%d) reached, refusing connection\n",
+               server_config.max_sessions);
+        close(fd);
+        return;
+    }
+    if (slot->thread.joinable()) {
+        slot->thread.join();
+    }
+
+    int opt = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    set_timeout(fd, SO_RCVTIMEO, SOCKET_TIMEOUT_MS);
+    set_timeout(fd, SO_SNDTIMEO, SEND_TIMEOUT_MS);
+
+    order_entry_session_t* session = &slot->session;
+    session->fd = fd;
+    session->user_address[0] = '\0';
+    session->next_in_seq = 1;
+    session->next_out_seq = 1;
+    session->broken = false;
+    session->out_length = 0;
+    slot->active.store(true);
+    slot->thread = std::thread(run_session, slot);
+}
+
+static void run_listener(void)
+{
+    struct pollfd listen_poll;
+    listen_poll.fd = listen_socket;
+    listen_poll.events = POLLIN;
+
+    while (keep_running) {
+        int ready = poll(&listen_poll, 1, SOCKET_TIMEOUT_MS);
+        if (ready <= 0) {
+            continue;
+        }
+        int fd = accept4(listen_socket, NULL, NULL, SOCK_CLOEXEC);
+        if (fd >= 0) {
+            start_session(fd);
+        } else if (errno != EINTR && errno != EAGAIN && errno != ECONNABORTED) {
+            perror("Order entry accept failed");
+        }
+    }
+
+    for (int i = 0; i < server_config.max_sessions; i++) {
+        if (slots[i].thread.joinable()) {
+            slots[i].thread.join();
+        }
+    }
+}
+
+int order_entry_server_start(const order_entry_config_t* config)
+{
+    server_config = *config;
+    if (server_config.port == 0) {
+        return 0;
+    }
+    if (server_config.handler == NULL || server_config.max_sessions < 1) {
+        printf("[ERROR] Invalid order entry server configuration\n");
+        return -1;
+    }
+
+    listen_socket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_socket < 0) {
+        perror("Order entry socket creation failed");
+        return -1;
+    }
+
+    int opt = 1;
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons((uint16_t)server_config.port);
+
+    if (setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) ||
+        bind(listen_socket, (struct sockaddr*)&address, sizeof(address)) < 0 ||
+        listen(listen_socket, server_config.max_sessions) < 0) {
+        perror("Order entry listen failed");
+        close(listen_socket);
+        listen_socket = -1;
+        return -1;
+    }
+
+    slots = new session_slot_t[server_config.max_sessions];
+    for (int i = 0; i < server_config.max_sessions; i++) {
+        slots[i].active.store(false);
+    }
+    listener = std::thread(run_listener);
+
+    printf("Order entry server started on port %d (%d sessions)\n",
+           server_config.port, server_config.max_sessions);
+    return 0;
+}
+
+// Called after keep_running is cleared; sessions notice within SOCKET_TIMEOUT_MS
+void order_entry_server_stop(void)
+{
+    if (!listener.joinable()) {
+        return;
+    }
+    listener.join();
+    close(listen_socket);
+    listen_socket = -1;
+    delete[] slots;
+    slots = NULL;
+}
@@ -0,0 +1,51 @@
+#ifndef _ORDER_ENTRY_SERVER_H_
+#define _ORDER_ENTRY_SERVER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "order_entry.h"
+
+#define DEFAULT_ORDER_ENTRY_PORT 9001
+#define DEFAULT_ORDER_ENTRY_SESSIONS 2
+#define ORDER_ENTRY_BUFFER_SIZE 8192
+
+/*
+ * One client session. Each session has its own thread, which issues the
+ * ECALLs itself, so HTTP workers plus sessions must stay below TCSNum.
+ */
+typedef struct _order_entry_session_t {
+    int fd;
+    char user_address[ORDER_ENTRY_USER_SIZE];   /* Empty until logged on */
+    uint32_t next_in_seq;
+    uint32_t next_out_seq;
+    bool broken;                                /* A send failed; the session ends */
+    size_t out_length;
+    char out[ORDER_ENTRY_BUFFER_SIZE];          /* Replies to the current batch of messages */
+} order_entry_session_t;
+
+/*
+ * Called on the session thread for each in-sequence OE_NEW_ORDER or
+ * OE_CANCEL of a logged-on session. message->length has been checked
+ * against the type; replies go out through order_entry_reply.
+ */
+typedef void (*order_entry_handler_t)(order_entry_session_t* session, const oe_header_t* message);
+
+typedef struct _order_entry_config_t {
+    int port;                       /* 0 disables the listener */
+    int max_sessions;
+    order_entry_handler_t handler;
+} order_entry_config_t;
+
+void order_entry_default_config(order_entry_config_t* config);
+
+/* Start the listener thread; sessions end when keep_running is cleared */
+int order_entry_server_start(const order_entry_config_t* config);
+void order_entry_server_stop(void);
+
+/* Queue a reply: fills in its header, which must be the start of a message of length bytes */
+void order_entry_reply(order_entry_session_t* session, oe_header_t* message, uint8_t type, size_t length);
+void order_entry_reject(order_entry_session_t* session, uint32_t ref_seq, uint64_t client_order_id,
+                        uint16_t reason);
+
+#endif /* !_ORDER_ENTRY_SERVER_H_ */
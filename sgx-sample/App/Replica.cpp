@@ -0,0 +1,270 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include "sgx_urts.h"
+#include "App.h"
+#include "Enclave_u.h"
+#include "MatchingThread.h"
+#include "Replica.h"
+#include "replica_journal.h"
+
+// ============================
+// Hot-standby replica
+// ============================
+//
+// The primary enclave appends every input that changed a book to the
+// shared journal (see replica_journal.h); the feeder thread copies new
+// entries out and applies them to the standby, which checks its state hash
+// after each one. Promotion needs no fencing inside either enclave: every
+// ECALL that changes a book goes through replica_enter, so once the ones
+// in progress are done the journal holds every input the primary applied,
+// and the standby is caught up when it has applied them all.
+
+// Entries handed to the standby per ECALL
+#define REPLICA_FEED_BATCH 256
+
+// Idle pause of the feeder, in microseconds
+#define REPLICA_FEED_POLL_US 200
+
+static replica_journal_t* journal = NULL;
+static sgx_enclave_id_t standby_eid = 0;
+static sgx_enclave_id_t retired_eid = 0;
+
+static std::thread feeder;
+static std::atomic<bool> feeding(false);
+
+// One feed pass at a time, the feeder's or a promotion's; also guards what follows
+static std::mutex feed_mutex;
+static replica_status_t positions[MARKET_COUNT];
+static int failure = REPLICA_OK;
+static bool overflowed = false;
+static replica_input_t batch[REPLICA_FEED_BATCH];
+
+// ECALLs that change a book in progress, and the promotion holding new ones back
+static std::atomic<bool> guarding(false);
+static std::atomic<int> in_flight(0);
+static std::atomic<bool> fenced(false);
+
+// Apply what the primary journaled since the last pass; false when there
+// was nothing new or the standby cannot follow any more. Caller holds feed_mutex.
+static bool feed_pass(void)
+{
+    bool fed = false;
+    for (int market = 0; market < MARKET_COUNT && failure == REPLICA_OK && !overflowed; market++) {
+        replica_journal_queue_t* queue = &journal->queues[market];
+        uint64_t head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+        uint64_t tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+        if (tail == head) {
+            // Entries published before the queue overflowed were applied by now
+            if (__atomic_load_n(&queue->overflowed, __ATOMIC_ACQUIRE)) {
+                printf("[ERROR] Replica journal of market %d overflowed; the standby stopped following\n", market);
+                overflowed = true;
+            }
+            continue;
+        }
+
+        size_t count = tail - head < REPLICA_FEED_BATCH ? (size_t)(tail - head) : REPLICA_FEED_BATCH;
+        for (size_t i = 0; i < count; i++) {
+            memcpy(&batch[i], &queue->inputs[(head + i) & (REPLICA_JOURNAL_SIZE - 1)], sizeof(batch[i]));
+        }
+        int result = REPLICA_OK;
+        sgx_status_t status = ecall_apply_inputs(standby_eid, &result, market, batch, count, &positions[market]);
+        if (status != SGX_SUCCESS) {
+            printf("[ERROR] Standby failed to apply inputs of market %d. Error code: %d\n", market, status);
+            failure = -1;
+        } else if (result != REPLICA_OK) {
+            printf("[ERROR] Standby stopped at input %llu of market %d (result %d)\n",
+                   (unsigned long long)(positions[market].applied_seq + 1), market, result);
+            failure = result;
+        } else {
+            __atomic_store_n(&queue->head, head + count, __ATOMIC_RELEASE);
+            fed = true;
+        }
+    }
+    return fed;
+}
+
+static void run_feeder(void)
+{
+    while (feeding.load()) {
+        bool fed;
+        bool following;
+        {
+            std::lock_guard<std::mutex> lock(feed_mutex);
+            fed = feed_pass();
+            following = failure == REPLICA_OK && !overflowed;
+        }
+        if (!following) {
+            return;
+        }
+        if (!fed) {
+            usleep(REPLICA_FEED_POLL_US);
+        }
+    }
+}
+
+int replica_start(bool ledger, const double* price_ticks)
+{
+    void* memory = NULL;
+    if (posix_memalign(&memory, REPLICA_JOURNAL_CACHE_LINE, sizeof(replica_journal_t)) != 0) {
+        printf("[ERROR] Failed to allocate the replica journal\n");
+        return -1;
+    }
+    journal = (replica_journal_t*)memory;
+    memset(journal, 0, sizeof(*journal));
+
+    sgx_status_t status = sgx_create_enclave(ENCLAVE_FILENAME, SGX_DEBUG_FLAG, NULL, NULL, &standby_eid, NULL);
+    if (status == SGX_SUCCESS && ledger) {
+        status = ecall_enable_ledger(standby_eid);
+    }
+    if (status != SGX_SUCCESS || set_price_ticks(standby_eid, price_ticks) < 0) {
+        printf("[ERROR] Failed to create the standby enclave. Error code: %d\n", status);
+        if (standby_eid != 0) {
+            sgx_destroy_enclave(standby_eid);
+            standby_eid = 0;
+        }
+        free(journal);
+        journal = NULL;
+        return -1;
+    }
+
+    status = ecall_attach_journal(global_eid, journal);
+    if (status != SGX_SUCCESS) {
+        printf("[ERROR] Failed to attach the replica journal. Error code: %d\n", status);
+        sgx_destroy_enclave(standby_eid);
+        standby_eid = 0;
+        free(journal);
+        journal = NULL;
+        return -1;
+    }
+
+    guarding.store(true);
+    feeding.store(true);
+    feeder = std::thread(run_feeder);
+    printf("Standby enclave following the primary (%d-input journal per market)\n", REPLICA_JOURNAL_SIZE);
+    return 0;
+}
+
+void replica_stop(void)
+{
+    feeding.store(false);
+    if (feeder.joinable()) {
+        feeder.join();
+    }
+    if (standby_eid != 0) {
+        sgx_destroy_enclave(standby_eid);
+        standby_eid = 0;
+    }
+    if (retired_eid != 0) {
+        sgx_destroy_enclave(retired_eid);
+        retired_eid = 0;
+    }
+    // The primary writes to the journal until it is destroyed
+    free(journal);
+    journal = NULL;
+}
+
+void replica_enter(void)
+{
+    if (!guarding.load(std::memory_order_relaxed)) {
+        return;
+    }
+    for (;;) {
+        // Pairs with replica_promote raising the fence before it counts what is in flight
+        in_flight.fetch_add(1);
+        if (!fenced.load()) {
+            return;
+        }
+        in_flight.fetch_sub(1);
+        while (fenced.load()) {
+            usleep(REPLICA_FEED_POLL_US);
+        }
+    }
+}
+
+void replica_exit(void)
+{
+    if (guarding.load(std::memory_order_relaxed)) {
+        in_flight.fetch_sub(1);
+    }
+}
+
+int replica_promote(void)
+{
+    // One promotion at a time; a second one finds no standby left
+    static std::mutex promote_mutex;
+    std::lock_guard<std::mutex> promoting(promote_mutex);
+    if (standby_eid == 0) {
+        return -1;
+    }
+
+    fenced.store(true);
+    while (in_flight.load() != 0) {
+        sched_yield();
+    }
+
+    // Every input the primary applied is in the journal now
+    feeding.store(false);
+    if (feeder.joinable()) {
+        feeder.join();
+    }
+    std::unique_lock<std::mutex> lock(feed_mutex);
+    while (feed_pass()) {
+    }
+    if (failure != REPLICA_OK || overflowed) {
+        lock.unlock();
+        fenced.store(false);
+        printf("[ERROR] Standby is not able to take over; the primary keeps serving\n");
+        return -1;
+    }
+
+    // ECALLs already past the swap finish in the old enclave; only reads
+    // can still be running there, so it is kept until shutdown
+    sgx_enclave_id_t previous = global_eid;
+    __atomic_store_n(&global_eid, standby_eid, __ATOMIC_SEQ_CST);
+    retired_eid = previous;
+    standby_eid = 0;
+    lock.unlock();
+
+    matching_thread_restart(previous);
+    fenced.store(false);
+    printf("Standby enclave promoted to primary\n");
+    return 0;
+}
+
+void replica_report(replica_report_t* report)
+{
+    memset(report, 0, sizeof(*report));
+    std::lock_guard<std::mutex> lock(feed_mutex);
+    report->standby = standby_eid != 0;
+    report->result = failure;
+    report->overflowed = overflowed;
+    if (journal == NULL) {
+        return;
+    }
+    for (int market = 0; market < MARKET_COUNT; market++) {
+        report->journaled[market] = __atomic_load_n(&journal->queues[market].tail, __ATOMIC_ACQUIRE);
+        report->applied[market] = positions[market];
+    }
+}
+
+uint64_t replica_lag(void)
+{
+    if (journal == NULL) {
+        return 0;
+    }
+    uint64_t lag = 0;
+    for (int market = 0; market < MARKET_COUNT; market++) {
+        uint64_t tail = __atomic_load_n(&journal->queues[market].tail, __ATOMIC_RELAXED);
+        uint64_t head = __atomic_load_n(&journal->queues[market].head, __ATOMIC_RELAXED);
+        lag += tail > head ? tail - head : 0;
+    }
+    return lag;
+}
@@ -0,0 +1,59 @@
+#ifndef _REPLICA_H_
+#define _REPLICA_H_
+
+#include <stdint.h>
+
+#include "user_types.h"
+
+/*
+ * Create the standby enclave, attach the input journal to the primary in
+ * global_eid and start the thread that feeds the journal to the standby.
+ * Called before any order arrives; ledger and price_ticks mirror --ledger
+ * and --price-tick. The standby
+ * is a second enclave, so it needs as much EPC as the primary.
+ */
+int replica_start(bool ledger, const double* price_ticks);
+
+/* Called once the primary is destroyed: destroys the standby and any primary it replaced */
+void replica_stop(void);
+
+/*
+ * Bracket every ECALL that changes a book, so a promotion can wait for
+ * the ones in progress and hold back new ones. Nothing to do without a
+ * standby. Use ReplicaGuard.
+ */
+void replica_enter(void);
+void replica_exit(void);
+
+class ReplicaGuard {
+public:
+    ReplicaGuard() { replica_enter(); }
+    ~ReplicaGuard() { replica_exit(); }
+
+private:
+    ReplicaGuard(const ReplicaGuard&);
+    ReplicaGuard& operator=(const ReplicaGuard&);
+};
+
+/*
+ * Hand the books over to the standby: hold back new inputs, wait for
+ * those in progress, apply what is left of the journal and point
+ * global_eid (and the matching threads) at the standby. Returns -1 and
+ * leaves the primary serving if there is no standby able to take over.
+ */
+int replica_promote(void);
+
+typedef struct _replica_report_t {
+    int standby;                                /* 1 while a standby follows the primary */
+    int result;                                 /* REPLICA_OK, what stopped the standby, or -1 for a failed ECALL */
+    int overflowed;                             /* A journal queue filled up before the standby caught up */
+    uint64_t journaled[MARKET_COUNT];           /* Inputs the primary journaled */
+    replica_status_t applied[MARKET_COUNT];     /* The standby's position */
+} replica_report_t;
+
+void replica_report(replica_report_t* report);
+
+/* Inputs journaled and not yet applied by the standby, over every market */
+uint64_t replica_lag(void);
+
+#endif /* !_REPLICA_H_ */
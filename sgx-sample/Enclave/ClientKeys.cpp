@@ -0,0 +1,53 @@
+#include "ClientKeys.h"
+#include "Memory.h"
+
+// ============================
+// Client key window
+// ============================
+
+// Next pointer and cached hash of an unordered container node
+#define HASH_NODE_OVERHEAD (2 * sizeof(void*))
+
+const std::string* ClientKeyWindow::find(const std::string& key) const
+{
+    std::unordered_map<std::string, std::string>::const_iterator entry = ids.find(key);
+    return entry == ids.end() ? NULL : &entry->second;
+}
+
+std::string* ClientKeyWindow::claim(const std::string& key)
+{
+    std::unordered_map<std::string, std::string>::iterator entry =
+        ids.insert(std::make_pair(key, std::string())).first;
+    try {
+        arrival.push_back(&entry->first);
+    } catch (...) {
+        ids.erase(entry);
+        throw;
+    }
+    // Only once the new key is in, so a failed claim forgets nothing
+    if (arrival.size() > CLIENT_KEY_WINDOW) {
+        ids.erase(ids.find(*arrival.front()));
+        arrival.pop_front();
+    }
+    return &entry->second;
+}
+
+void ClientKeyWindow::forget(const std::string& key)
+{
+    if (arrival.empty() || *arrival.back() != key) {
+        return;
+    }
+    arrival.pop_back();
+    ids.erase(key);
+}
+
+void ClientKeyWindow::measure(memory_usage_t* usage) const
+{
+    usage->count += ids.size();
+    usage->bytes += ids.bucket_count() * sizeof(void*) + arrival.size() * sizeof(const std::string*);
+    for (std::unordered_map<std::string, std::string>::const_iterator entry = ids.begin();
+         entry != ids.end(); ++entry) {
+        usage->bytes += HASH_NODE_OVERHEAD + sizeof(*entry) + string_heap_bytes(entry->first) +
+                        string_heap_bytes(entry->second);
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef _ENCLAVE_CLIENT_KEYS_H_
+#define _ENCLAVE_CLIENT_KEYS_H_
+
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include "user_types.h"
+
+// Client keys remembered per market
+#define CLIENT_KEY_WINDOW 16384
+
+/*
+ * Client keys of the orders a market accepted most recently
+ *
+ * A submitter that cannot tell whether an order got in, after a timeout or
+ * a replayed chain event, sends it again under the same key and gets the
+ * original order ID back instead of a second order. Keys are kept for the
+ * last CLIENT_KEY_WINDOW orders that carried one, oldest forgotten first, so
+ * the window bounds the memory and only a replay older than that is taken
+ * for a new order. Used with the book lock held.
+ */
+class ClientKeyWindow {
+public:
+    // The order ID accepted under key, or NULL
+    const std::string* find(const std::string& key) const;
+
+    // Remember key for an order about to be added, forgetting the oldest
+    // key if the window is full; the order's ID goes into the string
+    // returned. Throws std::bad_alloc and then remembers nothing new.
+    std::string* claim(const std::string& key);
+
+    // Take back the claim just made, when its order was not added
+    void forget(const std::string& key);
+
+    // Add the window's heap use to usage
+    void measure(memory_usage_t* usage) const;
+
+private:
+    // Key to order ID; nodes never move, so the window can point at their keys
+    std::unordered_map<std::string, std::string> ids;
+    std::deque<const std::string*> arrival;
+};
+
+#endif /* !_ENCLAVE_CLIENT_KEYS_H_ */
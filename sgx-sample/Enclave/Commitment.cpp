@@ -0,0 +1,221 @@
+#include "Commitment.h"
+#include "OrderBook.h"
+#include "TradeLog.h"
+#include "sgx_thread.h"
+#include <string.h>
+
+// ============================
+// Batch commitments
+// ============================
+
+#define LEAF_PREFIX 0
+#define NODE_PREFIX 1
+
+// Bytes of the signed commitment: market, four counters, root and digest
+#define COMMITMENT_MESSAGE_SIZE (4 + 4 * 8 + 2 * SETTLEMENT_DIGEST_SIZE)
+
+void hash_integer(sgx_sha_state_handle_t sha, uint64_t value, size_t bytes)
+{
+    uint8_t encoded[8];
+    for (size_t i = 0; i < bytes; i++) {
+        encoded[i] = (uint8_t)(value >> (8 * i));
+    }
+    sgx_sha256_update(encoded, (uint32_t)bytes, sha);
+}
+
+static void hash_string(sgx_sha_state_handle_t sha, const std::string& value)
+{
+    hash_integer(sha, (uint32_t)value.length(), 4);
+    sgx_sha256_update((const uint8_t*)value.data(), (uint32_t)value.length(), sha);
+}
+
+static bool hash_leaf(const Trade& trade, uint8_t* leaf)
+{
+    sgx_sha_state_handle_t sha = NULL;
+    if (sgx_sha256_init(&sha) != SGX_SUCCESS) {
+        return false;
+    }
+    uint64_t price_bits;
+    uint64_t quantity_bits;
+    memcpy(&price_bits, &trade.price, sizeof(price_bits));
+    memcpy(&quantity_bits, &trade.quantity, sizeof(quantity_bits));
+    hash_integer(sha, LEAF_PREFIX, 1);
+    hash_integer(sha, trade.seq, 8);
+    hash_string(sha, trade.id);
+    hash_string(sha, trade.maker_address);
+    hash_string(sha, trade.taker_address);
+    hash_integer(sha, (uint32_t)trade.taker_side, 4);
+    hash_integer(sha, price_bits, 8);
+    hash_integer(sha, quantity_bits, 8);
+    hash_integer(sha, (uint64_t)trade.timestamp, 8);
+    bool hashed = sgx_sha256_get_hash(sha, (sgx_sha256_hash_t*)leaf) == SGX_SUCCESS;
+    sgx_sha256_close(sha);
+    return hashed;
+}
+
+static bool hash_node(const uint8_t* left, const uint8_t* right, uint8_t* node)
+{
+    uint8_t children[1 + 2 * SETTLEMENT_DIGEST_SIZE];
+    children[0] = NODE_PREFIX;
+    memcpy(children + 1, left, SETTLEMENT_DIGEST_SIZE);
+    memcpy(children + 1 + SETTLEMENT_DIGEST_SIZE, right, SETTLEMENT_DIGEST_SIZE);
+    return sgx_sha256_msg(children, sizeof(children), (sgx_sha256_hash_t*)node) == SGX_SUCCESS;
+}
+
+// Root of a tree fed one leaf at a time. Like a binary counter, it holds a
+// full subtree per set bit of the leaf count, and closing folds them from
+// the smallest up, which gives the left-heavy shape of trade_proof_t.
+class MerkleStream {
+public:
+    MerkleStream() : count(0) {}
+
+    bool add(const uint8_t* leaf) {
+        uint8_t carry[SETTLEMENT_DIGEST_SIZE];
+        memcpy(carry, leaf, sizeof(carry));
+        int level = 0;
+        for (; count & (1ULL << level); level++) {
+            if (!hash_node(subtrees[level], carry, carry)) {
+                return false;
+            }
+        }
+        memcpy(subtrees[level], carry, sizeof(carry));
+        count++;
+        return true;
+    }
+
+    bool close(uint8_t* root) const {
+        int level = __builtin_ctzll(count);
+        memcpy(root, subtrees[level], SETTLEMENT_DIGEST_SIZE);
+        for (level++; level < 64 && (count >> level) != 0; level++) {
+            if ((count & (1ULL << level)) && !hash_node(subtrees[level], root, root)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    uint64_t count;
+    uint8_t subtrees[64][SETTLEMENT_DIGEST_SIZE];
+};
+
+bool merkle_root(const TradeLog& trades, size_t first, size_t end, uint8_t* root)
+{
+    MerkleStream stream;
+    uint8_t leaf[SETTLEMENT_DIGEST_SIZE];
+    for (size_t i = first; i < end; i++) {
+        if (!hash_leaf(trades[i], leaf) || !stream.add(leaf)) {
+            return false;
+        }
+    }
+    return stream.close(root);
+}
+
+// Path of index within [first, end), deepest sibling first; every sibling
+// is the root of the part of the range the path does not enter
+static bool prove_range(const TradeLog& trades, size_t first, size_t end, size_t index, trade_proof_t* proof)
+{
+    size_t count = end - first;
+    if (count == 1) {
+        return true;
+    }
+    size_t split = 1;
+    while (split * 2 < count) {
+        split *= 2;
+    }
+    bool left = index < first + split;
+    bool proved = left ? prove_range(trades, first, first + split, index, proof)
+                       : prove_range(trades, first + split, end, index, proof);
+    if (!proved || proof->path_length >= MERKLE_MAX_DEPTH) {
+        return false;
+    }
+    uint32_t step = proof->path_length++;
+    proof->path_left[step] = left ? 0 : 1;
+    return left ? merkle_root(trades, first + split, end, proof->path[step])
+                : merkle_root(trades, first, first + split, proof->path[step]);
+}
+
+bool merkle_prove(const TradeLog& trades, size_t first, size_t end, size_t index, trade_proof_t* proof)
+{
+    proof->leaf_index = index - first;
+    proof->path_length = 0;
+    return hash_leaf(trades[index], proof->leaf) && prove_range(trades, first, end, index, proof);
+}
+
+// The signing key, made on first use; signing is serialized, as an ECC
+// context is not meant for several threads at once
+static sgx_thread_mutex_t signer_mutex = SGX_THREAD_MUTEX_INITIALIZER;
+static sgx_ecc_state_handle_t signer = NULL;
+static sgx_ec256_private_t private_key;
+static sgx_ec256_public_t public_key;
+
+static bool signer_ready_locked()
+{
+    if (signer != NULL) {
+        return true;
+    }
+    sgx_ecc_state_handle_t context = NULL;
+    if (sgx_ecc256_open_context(&context) != SGX_SUCCESS) {
+        return false;
+    }
+    if (sgx_ecc256_create_key_pair(&private_key, &public_key, context) != SGX_SUCCESS) {
+        sgx_ecc256_close_context(context);
+        return false;
+    }
+    signer = context;
+    return true;
+}
+
+// The SDK keeps key and signature coordinates little-endian
+static void copy_reversed(uint8_t* out, const uint8_t* in, size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        out[i] = in[size - 1 - i];
+    }
+}
+
+static void put_integer(uint8_t** out, uint64_t value, size_t bytes)
+{
+    for (size_t i = 0; i < bytes; i++) {
+        (*out)[i] = (uint8_t)(value >> (8 * i));
+    }
+    *out += bytes;
+}
+
+bool sign_batch(settlement_batch_t* batch)
+{
+    uint8_t message[COMMITMENT_MESSAGE_SIZE];
+    uint8_t* out = message;
+    put_integer(&out, (uint32_t)batch->market, 4);
+    put_integer(&out, batch->number, 8);
+    put_integer(&out, batch->first_seq, 8);
+    put_integer(&out, batch->last_seq, 8);
+    put_integer(&out, batch->trade_count, 8);
+    memcpy(out, batch->merkle_root, SETTLEMENT_DIGEST_SIZE);
+    memcpy(out + SETTLEMENT_DIGEST_SIZE, batch->digest, SETTLEMENT_DIGEST_SIZE);
+
+    sgx_ec256_signature_t signature;
+    sgx_thread_mutex_lock(&signer_mutex);
+    bool signed_batch = signer_ready_locked() &&
+                        sgx_ecdsa_sign(message, sizeof(message), &private_key, &signature, signer) == SGX_SUCCESS;
+    sgx_thread_mutex_unlock(&signer_mutex);
+    if (!signed_batch) {
+        return false;
+    }
+    copy_reversed(batch->signature, (const uint8_t*)signature.x, COMMITMENT_SIGNATURE_SIZE / 2);
+    copy_reversed(batch->signature + COMMITMENT_SIGNATURE_SIZE / 2, (const uint8_t*)signature.y,
+                  COMMITMENT_SIGNATURE_SIZE / 2);
+    return true;
+}
+
+bool signing_key(uint8_t* key)
+{
+    sgx_thread_mutex_lock(&signer_mutex);
+    bool ready = signer_ready_locked();
+    if (ready) {
+        copy_reversed(key, public_key.gx, COMMITMENT_KEY_SIZE / 2);
+        copy_reversed(key + COMMITMENT_KEY_SIZE / 2, public_key.gy, COMMITMENT_KEY_SIZE / 2);
+    }
+    sgx_thread_mutex_unlock(&signer_mutex);
+    return ready;
+}
@@ -0,0 +1,40 @@
+#ifndef _ENCLAVE_COMMITMENT_H_
+#define _ENCLAVE_COMMITMENT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sgx_tcrypto.h"
+#include "user_types.h"
+
+class TradeLog;
+
+/*
+ * Commitments to settlement batches
+ *
+ * The trades of a batch are the leaves of a SHA-256 Merkle tree (layout in
+ * trade_proof_t), and only the root is signed, once per batch, with a P-256
+ * key the enclave makes on first use and never lets out. A trade's proof is
+ * rebuilt from the trade log when asked for, so no tree is kept; building
+ * the root or a proof streams the leaves with one hash per tree level held.
+ * The key lives as long as the enclave: a restarted enclave, or a standby
+ * that takes over, signs with a key of its own.
+ */
+
+// Feed the low bytes of value to sha, little-endian
+void hash_integer(sgx_sha_state_handle_t sha, uint64_t value, size_t bytes);
+
+// Root over trades[first, end), at least one trade; false if hashing failed
+bool merkle_root(const TradeLog& trades, size_t first, size_t end, uint8_t* root);
+
+// Leaf and path of trades[index] in the tree over trades[first, end) into
+// proof; false if hashing failed
+bool merkle_prove(const TradeLog& trades, size_t first, size_t end, size_t index, trade_proof_t* proof);
+
+// Sign the commitment of batch, whose merkle_root and digest are set, into
+// batch->signature
+bool sign_batch(settlement_batch_t* batch);
+
+// The public half of the signing key
+bool signing_key(uint8_t* public_key);
+
+#endif /* !_ENCLAVE_COMMITMENT_H_ */
@@ -34,6 +34,10 @@
 
 #include <assert.h>
 #include <stdlib.h>
+#include "user_types.h"
+#include "order_ring.h"
+#include "replica_journal.h"
+#include "order_envelope.h"
 
 #if defined(__cplusplus)
 extern "C" {
@@ -42,11 +46,35 @@ extern "C" {
 int printf(const char* fmt, ...);
 
 // Order book functions
-void ecall_add_order(const char* user_address, int order_type, int order_side, 
-                    double price, double quantity, char* order_id, size_t id_size);
-size_t ecall_get_trades(char* trades_json, size_t json_size);
-size_t ecall_get_user_trades(const char* user_address, char* trades_json, size_t json_size);
+int ecall_add_order(int market, const char* user_address, int order_type, int order_side, 
+                    double price, double quantity, const char* client_key, int64_t expires, char* order_id,
+                    size_t id_size, order_fill_t* fills, size_t max_fills, order_result_t* result);
+int ecall_cancel_order(const char* user_address, const char* order_id);
+int ecall_close_session(int market, uint64_t* expired);
+size_t ecall_export_trades(const char* user_address, const trade_query_t* query, uint64_t cursor,
+                           char* trades_json, size_t json_size, trade_export_t* progress);
+int ecall_close_settlement(int market, settlement_batch_t* batch, settlement_transfer_t* transfers,
+                           size_t max_transfers);
+int ecall_ack_settlement(int market, uint64_t number, const uint8_t* digest, size_t digest_size);
+int ecall_get_trade_proof(int market, uint64_t trade_seq, trade_proof_t* proof);
+int ecall_get_signing_key(uint8_t* public_key, size_t key_size);
+int ecall_open_order_session(const uint8_t* peer_key, size_t key_size, uint8_t* enclave_key,
+                             size_t enclave_key_size, uint64_t* session);
+void ecall_add_order_envelopes(const order_envelope_t* envelopes, size_t count, order_envelope_result_t* results);
+void ecall_enable_ledger();
+int ecall_set_price_tick(int market, double tick);
+int ecall_credit_account(int market, const char* user_address, int token, double amount, const char* deposit_id);
+int ecall_get_account(int market, const char* user_address, account_balance_t* balance);
 void ecall_clear_order_book();
+void ecall_get_stats(enclave_stats_t* stats, int reset);
+void ecall_get_book_stats(book_stats_t* stats);
+void ecall_get_memory_stats(memory_stats_t* stats, int reset);
+void ecall_run_order_ring(order_ring_t* ring, int worker);
+void ecall_wake_order_ring();
+void ecall_expire_orders();
+void ecall_get_boundary_stats(boundary_stats_t* stats);
+void ecall_attach_journal(replica_journal_t* journal);
+int ecall_apply_inputs(int market, const replica_input_t* inputs, size_t count, replica_status_t* status);
 
 #if defined(__cplusplus)
 }
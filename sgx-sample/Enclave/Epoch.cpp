@@ -0,0 +1,112 @@
+#include "Epoch.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "sgx_thread.h"
+
+// ============================
+// Epoch-based reclamation
+// ============================
+//
+// A reader slot holds the epoch its reader entered in, or 0 when free.
+// Retiring an object stamps it with the epoch in force when it was
+// unpublished and then advances the epoch, so any reader registered with
+// a later epoch loaded its pointers after the object was gone.
+
+#define EPOCH_CACHE_LINE 64
+
+typedef struct {
+    uint64_t epoch;
+    char padding[EPOCH_CACHE_LINE - sizeof(uint64_t)];
+} reader_slot_t;
+
+typedef struct {
+    uint64_t epoch;
+    void (*destroy)(void*);
+    void* object;
+} retired_t;
+
+static uint64_t global_epoch = 1;
+static reader_slot_t reader_slots[EPOCH_READER_SLOTS] __attribute__((aligned(EPOCH_CACHE_LINE)));
+
+// Each market's writer retires and reclaims under its own book lock, so
+// the list they share has a lock of its own
+static std::vector<retired_t> retired;
+static sgx_thread_mutex_t retired_mutex = SGX_THREAD_MUTEX_INITIALIZER;
+
+// Size of the list, so the common case of nothing retired takes no lock
+static size_t retired_count = 0;
+
+int epoch_enter(void)
+{
+    uint64_t epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+    for (int slot = 0;; slot = (slot + 1) % EPOCH_READER_SLOTS) {
+        uint64_t free_slot = 0;
+        if (__atomic_load_n(&reader_slots[slot].epoch, __ATOMIC_RELAXED) == 0 &&
+            __atomic_compare_exchange_n(&reader_slots[slot].epoch, &free_slot, epoch, false,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            // The epoch may have moved on before the slot was visible, and a
+            // writer that missed the slot could free what we are about to
+            // load; enter the newer epoch until it holds still
+            for (;;) {
+                uint64_t current = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+                if (current == epoch) {
+                    return slot;
+                }
+                epoch = current;
+                __atomic_store_n(&reader_slots[slot].epoch, epoch, __ATOMIC_SEQ_CST);
+            }
+        }
+        if (slot == EPOCH_READER_SLOTS - 1) {
+            __builtin_ia32_pause();
+        }
+    }
+}
+
+void epoch_exit(int slot)
+{
+    __atomic_store_n(&reader_slots[slot].epoch, 0, __ATOMIC_RELEASE);
+}
+
+void epoch_retire(void (*destroy)(void*), void* object)
+{
+    retired_t entry;
+    entry.destroy = destroy;
+    entry.object = object;
+    sgx_thread_mutex_lock(&retired_mutex);
+    entry.epoch = __atomic_fetch_add(&global_epoch, 1, __ATOMIC_SEQ_CST);
+    try {
+        retired.push_back(entry);
+        __atomic_store_n(&retired_count, retired.size(), __ATOMIC_RELAXED);
+    } catch (...) {
+        sgx_thread_mutex_unlock(&retired_mutex);
+        throw;
+    }
+    sgx_thread_mutex_unlock(&retired_mutex);
+}
+
+void epoch_reclaim(void)
+{
+    if (__atomic_load_n(&retired_count, __ATOMIC_RELAXED) == 0) {
+        return;
+    }
+    sgx_thread_mutex_lock(&retired_mutex);
+
+    uint64_t oldest = UINT64_MAX;
+    for (int slot = 0; slot < EPOCH_READER_SLOTS; slot++) {
+        uint64_t epoch = __atomic_load_n(&reader_slots[slot].epoch, __ATOMIC_SEQ_CST);
+        if (epoch != 0 && epoch < oldest) {
+            oldest = epoch;
+        }
+    }
+
+    // Entries are in retirement order, so the reclaimable ones come first
+    size_t done = 0;
+    while (done < retired.size() && retired[done].epoch < oldest) {
+        retired[done].destroy(retired[done].object);
+        done++;
+    }
+    retired.erase(retired.begin(), retired.begin() + done);
+    __atomic_store_n(&retired_count, retired.size(), __ATOMIC_RELAXED);
+    sgx_thread_mutex_unlock(&retired_mutex);
+}
@@ -0,0 +1,30 @@
+#ifndef _ENCLAVE_EPOCH_H_
+#define _ENCLAVE_EPOCH_H_
+
+/*
+ * Epoch-based reclamation for the book's read path
+ *
+ * Readers never lock: they register in a reader slot with the current
+ * epoch, follow published pointers, and leave. A writer that unpublishes an
+ * object hands it to epoch_retire, which advances the epoch; the object is
+ * destroyed by a later epoch_reclaim once every reader still registered
+ * entered after that advance, so none of them can hold a pointer to it.
+ *
+ * epoch_retire and epoch_reclaim are for writers, which hold a book lock.
+ */
+
+/* More slots than TCS threads, so a reader always finds one */
+#define EPOCH_READER_SLOTS 64
+
+/* Register the calling thread as a reader; returns its slot for epoch_exit */
+int epoch_enter(void);
+
+void epoch_exit(int slot);
+
+/* Destroy object with destroy(object) once no reader can still see it */
+void epoch_retire(void (*destroy)(void*), void* object);
+
+/* Destroy the retired objects no reader can see any more */
+void epoch_reclaim(void);
+
+#endif /* !_ENCLAVE_EPOCH_H_ */
@@ -0,0 +1,54 @@
+#include "Journal.h"
+#include <stdio.h>
+#include <string.h>
+
+// ============================
+// Input journal
+// ============================
+
+#define FNV_PRIME 0x100000001b3ULL
+
+void InputJournal::start(replica_journal_queue_t* shared)
+{
+    queue = shared;
+    tail = 0;
+    on = true;
+}
+
+uint64_t InputJournal::fold(uint64_t hash, const void* data, size_t size)
+{
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+void InputJournal::record(replica_input_t* input, uint64_t outcome)
+{
+    // Everything from time on; the caller zeroed the fields the kind does not use
+    hash = fold(hash, &input->time, sizeof(*input) - offsetof(replica_input_t, time));
+    hash = fold(hash, &outcome, sizeof(outcome));
+    input->seq = ++seq;
+    input->state_hash = hash;
+    if (queue != NULL) {
+        publish(input);
+    }
+}
+
+void InputJournal::publish(const replica_input_t* input)
+{
+    // The head comes from the untrusted side: a bad one can only cost the
+    // standby its place, never memory outside the queue
+    uint64_t head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+    if (tail - head >= REPLICA_JOURNAL_SIZE) {
+        printf("[Enclave] Replica journal full at input %llu; the standby can no longer follow\n",
+               (unsigned long long)input->seq);
+        __atomic_store_n(&queue->overflowed, 1, __ATOMIC_RELEASE);
+        queue = NULL;
+        return;
+    }
+    memcpy(&queue->inputs[tail & (REPLICA_JOURNAL_SIZE - 1)], input, sizeof(*input));
+    tail++;
+    __atomic_store_n(&queue->tail, tail, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,50 @@
+#ifndef _ENCLAVE_JOURNAL_H_
+#define _ENCLAVE_JOURNAL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "replica_journal.h"
+
+/*
+ * One book's input stream, on a primary or on its standby
+ *
+ * Numbers the inputs applied to the book and folds each one, with what it
+ * did, into a running 64-bit FNV-1a state hash; a standby that applies the
+ * same inputs lands on the same hash, or has diverged. A primary also
+ * appends every input to its market's queue of the shared journal (see
+ * replica_journal.h). Off until the App attaches a journal or starts
+ * feeding a standby, and only used with the book lock held.
+ */
+class InputJournal {
+public:
+    InputJournal() : queue(NULL), tail(0), seq(0), hash(EMPTY_HASH), on(false) {}
+
+    // State hash before any input
+    static const uint64_t EMPTY_HASH = 0xcbf29ce484222325ULL;
+
+    bool recording() const { return on; }
+
+    // Start numbering inputs; a primary passes its queue, a standby NULL
+    void start(replica_journal_queue_t* shared);
+
+    uint64_t last_seq() const { return seq; }
+    uint64_t state_hash() const { return hash; }
+
+    // Number input, fold it and its outcome (a hash of what it did) into
+    // the state hash, and publish it if this book has a queue
+    void record(replica_input_t* input, uint64_t outcome);
+
+    // Fold size bytes of data into hash
+    static uint64_t fold(uint64_t hash, const void* data, size_t size);
+
+private:
+    replica_journal_queue_t* queue;
+    uint64_t tail;          // Our copy; the shared one is only ever written
+    uint64_t seq;
+    uint64_t hash;
+    bool on;
+
+    void publish(const replica_input_t* input);
+};
+
+#endif /* !_ENCLAVE_JOURNAL_H_ */
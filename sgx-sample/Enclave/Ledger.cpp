@@ -0,0 +1,152 @@
+#include "Ledger.h"
+#include "Memory.h"
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+
+// ============================
+// Account ledger
+// ============================
+
+// Next pointer and cached hash of an unordered container node
+#define HASH_NODE_OVERHEAD (2 * sizeof(void*))
+
+int AccountLedger::credit(const std::string& user, int token, double amount, const std::string& deposit_id)
+{
+    if (!on) {
+        return LEDGER_DISABLED;
+    }
+    if ((token != SETTLEMENT_TOKEN_BASE && token != SETTLEMENT_TOKEN_QUOTE) ||
+        !(amount > 0 && amount < HUGE_VAL) || user.empty() || deposit_id.empty()) {
+        return LEDGER_INVALID;
+    }
+    if (deposits.count(deposit_id) > 0) {
+        return LEDGER_DUPLICATE_DEPOSIT;
+    }
+
+    // Both insertions can throw; the deposit is recorded last so a failure
+    // leaves at most an empty account behind
+    std::unordered_map<std::string, Account>::iterator account = accounts.find(user);
+    if (account == accounts.end()) {
+        Account empty;
+        memset(&empty, 0, sizeof(empty));
+        account = accounts.insert(std::make_pair(user, empty)).first;
+    }
+    deposits.insert(deposit_id);
+    account->second.total[token] += amount;
+    return LEDGER_OK;
+}
+
+bool AccountLedger::find(const std::string& user, account_balance_t* balance) const
+{
+    std::unordered_map<std::string, Account>::const_iterator account = accounts.find(user);
+    if (account == accounts.end()) {
+        return false;
+    }
+    for (int token = SETTLEMENT_TOKEN_BASE; token <= SETTLEMENT_TOKEN_QUOTE; token++) {
+        balance->total[token] = account->second.total[token];
+        balance->reserved[token] = account->second.reserved[token];
+    }
+    return true;
+}
+
+double AccountLedger::available(const std::string& user, int token) const
+{
+    std::unordered_map<std::string, Account>::const_iterator account = accounts.find(user);
+    if (account == accounts.end()) {
+        return 0;
+    }
+    return account->second.total[token] - account->second.reserved[token];
+}
+
+bool AccountLedger::can_fund(const std::string& user, OrderType type, OrderSide side, double price, double quantity) const
+{
+    if (!on) {
+        return true;
+    }
+    double funds = available(user, cost_token(side));
+    if (type == MARKET && side == BUY) {
+        return funds > 0;
+    }
+    return funds >= cost(side, price, quantity);
+}
+
+double AccountLedger::fundable_quantity(const std::string& user, OrderSide side, double price, double quantity) const
+{
+    if (!on) {
+        return quantity;
+    }
+    double funds = std::max(available(user, cost_token(side)), 0.0);
+    double covered = side == BUY ? (price > 0 ? funds / price : quantity) : funds;
+    return std::min(quantity, covered);
+}
+
+void AccountLedger::hold(const std::string& user, int token, double amount)
+{
+    std::unordered_map<std::string, Account>::iterator account = accounts.find(user);
+    if (account == accounts.end()) {
+        return;
+    }
+    // Rounding must not leave a reservation below zero once its order is gone
+    account->second.reserved[token] = std::max(account->second.reserved[token] + amount, 0.0);
+}
+
+void AccountLedger::reserve(const Order& order)
+{
+    if (on) {
+        hold(order.user_address, cost_token(order.side), cost(order.side, order.price, order.remaining_quantity));
+    }
+}
+
+void AccountLedger::release(const Order& order)
+{
+    if (on) {
+        hold(order.user_address, cost_token(order.side), -cost(order.side, order.price, order.remaining_quantity));
+    }
+}
+
+void AccountLedger::apply_trade(const Trade& trade)
+{
+    if (!on) {
+        return;
+    }
+    OrderSide maker_side = trade.taker_side == BUY ? SELL : BUY;
+    hold(trade.maker_address, cost_token(maker_side), -cost(maker_side, trade.price, trade.quantity));
+
+    const std::string& buyer = trade.taker_side == BUY ? trade.taker_address : trade.maker_address;
+    const std::string& seller = trade.taker_side == BUY ? trade.maker_address : trade.taker_address;
+    std::unordered_map<std::string, Account>::iterator bought = accounts.find(buyer);
+    std::unordered_map<std::string, Account>::iterator sold = accounts.find(seller);
+    double value = trade.price * trade.quantity;
+    if (bought != accounts.end()) {
+        bought->second.total[SETTLEMENT_TOKEN_BASE] += trade.quantity;
+        bought->second.total[SETTLEMENT_TOKEN_QUOTE] -= value;
+    }
+    if (sold != accounts.end()) {
+        sold->second.total[SETTLEMENT_TOKEN_BASE] -= trade.quantity;
+        sold->second.total[SETTLEMENT_TOKEN_QUOTE] += value;
+    }
+}
+
+void AccountLedger::clear_reservations()
+{
+    for (std::unordered_map<std::string, Account>::iterator account = accounts.begin();
+         account != accounts.end(); ++account) {
+        account->second.reserved[SETTLEMENT_TOKEN_BASE] = 0;
+        account->second.reserved[SETTLEMENT_TOKEN_QUOTE] = 0;
+    }
+}
+
+void AccountLedger::measure(memory_usage_t* usage) const
+{
+    usage->count += accounts.size();
+    usage->bytes += accounts.bucket_count() * sizeof(void*) + deposits.bucket_count() * sizeof(void*);
+    for (std::unordered_map<std::string, Account>::const_iterator account = accounts.begin();
+         account != accounts.end(); ++account) {
+        usage->bytes += HASH_NODE_OVERHEAD + sizeof(*account) + string_heap_bytes(account->first);
+    }
+    for (std::unordered_set<std::string>::const_iterator deposit = deposits.begin();
+         deposit != deposits.end(); ++deposit) {
+        usage->bytes += HASH_NODE_OVERHEAD + sizeof(std::string) + string_heap_bytes(*deposit);
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef _ENCLAVE_LEDGER_H_
+#define _ENCLAVE_LEDGER_H_
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include "OrderBook.h"
+#include "user_types.h"
+
+/*
+ * Balances of one market's users, in its base and quote tokens
+ *
+ * Deposits credit an account; every trade moves base from the seller to
+ * the buyer and quote the other way, as settlement will; a resting order
+ * holds back what it can still cost. Orders are checked against what is
+ * left before they reach the book. Until the ledger is enabled it holds no
+ * accounts and every order is fundable. Like the rest of the book it is
+ * only used with the book lock held.
+ */
+class AccountLedger {
+public:
+    AccountLedger() : on(false) {}
+
+    bool enabled() const { return on; }
+
+    void enable() { on = true; }
+
+    // Credit a deposit once per deposit_id; returns LEDGER_*. Throws
+    // std::bad_alloc and then credits nothing.
+    int credit(const std::string& user, int token, double amount, const std::string& deposit_id);
+
+    // The user's balances; false if they never deposited
+    bool find(const std::string& user, account_balance_t* balance) const;
+
+    // Whether user can pay for quantity on side at price; a market buy
+    // only needs something to pay with, see fundable_quantity
+    bool can_fund(const std::string& user, OrderType type, OrderSide side, double price, double quantity) const;
+
+    // Part of quantity at price that the user's available balance covers
+    double fundable_quantity(const std::string& user, OrderSide side, double price, double quantity) const;
+
+    // Hold back what a resting order can still cost, and give it back on cancel
+    void reserve(const Order& order);
+    void release(const Order& order);
+
+    // Move the trade's tokens between buyer and seller and use up what the
+    // maker's order held back. Never allocates.
+    void apply_trade(const Trade& trade);
+
+    // The book was emptied: no order holds anything back any more
+    void clear_reservations();
+
+    // Add the ledger's heap use to usage
+    void measure(memory_usage_t* usage) const;
+
+private:
+    struct Account {
+        double total[2];
+        double reserved[2];
+    };
+
+    std::unordered_map<std::string, Account> accounts;
+    std::unordered_set<std::string> deposits;
+    bool on;
+
+    // What an order needs: quote for a buy, base for a sell
+    static int cost_token(OrderSide side) { return side == BUY ? SETTLEMENT_TOKEN_QUOTE : SETTLEMENT_TOKEN_BASE; }
+    static double cost(OrderSide side, double price, double quantity) { return side == BUY ? price * quantity : quantity; }
+
+    double available(const std::string& user, int token) const;
+    void hold(const std::string& user, int token, double amount);
+};
+
+#endif /* !_ENCLAVE_LEDGER_H_ */
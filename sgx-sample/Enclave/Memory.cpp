@@ -0,0 +1,132 @@
+#include "Memory.h"
+#include <stdlib.h>
+#include <new>
+
+// ============================
+// Allocator hooks
+// ============================
+//
+// All STL containers and strings in the enclave allocate through the global
+// operator new, so replacing it is enough to account for the order book's
+// heap usage. Every block carries a small header recording its size, since
+// C++11 deallocation does not pass the size back.
+
+#define ALLOCATION_HEADER_SIZE 16
+
+// HeapMaxSize of the enclave configuration, passed in by the Makefile
+#ifndef ENCLAVE_HEAP_MAX_SIZE
+#define ENCLAVE_HEAP_MAX_SIZE 0x100000
+#endif
+
+static size_t heap_in_use = 0;
+static size_t heap_high_water = 0;
+static uint64_t allocations = 0;
+
+// heap_in_use does not see the allocator's own overhead or fragmentation,
+// so only 7/8 of the heap is handed out to the book
+static size_t budget = (size_t)ENCLAVE_HEAP_MAX_SIZE / 8 * 7;
+
+static void* tracked_alloc(size_t size)
+{
+    void* block = malloc(size + ALLOCATION_HEADER_SIZE);
+    if (block == NULL) {
+        return NULL;
+    }
+    *(size_t*)block = size;
+    __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+    size_t in_use = __atomic_add_fetch(&heap_in_use, size, __ATOMIC_RELAXED);
+    size_t high_water = __atomic_load_n(&heap_high_water, __ATOMIC_RELAXED);
+    while (in_use > high_water &&
+           !__atomic_compare_exchange_n(&heap_high_water, &high_water, in_use, false,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    return (char*)block + ALLOCATION_HEADER_SIZE;
+}
+
+static void tracked_free(void* ptr)
+{
+    if (ptr == NULL) {
+        return;
+    }
+    void* block = (char*)ptr - ALLOCATION_HEADER_SIZE;
+    __atomic_fetch_sub(&heap_in_use, *(size_t*)block, __ATOMIC_RELAXED);
+    free(block);
+}
+
+size_t memory_heap_in_use(void)
+{
+    return __atomic_load_n(&heap_in_use, __ATOMIC_RELAXED);
+}
+
+size_t memory_heap_high_water(void)
+{
+    return __atomic_load_n(&heap_high_water, __ATOMIC_RELAXED);
+}
+
+uint64_t memory_allocations(void)
+{
+    return __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+}
+
+size_t memory_budget(void)
+{
+    return __atomic_load_n(&budget, __ATOMIC_RELAXED);
+}
+
+bool memory_budget_allows(size_t reserve)
+{
+    return memory_heap_in_use() + reserve <= memory_budget();
+}
+
+void memory_budget_lower(void)
+{
+    size_t in_use = memory_heap_in_use();
+    size_t current = memory_budget();
+    while (in_use < current &&
+           !__atomic_compare_exchange_n(&budget, &current, in_use, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+void* operator new(size_t size)
+{
+    void* ptr = tracked_alloc(size);
+    if (ptr == NULL) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    return tracked_alloc(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    return tracked_alloc(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+    tracked_free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+    tracked_free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept
+{
+    tracked_free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept
+{
+    tracked_free(ptr);
+}
@@ -0,0 +1,33 @@
+#ifndef _ENCLAVE_MEMORY_H_
+#define _ENCLAVE_MEMORY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+/* Bytes currently allocated through the enclave's operator new */
+size_t memory_heap_in_use(void);
+
+/* Largest memory_heap_in_use seen since the enclave started */
+size_t memory_heap_high_water(void);
+
+/* Calls to operator new since the enclave started */
+uint64_t memory_allocations(void);
+
+/* Heap bytes the book may use, derived from the signed HeapMaxSize */
+size_t memory_budget(void);
+
+/* Whether reserve more bytes still fit in the budget */
+bool memory_budget_allows(size_t reserve);
+
+/* After an allocation failure: the heap is smaller than configured (an
+ * EDMM profile on hardware without EDMM), so cap the budget at current use */
+void memory_budget_lower(void);
+
+/* Heap buffer behind a string; short strings live inline and have none */
+static inline size_t string_heap_bytes(const std::string& value)
+{
+    return value.capacity() > std::string().capacity() ? value.capacity() + 1 : 0;
+}
+
+#endif /* !_ENCLAVE_MEMORY_H_ */
@@ -1,298 +1,347 @@
 #include "OrderBook.h"
 #include "Enclave.h"
 #include "Enclave_t.h"
+#include "Stats.h"
+#include "Memory.h"
+#include "Epoch.h"
+#include "TradeLog.h"
+#include "Settlement.h"
+#include "Ledger.h"
+#include "ClientKeys.h"
+#include "Journal.h"
+#include "PriceLadder.h"
+#include "Commitment.h"
+#include "OrderEnvelope.h"
+#include "TimingWheel.h"
+#include "sgx_thread.h"
+#include "sgx_trts.h"
 #include <string>
 #include <sstream>
 #include <iomanip>
 #include <algorithm>
 #include <cstring>
+#include <cmath>
+#include <new>
 
 // ============================
 // OrderBook implementation ;)
 // ============================
 
+// Heap kept free for the order being matched: its strings, trades and index entries
+#define ORDER_MEMORY_RESERVE 0x4000
+
+// Colour and parent/left/right links of a std::map node
+#define TREE_NODE_OVERHEAD (4 * sizeof(void*))
+
+// HTTP workers call in on several TCS threads at once. Each market's book
+// has a mutex, held for the whole duration of every ECALL that changes that
+// book, so different markets match in parallel. Queries do not take it:
+// they read what the writer last published (see ReadGuard).
+class BookLock {
+public:
+    explicit BookLock(sgx_thread_mutex_t* book_mutex) : mutex(book_mutex) { sgx_thread_mutex_lock(mutex); }
+    ~BookLock() { sgx_thread_mutex_unlock(mutex); }
+private:
+    sgx_thread_mutex_t* mutex;
+    BookLock(const BookLock&);
+    BookLock& operator=(const BookLock&);
+};
+
+// Held by a query for as long as it looks at published state: nothing it
+// can reach is freed meanwhile, and the writer never waits for it
+class ReadGuard {
+public:
+    ReadGuard() : slot(epoch_enter()) {}
+    ~ReadGuard() { epoch_exit(slot); }
+private:
+    int slot;
+    ReadGuard(const ReadGuard&);
+    ReadGuard& operator=(const ReadGuard&);
+};
+
+static size_t order_heap_bytes(const Order& order) {
+    return string_heap_bytes(order.id) + string_heap_bytes(order.user_address);
+}
+
 class OrderBookImpl {
+public:
+    // Held while the book changes; see BookLock
+    sgx_thread_mutex_t mutex;
+
 private:
-    // Priority queues for buy and sell orders
-    std::priority_queue<Order, std::vector<Order>, BuyOrderComparator> buy_orders;
-    std::priority_queue<Order, std::vector<Order>, SellOrderComparator> sell_orders;
+    // Market of this book, and the prefix its order and trade IDs carry
+    int market;
+    char id_prefix[16];
+    
+    // Counters behind the IDs
+    int order_counter;
+    int trade_counter;
     
-    // Map of all orders by ID
+    // Clock reading of the order being matched, taken once for its ID, its
+    // timestamp and its fills' IDs and timestamps; a standby is handed the
+    // primary's reading, so it makes the same IDs
+    time_t input_time;
+    
+    // Resting buy and sell orders by price level
+    PriceLadder ladders[2];
+    
+    // Map of all orders by ID, but for expired ones; the ladders queue the
+    // entries of the resting orders
     std::map<std::string, Order> orders;
     
-    // List of all trades
-    std::vector<Trade> trades;
+    // Expiry of the resting GTT and day orders
+    TimingWheel timers;
+    
+    // Trades in sequence and timestamp order, with each user's trades
+    // indexed. Readers load it without the book lock; a clear publishes a
+    // new log that continues the sequence numbers, so none is ever reused.
+    TradeLog* log;
+    
+    // Resting orders on each side, kept as orders rest, fill and are
+    // cancelled, so the summary below never needs a walk of the book; the
+    // ladders count the levels
+    uint64_t resting_orders[2];
+    
+    // Book summary for queries, republished after every change behind a
+    // sequence counter that is odd while the writer is updating it
+    book_stats_t summary;
+    uint64_t summary_seq;
+    
+    // Trades netted into settlement batches so far
+    SettlementWindow settlement;
+    
+    // What each user can pay with; off unless the App enables it
+    AccountLedger ledger;
+    
+    // Orders recently accepted under a client key, so a resend is not added twice
+    ClientKeyWindow key_window;
+    
+    // Inputs applied to this book, for a standby to follow
+    InputJournal input_journal;
     
-    // Singleton instance
-    static OrderBookImpl* instance;
+    // Trades of the last order added, folded while the journal records
+    uint64_t fills_hash;
+    
+    // One book per market, all created on first use
+    static OrderBookImpl* instances[MARKET_COUNT];
+    
+    explicit OrderBookImpl(int book_market)
+        : market(book_market), order_counter(0), trade_counter(0), input_time(0),
+          ladders{ {BUY}, {SELL} }, log(new TradeLog(1)), summary_seq(0), fills_hash(InputJournal::EMPTY_HASH) {
+        sgx_thread_mutex_init(&mutex, NULL);
+        // Market 0 keeps the IDs it had before there were markets
+        id_prefix[0] = '\0';
+        if (market != 0) {
+            snprintf(id_prefix, sizeof(id_prefix), "m%d-", market);
+        }
+        memset(resting_orders, 0, sizeof(resting_orders));
+        memset(&summary, 0, sizeof(summary));
+    }
 
-    // Generate a unique order ID
+    // Generate a unique order ID; like everything that changes the book,
+    // only called with the book lock held
     std::string generate_order_id() {
-        static int counter = 0;
-        time_t now;
-        ocall_get_current_time(&now);
-        
         char buffer[64];
-        snprintf(buffer, sizeof(buffer), "%lx-%d", (long)now, ++counter);
+        snprintf(buffer, sizeof(buffer), "%s%lx-%d", id_prefix, (long)input_time, ++order_counter);
         return std::string(buffer);
     }
     
     // Generate a unique trade ID
     std::string generate_trade_id() {
-        static int counter = 0;
-        time_t now;
-        ocall_get_current_time(&now);
-        
         char buffer[64];
-        snprintf(buffer, sizeof(buffer), "%lx-trade-%d", (long)now, ++counter);
+        snprintf(buffer, sizeof(buffer), "%s%lx-trade-%d", id_prefix, (long)input_time, ++trade_counter);
         return std::string(buffer);
     }
     
-    // Match a market order
-    void match_market_order(Order& order) {
-        if (order.side == BUY) {
-            // For buy orders, match against sell orders
-            while (order.remaining_quantity > 0 && !sell_orders.empty()) {
-                // Get the best matching order
-                Order matching_order = sell_orders.top();
-                sell_orders.pop();
-                
-                // Skip orders that are not open
-                if (matching_order.status != OPEN) {
-                    continue;
-                }
-                
-                // Calculate fill quantity
-                double fill_quantity = std::min(order.remaining_quantity, matching_order.remaining_quantity);
-                
-                // Create trade
-                Trade trade;
-                trade.id = generate_trade_id();
-                trade.price = matching_order.price;
-                trade.quantity = fill_quantity;
-                ocall_get_current_time(&trade.timestamp);
-                
-                trade.taker_address = order.user_address;
-                trade.maker_address = matching_order.user_address;
-                trade.taker_side = BUY;
-                
-                // Update order quantities
-                order.remaining_quantity -= fill_quantity;
-                matching_order.remaining_quantity -= fill_quantity;
-                
-                // Update order statuses
-                if (matching_order.remaining_quantity <= 0) {
-                    matching_order.status = FILLED;
-                } else {
-                    matching_order.status = PARTIALLY_FILLED;
-                    sell_orders.push(matching_order);
-                }
-                
-                // Update the order in the map
-                orders[matching_order.id] = matching_order;
-                
-                trades.push_back(trade);
-                
-                printf("[Enclave] Trade executed: %s, Price: %.2f, Quantity: %.2f\n", 
-                       trade.id.c_str(), trade.price, trade.quantity);
+    // Append a trade to the log. Sequence numbers are gap-free within the log
+    // and timestamps are held monotonic, so both can be searched directly.
+    void record_trade(Trade& trade) {
+        log->record(trade);
+        ledger.apply_trade(trade);
+    }
+    
+    // An order, its entry in the map, is queued from when it rests until it
+    // is filled, cancelled or expired. Only queueing it can throw.
+    void rest(Order& order) {
+        ladders[order.side].push(&order);
+        resting_orders[order.side]++;
+        ledger.reserve(order);
+    }
+    
+    void unrest(Order& order) {
+        ladders[order.side].remove(&order);
+        resting_orders[order.side]--;
+    }
+    
+    // Take a resting order off the book as status, disarming its expiry
+    void withdraw(Order& order, OrderStatus status) {
+        if (order.timer != NULL) {
+            timers.cancel(order.timer);
+        }
+        unrest(order);
+        ledger.release(order);
+        order.status = status;
+    }
+    
+    // Withdraw every order whose timer the wheel has made due, and forget
+    // it: an expired order leaves no record behind; returns how many
+    size_t withdraw_expired() {
+        size_t expired = 0;
+        for (Order* order; (order = timers.take_due()) != NULL; expired++) {
+            withdraw(*order, EXPIRED);
+            orders.erase(orders.find(order->id));
+        }
+        if (expired > 0) {
+            publish_summary();
+            printf("[Enclave] %zu orders expired\n", expired);
+        }
+        return expired;
+    }
+    
+    // Match an order against the other side, best price first and in time
+    // order within a price; a limit order stops at its own price. A maker
+    // that is partly filled keeps its place at the front of its level.
+    // Returns the order's entry in the map, queued if it rests, and adds
+    // the price levels it traded at to *levels.
+    Order& match_order(Order& order, size_t* levels) {
+        PriceLadder& makers = ladders[order.side == BUY ? SELL : BUY];
+        PriceLevel* swept = NULL;
+        fills_hash = InputJournal::EMPTY_HASH;
+        while (order.remaining_quantity > 0) {
+            PriceLevel* level = makers.best();
+            if (level == NULL) {
+                break;
             }
-        } else {
-            // For sell orders, match against buy orders
-            while (order.remaining_quantity > 0 && !buy_orders.empty()) {
-                // Get the best matching order
-                Order matching_order = buy_orders.top();
-                buy_orders.pop();
-                
-                // Skip orders that are not open
-                if (matching_order.status != OPEN) {
-                    continue;
-                }
-                
-                // Calculate fill quantity
-                double fill_quantity = std::min(order.remaining_quantity, matching_order.remaining_quantity);
-                
-                // Create trade
-                Trade trade;
-                trade.id = generate_trade_id();
-                trade.price = matching_order.price;
-                trade.quantity = fill_quantity;
-                ocall_get_current_time(&trade.timestamp);
-                
-                trade.taker_address = order.user_address;
-                trade.maker_address = matching_order.user_address;
-                trade.taker_side = SELL;
-                
-                // Update order quantities
-                order.remaining_quantity -= fill_quantity;
-                matching_order.remaining_quantity -= fill_quantity;
-                
-                // Update order statuses
-                if (matching_order.remaining_quantity <= 0) {
-                    matching_order.status = FILLED;
-                } else {
-                    matching_order.status = PARTIALLY_FILLED;
-                    buy_orders.push(matching_order);
-                }
-                
-                // Update the order in the map
-                orders[matching_order.id] = matching_order;
-                
-                trades.push_back(trade);
-                
-                printf("[Enclave] Trade executed: %s, Price: %.2f, Quantity: %.2f\n", 
-                       trade.id.c_str(), trade.price, trade.quantity);
+            
+            // Check if the price is acceptable
+            if (order.type == LIMIT && (order.side == BUY ? level->price > order.price : level->price < order.price)) {
+                break; // No more matching orders at acceptable price
             }
-        }
-        
-        // Update order status
-        if (order.remaining_quantity <= 0) {
-            order.status = FILLED;
-        } else {
-            order.status = OPEN;
-            if (order.side == BUY) {
-                buy_orders.push(order);
-            } else {
-                sell_orders.push(order);
+            
+            Order& matching_order = *level->front;
+            if (level != swept) {
+                swept = level;
+                (*levels)++;
             }
-        }
-        
-        orders[order.id] = order;
-    }
-    
-    // Match a limit order
-    void match_limit_order(Order& order) {
-        if (order.side == BUY) {
-            // For buy orders, match against sell orders
-            while (order.remaining_quantity > 0 && !sell_orders.empty()) {
-                // Get the best matching order
-                Order matching_order = sell_orders.top();
-                
-                // Check if the price is acceptable
-                if (matching_order.price > order.price) {
-                    break; // No more matching orders at acceptable price
-                }
-                
-                sell_orders.pop();
-                
-                // Skip orders that are not open
-                if (matching_order.status != OPEN) {
-                    continue;
-                }
-                
-                // Calculate fill quantity
-                double fill_quantity = std::min(order.remaining_quantity, matching_order.remaining_quantity);
-                
-                // Create trade
-                Trade trade;
-                trade.id = generate_trade_id();
-                trade.price = matching_order.price;
-                trade.quantity = fill_quantity;
-                ocall_get_current_time(&trade.timestamp);
-                
-                trade.taker_address = order.user_address;
-                trade.maker_address = matching_order.user_address;
-                trade.taker_side = BUY;
-                
-                // Update order quantities
-                order.remaining_quantity -= fill_quantity;
-                matching_order.remaining_quantity -= fill_quantity;
-                
-                // Update order statuses
-                if (matching_order.remaining_quantity <= 0) {
-                    matching_order.status = FILLED;
-                } else {
-                    matching_order.status = PARTIALLY_FILLED;
-                    sell_orders.push(matching_order);
+            
+            // Calculate fill quantity; with the ledger on, a market buy takes
+            // no more than the taker can still pay for
+            double fill_quantity = std::min(order.remaining_quantity, matching_order.remaining_quantity);
+            bool funds_used_up = false;
+            if (order.type == MARKET && order.side == BUY) {
+                double fundable = ledger.fundable_quantity(order.user_address, BUY, level->price, fill_quantity);
+                if (fundable <= 0) {
+                    break;
                 }
-                
-                // Update the order in the map
-                orders[matching_order.id] = matching_order;
-                
-                trades.push_back(trade);
-                
-                printf("[Enclave] Trade executed: %s, Price: %.2f, Quantity: %.2f\n", 
-                       trade.id.c_str(), trade.price, trade.quantity);
+                funds_used_up = fundable < fill_quantity;
+                fill_quantity = fundable;
             }
-        } else {
-            // For sell orders, match against buy orders
-            while (order.remaining_quantity > 0 && !buy_orders.empty()) {
-                // Get the best matching order
-                Order matching_order = buy_orders.top();
-                
-                // Check if the price is acceptable
-                if (matching_order.price < order.price) {
-                    break; // No more matching orders at acceptable price
-                }
-                
-                buy_orders.pop();
-                
-                // Skip orders that are not open
-                if (matching_order.status != OPEN) {
-                    continue;
+            
+            // Create trade
+            Trade trade;
+            trade.id = generate_trade_id();
+            trade.price = matching_order.price;
+            trade.quantity = fill_quantity;
+            trade.timestamp = input_time;
+            
+            trade.taker_address = order.user_address;
+            trade.maker_address = matching_order.user_address;
+            trade.taker_side = order.side;
+            
+            // Update order quantities
+            order.remaining_quantity -= fill_quantity;
+            matching_order.remaining_quantity -= fill_quantity;
+            
+            // A filled maker leaves the book, and its expiry with it
+            if (matching_order.remaining_quantity <= 0) {
+                matching_order.status = FILLED;
+                if (matching_order.timer != NULL) {
+                    timers.cancel(matching_order.timer);
                 }
-                
-                // Calculate fill quantity
-                double fill_quantity = std::min(order.remaining_quantity, matching_order.remaining_quantity);
-                
-                // Create trade
-                Trade trade;
-                trade.id = generate_trade_id();
-                trade.price = matching_order.price;
-                trade.quantity = fill_quantity;
-                ocall_get_current_time(&trade.timestamp);
-                
-                trade.taker_address = order.user_address;
-                trade.maker_address = matching_order.user_address;
-                trade.taker_side = SELL;
-                
-                // Update order quantities
-                order.remaining_quantity -= fill_quantity;
-                matching_order.remaining_quantity -= fill_quantity;
-                
-                // Update order statuses
-                if (matching_order.remaining_quantity <= 0) {
-                    matching_order.status = FILLED;
-                } else {
-                    matching_order.status = PARTIALLY_FILLED;
-                    buy_orders.push(matching_order);
+                if (level->length == 1) {
+                    swept = NULL; // The level goes with its last order
                 }
-                
-                // Update the order in the map
-                orders[matching_order.id] = matching_order;
-                
-                trades.push_back(trade);
-                
-                printf("[Enclave] Trade executed: %s, Price: %.2f, Quantity: %.2f\n", 
-                       trade.id.c_str(), trade.price, trade.quantity);
+                unrest(matching_order);
+            } else {
+                matching_order.status = PARTIALLY_FILLED;
+            }
+            
+            record_trade(trade);
+            if (input_journal.recording()) {
+                fills_hash = InputJournal::fold(fills_hash, &trade.seq, sizeof(trade.seq));
+                fills_hash = InputJournal::fold(fills_hash, &trade.price, sizeof(trade.price));
+                fills_hash = InputJournal::fold(fills_hash, &trade.quantity, sizeof(trade.quantity));
+                fills_hash = InputJournal::fold(fills_hash, matching_order.id.data(), matching_order.id.length() + 1);
+                fills_hash = InputJournal::fold(fills_hash, order.id.data(), order.id.length() + 1);
+            }
+            
+#ifdef ENCLAVE_ORDER_TRACE
+            printf("[Enclave] Trade executed: %s, Price: %.2f, Quantity: %.2f\n", 
+                   trade.id.c_str(), trade.price, trade.quantity);
+#endif
+            
+            // Stop on what the funds covered rather than trade dust
+            if (funds_used_up) {
+                break;
             }
         }
         
+        // Update order status
         if (order.remaining_quantity <= 0) {
             order.status = FILLED;
+        } else if (order.type == MARKET && ledger.enabled()) {
+            // Nothing prices what is left of a market order, so no
+            // reservation could cover it; with the ledger on it cannot rest
+            order.status = CANCELLED;
         } else {
             order.status = OPEN;
-            if (order.side == BUY) {
-                buy_orders.push(order);
-            } else {
-                sell_orders.push(order);
-            }
         }
         
-        orders[order.id] = order;
+        Order& entry = orders[order.id];
+        entry = order;
+        if (entry.status == OPEN) {
+            try {
+                rest(entry);
+            } catch (...) {
+                orders.erase(order.id);
+                throw;
+            }
+        }
+        return entry;
     }
 
 public:
-    // Get singleton instance
-    static OrderBookImpl* getInstance() {
-        if (instance == nullptr) {
-            instance = new OrderBookImpl();
+    // Get the book of a market below MARKET_COUNT; queries may ask first,
+    // outside any book lock
+    static OrderBookImpl* getInstance(int market) {
+        static sgx_thread_mutex_t instance_mutex = SGX_THREAD_MUTEX_INITIALIZER;
+        OrderBookImpl* book = __atomic_load_n(&instances[market], __ATOMIC_ACQUIRE);
+        if (book == nullptr) {
+            sgx_thread_mutex_lock(&instance_mutex);
+            for (int i = 0; i < MARKET_COUNT; i++) {
+                if (instances[i] == nullptr) {
+                    __atomic_store_n(&instances[i], new OrderBookImpl(i), __ATOMIC_RELEASE);
+                }
+            }
+            sgx_thread_mutex_unlock(&instance_mutex);
+            book = instances[market];
         }
-        return instance;
+        return book;
     }
     
-    // Add an order to the book
+    // Whether one more order can be matched and booked within the memory budget
+    bool has_memory_for_order() const {
+        return memory_budget_allows(ORDER_MEMORY_RESERVE + log->growth_bytes());
+    }
+    
+    // Add an order to the book at clock reading now, to expire as expires
+    // says if it rests; fills and result, when given, receive its
+    // executions. A sealed order is not logged.
     std::string add_order(const std::string& user_address, OrderType type, 
-                         OrderSide side, double price, double quantity) {
+                         OrderSide side, double price, double quantity, int64_t expires, time_t now,
+                         order_fill_t* fills, size_t max_fills, order_result_t* result,
+                         bool sealed = false) {
+        input_time = now;
         Order order;
         order.id = generate_order_id();
         order.user_address = user_address;
@@ -302,76 +351,345 @@ public:
         order.quantity = quantity;
         order.remaining_quantity = quantity;
         order.status = OPEN;
-        ocall_get_current_time(&order.timestamp);
+        order.timestamp = now;
+        order.expires = expires;
+        order.timer = NULL;
+        order.queue_prev = NULL;
+        order.queue_next = NULL;
+        
+        // Made before matching, so nothing can fail once the order rests
+        WheelTimer* timer = expires != ORDER_EXPIRES_NEVER ? new WheelTimer : NULL;
         
-        printf("[Enclave] New order: %s, Type: %d, Side: %d, Price: %.2f, Quantity: %.2f\n", 
-               order.id.c_str(), type, side, price, quantity);
+#ifdef ENCLAVE_ORDER_TRACE
+        // The log goes out to the host, which must not see a sealed order's terms
+        if (!sealed) {
+            printf("[Enclave] New order: %s, Type: %d, Side: %d, Price: %.2f, Quantity: %.2f\n", 
+                   order.id.c_str(), type, side, price, quantity);
+        }
+#else
+        (void)sealed;
+#endif
+        
+        uint64_t start = stats_cycles();
+        const TradeLog& trades = *log;
+        size_t first_trade = trades.size();
         
-        if (type == MARKET) {
-            match_market_order(order);
+        size_t levels = 0;
+        Order& entry = match_order(order, &levels);
+        if (timer != NULL && entry.status == OPEN) {
+            timers.schedule(timer, &entry, expires);
         } else {
-            match_limit_order(order);
+            delete timer;
         }
         
+        stats_record_add_order(stats_cycles() - start, trades.size() - first_trade, levels);
+        
+        for (size_t i = first_trade; fills != NULL && i < trades.size() && i - first_trade < max_fills; i++) {
+            fills[i - first_trade].trade_seq = trades[i].seq;
+            fills[i - first_trade].price = trades[i].price;
+            fills[i - first_trade].quantity = trades[i].quantity;
+        }
+        if (result != NULL) {
+            result->fill_count = trades.size() - first_trade;
+            result->filled_quantity = order.quantity - order.remaining_quantity;
+            result->remaining_quantity = order.remaining_quantity > 0 ? order.remaining_quantity : 0;
+            result->status = order.status;
+        }
+        
+        publish_summary();
         return order.id;
     }
     
-    // Get all trades
-    std::vector<Trade> get_trades() {
-        return trades;
+    // Cancel a resting order
+    int cancel_order(const std::string& user_address, const std::string& order_id) {
+        std::map<std::string, Order>::iterator entry = orders.find(order_id);
+        if (entry == orders.end() || entry->second.user_address != user_address) {
+            return ORDER_CANCEL_UNKNOWN_ORDER;
+        }
+        if (entry->second.status != OPEN && entry->second.status != PARTIALLY_FILLED) {
+            return ORDER_CANCEL_NOT_OPEN;
+        }
+        
+        withdraw(entry->second, CANCELLED);
+        publish_summary();
+#ifdef ENCLAVE_ORDER_TRACE
+        printf("[Enclave] Order cancelled: %s\n", order_id.c_str());
+#endif
+        return ORDER_CANCEL_OK;
     }
     
-    // Get trades for a specific user
-    std::vector<Trade> get_user_trades(const std::string& user_address) {
-        std::vector<Trade> user_trades;
-        for (const auto& trade : trades) {
-            if (trade.maker_address == user_address || trade.taker_address == user_address) {
-                user_trades.push_back(trade);
-            }
+    // Expire the orders due by clock reading now; returns how many. Orders
+    // already past their time still rest until the clock gets there.
+    size_t expire_orders(time_t now) {
+        timers.advance(now);
+        return withdraw_expired();
+    }
+    
+    // Close the trading session: expire every day order; returns how many
+    size_t close_session() {
+        timers.close_session();
+        return withdraw_expired();
+    }
+    
+    // A limit price on the book's tick, when it is within the tick's
+    // tolerance; both ladders have the same tick
+    double snap_price(double price) const {
+        return ladders[BUY].snap(price);
+    }
+    
+    // Lay both ladders out in ticks of tick; false once orders rest
+    bool set_price_tick(double tick) {
+        if (ladders[BUY].levels() > 0 || ladders[SELL].levels() > 0) {
+            return false;
         }
-        return user_trades;
+        return ladders[BUY].set_tick(tick) && ladders[SELL].set_tick(tick);
+    }
+    
+    // The latest clock reading the book's orders have expired up to
+    time_t expiry_clock() const {
+        return (time_t)timers.now();
+    }
+    
+    // Write one trade as a JSON object; returns the length snprintf reports.
+    // exact keeps every digit of price and quantity, as a proof's leaf has them.
+    static int format_trade_json(const Trade& trade, const char* separator, char* out, size_t out_size,
+                                 bool exact = false) {
+#define TRADE_JSON_FORMAT(number) \
+        "%s{\"seq\":%llu," \
+        "\"id\":\"%s\"," \
+        "\"maker\":\"%s\"," \
+        "\"taker\":\"%s\"," \
+        "\"taker_side\":\"%s\"," \
+        "\"price\":" number "," \
+        "\"quantity\":" number "," \
+        "\"timestamp\":%ld}"
+        return snprintf(out, out_size,
+                        exact ? TRADE_JSON_FORMAT("%.17g") : TRADE_JSON_FORMAT("%.2f"),
+                        separator,
+                        (unsigned long long)trade.seq,
+                        trade.id.c_str(),
+                        trade.maker_address.c_str(),
+                        trade.taker_address.c_str(),
+                        (trade.taker_side == BUY ? "buy" : "sell"),
+                        trade.price,
+                        trade.quantity,
+                        (long)trade.timestamp);
+#undef TRADE_JSON_FORMAT
     }
     
-    // Convert trades to JSON
-    std::string trades_to_json(const std::vector<Trade>& trades_list) {
-        std::string result = "[";
-        bool first = true;
+    // Serialize the trades matching query from sequence number cursor on,
+    // straight from the trade log into the caller's buffer. The sequence and
+    // time bounds become a window of log indices (direct for sequence numbers,
+    // binary search for timestamps); only user and side filter per trade, and
+    // a user's trades are walked through their own index.
+    //
+    // Runs without the book lock on the log as published when it starts: the
+    // trade count is loaded once, so appends made meanwhile are left for the
+    // next chunk and a clear meanwhile leaves this log to the caller's
+    // ReadGuard.
+    static size_t export_trades(const TradeLog& trades, const char* user_address, const trade_query_t* query,
+                                uint64_t cursor, char* out, size_t out_size, trade_export_t* progress) {
+        uint64_t start = stats_cycles();
+        size_t used = 0;
+        progress->count = 0;
+        progress->next_cursor = TRADE_EXPORT_END;
         
-        printf("[Enclave] Converting %zu trades to JSON\n", trades_list.size());
+        size_t count = trades.size();
+        uint64_t next_trade_seq = trades.first_seq() + count;
+        size_t first = trades.index_of_seq(std::max(cursor, query->since_seq), count);
+        size_t last = count;
+        if (query->until_seq != 0 && query->until_seq < next_trade_seq) {
+            last = trades.index_of_seq(query->until_seq + 1, count);
+        }
+        if (query->from_ts != 0) {
+            first = std::max(first, trades.first_at_or_after(query->from_ts, count));
+        }
+        if (query->to_ts != 0) {
+            last = std::min(last, trades.first_after(query->to_ts, count));
+        }
         
-        for (const auto& trade : trades_list) {
-            if (!first) {
-                result += ",";
+        // Log indices to visit: the window itself, or the user's trades inside it
+        const PublishedLog<uint64_t, 2, 28>* user_seqs = NULL;
+        size_t position = first;
+        size_t end = last;
+        if (user_address != NULL && user_address[0] != '\0') {
+            const UserTrades* entry = trades.find_user(user_address);
+            if (entry == NULL || first >= last) {
+                stats_record_json_export(stats_cycles() - start);
+                return 0;
             }
-            first = false;
-            
-            char trade_json[512]; // Increased buffer size
-            snprintf(trade_json, sizeof(trade_json), 
-                    "{\"id\":\"%s\","
-                    "\"maker\":\"%s\","
-                    "\"taker\":\"%s\","
-                    "\"taker_side\":\"%s\","
-                    "\"price\":%.2f,"
-                    "\"quantity\":%.2f,"
-                    "\"timestamp\":%ld}",
-                    trade.id.c_str(),
-                    trade.maker_address.c_str(),
-                    trade.taker_address.c_str(),
-                    (trade.taker_side == BUY ? "buy" : "sell"),
-                    trade.price,
-                    trade.quantity,
-                    (long)trade.timestamp);
-            
-            result += trade_json;
-            
-            // Debug output for each trade
-            printf("[Enclave] Added trade: %s\n", trade_json);
+            user_seqs = &entry->seqs;
+            position = lower_bound_seq(*user_seqs, trades[first].seq);
+            end = lower_bound_seq(*user_seqs, last < count ? trades[last].seq : next_trade_seq);
+        }
+        
+        for (; position < end; position++) {
+            const Trade& trade = user_seqs ? trades[trades.index_of_seq((*user_seqs)[position], count)]
+                                           : trades[position];
+            if (query->side >= 0 && trade.taker_side != query->side) {
+                continue;
+            }
+            if (query->limit != 0 && progress->count == query->limit) {
+                progress->next_cursor = trade.seq;
+                break;
+            }
+            int length = format_trade_json(trade, used == 0 ? "" : ",", out + used, out_size - used);
+            if (length < 0 || (size_t)length >= out_size - used) {
+                progress->next_cursor = trade.seq;
+                break;
+            }
+            used += (size_t)length;
+            progress->count++;
         }
         
-        result += "]";
-        return result;
+        stats_record_json_export(stats_cycles() - start);
+        return used;
+    }
+    
+    // Position of the first sequence number >= seq in a user's index
+    static size_t lower_bound_seq(const PublishedLog<uint64_t, 2, 28>& seqs, uint64_t seq) {
+        size_t low = 0;
+        size_t high = seqs.size();
+        while (low < high) {
+            size_t middle = low + (high - low) / 2;
+            if (seqs[middle] < seq) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        return low;
+    }
+    
+    // Readers: the trade log as last published, valid while their ReadGuard lives
+    const TradeLog* published_log() const {
+        return __atomic_load_n(&log, __ATOMIC_ACQUIRE);
+    }
+    
+    // Ledger access for the ECALLs; the caller holds the book lock
+    AccountLedger& accounts() {
+        return ledger;
+    }
+    
+    ClientKeyWindow& client_keys() {
+        return key_window;
+    }
+    
+    InputJournal& journal() {
+        return input_journal;
+    }
+    
+    // Hash of the trades the last add_order made, each its sequence number,
+    // price, quantity and maker and taker order IDs; empty unless journaling
+    uint64_t last_fills_hash() const {
+        return fills_hash;
+    }
+    
+    // Close this market's settlement window over the published log; like
+    // the other queries it never takes the book lock
+    int close_settlement(settlement_batch_t* batch, settlement_transfer_t* transfers, size_t max_transfers) {
+        ReadGuard guard;
+        return settlement.close(*published_log(), market, id_prefix, batch, transfers, max_transfers);
+    }
+    
+    // Let the pending batch go once the host is done with it
+    int ack_settlement(uint64_t number, const uint8_t* digest, bool* released) {
+        return settlement.acknowledge(number, digest, released);
+    }
+    
+    // On a standby: close the batch the primary journaled; the caller holds the book lock
+    bool replay_settlement(uint64_t number, uint64_t last_seq, const uint8_t* digest, settlement_batch_t* batch) {
+        return settlement.replay(*log, market, id_prefix, number, last_seq, digest, batch);
+    }
+    
+    // Inclusion proof of trade seq in its settlement batch; a query, like
+    // the trade exports
+    int prove_trade(uint64_t seq, trade_proof_t* proof) {
+        ReadGuard guard;
+        const TradeLog& trades = *published_log();
+        size_t count = trades.size();
+        if (seq == 0 || seq >= trades.first_seq() + count) {
+            return PROOF_UNKNOWN_TRADE;
+        }
+        int result = settlement.find(seq, &proof->batch);
+        if (result != PROOF_OK) {
+            return result;
+        }
+        if (proof->batch.first_seq < trades.first_seq()) {
+            return PROOF_UNAVAILABLE;
+        }
+        size_t first = trades.index_of_seq(proof->batch.first_seq, count);
+        size_t end = trades.index_of_seq(proof->batch.last_seq + 1, count);
+        size_t index = trades.index_of_seq(seq, count);
+        if (!merkle_prove(trades, first, end, index, proof)) {
+            return PROOF_FAILED;
+        }
+        format_trade_json(trades[index], "", proof->trade_json, sizeof(proof->trade_json), true);
+        return PROOF_OK;
+    }
+    
+    // Writer: show the current book summary to readers
+    void publish_summary() {
+        uint64_t seq = summary_seq;
+        __atomic_store_n(&summary_seq, seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        for (int side = BUY; side <= SELL; side++) {
+            __atomic_store_n(&summary.open_orders[side], resting_orders[side], __ATOMIC_RELAXED);
+            __atomic_store_n(&summary.price_levels[side], ladders[side].levels(), __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&summary.trade_count, (uint64_t)log->size(), __ATOMIC_RELAXED);
+        __atomic_store_n(&summary_seq, seq + 2, __ATOMIC_RELEASE);
+    }
+    
+    // Add this book's last published summary to the occupancy counts
+    void add_book_stats(book_stats_t* stats) const {
+        book_stats_t copy;
+        for (;;) {
+            uint64_t seq = __atomic_load_n(&summary_seq, __ATOMIC_ACQUIRE);
+            if (seq & 1) {
+                __builtin_ia32_pause();
+                continue;
+            }
+            for (int side = BUY; side <= SELL; side++) {
+                copy.open_orders[side] = __atomic_load_n(&summary.open_orders[side], __ATOMIC_RELAXED);
+                copy.price_levels[side] = __atomic_load_n(&summary.price_levels[side], __ATOMIC_RELAXED);
+            }
+            copy.trade_count = __atomic_load_n(&summary.trade_count, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&summary_seq, __ATOMIC_RELAXED) == seq) {
+                break;
+            }
+        }
+        for (int side = BUY; side <= SELL; side++) {
+            stats->open_orders[side] += copy.open_orders[side];
+            stats->price_levels[side] += copy.price_levels[side];
+        }
+        stats->trade_count += copy.trade_count;
     }
 
+    // Add this book's estimated heap use per structure. Walks the whole
+    // book, so it is meant for capacity planning and scrapes, not for the
+    // order path.
+    void add_memory_stats(memory_stats_t* stats) {
+        for (int side = BUY; side <= SELL; side++) {
+            ladders[side].measure(&stats->resting_orders);
+        }
+        
+        for (const auto& entry : orders) {
+            bool open = entry.second.status == OPEN || entry.second.status == PARTIALLY_FILLED;
+            memory_usage_t* usage = open ? &stats->open_order_records : &stats->terminal_order_records;
+            usage->count++;
+            usage->bytes += TREE_NODE_OVERHEAD + sizeof(entry) + string_heap_bytes(entry.first) +
+                            order_heap_bytes(entry.second);
+        }
+        
+        log->measure(&stats->trades, &stats->user_index, &stats->indexed_users);
+        ledger.measure(&stats->accounts);
+        key_window.measure(&stats->client_keys);
+        settlement.measure(&stats->batch_commitments);
+        timers.measure(&stats->order_timers);
+    }
+    
     // Clear all orders and trades
     void clear_all_data() {
         char log_buf[256];
@@ -379,20 +697,26 @@ public:
         snprintf(log_buf, sizeof(log_buf), "[Enclave] Clearing all orders and trades");
         ocall_log_message(log_buf);
         
-        // Clear the priority queues
-        while (!buy_orders.empty()) {
-            buy_orders.pop();
+        // Clear the price ladders
+        for (int side = BUY; side <= SELL; side++) {
+            ladders[side].clear();
         }
         
-        while (!sell_orders.empty()) {
-            sell_orders.pop();
-        }
-        
-        // Clear the orders map
+        // Clear the orders map, after the timers that point into it
+        timers.clear();
         orders.clear();
         
-        // Clear the trades vector
-        trades.clear();
+        // Start a new trade log; exports still reading the old one keep it
+        // until they finish
+        TradeLog* old_log = log;
+        __atomic_store_n(&log, new TradeLog(old_log->first_seq() + old_log->size()), __ATOMIC_RELEASE);
+        epoch_retire(TradeLog::destroy, old_log);
+        
+        for (int side = BUY; side <= SELL; side++) {
+            resting_orders[side] = 0;
+        }
+        ledger.clear_reservations();
+        publish_summary();
         
         snprintf(log_buf, sizeof(log_buf), "[Enclave] All orders and trades have been cleared");
         ocall_log_message(log_buf);
@@ -400,92 +724,898 @@ public:
 };
 
 // Initialize the static member outside the class
-OrderBookImpl* OrderBookImpl::instance = nullptr;
+OrderBookImpl* OrderBookImpl::instances[MARKET_COUNT] = {};
 
-// Helper function to get the order book instance
-OrderBookImpl* get_order_book() {
-    return OrderBookImpl::getInstance();
+// Helper function to get the order book of a market below MARKET_COUNT
+OrderBookImpl* get_order_book(int market) {
+    return OrderBookImpl::getInstance(market);
 }
 
-// Add an order to the book
-void ecall_add_order(const char* user_address, int order_type, 
-                    int order_side, double price, double quantity,
-                    char* order_id, size_t id_size) {
-    std::string address(user_address);
-    OrderType type = static_cast<OrderType>(order_type);
-    OrderSide side = static_cast<OrderSide>(order_side);
-    
-    std::string result = get_order_book()->add_order(address, type, side, price, quantity);
-    
-    // Copy the order ID to the output buffer
-    if (result.length() < id_size) {
-        strncpy(order_id, result.c_str(), result.length() + 1);
+static bool valid_market(int market) {
+    return market >= 0 && market < MARKET_COUNT;
+}
+
+// Market an order ID belongs to, from its "m<market>-" prefix; -1 if none is valid
+static int market_of_order_id(const char* order_id) {
+    if (order_id[0] != 'm') {
+        return 0;
+    }
+    int market = 0;
+    const char* digit = order_id + 1;
+    for (; *digit >= '0' && *digit <= '9' && market < MARKET_COUNT; digit++) {
+        market = market * 10 + (*digit - '0');
+    }
+    return digit > order_id + 1 && *digit == '-' && market > 0 && valid_market(market) ? market : -1;
+}
+
+// Copy an order ID to the output buffer, truncated if it does not fit
+static void copy_order_id(const std::string& id, char* order_id, size_t id_size) {
+    if (id.length() < id_size) {
+        strncpy(order_id, id.c_str(), id.length() + 1);
     } else {
-        // Buffer too small, truncate
-        strncpy(order_id, result.c_str(), id_size - 1);
+        strncpy(order_id, id.c_str(), id_size - 1);
         order_id[id_size - 1] = '\0';
     }
 }
 
-// Get all trades
-size_t ecall_get_trades(char* trades_json, size_t json_size) {
-    std::vector<Trade> all_trades = get_order_book()->get_trades();
+// The clock reading an input is applied at
+static time_t read_clock() {
+    time_t now = 0;
+    ocall_get_current_time(&now);
+    return now;
+}
+
+// Copy at most size - 1 bytes of text into a journal field, NUL-padded
+static void copy_journal_field(char* field, size_t size, const char* text) {
+    strncpy(field, text, size - 1);
+}
+
+// Expire a book's orders due by clock reading now; the caller holds its
+// lock. Expiries are journaled only when there are some: a standby's clock
+// only has to reach the same readings where they happened.
+static size_t expire_orders_locked(OrderBookImpl* book, time_t now) {
+    uint64_t expired = book->expire_orders(now);
+    if (expired > 0 && book->journal().recording()) {
+        replica_input_t input;
+        memset(&input, 0, sizeof(input));
+        input.time = now;
+        input.kind = REPLICA_INPUT_EXPIRY;
+        book->journal().record(&input, InputJournal::fold(InputJournal::EMPTY_HASH, &expired, sizeof(expired)));
+    }
+    return expired;
+}
+
+// Expire a book's day orders; the caller holds its lock
+static size_t close_session_locked(OrderBookImpl* book) {
+    uint64_t expired = book->close_session();
+    if (expired > 0 && book->journal().recording()) {
+        replica_input_t input;
+        memset(&input, 0, sizeof(input));
+        input.kind = REPLICA_INPUT_SESSION_CLOSE;
+        book->journal().record(&input, InputJournal::fold(InputJournal::EMPTY_HASH, &expired, sizeof(expired)));
+    }
+    return expired;
+}
+
+// Add an order to a book at clock reading now, first expiring what is due
+// by then; the caller holds its lock. sealed is set for an order that came
+// in an envelope.
+static int add_order_locked(OrderBookImpl* book, const char* user_address, int order_type, 
+                            int order_side, double price, double quantity, const char* client_key,
+                            int64_t expires, time_t now, char* order_id, size_t id_size, order_fill_t* fills,
+                            size_t max_fills, order_result_t* order_result, bool sealed = false) {
+    OrderType type = static_cast<OrderType>(order_type);
+    OrderSide side = static_cast<OrderSide>(order_side);
+    expire_orders_locked(book, now);
     
-    // Debug output to see if trades exist
-    char log_buf[256];
-    snprintf(log_buf, sizeof(log_buf), "[Enclave] Getting all trades, found %d trades", (int)all_trades.size());
-    ocall_log_message(log_buf);
+    // Orders a rounding error off a tick share its level, so they must
+    // share its price too: a limit is checked against the level's price,
+    // and the funds a fill needs are counted at it
+    if (type == LIMIT) {
+        price = book->snap_price(price);
+    }
+    
+    // A resend is answered with the first order, whatever the book looks like now
+    bool keyed = client_key != NULL && client_key[0] != '\0';
+    if (keyed) {
+        const std::string* original = book->client_keys().find(client_key);
+        if (original != NULL) {
+            copy_order_id(*original, order_id, id_size);
+            return ORDER_ADD_DUPLICATE;
+        }
+    }
+    
+    // Unfundable orders never reach the book
+    if (!book->accounts().can_fund(user_address, type, side, type == MARKET ? 0 : price, quantity)) {
+        return ORDER_ADD_INSUFFICIENT_FUNDS;
+    }
     
-    std::string json_str = get_order_book()->trades_to_json(all_trades);
+    // Nor do orders that would already have expired
+    if (expires < ORDER_EXPIRES_SESSION_CLOSE || (expires > ORDER_EXPIRES_NEVER && expires <= book->expiry_clock())) {
+        return ORDER_ADD_EXPIRED;
+    }
+    
+    // Near the budget new orders are turned away before anything is allocated
+    if (!book->has_memory_for_order()) {
+        return ORDER_ADD_BOOK_FULL;
+    }
     
-    // Debug output to see JSON string size
-    snprintf(log_buf, sizeof(log_buf), "[Enclave] JSON string length: %d, buffer size: %d", 
-             (int)json_str.length(), (int)json_size);
-    ocall_log_message(log_buf);
+    // The journal hashes the outcome, so there always is one
+    order_result_t outcome;
+    if (order_result == NULL) {
+        order_result = &outcome;
+    }
     
-    // Check if buffer is large enough
-    if (json_str.length() >= json_size) {
-        ocall_log_message("[Enclave] ERROR: Buffer too small for trades JSON");
-        return 0; // Buffer too small
+    std::string result;
+    std::string* claimed = NULL;
+    try {
+        // Claimed first, so nothing can fail once the order is in the book
+        if (keyed) {
+            claimed = book->client_keys().claim(client_key);
+        }
+        result = book->add_order(user_address, type, side, price, quantity, expires, now, fills, max_fills,
+                                 order_result, sealed);
+    } catch (const std::bad_alloc&) {
+        // The heap ran out below the budget, so the budget was wrong; an
+        // exception escaping the ECALL would abort the enclave instead
+        if (claimed != NULL) {
+            book->client_keys().forget(client_key);
+        }
+        memory_budget_lower();
+        printf("[Enclave] Out of memory adding an order; budget lowered to %zu bytes\n", memory_budget());
+        return ORDER_ADD_BOOK_FULL;
+    }
+    
+    if (book->journal().recording()) {
+        replica_input_t input;
+        memset(&input, 0, sizeof(input));
+        input.time = now;
+        input.kind = REPLICA_INPUT_ORDER;
+        input.order_type = order_type;
+        input.order_side = order_side;
+        input.price = price;
+        input.quantity = quantity;
+        input.expires = expires;
+        copy_journal_field(input.user_address, sizeof(input.user_address), user_address);
+        copy_journal_field(input.key, sizeof(input.key), keyed ? client_key : "");
+        uint64_t done = InputJournal::fold(InputJournal::EMPTY_HASH, result.data(), result.length());
+        done = InputJournal::fold(done, &order_result->fill_count, sizeof(order_result->fill_count));
+        done = InputJournal::fold(done, &order_result->filled_quantity, sizeof(order_result->filled_quantity));
+        done = InputJournal::fold(done, &order_result->status, sizeof(order_result->status));
+        uint64_t traded = book->last_fills_hash();
+        done = InputJournal::fold(done, &traded, sizeof(traded));
+        book->journal().record(&input, done);
+    }
+    
+    copy_order_id(result, order_id, id_size);
+    if (claimed != NULL) {
+        claimed->swap(result);
+    }
+    return ORDER_ADD_OK;
+}
+
+// Cancel an order in a book; the caller holds its lock
+static int cancel_order_locked(OrderBookImpl* book, const char* user_address, const char* order_id) {
+    int result = book->cancel_order(user_address, order_id);
+    if (result == ORDER_CANCEL_OK && book->journal().recording()) {
+        replica_input_t input;
+        memset(&input, 0, sizeof(input));
+        input.kind = REPLICA_INPUT_CANCEL;
+        copy_journal_field(input.user_address, sizeof(input.user_address), user_address);
+        copy_journal_field(input.key, sizeof(input.key), order_id);
+        book->journal().record(&input, 0);
+    }
+    return result;
+}
+
+// Credit a deposit in a book's ledger; the caller holds its lock
+static int credit_account_locked(OrderBookImpl* book, const char* user_address, int token, double amount,
+                                 const char* deposit_id) {
+    int result;
+    try {
+        result = book->accounts().credit(user_address, token, amount, deposit_id);
+    } catch (const std::bad_alloc&) {
+        memory_budget_lower();
+        return LEDGER_OUT_OF_MEMORY;
+    }
+    if (result == LEDGER_OK && book->journal().recording()) {
+        replica_input_t input;
+        memset(&input, 0, sizeof(input));
+        input.kind = REPLICA_INPUT_DEPOSIT;
+        input.order_type = token;
+        input.quantity = amount;
+        copy_journal_field(input.user_address, sizeof(input.user_address), user_address);
+        copy_journal_field(input.key, sizeof(input.key), deposit_id);
+        book->journal().record(&input, 0);
+    }
+    return result;
+}
+
+// Empty a book; the caller holds its lock
+static void clear_locked(OrderBookImpl* book) {
+    book->clear_all_data();
+    if (book->journal().recording()) {
+        replica_input_t input;
+        memset(&input, 0, sizeof(input));
+        input.kind = REPLICA_INPUT_CLEAR;
+        book->journal().record(&input, 0);
+    }
+}
+
+// A settlement batch closed; the caller holds the book lock, so the batch
+// takes its place among the other inputs. A standby closes the same batch
+// over its own trades and signs it itself; the digest only checks it.
+static void settlement_closed_locked(OrderBookImpl* book, const settlement_batch_t* batch) {
+    if (book->journal().recording()) {
+        replica_input_t input;
+        memset(&input, 0, sizeof(input));
+        input.kind = REPLICA_INPUT_SETTLEMENT;
+        input.batch_number = batch->number;
+        input.batch_last_seq = batch->last_seq;
+        memcpy(input.key, batch->digest, SETTLEMENT_DIGEST_SIZE);
+        book->journal().record(&input, 0);
+    }
+}
+
+// The pending settlement batch was acknowledged; the caller holds the book
+// lock. Until then a standby returns the batch again too.
+static void settlement_acked_locked(OrderBookImpl* book, uint64_t number, const uint8_t* digest) {
+    if (book->journal().recording()) {
+        replica_input_t input;
+        memset(&input, 0, sizeof(input));
+        input.kind = REPLICA_INPUT_SETTLEMENT_ACK;
+        input.batch_number = number;
+        memcpy(input.key, digest, SETTLEMENT_DIGEST_SIZE);
+        book->journal().record(&input, 0);
+    }
+}
+
+// Whether an order's terms can be matched: a known type and side and sane
+// amounts. Every way in checks them, since the host is not trusted.
+static bool valid_order_terms(int order_type, int order_side, double price, double quantity) {
+    return (order_type == LIMIT || order_type == MARKET) &&
+           (order_side == BUY || order_side == SELL) &&
+           quantity > 0 && quantity < HUGE_VAL &&
+           (order_type == MARKET || (price > 0 && price < HUGE_VAL));
+}
+
+// Add an order to a market's book
+int ecall_add_order(int market, const char* user_address, int order_type, 
+                    int order_side, double price, double quantity, const char* client_key,
+                    int64_t expires, char* order_id, size_t id_size, order_fill_t* fills,
+                    size_t max_fills, order_result_t* order_result) {
+    if (!valid_market(market)) {
+        return ORDER_ADD_UNKNOWN_MARKET;
+    }
+    if (user_address == NULL || user_address[0] == '\0' ||
+        !valid_order_terms(order_type, order_side, price, quantity)) {
+        return ORDER_ADD_INVALID;
+    }
+    OrderBookImpl* book = get_order_book(market);
+    time_t now = read_clock();
+    BookLock lock(&book->mutex);
+    epoch_reclaim();
+    return add_order_locked(book, user_address, order_type, order_side, price, quantity, client_key, expires,
+                            now, order_id, id_size, fills, max_fills, order_result);
+}
+
+// Cancel a resting order owned by user_address; its ID names the market
+int ecall_cancel_order(const char* user_address, const char* order_id) {
+    int market = market_of_order_id(order_id);
+    if (market < 0) {
+        return ORDER_CANCEL_UNKNOWN_ORDER;
+    }
+    OrderBookImpl* book = get_order_book(market);
+    BookLock lock(&book->mutex);
+    return cancel_order_locked(book, user_address, order_id);
+}
+
+// Expire the orders of every market due by the clock; the App calls it
+// once a second, so orders expire even in a book nobody trades in
+void ecall_expire_orders() {
+    time_t now = read_clock();
+    for (int market = 0; market < MARKET_COUNT; market++) {
+        OrderBookImpl* book = get_order_book(market);
+        BookLock lock(&book->mutex);
+        expire_orders_locked(book, now);
+    }
+}
+
+// Close a market's trading session, expiring all of its day orders
+int ecall_close_session(int market, uint64_t* expired) {
+    if (expired == NULL) {
+        return SESSION_CLOSE_INVALID;
+    }
+    *expired = 0;
+    if (!valid_market(market)) {
+        return SESSION_CLOSE_UNKNOWN_MARKET;
+    }
+    OrderBookImpl* book = get_order_book(market);
+    BookLock lock(&book->mutex);
+    *expired = close_session_locked(book);
+    return SESSION_CLOSE_OK;
+}
+
+// Export trades in chunks; the App calls again with progress->next_cursor until it is TRADE_EXPORT_END.
+// Reads the published log and never waits for a book lock.
+size_t ecall_export_trades(const char* user_address, const trade_query_t* query, uint64_t cursor,
+                           char* trades_json, size_t json_size, trade_export_t* progress) {
+    if (progress == NULL) {
+        return 0;
+    }
+    if (query == NULL || trades_json == NULL || !valid_market(query->market)) {
+        progress->count = 0;
+        progress->next_cursor = TRADE_EXPORT_END;
+        return 0;
+    }
+    ReadGuard guard;
+    return OrderBookImpl::export_trades(*get_order_book(query->market)->published_log(), user_address, query,
+                                        cursor, trades_json, json_size, progress);
+}
+
+// Net a market's trades since its last settlement batch into one transfer per
+// user and token. Reads the published log; only a primary with a standby
+// takes the book lock, to journal the batch.
+int ecall_close_settlement(int market, settlement_batch_t* batch, settlement_transfer_t* transfers,
+                           size_t max_transfers) {
+    if (!valid_market(market)) {
+        return SETTLEMENT_UNKNOWN_MARKET;
+    }
+    OrderBookImpl* book = get_order_book(market);
+    if (!book->journal().recording()) {
+        return book->close_settlement(batch, transfers, max_transfers);
     }
     
-    // Copy to output buffer
-    memcpy(trades_json, json_str.c_str(), json_str.length() + 1);
+    // Journaled at the point of the stream where it was closed, so a
+    // standby has the same trades, and no more cleared, when it replays it
+    BookLock lock(&book->mutex);
+    int result = book->close_settlement(batch, transfers, max_transfers);
+    if (result == SETTLEMENT_OK) {
+        settlement_closed_locked(book, batch);
+    }
+    return result;
+}
+
+// The host stored and paid out batch number of a market, whose digest is
+// digest, so the enclave closes the next one. Like closing, only a primary
+// with a standby takes the book lock.
+int ecall_ack_settlement(int market, uint64_t number, const uint8_t* digest, size_t digest_size) {
+    if (!valid_market(market)) {
+        return SETTLEMENT_UNKNOWN_MARKET;
+    }
+    if (digest_size != SETTLEMENT_DIGEST_SIZE) {
+        return SETTLEMENT_UNKNOWN_BATCH;
+    }
+    OrderBookImpl* book = get_order_book(market);
+    bool released = false;
+    if (!book->journal().recording()) {
+        return book->ack_settlement(number, digest, &released);
+    }
     
-    return json_str.length();
+    BookLock lock(&book->mutex);
+    int result = book->ack_settlement(number, digest, &released);
+    if (released) {
+        settlement_acked_locked(book, number, digest);
+    }
+    return result;
+}
+
+// Prove that trade trade_seq of a market is in a signed settlement batch
+int ecall_get_trade_proof(int market, uint64_t trade_seq, trade_proof_t* proof) {
+    memset(proof, 0, sizeof(*proof));
+    if (!valid_market(market)) {
+        return PROOF_UNKNOWN_MARKET;
+    }
+    return get_order_book(market)->prove_trade(trade_seq, proof);
+}
+
+// The public key that settlement batches are signed with
+int ecall_get_signing_key(uint8_t* public_key, size_t key_size) {
+    if (key_size < COMMITMENT_KEY_SIZE) {
+        return -1;
+    }
+    return signing_key(public_key) ? 0 : -1;
 }
 
-// Get trades for a specific user
-size_t ecall_get_user_trades(const char* user_address, char* trades_json, size_t json_size) {
-    std::string address(user_address);
-    std::vector<Trade> user_trades = get_order_book()->get_user_trades(address);
+// Check orders against the users' balances from now on, in every market
+void ecall_enable_ledger() {
+    for (int market = 0; market < MARKET_COUNT; market++) {
+        OrderBookImpl* book = get_order_book(market);
+        BookLock lock(&book->mutex);
+        book->accounts().enable();
+    }
+}
+
+// Set the tick a market's price ladders are laid out in
+int ecall_set_price_tick(int market, double tick) {
+    if (!valid_market(market)) {
+        return PRICE_TICK_UNKNOWN_MARKET;
+    }
+    if (!(tick > 0 && tick < INFINITY)) {
+        return PRICE_TICK_INVALID;
+    }
+    OrderBookImpl* book = get_order_book(market);
+    BookLock lock(&book->mutex);
+    return book->set_price_tick(tick) ? PRICE_TICK_OK : PRICE_TICK_BOOK_NOT_EMPTY;
+}
+
+// Credit a deposit to a user's account, once per deposit_id
+int ecall_credit_account(int market, const char* user_address, int token, double amount, const char* deposit_id) {
+    if (!valid_market(market)) {
+        return LEDGER_UNKNOWN_MARKET;
+    }
+    OrderBookImpl* book = get_order_book(market);
+    BookLock lock(&book->mutex);
+    return credit_account_locked(book, user_address, token, amount, deposit_id);
+}
+
+// Get a user's balances in a market
+int ecall_get_account(int market, const char* user_address, account_balance_t* balance) {
+    memset(balance, 0, sizeof(*balance));
+    if (!valid_market(market)) {
+        return LEDGER_UNKNOWN_MARKET;
+    }
+    OrderBookImpl* book = get_order_book(market);
+    BookLock lock(&book->mutex);
+    if (!book->accounts().enabled()) {
+        return LEDGER_DISABLED;
+    }
+    return book->accounts().find(user_address, balance) ? LEDGER_OK : LEDGER_UNKNOWN_ACCOUNT;
+}
+
+// Clear all orders and trades of every market
+void ecall_clear_order_book() {
+    for (int market = 0; market < MARKET_COUNT; market++) {
+        OrderBookImpl* book = get_order_book(market);
+        BookLock lock(&book->mutex);
+        clear_locked(book);
+        epoch_reclaim();
+    }
+}
+
+// Get book occupancy gauges, summed over the markets; never waits for a book lock
+void ecall_get_book_stats(book_stats_t* stats) {
+    memset(stats, 0, sizeof(*stats));
+    for (int market = 0; market < MARKET_COUNT; market++) {
+        get_order_book(market)->add_book_stats(stats);
+    }
+    stats->heap_in_use = memory_heap_in_use();
+    stats->heap_budget = memory_budget();
+    stats->heap_high_water = memory_heap_high_water();
+    stats->allocations_total = memory_allocations();
+}
+
+// Get heap use per structure; reset != 0 restarts the allocation count
+void ecall_get_memory_stats(memory_stats_t* stats, int reset) {
+    // Allocation count at the last reset
+    static uint64_t allocations_mark = 0;
+    
+    memset(stats, 0, sizeof(*stats));
+    for (int market = 0; market < MARKET_COUNT; market++) {
+        OrderBookImpl* book = get_order_book(market);
+        BookLock lock(&book->mutex);
+        book->add_memory_stats(stats);
+    }
     
-    // Debug output to see if user trades exist
-    char log_buf[256];
-    snprintf(log_buf, sizeof(log_buf), "[Enclave] Getting trades for user %s, found %d trades", 
-             user_address, (int)user_trades.size());
-    ocall_log_message(log_buf);
+    stats->heap_in_use = memory_heap_in_use();
+    stats->heap_high_water = memory_heap_high_water();
+    stats->heap_budget = memory_budget();
+    stats->allocations_total = memory_allocations();
+    stats->allocations = stats->allocations_total - allocations_mark;
+    if (reset) {
+        allocations_mark = stats->allocations_total;
+    }
+}
+
+// ============================
+// Matching threads
+// ============================
+//
+// ecall_run_order_ring keeps a thread inside the enclave that takes orders
+// from the shared ring (see order_ring.h) instead of an ECALL per order.
+// Each market has its own queue in the ring, and a market's queue is only
+// ever drained by the thread holding that market's book lock, a batch at a
+// time. Worker w of n serves the markets m with m % n == w first; when
+// those queues are empty it steals whole queues of other markets whose
+// book it can lock, never single orders, so each market still matches its
+// orders one at a time in arrival order.
+//
+// Other ECALLs that change a book (direct orders, cancels, clears) take the
+// same lock and interleave between batches; exports and book stats do not
+// wait for it at all.
+
+// Empty polls before a matching thread goes to sleep
+#define ORDER_RING_SPIN 20000
+
+// Orders matched per hold of a book lock
+#define ORDER_RING_BATCH 64
+
+static sgx_thread_mutex_t ring_mutex = SGX_THREAD_MUTEX_INITIALIZER;
+static sgx_thread_cond_t ring_ready = SGX_THREAD_COND_INITIALIZER;
+
+// Next cell to match in each market's queue. Written under the market's
+// book lock; they start where the ring says, which is 0 unless a standby
+// takes over a ring its primary was serving.
+static uint64_t ring_heads[MARKET_COUNT];
+static const order_ring_t* ring_attached = NULL;
+
+static bool ring_request_ready(const order_ring_queue_t* queue, uint64_t head) {
+    const order_ring_request_t* cell = &queue->requests[head & (ORDER_RING_SIZE - 1)];
+    return __atomic_load_n(&cell->sequence, __ATOMIC_SEQ_CST) == head + 1;
+}
+
+// Whether any queue has a request waiting; a hint, as it reads the heads unlocked
+static bool ring_has_requests(const order_ring_t* ring) {
+    for (int market = 0; market < MARKET_COUNT; market++) {
+        if (ring_request_ready(&ring->queues[market], __atomic_load_n(&ring_heads[market], __ATOMIC_RELAXED))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool ring_stopping(const order_ring_t* ring) {
+    return __atomic_load_n(&ring->stop, __ATOMIC_ACQUIRE) != 0;
+}
+
+// Copy the request at head into the enclave and hand its cell back to the producers
+static bool take_ring_request(order_ring_queue_t* queue, uint64_t* head, order_ring_request_t* request) {
+    order_ring_request_t* cell = &queue->requests[*head & (ORDER_RING_SIZE - 1)];
+    if (__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) != *head + 1) {
+        return false;
+    }
+    memcpy(request, cell, sizeof(*request));
+    __atomic_store_n(&cell->sequence, *head + ORDER_RING_SIZE, __ATOMIC_RELEASE);
+    (*head)++;
+    return true;
+}
+
+// Whether the fields of an order from a fixed-layout struct can be matched:
+// terminated strings, a user, a known type and side and sane amounts
+static bool valid_order_fields(const char* user_address, size_t user_size, const char* client_key,
+                               size_t key_size, int order_type, int order_side, double price, double quantity) {
+    return memchr(user_address, '\0', user_size) != NULL && user_address[0] != '\0' &&
+           memchr(client_key, '\0', key_size) != NULL &&
+           valid_order_terms(order_type, order_side, price, quantity);
+}
+
+// Match one request at clock reading now and publish its reply; the caller
+// holds the book's lock
+static void match_ring_request(OrderBookImpl* book, order_ring_t* ring, const order_ring_request_t* request,
+                               time_t now) {
+    if (request->producer >= ORDER_RING_PRODUCERS) {
+        return;
+    }
+    order_ring_reply_t* reply = &ring->replies[request->producer];
     
-    std::string json_str = get_order_book()->trades_to_json(user_trades);
+    // The copy is ours, but its fields still came from the untrusted side
+    int result = ORDER_RING_INVALID;
+    if (valid_order_fields(request->user_address, sizeof(request->user_address), request->client_key,
+                           sizeof(request->client_key), request->order_type, request->order_side,
+                           request->price, request->quantity)) {
+        // Built in the enclave and copied out whole, so a host writing to
+        // the reply meanwhile cannot affect matching
+        char order_id[ORDER_RING_ORDER_ID_SIZE] = {0};
+        order_fill_t fills[ORDER_RING_MAX_FILLS];
+        order_result_t outcome;
+        result = add_order_locked(book, request->user_address, request->order_type, request->order_side,
+                                  request->price, request->quantity, request->client_key, request->expires,
+                                  now, order_id, sizeof(order_id),
+                                  fills, ORDER_RING_MAX_FILLS, &outcome);
+        memcpy(reply->order_id, order_id, sizeof(order_id));
+        if (result == ORDER_ADD_OK) {
+            size_t reported = outcome.fill_count < ORDER_RING_MAX_FILLS ? (size_t)outcome.fill_count
+                                                                         : ORDER_RING_MAX_FILLS;
+            memcpy(&reply->outcome, &outcome, sizeof(outcome));
+            memcpy(reply->fills, fills, reported * sizeof(order_fill_t));
+        }
+    }
+    reply->result = result;
+    __atomic_store_n(&reply->done, request->ticket, __ATOMIC_RELEASE);
+}
+
+// Match a batch from one market's queue if it has requests and no other
+// thread holds its book; returns whether anything was matched
+static bool serve_market(order_ring_t* ring, int market) {
+    order_ring_queue_t* queue = &ring->queues[market];
+    if (!ring_request_ready(queue, __atomic_load_n(&ring_heads[market], __ATOMIC_RELAXED))) {
+        return false;
+    }
+    OrderBookImpl* book = get_order_book(market);
+    if (sgx_thread_mutex_trylock(&book->mutex) != 0) {
+        return false;
+    }
     
-    // Debug output to see JSON string size
-    snprintf(log_buf, sizeof(log_buf), "[Enclave] JSON string length: %d, buffer size: %d", 
-             (int)json_str.length(), (int)json_size);
-    ocall_log_message(log_buf);
+    // One clock reading serves the whole batch
+    epoch_reclaim();
+    time_t now = read_clock();
+    uint64_t head = ring_heads[market];
+    order_ring_request_t request;
+    int batch = 0;
+    while (batch < ORDER_RING_BATCH && take_ring_request(queue, &head, &request)) {
+        match_ring_request(book, ring, &request, now);
+        batch++;
+    }
+    __atomic_store_n(&ring_heads[market], head, __ATOMIC_RELAXED);
+    __atomic_store_n(&queue->head, head, __ATOMIC_RELEASE);
+    sgx_thread_mutex_unlock(&book->mutex);
+    return batch > 0;
+}
+
+// One pass over the worker's own markets, or over everybody else's
+static bool serve_markets(order_ring_t* ring, int worker, int workers, bool own) {
+    bool served = false;
+    for (int i = 0; i < MARKET_COUNT; i++) {
+        int market = (worker + i) % MARKET_COUNT;
+        if ((market % workers == worker) == own && serve_market(ring, market)) {
+            served = true;
+        }
+    }
+    return served;
+}
+
+// Block until a request arrives or the ring is stopped. The thread counts
+// itself in sleeping before its last look at the ring, so a producer
+// publishing a request either is seen here or sees sleeping and wakes us.
+static void wait_for_ring(order_ring_t* ring) {
+    sgx_thread_mutex_lock(&ring_mutex);
+    __atomic_add_fetch(&ring->sleeping, 1, __ATOMIC_SEQ_CST);
+    while (!ring_has_requests(ring) && !ring_stopping(ring)) {
+        sgx_thread_cond_wait(&ring_ready, &ring_mutex);
+    }
+    __atomic_sub_fetch(&ring->sleeping, 1, __ATOMIC_RELAXED);
+    sgx_thread_mutex_unlock(&ring_mutex);
+}
+
+// Match orders from the ring as worker of ring->workers until ring->stop is set
+void ecall_run_order_ring(order_ring_t* ring, int worker) {
+    if (ring == NULL || !sgx_is_outside_enclave(ring, sizeof(*ring))) {
+        return;
+    }
+    int workers = (int)__atomic_load_n(&ring->workers, __ATOMIC_RELAXED);
+    if (workers < 1 || workers > MARKET_COUNT || worker < 0 || worker >= workers) {
+        return;
+    }
     
-    // Check if buffer is large enough
-    if (json_str.length() >= json_size) {
-        ocall_log_message("[Enclave] ERROR: Buffer too small for user trades JSON");
-        return 0; // Buffer too small
+    // The first worker in picks up the queues where the App's heads are;
+    // a wrong head only stalls its queue, as cells carry their own turn
+    sgx_thread_mutex_lock(&ring_mutex);
+    if (ring_attached != ring) {
+        for (int market = 0; market < MARKET_COUNT; market++) {
+            OrderBookImpl* book = get_order_book(market);
+            BookLock lock(&book->mutex);
+            __atomic_store_n(&ring_heads[market], __atomic_load_n(&ring->queues[market].head, __ATOMIC_ACQUIRE),
+                             __ATOMIC_RELAXED);
+        }
+        ring_attached = ring;
     }
+    sgx_thread_mutex_unlock(&ring_mutex);
     
-    // Copy to output buffer
-    memcpy(trades_json, json_str.c_str(), json_str.length() + 1);
+    unsigned idle = 0;
+    while (!ring_stopping(ring)) {
+        // Steal only once the worker's own queues are empty
+        if (serve_markets(ring, worker, workers, true) || serve_markets(ring, worker, workers, false)) {
+            idle = 0;
+        } else if (++idle < ORDER_RING_SPIN) {
+            __builtin_ia32_pause();
+        } else {
+            wait_for_ring(ring);
+            idle = 0;
+        }
+    }
+}
+
+// Wake the sleeping matching threads after submitting to the ring, or to stop them
+void ecall_wake_order_ring() {
+    sgx_thread_mutex_lock(&ring_mutex);
+    sgx_thread_cond_broadcast(&ring_ready);
+    sgx_thread_mutex_unlock(&ring_mutex);
+}
+
+// ============================
+// Encrypted orders
+// ============================
+//
+// Envelopes (see order_envelope.h) arrive in batches, one ECALL each. A
+// batch is opened into a fixed array first, which needs no allocation and
+// takes no book lock, then matched a market at a time: each book is locked
+// once for all of the batch's orders in it, which keep their batch order,
+// at one clock reading.
+//
+// A standby's journal holds every order in the clear, in untrusted memory,
+// so once a journal is attached no session opens and no envelope is opened.
+
+// Set by ecall_attach_journal, never cleared
+static bool journal_attached = false;
+
+// Open a session for the client's public key, answering with the enclave's
+int ecall_open_order_session(const uint8_t* peer_key, size_t key_size, uint8_t* enclave_key,
+                             size_t enclave_key_size, uint64_t* session) {
+    if (key_size != ORDER_ENVELOPE_KEY_SIZE || enclave_key_size < ORDER_ENVELOPE_KEY_SIZE) {
+        return ORDER_SESSION_INVALID_KEY;
+    }
+    if (__atomic_load_n(&journal_attached, __ATOMIC_ACQUIRE)) {
+        return ORDER_SESSION_JOURNALED;
+    }
+    return open_order_session(peer_key, enclave_key, session);
+}
+
+// Match the opened orders of a batch, those whose result is still
+// ORDER_ADD_OK, a book at a time
+static void match_order_payloads(const order_payload_t* payloads, order_envelope_result_t* results,
+                                 size_t count) {
+    bool matched[ORDER_ENVELOPE_BATCH] = {false};
+    for (size_t first = 0; first < count; first++) {
+        if (matched[first] || results[first].result != ORDER_ADD_OK) {
+            continue;
+        }
+        int market = payloads[first].market;
+        OrderBookImpl* book = get_order_book(market);
+        time_t now = read_clock();
+        BookLock lock(&book->mutex);
+        epoch_reclaim();
+        for (size_t i = first; i < count; i++) {
+            if (matched[i] || results[i].result != ORDER_ADD_OK || payloads[i].market != market) {
+                continue;
+            }
+            const order_payload_t* order = &payloads[i];
+            results[i].result = add_order_locked(book, order->user_address, order->order_type, order->order_side,
+                                                 order->price, order->quantity, order->client_key, order->expires,
+                                                 now, results[i].order_id, sizeof(results[i].order_id),
+                                                 NULL, 0, &results[i].outcome, true);
+            matched[i] = true;
+        }
+    }
+}
+
+// Open and match a batch of encrypted orders, count of them, each result
+// in the place of its envelope
+void ecall_add_order_envelopes(const order_envelope_t* envelopes, size_t count,
+                               order_envelope_result_t* results) {
+    // Sessions opened before the journal was attached end with it
+    if (__atomic_load_n(&journal_attached, __ATOMIC_ACQUIRE)) {
+        for (size_t i = 0; i < count; i++) {
+            memset(&results[i], 0, sizeof(results[i]));
+            results[i].result = ORDER_ENVELOPE_JOURNALED;
+        }
+        return;
+    }
     
-    return json_str.length();
+    order_payload_t payloads[ORDER_ENVELOPE_BATCH];
+    for (size_t first = 0; first < count; first += ORDER_ENVELOPE_BATCH) {
+        size_t batch = count - first < ORDER_ENVELOPE_BATCH ? count - first : ORDER_ENVELOPE_BATCH;
+        for (size_t i = 0; i < batch; i++) {
+            order_envelope_result_t* result = &results[first + i];
+            memset(result, 0, sizeof(*result));
+            const order_payload_t* order = &payloads[i];
+            result->result = open_order_envelope(&envelopes[first + i], &payloads[i]);
+            if (result->result != 0) {
+                continue;
+            }
+            if (!valid_order_fields(order->user_address, sizeof(order->user_address), order->client_key,
+                                    sizeof(order->client_key), order->order_type, order->order_side,
+                                    order->price, order->quantity)) {
+                result->result = ORDER_ENVELOPE_INVALID;
+            } else if (!valid_market(order->market)) {
+                result->result = ORDER_ADD_UNKNOWN_MARKET;
+            }
+        }
+        match_order_payloads(payloads, results + first, batch);
+    }
 }
 
-// Clear all orders and trades
-void ecall_clear_order_book() {
-    get_order_book()->clear_all_data();
+// ============================
+// Standby replica
+// ============================
+//
+// A primary journals every input that changes a book (see replica_journal.h
+// and InputJournal); the App feeds the journal to a second enclave through
+// ecall_apply_inputs. The standby runs each input through the same code as
+// the primary did, at the primary's clock reading, so it builds the same
+// books, IDs and trades, and checks its state hash against the primary's
+// after every input. Promoting it is the App pointing its ECALLs at it.
+
+// Journal every input that changes a book to journal from now on
+void ecall_attach_journal(replica_journal_t* journal) {
+    if (journal == NULL || !sgx_is_outside_enclave(journal, sizeof(*journal))) {
+        return;
+    }
+    __atomic_store_n(&journal_attached, true, __ATOMIC_RELEASE);
+    for (int market = 0; market < MARKET_COUNT; market++) {
+        OrderBookImpl* book = get_order_book(market);
+        BookLock lock(&book->mutex);
+        book->journal().start(&journal->queues[market]);
+    }
+}
+
+// Apply one journaled input; the caller holds the book lock and checked its fields
+static void apply_input_locked(OrderBookImpl* book, const replica_input_t* input) {
+    char order_id[64];
+    switch (input->kind) {
+    case REPLICA_INPUT_ORDER:
+        add_order_locked(book, input->user_address, input->order_type, input->order_side, input->price,
+                         input->quantity, input->key, input->expires, (time_t)input->time, order_id,
+                         sizeof(order_id), NULL, 0, NULL);
+        break;
+    case REPLICA_INPUT_CANCEL:
+        cancel_order_locked(book, input->user_address, input->key);
+        break;
+    case REPLICA_INPUT_DEPOSIT:
+        credit_account_locked(book, input->user_address, input->order_type, input->quantity, input->key);
+        break;
+    case REPLICA_INPUT_CLEAR:
+        clear_locked(book);
+        epoch_reclaim();
+        break;
+    case REPLICA_INPUT_EXPIRY:
+        expire_orders_locked(book, (time_t)input->time);
+        break;
+    case REPLICA_INPUT_SESSION_CLOSE:
+        close_session_locked(book);
+        break;
+    case REPLICA_INPUT_SETTLEMENT: {
+        // Closed again over the standby's own trades, so it signs only what
+        // it matched itself; a batch that comes out different is not
+        // journaled, which shows as a divergence
+        settlement_batch_t batch;
+        if (book->replay_settlement(input->batch_number, input->batch_last_seq, (const uint8_t*)input->key,
+                                    &batch)) {
+            settlement_closed_locked(book, &batch);
+        }
+        break;
+    }
+    case REPLICA_INPUT_SETTLEMENT_ACK: {
+        // An ack that releases nothing here is not journaled either
+        bool released = false;
+        book->ack_settlement(input->batch_number, (const uint8_t*)input->key, &released);
+        if (released) {
+            settlement_acked_locked(book, input->batch_number, (const uint8_t*)input->key);
+        }
+        break;
+    }
+    }
+}
+
+// Apply the next inputs of a market's stream on a standby. An input that
+// does not reproduce the primary's state hash, or is not applied at all,
+// stops the standby for good.
+int ecall_apply_inputs(int market, const replica_input_t* inputs, size_t count, replica_status_t* status) {
+    memset(status, 0, sizeof(*status));
+    if (!valid_market(market)) {
+        return REPLICA_UNKNOWN_MARKET;
+    }
+    OrderBookImpl* book = get_order_book(market);
+    BookLock lock(&book->mutex);
+    epoch_reclaim();
+    InputJournal& journal = book->journal();
+    if (!journal.recording()) {
+        journal.start(NULL);
+    }
+    
+    int result = REPLICA_OK;
+    for (size_t i = 0; i < count && result == REPLICA_OK; i++) {
+        const replica_input_t* input = &inputs[i];
+        if (input->kind < REPLICA_INPUT_ORDER || input->kind > REPLICA_INPUT_SETTLEMENT_ACK ||
+            memchr(input->user_address, '\0', sizeof(input->user_address)) == NULL ||
+            memchr(input->key, '\0', sizeof(input->key)) == NULL ||
+            (input->kind == REPLICA_INPUT_ORDER &&
+             !valid_order_fields(input->user_address, sizeof(input->user_address), input->key,
+                                 sizeof(input->key), input->order_type, input->order_side, input->price,
+                                 input->quantity))) {
+            // The journal is in untrusted memory, so an order in it is checked like any other
+            result = REPLICA_INVALID;
+        } else if (input->seq != journal.last_seq() + 1) {
+            result = REPLICA_GAP;
+        } else {
+            apply_input_locked(book, input);
+            if (journal.last_seq() != input->seq || journal.state_hash() != input->state_hash) {
+                printf("[Enclave] Standby diverged from the primary at input %llu of market %d\n",
+                       (unsigned long long)input->seq, market);
+                result = REPLICA_DIVERGED;
+            }
+        }
+    }
+    status->applied_seq = journal.last_seq();
+    status->state_hash = journal.state_hash();
+    return result;
 }
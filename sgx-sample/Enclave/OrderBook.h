@@ -4,8 +4,8 @@
 #include <string>
 #include <vector>
 #include <map>
-#include <queue>
 #include <ctime>
+#include <stdint.h>
 
 enum OrderType {
     LIMIT = 0,
@@ -21,9 +21,12 @@ enum OrderStatus {
     OPEN = 0,
     FILLED = 1,
     PARTIALLY_FILLED = 2,
-    CANCELLED = 3
+    CANCELLED = 3,
+    EXPIRED = 4
 };
 
+struct WheelTimer;
+
 // Order structure (not exposed outside enclave)
 struct Order {
     std::string id;                // Unique order ID
@@ -35,35 +38,22 @@ struct Order {
     double remaining_quantity;     // Remaining quantity to be filled
     OrderStatus status;            // Current status
     time_t timestamp;              // Creation timestamp
+    int64_t expires;               // Expiry time, or ORDER_EXPIRES_*
+    WheelTimer* timer;             // Its armed expiry; set in the orders map entry only
+    Order* queue_prev;             // Neighbours in its price level's queue while it
+    Order* queue_next;             // rests; map entries link to each other
 };
 
 // Trade structure (exposed via API)
 struct Trade {
+    uint64_t seq;                  // Position in the trade log, gap-free from 1
     std::string id;                // Unique trade ID
     std::string maker_address;     // Ethereum address of maker
     std::string taker_address;     // Ethereum address of taker
     OrderSide taker_side;          // Side of the taker
     double price;                  // Execution price
     double quantity;               // Execution quantity
-    time_t timestamp;              // Execution timestamp
-};
-
-struct BuyOrderComparator {
-    bool operator()(const Order& a, const Order& b) const {
-        if (a.price == b.price) {
-            return a.timestamp > b.timestamp;
-        }
-        return a.price < b.price;
-    }
-};
-
-struct SellOrderComparator {
-    bool operator()(const Order& a, const Order& b) const {
-        if (a.price == b.price) {
-            return a.timestamp > b.timestamp;
-        }
-        return a.price > b.price;
-    }
+    time_t timestamp;              // Execution timestamp, never decreasing along the log
 };
 
 #endif
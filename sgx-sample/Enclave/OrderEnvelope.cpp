@@ -0,0 +1,164 @@
+#include "OrderEnvelope.h"
+#include "sgx_tcrypto.h"
+#include "sgx_thread.h"
+#include "sgx_trts.h"
+#include <string.h>
+
+// ============================
+// Order sessions
+// ============================
+
+#define SESSION_KEY_SIZE 16
+
+struct OrderSession {
+    uint64_t id;                    // 0 while the slot is free
+    uint64_t counter;               // Counter of the last envelope opened
+    sgx_aes_gcm_128bit_key_t key;
+};
+
+static sgx_thread_mutex_t session_mutex = SGX_THREAD_MUTEX_INITIALIZER;
+static OrderSession sessions[ORDER_SESSION_SLOTS];
+static uint64_t sessions_opened = 0;
+
+// The key exchange key, made on first use; like signing, key exchange is
+// serialized on its ECC context
+static sgx_thread_mutex_t exchange_mutex = SGX_THREAD_MUTEX_INITIALIZER;
+static sgx_ecc_state_handle_t exchange = NULL;
+static sgx_ec256_private_t private_key;
+static sgx_ec256_public_t public_key;
+
+static bool exchange_ready_locked()
+{
+    if (exchange != NULL) {
+        return true;
+    }
+    sgx_ecc_state_handle_t context = NULL;
+    if (sgx_ecc256_open_context(&context) != SGX_SUCCESS) {
+        return false;
+    }
+    if (sgx_ecc256_create_key_pair(&private_key, &public_key, context) != SGX_SUCCESS) {
+        sgx_ecc256_close_context(context);
+        return false;
+    }
+    exchange = context;
+    return true;
+}
+
+// The SDK keeps key coordinates little-endian
+static void copy_reversed(uint8_t* out, const uint8_t* in, size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        out[i] = in[size - 1 - i];
+    }
+}
+
+// Zero key material in a way the compiler keeps
+static void wipe(void* data, size_t size)
+{
+    volatile uint8_t* bytes = (volatile uint8_t*)data;
+    while (size--) {
+        *bytes++ = 0;
+    }
+}
+
+// The ECDH shared secret with the client's key; ORDER_SESSION_*
+static int exchange_keys(const uint8_t* peer_key, uint8_t* enclave_key, sgx_ec256_dh_shared_t* shared)
+{
+    sgx_ec256_public_t peer;
+    copy_reversed(peer.gx, peer_key, ORDER_ENVELOPE_KEY_SIZE / 2);
+    copy_reversed(peer.gy, peer_key + ORDER_ENVELOPE_KEY_SIZE / 2, ORDER_ENVELOPE_KEY_SIZE / 2);
+
+    sgx_thread_mutex_lock(&exchange_mutex);
+    int result = ORDER_SESSION_FAILED;
+    int valid = 0;
+    if (exchange_ready_locked() && sgx_ecc256_check_point(&peer, exchange, &valid) == SGX_SUCCESS) {
+        if (!valid) {
+            result = ORDER_SESSION_INVALID_KEY;
+        } else if (sgx_ecc256_compute_shared_dhkey(&private_key, &peer, shared, exchange) == SGX_SUCCESS) {
+            copy_reversed(enclave_key, public_key.gx, ORDER_ENVELOPE_KEY_SIZE / 2);
+            copy_reversed(enclave_key + ORDER_ENVELOPE_KEY_SIZE / 2, public_key.gy, ORDER_ENVELOPE_KEY_SIZE / 2);
+            result = ORDER_SESSION_OK;
+        }
+    }
+    sgx_thread_mutex_unlock(&exchange_mutex);
+    return result;
+}
+
+int open_order_session(const uint8_t* peer_key, uint8_t* enclave_key, uint64_t* session)
+{
+    sgx_ec256_dh_shared_t shared;
+    int result = exchange_keys(peer_key, enclave_key, &shared);
+    if (result != ORDER_SESSION_OK) {
+        return result;
+    }
+
+    // The key is the hash of the shared X coordinate, as the client sees it
+    uint8_t shared_x[sizeof(shared.s)];
+    sgx_sha256_hash_t digest;
+    uint64_t random = 0;
+    copy_reversed(shared_x, shared.s, sizeof(shared_x));
+    bool derived = sgx_sha256_msg(shared_x, sizeof(shared_x), &digest) == SGX_SUCCESS &&
+                   sgx_read_rand((unsigned char*)&random, sizeof(random)) == SGX_SUCCESS;
+    wipe(&shared, sizeof(shared));
+    wipe(shared_x, sizeof(shared_x));
+    if (!derived) {
+        wipe(digest, sizeof(digest));
+        return ORDER_SESSION_FAILED;
+    }
+
+    // The low bits of an ID are its slot, the rest random
+    sgx_thread_mutex_lock(&session_mutex);
+    uint64_t slot = sessions_opened++ % ORDER_SESSION_SLOTS;
+    uint64_t id = (random & ~(uint64_t)(ORDER_SESSION_SLOTS - 1)) | slot;
+    if (id == 0) {
+        id = ORDER_SESSION_SLOTS;
+    }
+    sessions[slot].id = id;
+    sessions[slot].counter = 0;
+    memcpy(sessions[slot].key, digest, SESSION_KEY_SIZE);
+    sgx_thread_mutex_unlock(&session_mutex);
+    wipe(digest, sizeof(digest));
+    *session = id;
+    return ORDER_SESSION_OK;
+}
+
+int open_order_envelope(const order_envelope_t* envelope, order_payload_t* payload)
+{
+    uint64_t id = envelope->session;
+    uint64_t slot = id % ORDER_SESSION_SLOTS;
+    OrderSession session;
+    sgx_thread_mutex_lock(&session_mutex);
+    memcpy(&session, &sessions[slot], sizeof(session));
+    sgx_thread_mutex_unlock(&session_mutex);
+    if (id == 0 || session.id != id) {
+        wipe(&session, sizeof(session));
+        return ORDER_ENVELOPE_UNKNOWN_SESSION;
+    }
+
+    uint64_t counter = 0;
+    for (int i = ORDER_ENVELOPE_NONCE_SIZE - 8; i < ORDER_ENVELOPE_NONCE_SIZE; i++) {
+        counter = (counter << 8) | envelope->nonce[i];
+    }
+    uint8_t aad[sizeof(id)];
+    for (size_t i = 0; i < sizeof(aad); i++) {
+        aad[i] = (uint8_t)(id >> (8 * i));
+    }
+    bool opened = counter > session.counter &&
+                  sgx_rijndael128GCM_decrypt(&session.key, envelope->payload, sizeof(envelope->payload),
+                                             (uint8_t*)payload, envelope->nonce, ORDER_ENVELOPE_NONCE_SIZE,
+                                             aad, sizeof(aad),
+                                             (const sgx_aes_gcm_128bit_tag_t*)envelope->tag) == SGX_SUCCESS;
+    wipe(&session, sizeof(session));
+    if (!opened) {
+        return ORDER_ENVELOPE_REJECTED;
+    }
+
+    // Another thread may have opened a later envelope of the session meanwhile
+    sgx_thread_mutex_lock(&session_mutex);
+    bool fresh = sessions[slot].id == id && counter > sessions[slot].counter;
+    if (fresh) {
+        sessions[slot].counter = counter;
+    }
+    sgx_thread_mutex_unlock(&session_mutex);
+    return fresh ? 0 : ORDER_ENVELOPE_REJECTED;
+}
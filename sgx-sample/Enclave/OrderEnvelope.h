@@ -0,0 +1,26 @@
+#ifndef _ENCLAVE_ORDER_ENVELOPE_H_
+#define _ENCLAVE_ORDER_ENVELOPE_H_
+
+#include <stdint.h>
+#include "order_envelope.h"
+
+/*
+ * Order sessions and envelope opening (see order_envelope.h)
+ *
+ * Sessions sit in a fixed table of ORDER_SESSION_SLOTS, each holding its
+ * AES key and the last counter it accepted. A session ID carries its slot,
+ * so a lookup is an index and a compare, and new sessions take the slots
+ * in turn, replacing the oldest. Opening an envelope allocates nothing
+ * itself: the table lock is held only to read the key and to advance the
+ * counter, never across the decryption.
+ */
+
+// Open a session with the client's public key, writing the enclave's
+// public key and the session ID; ORDER_SESSION_*
+int open_order_session(const uint8_t* peer_key, uint8_t* enclave_key, uint64_t* session);
+
+// Decrypt envelope into payload and advance its session's counter; 0, or
+// ORDER_ENVELOPE_UNKNOWN_SESSION or ORDER_ENVELOPE_REJECTED
+int open_order_envelope(const order_envelope_t* envelope, order_payload_t* payload);
+
+#endif /* !_ENCLAVE_ORDER_ENVELOPE_H_ */
@@ -0,0 +1,305 @@
+#include "PriceLadder.h"
+#include <string.h>
+#include <cmath>
+
+// ============================
+// Price ladder
+// ============================
+
+// Ticks beyond which a price is left to the sparse map; below it a double
+// still resolves a thousandth of a tick
+#define TICK_LIMIT 1e12
+
+// Fraction of a tick a price may be off one and still be on it
+#define TICK_TOLERANCE 1e-3
+
+// 1 / tick when that is a whole number of ticks, else 0
+static double whole_ticks_per_unit(double tick)
+{
+    double per_unit = 1.0 / tick;
+    double whole = floor(per_unit + 0.5);
+    return whole >= 1 && fabs(per_unit - whole) <= 1e-9 * whole ? whole : 0;
+}
+
+PriceLadder::PriceLadder(OrderSide book_side)
+    : highest_first(book_side == BUY), tick_size(PRICE_TICK_DEFAULT),
+      ticks_per_unit(whole_ticks_per_unit(PRICE_TICK_DEFAULT)), base(0), dense_count(0), summary(0)
+{
+    memset(occupied, 0, sizeof(occupied));
+}
+
+PriceLadder::~PriceLadder()
+{
+    clear();
+}
+
+bool PriceLadder::set_tick(double tick)
+{
+    if (levels() > 0 || !(tick > 0 && tick < INFINITY)) {
+        return false;
+    }
+    tick_size = tick;
+    ticks_per_unit = whole_ticks_per_unit(tick);
+    return true;
+}
+
+double PriceLadder::snap(double price) const
+{
+    int64_t tick = tick_of(price);
+    return tick == PRICE_LEVEL_OFF_TICK ? price : tick_price(tick);
+}
+
+double PriceLadder::tick_price(int64_t tick) const
+{
+    return ticks_per_unit > 0 ? (double)tick / ticks_per_unit : (double)tick * tick_size;
+}
+
+int64_t PriceLadder::tick_of(double price) const
+{
+    double ticks = price / tick_size;
+    if (!(ticks > -TICK_LIMIT && ticks < TICK_LIMIT)) {
+        return PRICE_LEVEL_OFF_TICK;
+    }
+    double nearest = floor(ticks + 0.5);
+    if (fabs(ticks - nearest) > TICK_TOLERANCE) {
+        return PRICE_LEVEL_OFF_TICK;
+    }
+    return (int64_t)nearest;
+}
+
+long PriceLadder::slot_of(int64_t tick) const
+{
+    if (slots.empty() || tick == PRICE_LEVEL_OFF_TICK || tick < base || tick - base >= PRICE_LADDER_SLOTS) {
+        return -1;
+    }
+    return (long)(tick - base);
+}
+
+double PriceLadder::sparse_key(int64_t tick, double price) const
+{
+    return tick == PRICE_LEVEL_OFF_TICK ? price : tick_price(tick);
+}
+
+PriceLevel* PriceLadder::find(int64_t tick, double price) const
+{
+    long slot = slot_of(tick);
+    if (slot >= 0) {
+        return slots[slot];
+    }
+    if (sparse.empty()) {
+        return NULL;
+    }
+    std::map<double, PriceLevel*>::const_iterator entry = sparse.find(sparse_key(tick, price));
+    return entry == sparse.end() ? NULL : entry->second;
+}
+
+PriceLevel* PriceLadder::best() const
+{
+    PriceLevel* dense = NULL;
+    if (summary != 0) {
+        int word = highest_first ? 63 - __builtin_clzll(summary) : __builtin_ctzll(summary);
+        int bit = highest_first ? 63 - __builtin_clzll(occupied[word]) : __builtin_ctzll(occupied[word]);
+        dense = slots[word * 64 + bit];
+    }
+    if (sparse.empty()) {
+        return dense;
+    }
+    PriceLevel* far = highest_first ? sparse.rbegin()->second : sparse.begin()->second;
+    if (dense == NULL) {
+        return far;
+    }
+    bool far_better = highest_first ? far->price > dense->price : far->price < dense->price;
+    return far_better ? far : dense;
+}
+
+bool PriceLadder::leads(double price) const
+{
+    PriceLevel* level = best();
+    return level == NULL || (highest_first ? price > level->price : price < level->price);
+}
+
+void PriceLadder::occupy(long slot, PriceLevel* level)
+{
+    slots[slot] = level;
+    occupied[slot / 64] |= 1ULL << (slot % 64);
+    summary |= 1ULL << (slot / 64);
+    dense_count++;
+}
+
+void PriceLadder::vacate(long slot)
+{
+    slots[slot] = NULL;
+    occupied[slot / 64] &= ~(1ULL << (slot % 64));
+    if (occupied[slot / 64] == 0) {
+        summary &= ~(1ULL << (slot / 64));
+    }
+    dense_count--;
+}
+
+// Whether slot keeps a place when the window moves up by shift ticks
+static bool stays(long slot, int64_t shift)
+{
+    return slot - shift >= 0 && slot - shift < PRICE_LADDER_SLOTS;
+}
+
+void PriceLadder::recentre(int64_t tick)
+{
+    if (slots.empty()) {
+        slots.resize(PRICE_LADDER_SLOTS, NULL);
+    }
+    int64_t shift = tick - PRICE_LADDER_SLOTS / 2 - base;
+
+    // Levels the window leaves go into the map first, so running out of
+    // memory on the way leaves everything where it was
+    long slot = 0;
+    try {
+        for (; dense_count > 0 && slot < PRICE_LADDER_SLOTS; slot++) {
+            if (slots[slot] != NULL && !stays(slot, shift)) {
+                sparse[sparse_key(slots[slot]->tick, slots[slot]->price)] = slots[slot];
+            }
+        }
+    } catch (...) {
+        while (slot-- > 0) {
+            if (slots[slot] != NULL && !stays(slot, shift)) {
+                sparse.erase(sparse_key(slots[slot]->tick, slots[slot]->price));
+            }
+        }
+        throw;
+    }
+
+    // Move the levels that stay, reading each slot before it is written
+    if (shift > 0) {
+        for (slot = 0; slot < PRICE_LADDER_SLOTS; slot++) {
+            slots[slot] = slot + shift < PRICE_LADDER_SLOTS ? slots[slot + shift] : NULL;
+        }
+    } else if (shift < 0) {
+        for (slot = PRICE_LADDER_SLOTS - 1; slot >= 0; slot--) {
+            slots[slot] = slot + shift >= 0 ? slots[slot + shift] : NULL;
+        }
+    }
+    base += shift;
+    memset(occupied, 0, sizeof(occupied));
+    summary = 0;
+    dense_count = 0;
+    for (slot = 0; slot < PRICE_LADDER_SLOTS; slot++) {
+        if (slots[slot] != NULL) {
+            occupy(slot, slots[slot]);
+        }
+    }
+
+    // Levels on a tick the window now covers come out of the map
+    if (sparse.empty()) {
+        return;
+    }
+    std::map<double, PriceLevel*>::iterator entry = sparse.lower_bound(((double)base - 0.5) * tick_size);
+    std::map<double, PriceLevel*>::iterator end =
+        sparse.lower_bound(((double)(base + PRICE_LADDER_SLOTS) - 0.5) * tick_size);
+    while (entry != end) {
+        slot = slot_of(entry->second->tick);
+        if (slot >= 0 && slots[slot] == NULL) {
+            occupy(slot, entry->second);
+            sparse.erase(entry++);
+        } else {
+            ++entry;
+        }
+    }
+}
+
+void PriceLadder::push(Order* order)
+{
+    order->queue_next = NULL;
+    int64_t tick = tick_of(order->price);
+    PriceLevel* level = find(tick, order->price);
+    if (level != NULL) {
+        order->queue_prev = level->back;
+        level->back->queue_next = order;
+        level->back = order;
+        level->length++;
+        return;
+    }
+
+    // A new best price outside the window moves the window to it
+    if (tick != PRICE_LEVEL_OFF_TICK && slot_of(tick) < 0 && leads(order->price)) {
+        recentre(tick);
+    }
+    level = new PriceLevel();
+    level->price = order->price;
+    level->tick = tick;
+    level->length = 1;
+    level->front = order;
+    level->back = order;
+    order->queue_prev = NULL;
+    long slot = slot_of(tick);
+    if (slot >= 0) {
+        occupy(slot, level);
+        return;
+    }
+    try {
+        sparse[sparse_key(tick, order->price)] = level;
+    } catch (...) {
+        delete level;
+        throw;
+    }
+}
+
+void PriceLadder::remove(Order* order)
+{
+    PriceLevel* level = find(tick_of(order->price), order->price);
+    if (level == NULL) {
+        return;
+    }
+    (order->queue_prev != NULL ? order->queue_prev->queue_next : level->front) = order->queue_next;
+    (order->queue_next != NULL ? order->queue_next->queue_prev : level->back) = order->queue_prev;
+    order->queue_prev = NULL;
+    order->queue_next = NULL;
+    if (--level->length > 0) {
+        return;
+    }
+    long slot = slot_of(level->tick);
+    if (slot >= 0) {
+        vacate(slot);
+    } else {
+        sparse.erase(sparse_key(level->tick, level->price));
+    }
+    delete level;
+
+    // An emptied window moves to the best price left, which never has to
+    // allocate: only levels come out of the map
+    if (dense_count == 0 && !sparse.empty()) {
+        PriceLevel* next = best();
+        if (next->tick != PRICE_LEVEL_OFF_TICK) {
+            recentre(next->tick);
+        }
+    }
+}
+
+void PriceLadder::clear()
+{
+    // The slots stay allocated for the orders to come
+    for (size_t slot = 0; slot < slots.size(); slot++) {
+        delete slots[slot];
+        slots[slot] = NULL;
+    }
+    for (std::map<double, PriceLevel*>::iterator entry = sparse.begin(); entry != sparse.end(); ++entry) {
+        delete entry->second;
+    }
+    sparse.clear();
+    memset(occupied, 0, sizeof(occupied));
+    summary = 0;
+    dense_count = 0;
+}
+
+void PriceLadder::measure(memory_usage_t* usage) const
+{
+    usage->bytes += slots.capacity() * sizeof(PriceLevel*) + levels() * sizeof(PriceLevel);
+    for (size_t slot = 0; slot < slots.size(); slot++) {
+        if (slots[slot] != NULL) {
+            usage->count += slots[slot]->length;
+        }
+    }
+    for (std::map<double, PriceLevel*>::const_iterator entry = sparse.begin(); entry != sparse.end(); ++entry) {
+        // Colour and parent/left/right links of a std::map node
+        usage->bytes += 4 * sizeof(void*) + sizeof(*entry);
+        usage->count += entry->second->length;
+    }
+}
@@ -0,0 +1,116 @@
+#ifndef _ENCLAVE_PRICE_LADDER_H_
+#define _ENCLAVE_PRICE_LADDER_H_
+
+#include <map>
+#include <vector>
+#include <stdint.h>
+#include "OrderBook.h"
+#include "user_types.h"
+
+// Tick of a level whose price is not on one, or too far out to have one
+#define PRICE_LEVEL_OFF_TICK INT64_MIN
+
+// Ticks in the dense window, 64 per occupancy word and at most 64 words
+#define PRICE_LADDER_SLOTS 1024
+#define PRICE_LADDER_WORDS (PRICE_LADDER_SLOTS / 64)
+
+// Orders resting at one price, in time priority: the orders map entries,
+// linked through their queue_prev and queue_next
+struct PriceLevel {
+    double price;                  // Of every order resting here
+    int64_t tick;                  // Orders within a tick's tolerance share its level
+    uint64_t length;
+    Order* front;
+    Order* back;
+};
+
+/*
+ * One side of a book as price levels, best first
+ *
+ * Most orders rest within a few hundred ticks of the best price, so levels
+ * there sit in a dense array of PRICE_LADDER_SLOTS ticks, with a bit per
+ * tick and a summary bit per 64 ticks: the best level is two bit scans and
+ * adding or finding a level is an index. Levels are told apart by tick, so
+ * prices a rounding error apart would share one; snap() moves such a price
+ * onto its tick before the order is matched, so every order on a level has
+ * the level's price. A level outside the window, or at a price off the
+ * ticks, goes to a sparse ordered map instead.
+ *
+ * The window follows the best price: a new best outside it, or a best left
+ * outside once the window empties, centres it there. The levels the window
+ * leaves move to the map and those it reaches move out of it.
+ *
+ * The slots are only allocated once the side has a resting order. Used
+ * with the book lock held.
+ */
+class PriceLadder {
+public:
+    PriceLadder(OrderSide book_side);
+    ~PriceLadder();
+
+    // Lay the window out in ticks of tick; false unless the side is empty
+    // and tick a positive price
+    bool set_tick(double tick);
+
+    // The price of the tick price is within the tolerance of, or price
+    // itself when it is off the ticks
+    double snap(double price) const;
+
+    // The best level, highest bid or lowest ask, or NULL
+    PriceLevel* best() const;
+
+    // Append order, its entry in the orders map, to the queue of its price,
+    // making the level if needed
+    void push(Order* order);
+
+    // Unlink a queued order, a cancelled, expired or filled one from
+    // anywhere in its queue, and drop its level once it is empty
+    void remove(Order* order);
+
+    // Levels with an order queued
+    uint64_t levels() const { return dense_count + sparse.size(); }
+
+    // Drop every level; the orders themselves belong to the map
+    void clear();
+
+    // Add the queued orders, and the levels and index that hold them, to usage
+    void measure(memory_usage_t* usage) const;
+
+private:
+    bool highest_first;
+    double tick_size;
+    double ticks_per_unit;                  // 1 / tick_size when that is a whole number, else 0
+    int64_t base;                           // Tick of slot 0
+    size_t dense_count;
+    std::vector<PriceLevel*> slots;
+    uint64_t occupied[PRICE_LADDER_WORDS];
+    uint64_t summary;                       // Bit w set while occupied[w] is not zero
+    std::map<double, PriceLevel*> sparse;   // By price, the tick's own for a level on one
+
+    // Tick price is on, or PRICE_LEVEL_OFF_TICK
+    int64_t tick_of(double price) const;
+
+    // Price of tick; exact for the decimal ticks, so a price like 0.57
+    // snaps to itself rather than to 57 * 0.01
+    double tick_price(int64_t tick) const;
+
+    // Slot of tick in the window, or -1
+    long slot_of(int64_t tick) const;
+
+    double sparse_key(int64_t tick, double price) const;
+    PriceLevel* find(int64_t tick, double price) const;
+
+    // Whether a level at price would be the best one
+    bool leads(double price) const;
+
+    // Centre the window on tick and move levels between it and the map.
+    // Throws std::bad_alloc and then leaves the window where it was.
+    void recentre(int64_t tick);
+    void occupy(long slot, PriceLevel* level);
+    void vacate(long slot);
+
+    PriceLadder(const PriceLadder&);
+    PriceLadder& operator=(const PriceLadder&);
+};
+
+#endif /* !_ENCLAVE_PRICE_LADDER_H_ */
@@ -0,0 +1,259 @@
+#include "Enclave.h"
+#include "Enclave_t.h"
+#include "Stats.h"
+#include <string.h>
+
+// ============================
+// Boundary profiler (trusted side)
+// ============================
+//
+// The Makefile links the enclave with --wrap for every profiled ECALL and
+// OCALL, so the edger8r bridges in Enclave_t.c enter through the __wrap_
+// functions below. ECALLs record the cycles spent between entry and exit;
+// OCALL proxies record the cycles spent outside the enclave, transitions
+// included. The App subtracts these from its own measurements to split
+// time inside from transition overhead.
+
+static boundary_stats_t boundary;
+
+static inline void record(uint64_t* calls, uint64_t* cycles, uint64_t start)
+{
+    __atomic_fetch_add(calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(cycles, stats_cycles() - start, __ATOMIC_RELAXED);
+}
+
+#define RECORD_ECALL(id, start) \
+    record(&boundary.ecall_calls[id], &boundary.ecall_inside_cycles[id], start)
+#define RECORD_OCALL(id, start) \
+    record(&boundary.ocall_calls[id], &boundary.ocall_outside_cycles[id], start)
+
+extern "C" {
+
+int __real_ecall_add_order(int market, const char* user_address, int order_type, int order_side,
+                           double price, double quantity, const char* client_key, int64_t expires, char* order_id,
+                           size_t id_size, order_fill_t* fills, size_t max_fills, order_result_t* result);
+size_t __real_ecall_export_trades(const char* user_address, const trade_query_t* query, uint64_t cursor,
+                                  char* trades_json, size_t json_size, trade_export_t* progress);
+void __real_ecall_clear_order_book(void);
+void __real_ecall_get_stats(enclave_stats_t* stats, int reset);
+void __real_ecall_get_book_stats(book_stats_t* stats);
+int __real_ecall_cancel_order(const char* user_address, const char* order_id);
+void __real_ecall_get_memory_stats(memory_stats_t* stats, int reset);
+void __real_ecall_wake_order_ring(void);
+int __real_ecall_close_settlement(int market, settlement_batch_t* batch, settlement_transfer_t* transfers,
+                                  size_t max_transfers);
+int __real_ecall_credit_account(int market, const char* user_address, int token, double amount,
+                                const char* deposit_id);
+int __real_ecall_get_account(int market, const char* user_address, account_balance_t* balance);
+int __real_ecall_get_trade_proof(int market, uint64_t trade_seq, trade_proof_t* proof);
+int __real_ecall_get_signing_key(uint8_t* public_key, size_t key_size);
+int __real_ecall_open_order_session(const uint8_t* peer_key, size_t key_size, uint8_t* enclave_key,
+                                    size_t enclave_key_size, uint64_t* session);
+void __real_ecall_add_order_envelopes(const order_envelope_t* envelopes, size_t count,
+                                      order_envelope_result_t* results);
+int __real_ecall_close_session(int market, uint64_t* expired);
+void __real_ecall_expire_orders(void);
+void __real_ecall_run_order_ring(order_ring_t* ring, int worker);
+int __real_ecall_ack_settlement(int market, uint64_t number, const uint8_t* digest, size_t digest_size);
+int __real_ecall_apply_inputs(int market, const replica_input_t* inputs, size_t count, replica_status_t* status);
+
+sgx_status_t __real_ocall_print_string(const char* str);
+sgx_status_t __real_ocall_get_current_time(time_t* time_value);
+sgx_status_t __real_ocall_log_message(const char* message);
+
+int __wrap_ecall_add_order(int market, const char* user_address, int order_type, int order_side,
+                           double price, double quantity, const char* client_key, int64_t expires, char* order_id,
+                           size_t id_size, order_fill_t* fills, size_t max_fills, order_result_t* result)
+{
+    uint64_t start = stats_cycles();
+    int status = __real_ecall_add_order(market, user_address, order_type, order_side, price, quantity,
+                                        client_key, expires, order_id, id_size, fills, max_fills, result);
+    RECORD_ECALL(ECALL_ID_ADD_ORDER, start);
+    return status;
+}
+
+size_t __wrap_ecall_export_trades(const char* user_address, const trade_query_t* query, uint64_t cursor,
+                                  char* trades_json, size_t json_size, trade_export_t* progress)
+{
+    uint64_t start = stats_cycles();
+    size_t result = __real_ecall_export_trades(user_address, query, cursor, trades_json, json_size, progress);
+    RECORD_ECALL(ECALL_ID_EXPORT_TRADES, start);
+    return result;
+}
+
+void __wrap_ecall_clear_order_book(void)
+{
+    uint64_t start = stats_cycles();
+    __real_ecall_clear_order_book();
+    RECORD_ECALL(ECALL_ID_CLEAR_ORDER_BOOK, start);
+}
+
+void __wrap_ecall_get_stats(enclave_stats_t* stats, int reset)
+{
+    uint64_t start = stats_cycles();
+    __real_ecall_get_stats(stats, reset);
+    RECORD_ECALL(ECALL_ID_GET_STATS, start);
+}
+
+void __wrap_ecall_get_book_stats(book_stats_t* stats)
+{
+    uint64_t start = stats_cycles();
+    __real_ecall_get_book_stats(stats);
+    RECORD_ECALL(ECALL_ID_GET_BOOK_STATS, start);
+}
+
+int __wrap_ecall_cancel_order(const char* user_address, const char* order_id)
+{
+    uint64_t start = stats_cycles();
+    int result = __real_ecall_cancel_order(user_address, order_id);
+    RECORD_ECALL(ECALL_ID_CANCEL_ORDER, start);
+    return result;
+}
+
+void __wrap_ecall_get_memory_stats(memory_stats_t* stats, int reset)
+{
+    uint64_t start = stats_cycles();
+    __real_ecall_get_memory_stats(stats, reset);
+    RECORD_ECALL(ECALL_ID_GET_MEMORY_STATS, start);
+}
+
+void __wrap_ecall_wake_order_ring(void)
+{
+    uint64_t start = stats_cycles();
+    __real_ecall_wake_order_ring();
+    RECORD_ECALL(ECALL_ID_WAKE_ORDER_RING, start);
+}
+
+int __wrap_ecall_close_settlement(int market, settlement_batch_t* batch, settlement_transfer_t* transfers,
+                                  size_t max_transfers)
+{
+    uint64_t start = stats_cycles();
+    int result = __real_ecall_close_settlement(market, batch, transfers, max_transfers);
+    RECORD_ECALL(ECALL_ID_CLOSE_SETTLEMENT, start);
+    return result;
+}
+
+int __wrap_ecall_credit_account(int market, const char* user_address, int token, double amount,
+                                const char* deposit_id)
+{
+    uint64_t start = stats_cycles();
+    int result = __real_ecall_credit_account(market, user_address, token, amount, deposit_id);
+    RECORD_ECALL(ECALL_ID_CREDIT_ACCOUNT, start);
+    return result;
+}
+
+int __wrap_ecall_get_account(int market, const char* user_address, account_balance_t* balance)
+{
+    uint64_t start = stats_cycles();
+    int result = __real_ecall_get_account(market, user_address, balance);
+    RECORD_ECALL(ECALL_ID_GET_ACCOUNT, start);
+    return result;
+}
+
+int __wrap_ecall_get_trade_proof(int market, uint64_t trade_seq, trade_proof_t* proof)
+{
+    uint64_t start = stats_cycles();
+    int result = __real_ecall_get_trade_proof(market, trade_seq, proof);
+    RECORD_ECALL(ECALL_ID_GET_TRADE_PROOF, start);
+    return result;
+}
+
+int __wrap_ecall_get_signing_key(uint8_t* public_key, size_t key_size)
+{
+    uint64_t start = stats_cycles();
+    int result = __real_ecall_get_signing_key(public_key, key_size);
+    RECORD_ECALL(ECALL_ID_GET_SIGNING_KEY, start);
+    return result;
+}
+
+int __wrap_ecall_open_order_session(const uint8_t* peer_key, size_t key_size, uint8_t* enclave_key,
+                                    size_t enclave_key_size, uint64_t* session)
+{
+    uint64_t start = stats_cycles();
+    int result = __real_ecall_open_order_session(peer_key, key_size, enclave_key, enclave_key_size, session);
+    RECORD_ECALL(ECALL_ID_OPEN_ORDER_SESSION, start);
+    return result;
+}
+
+void __wrap_ecall_add_order_envelopes(const order_envelope_t* envelopes, size_t count,
+                                      order_envelope_result_t* results)
+{
+    uint64_t start = stats_cycles();
+    __real_ecall_add_order_envelopes(envelopes, count, results);
+    RECORD_ECALL(ECALL_ID_ADD_ORDER_ENVELOPES, start);
+}
+
+int __wrap_ecall_close_session(int market, uint64_t* expired)
+{
+    uint64_t start = stats_cycles();
+    int result = __real_ecall_close_session(market, expired);
+    RECORD_ECALL(ECALL_ID_CLOSE_SESSION, start);
+    return result;
+}
+
+void __wrap_ecall_expire_orders(void)
+{
+    uint64_t start = stats_cycles();
+    __real_ecall_expire_orders();
+    RECORD_ECALL(ECALL_ID_EXPIRE_ORDERS, start);
+}
+
+// Recorded once per matching thread, when the thread stops
+void __wrap_ecall_run_order_ring(order_ring_t* ring, int worker)
+{
+    uint64_t start = stats_cycles();
+    __real_ecall_run_order_ring(ring, worker);
+    RECORD_ECALL(ECALL_ID_RUN_ORDER_RING, start);
+}
+
+int __wrap_ecall_ack_settlement(int market, uint64_t number, const uint8_t* digest, size_t digest_size)
+{
+    uint64_t start = stats_cycles();
+    int result = __real_ecall_ack_settlement(market, number, digest, digest_size);
+    RECORD_ECALL(ECALL_ID_ACK_SETTLEMENT, start);
+    return result;
+}
+
+int __wrap_ecall_apply_inputs(int market, const replica_input_t* inputs, size_t count, replica_status_t* status)
+{
+    uint64_t start = stats_cycles();
+    int result = __real_ecall_apply_inputs(market, inputs, count, status);
+    RECORD_ECALL(ECALL_ID_APPLY_INPUTS, start);
+    return result;
+}
+
+sgx_status_t __wrap_ocall_print_string(const char* str)
+{
+    uint64_t start = stats_cycles();
+    sgx_status_t status = __real_ocall_print_string(str);
+    RECORD_OCALL(OCALL_ID_PRINT_STRING, start);
+    return status;
+}
+
+sgx_status_t __wrap_ocall_get_current_time(time_t* time_value)
+{
+    uint64_t start = stats_cycles();
+    sgx_status_t status = __real_ocall_get_current_time(time_value);
+    RECORD_OCALL(OCALL_ID_GET_CURRENT_TIME, start);
+    return status;
+}
+
+sgx_status_t __wrap_ocall_log_message(const char* message)
+{
+    uint64_t start = stats_cycles();
+    sgx_status_t status = __real_ocall_log_message(message);
+    RECORD_OCALL(OCALL_ID_LOG_MESSAGE, start);
+    return status;
+}
+
+} // extern "C"
+
+// Snapshot of the enclave-side boundary counters
+void ecall_get_boundary_stats(boundary_stats_t* stats)
+{
+    uint64_t* out = (uint64_t*)stats;
+    const uint64_t* in = (const uint64_t*)&boundary;
+    for (size_t i = 0; i < sizeof(boundary) / sizeof(uint64_t); i++) {
+        out[i] = __atomic_load_n(&in[i], __ATOMIC_RELAXED);
+    }
+}
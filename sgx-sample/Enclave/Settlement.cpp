@@ -0,0 +1,291 @@
+#include "Settlement.h"
+#include "OrderBook.h"
+#include "TradeLog.h"
+#include "Memory.h"
+#include "Commitment.h"
+#include "sgx_tcrypto.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <new>
+#include <string>
+
+// ============================
+// Settlement netting
+// ============================
+
+// Fraction of what a user moved in a token that their net amount may be
+// off zero and still count as zero, left over from rounding
+#define NET_ZERO_TOLERANCE 1e-9
+
+// Net amounts of one user in the batch being built, by SETTLEMENT_TOKEN_*,
+// and the gross amounts that went into them
+struct NetPosition {
+    NetPosition() {
+        amount[SETTLEMENT_TOKEN_BASE] = amount[SETTLEMENT_TOKEN_QUOTE] = 0;
+        gross[SETTLEMENT_TOKEN_BASE] = gross[SETTLEMENT_TOKEN_QUOTE] = 0;
+    }
+    double amount[2];
+    double gross[2];
+
+    // Whether the user's trades cancel out in token
+    bool nets_out(int token) const { return fabs(amount[token]) <= gross[token] * NET_ZERO_TOLERANCE; }
+};
+
+// Users in address order, which is the order of the transfers
+typedef std::map<std::string, NetPosition> NetPositions;
+
+// The digest laid out in settlement_batch_t, over batch->previous_digest
+static bool hash_batch(settlement_batch_t* batch, const settlement_transfer_t* transfers)
+{
+    sgx_sha_state_handle_t sha = NULL;
+    if (sgx_sha256_init(&sha) != SGX_SUCCESS) {
+        return false;
+    }
+    sgx_sha256_update(batch->previous_digest, SETTLEMENT_DIGEST_SIZE, sha);
+    hash_integer(sha, (uint32_t)batch->market, 4);
+    hash_integer(sha, batch->number, 8);
+    hash_integer(sha, batch->first_seq, 8);
+    hash_integer(sha, batch->last_seq, 8);
+    hash_integer(sha, batch->transfer_count, 8);
+    for (uint64_t i = 0; i < batch->transfer_count; i++) {
+        uint64_t amount_bits;
+        memcpy(&amount_bits, &transfers[i].amount, sizeof(amount_bits));
+        sgx_sha256_update((const uint8_t*)transfers[i].user_address, SETTLEMENT_ADDRESS_SIZE, sha);
+        hash_integer(sha, (uint32_t)transfers[i].token, 4);
+        hash_integer(sha, amount_bits, 8);
+    }
+    sgx_sha256_hash_t hash;
+    bool hashed = sgx_sha256_get_hash(sha, &hash) == SGX_SUCCESS;
+    sgx_sha256_close(sha);
+    memcpy(batch->digest, hash, SETTLEMENT_DIGEST_SIZE);
+    return hashed;
+}
+
+// Net one trade: the buyer receives base and pays quote, the seller the reverse
+static void net_trade(NetPositions& positions, const Trade& trade)
+{
+    const std::string& buyer = trade.taker_side == BUY ? trade.taker_address : trade.maker_address;
+    const std::string& seller = trade.taker_side == BUY ? trade.maker_address : trade.taker_address;
+    double value = trade.price * trade.quantity;
+    NetPosition& bought = positions[buyer];
+    NetPosition& sold = positions[seller];
+    bought.amount[SETTLEMENT_TOKEN_BASE] += trade.quantity;
+    bought.amount[SETTLEMENT_TOKEN_QUOTE] -= value;
+    sold.amount[SETTLEMENT_TOKEN_BASE] -= trade.quantity;
+    sold.amount[SETTLEMENT_TOKEN_QUOTE] += value;
+    bought.gross[SETTLEMENT_TOKEN_BASE] += trade.quantity;
+    bought.gross[SETTLEMENT_TOKEN_QUOTE] += value;
+    sold.gross[SETTLEMENT_TOKEN_BASE] += trade.quantity;
+    sold.gross[SETTLEMENT_TOKEN_QUOTE] += value;
+}
+
+SettlementWindow::SettlementWindow() : settled_seq(1), batches(0), pending(false)
+{
+    sgx_thread_mutex_init(&mutex, NULL);
+    memset(digest, 0, sizeof(digest));
+}
+
+int SettlementWindow::close(const TradeLog& trades, int market, const char* id_prefix, settlement_batch_t* batch,
+                            settlement_transfer_t* transfers, size_t max_transfers)
+{
+    sgx_thread_mutex_lock(&mutex);
+    int result = SETTLEMENT_OK;
+    if (pending) {
+        if (pending_transfers.size() > max_transfers) {
+            result = SETTLEMENT_BUFFER_TOO_SMALL;
+        } else {
+            *batch = closed.back();
+            if (!pending_transfers.empty()) {
+                memcpy(transfers, pending_transfers.data(), pending_transfers.size() * sizeof(settlement_transfer_t));
+            }
+            result = SETTLEMENT_PENDING;
+        }
+        sgx_thread_mutex_unlock(&mutex);
+        return result;
+    }
+    try {
+        result = close_locked(trades, market, id_prefix, 0, batch, transfers, max_transfers, NULL);
+        if (result == SETTLEMENT_OK) {
+            commit_locked(batch, transfers);
+        }
+    } catch (const std::bad_alloc&) {
+        memory_budget_lower();
+        printf("[Enclave] Out of memory closing a settlement batch; budget lowered to %zu bytes\n", memory_budget());
+        result = SETTLEMENT_OUT_OF_MEMORY;
+    }
+    sgx_thread_mutex_unlock(&mutex);
+    return result;
+}
+
+bool SettlementWindow::replay(const TradeLog& trades, int market, const char* id_prefix, uint64_t number,
+                              uint64_t last_seq, const uint8_t* batch_digest, settlement_batch_t* batch)
+{
+    sgx_thread_mutex_lock(&mutex);
+    bool replayed = false;
+    try {
+        // The primary closes nothing while a batch is pending, so neither does a standby
+        std::vector<settlement_transfer_t> owned;
+        replayed = !pending &&
+                   close_locked(trades, market, id_prefix, last_seq, batch, NULL, 0, &owned) == SETTLEMENT_OK &&
+                   batch->number == number && batch->last_seq == last_seq &&
+                   memcmp(batch->digest, batch_digest, SETTLEMENT_DIGEST_SIZE) == 0;
+        if (replayed) {
+            commit_locked(batch, owned.data());
+        }
+    } catch (const std::bad_alloc&) {
+        memory_budget_lower();
+        replayed = false;
+    }
+    sgx_thread_mutex_unlock(&mutex);
+    return replayed;
+}
+
+int SettlementWindow::acknowledge(uint64_t number, const uint8_t* batch_digest, bool* released)
+{
+    sgx_thread_mutex_lock(&mutex);
+    *released = false;
+    int result = SETTLEMENT_UNKNOWN_BATCH;
+    if (number >= 1 && number <= closed.size() &&
+        memcmp(closed[number - 1].digest, batch_digest, SETTLEMENT_DIGEST_SIZE) == 0) {
+        // Only the last batch can be pending; an earlier one was acknowledged before
+        if (pending && number == closed.size()) {
+            std::vector<settlement_transfer_t>().swap(pending_transfers);
+            pending = false;
+            *released = true;
+        }
+        result = SETTLEMENT_OK;
+    }
+    sgx_thread_mutex_unlock(&mutex);
+    return result;
+}
+
+int SettlementWindow::find(uint64_t seq, settlement_batch_t* batch)
+{
+    sgx_thread_mutex_lock(&mutex);
+    int result = PROOF_NOT_SETTLED;
+    if (seq < settled_seq) {
+        // First batch ending at or after seq; a clear can have skipped seq
+        size_t low = 0;
+        size_t high = closed.size();
+        while (low < high) {
+            size_t middle = low + (high - low) / 2;
+            if (closed[middle].last_seq < seq) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        result = PROOF_UNAVAILABLE;
+        if (low < closed.size() && closed[low].first_seq <= seq) {
+            *batch = closed[low];
+            result = PROOF_OK;
+        }
+    }
+    sgx_thread_mutex_unlock(&mutex);
+    return result;
+}
+
+void SettlementWindow::measure(memory_usage_t* usage)
+{
+    sgx_thread_mutex_lock(&mutex);
+    usage->count += closed.size();
+    usage->bytes += closed.capacity() * sizeof(settlement_batch_t) +
+                    pending_transfers.capacity() * sizeof(settlement_transfer_t);
+    sgx_thread_mutex_unlock(&mutex);
+}
+
+void SettlementWindow::commit_locked(const settlement_batch_t* batch, const settlement_transfer_t* transfers)
+{
+    std::vector<settlement_transfer_t> kept(transfers, transfers + batch->transfer_count);
+    closed.push_back(*batch);
+    pending_transfers.swap(kept);
+    pending = true;
+    settled_seq = batch->last_seq + 1;
+    batches = batch->number;
+    memcpy(digest, batch->digest, SETTLEMENT_DIGEST_SIZE);
+}
+
+int SettlementWindow::close_locked(const TradeLog& trades, int market, const char* id_prefix, uint64_t until_seq,
+                                   settlement_batch_t* batch, settlement_transfer_t* transfers,
+                                   size_t max_transfers, std::vector<settlement_transfer_t>* owned)
+{
+    if (transfers == NULL) {
+        max_transfers = std::numeric_limits<size_t>::max() / 4;
+    }
+
+    // A clear drops the trades nobody settled; the next batch starts past
+    // them, which shows as a gap in the sequence numbers
+    size_t count = trades.size();
+    uint64_t first_seq = std::max(settled_seq, trades.first_seq());
+    if (first_seq >= trades.first_seq() + count) {
+        return SETTLEMENT_EMPTY;
+    }
+
+    // Take trades while every user they touch still has room for a transfer per token
+    NetPositions positions;
+    size_t first = trades.index_of_seq(first_seq, count);
+    size_t end = first;
+    for (; end < count; end++) {
+        const Trade& trade = trades[end];
+        if (until_seq != 0 && trade.seq > until_seq) {
+            break;
+        }
+        if (trade.maker_address.length() >= SETTLEMENT_ADDRESS_SIZE ||
+            trade.taker_address.length() >= SETTLEMENT_ADDRESS_SIZE) {
+            if (end == first) {
+                return SETTLEMENT_ADDRESS_TOO_LONG;
+            }
+            break;
+        }
+        size_t users = positions.size() + (positions.count(trade.maker_address) == 0) +
+                       (trade.taker_address != trade.maker_address && positions.count(trade.taker_address) == 0);
+        if (users * 2 > max_transfers) {
+            break;
+        }
+        net_trade(positions, trade);
+    }
+    if (end == first) {
+        return SETTLEMENT_BUFFER_TOO_SMALL;
+    }
+
+    if (transfers == NULL) {
+        owned->resize(positions.size() * 2);
+        transfers = owned->data();
+    }
+
+    // A user whose trades cancel out in a token gets no transfer in it
+    uint64_t transfer_count = 0;
+    for (NetPositions::const_iterator position = positions.begin(); position != positions.end(); ++position) {
+        for (int token = SETTLEMENT_TOKEN_BASE; token <= SETTLEMENT_TOKEN_QUOTE; token++) {
+            if (position->second.nets_out(token)) {
+                continue;
+            }
+            settlement_transfer_t* transfer = &transfers[transfer_count++];
+            memset(transfer->user_address, 0, sizeof(transfer->user_address));
+            memcpy(transfer->user_address, position->first.data(), position->first.length());
+            transfer->token = token;
+            transfer->amount = position->second.amount[token];
+        }
+    }
+
+    memset(batch, 0, sizeof(*batch));
+    batch->market = market;
+    batch->number = batches + 1;
+    batch->first_seq = trades[first].seq;
+    batch->last_seq = trades[end - 1].seq;
+    batch->trade_count = end - first;
+    batch->transfer_count = transfer_count;
+    batch->pending_trades = count - end;
+    snprintf(batch->batch_id, sizeof(batch->batch_id), "%sbatch-%llu-%llu", id_prefix,
+             (unsigned long long)batch->first_seq, (unsigned long long)batch->last_seq);
+    memcpy(batch->previous_digest, digest, SETTLEMENT_DIGEST_SIZE);
+    if (!hash_batch(batch, transfers) || !merkle_root(trades, first, end, batch->merkle_root) ||
+        !sign_batch(batch)) {
+        return SETTLEMENT_OUT_OF_MEMORY;
+    }
+    return SETTLEMENT_OK;
+}
@@ -0,0 +1,91 @@
+#ifndef _ENCLAVE_SETTLEMENT_H_
+#define _ENCLAVE_SETTLEMENT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "sgx_thread.h"
+#include "user_types.h"
+
+class TradeLog;
+
+/*
+ * Settlement windows of one market
+ *
+ * Each close nets the trades recorded since the previous batch into one
+ * transfer per user and token and chains the batch digest onto the last
+ * one (see settlement_batch_t), and signs the batch's commitment (see
+ * Commitment.h). Closing reads the published trade log like any query, so
+ * it never holds up matching; closes of the same market are serialized by
+ * a lock of their own. The batches closed are kept, without their
+ * transfers, to prove their trades.
+ *
+ * The last batch closed also keeps its transfers until the host
+ * acknowledges it, having stored and paid it out. Until then every close
+ * returns that batch again and closes no other, so a host that lost the
+ * reply or crashed half way gets the same batch back.
+ */
+class SettlementWindow {
+public:
+    SettlementWindow();
+
+    // Close the window over trades, which the caller keeps alive with a
+    // ReadGuard. Takes as many trades as max_transfers has room for and
+    // leaves the rest pending. Returns SETTLEMENT_*; on anything but
+    // SETTLEMENT_OK the window stays open. An unacknowledged batch comes
+    // back as SETTLEMENT_PENDING instead.
+    int close(const TradeLog& trades, int market, const char* id_prefix, settlement_batch_t* batch,
+              settlement_transfer_t* transfers, size_t max_transfers);
+
+    // The host is done with batch number, whose digest is batch_digest:
+    // SETTLEMENT_OK, also when it was acknowledged before, or
+    // SETTLEMENT_UNKNOWN_BATCH. *released tells whether this call let the
+    // pending batch go.
+    int acknowledge(uint64_t number, const uint8_t* batch_digest, bool* released);
+
+    // On a standby: close the batch the primary closed as number, up to
+    // last_seq, over the standby's own trades, and sign it with the
+    // standby's key. False, closing nothing, unless the batch comes out
+    // with the primary's digest.
+    bool replay(const TradeLog& trades, int market, const char* id_prefix, uint64_t number, uint64_t last_seq,
+                const uint8_t* batch_digest, settlement_batch_t* batch);
+
+    // The closed batch holding trade seq into batch; PROOF_OK, or
+    // PROOF_NOT_SETTLED or PROOF_UNAVAILABLE
+    int find(uint64_t seq, settlement_batch_t* batch);
+
+    // Add the batches kept to usage
+    void measure(memory_usage_t* usage);
+
+private:
+    sgx_thread_mutex_t mutex;
+
+    // First trade not yet in a batch
+    uint64_t settled_seq;
+
+    uint64_t batches;
+    uint8_t digest[SETTLEMENT_DIGEST_SIZE];
+
+    // Batch number n is closed[n - 1]
+    std::vector<settlement_batch_t> closed;
+
+    // Whether closed.back() waits for the host, and its transfers
+    bool pending;
+    std::vector<settlement_transfer_t> pending_transfers;
+
+    // Build the next batch, up to until_seq unless it is 0; with no
+    // transfers buffer given, every transfer fits and goes into owned.
+    // Changes nothing.
+    int close_locked(const TradeLog& trades, int market, const char* id_prefix, uint64_t until_seq,
+                     settlement_batch_t* batch, settlement_transfer_t* transfers, size_t max_transfers,
+                     std::vector<settlement_transfer_t>* owned);
+
+    // Make batch the last one closed, pending with its transfers; throws
+    // std::bad_alloc and then changes nothing
+    void commit_locked(const settlement_batch_t* batch, const settlement_transfer_t* transfers);
+
+    SettlementWindow(const SettlementWindow&);
+    SettlementWindow& operator=(const SettlementWindow&);
+};
+
+#endif /* !_ENCLAVE_SETTLEMENT_H_ */
@@ -0,0 +1,76 @@
+#include "Stats.h"
+#include "Enclave.h"
+#include "Enclave_t.h"
+#include <string.h>
+
+// ============================
+// Matching path statistics
+// ============================
+
+// Recorded with relaxed atomics rather than under a lock: every market's
+// matcher and every trade export records here, and none of them may wait
+// for another market or for a stats query copying the histograms out. A
+// query or reset running meanwhile may split one order's three samples
+// between two intervals, which a histogram does not notice.
+static enclave_stats_t stats;
+static uint64_t interval_start = 0;
+
+static void histogram_record(enclave_histogram_t* hist, uint64_t value)
+{
+    __atomic_fetch_add(&hist->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->sum, value, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+    while (value > max &&
+           !__atomic_compare_exchange_n(&hist->max, &max, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    __atomic_fetch_add(&hist->buckets[log_hist_index(value, ENCLAVE_STATS_SUB_BITS)], 1, __ATOMIC_RELAXED);
+}
+
+// Copy a histogram out field by field unless out is NULL, zeroing each
+// field as it goes on a reset
+static void histogram_read(enclave_histogram_t* hist, enclave_histogram_t* out, int reset)
+{
+    uint64_t* fields = (uint64_t*)hist;
+    uint64_t* copy = (uint64_t*)out;
+    for (size_t i = 0; i < sizeof(*hist) / sizeof(uint64_t); i++) {
+        uint64_t value = reset ? __atomic_exchange_n(&fields[i], 0, __ATOMIC_RELAXED)
+                               : __atomic_load_n(&fields[i], __ATOMIC_RELAXED);
+        if (copy != NULL) {
+            copy[i] = value;
+        }
+    }
+}
+
+void stats_record_add_order(uint64_t cycles, uint64_t fills, uint64_t levels)
+{
+    if (__atomic_load_n(&interval_start, __ATOMIC_RELAXED) == 0) {
+        uint64_t unset = 0;
+        __atomic_compare_exchange_n(&interval_start, &unset, stats_cycles(), false, __ATOMIC_RELAXED,
+                                    __ATOMIC_RELAXED);
+    }
+    histogram_record(&stats.add_order_cycles, cycles);
+    histogram_record(&stats.fills_per_order, fills);
+    histogram_record(&stats.levels_swept, levels);
+}
+
+void stats_record_json_export(uint64_t cycles)
+{
+    histogram_record(&stats.json_export_cycles, cycles);
+}
+
+// Copy out the statistics of the current interval, optionally starting a new one
+void ecall_get_stats(enclave_stats_t* out, int reset)
+{
+    uint64_t now = stats_cycles();
+    uint64_t unset = 0;
+    __atomic_compare_exchange_n(&interval_start, &unset, now, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    uint64_t started = reset ? __atomic_exchange_n(&interval_start, now, __ATOMIC_RELAXED)
+                             : __atomic_load_n(&interval_start, __ATOMIC_RELAXED);
+    if (out != NULL) {
+        out->interval_cycles = now - started;
+    }
+    histogram_read(&stats.add_order_cycles, out ? &out->add_order_cycles : NULL, reset);
+    histogram_read(&stats.fills_per_order, out ? &out->fills_per_order : NULL, reset);
+    histogram_read(&stats.levels_swept, out ? &out->levels_swept : NULL, reset);
+    histogram_read(&stats.json_export_cycles, out ? &out->json_export_cycles : NULL, reset);
+}
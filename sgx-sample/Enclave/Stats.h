@@ -0,0 +1,27 @@
+#ifndef _ENCLAVE_STATS_H_
+#define _ENCLAVE_STATS_H_
+
+#include <stdint.h>
+#include "user_types.h"
+
+/*
+ * Cycle counter for the matching path statistics. RDTSC is permitted inside
+ * SGX2 enclaves and in simulation mode, but on SGX1 parts it faults, so it is
+ * read only in builds that set ENCLAVE_RDTSC (SGX_RDTSC=1). Other builds read
+ * zero and only the count histograms are kept.
+ */
+static inline uint64_t stats_cycles(void)
+{
+#ifdef ENCLAVE_RDTSC
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+#else
+    return 0;
+#endif
+}
+
+void stats_record_add_order(uint64_t cycles, uint64_t fills, uint64_t levels);
+void stats_record_json_export(uint64_t cycles);
+
+#endif /* !_ENCLAVE_STATS_H_ */
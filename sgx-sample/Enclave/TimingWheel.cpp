@@ -0,0 +1,169 @@
+#include "TimingWheel.h"
+#include <string.h>
+
+// ============================
+// Timing wheel
+// ============================
+
+TimingWheel::TimingWheel() : current(0), armed(0)
+{
+    memset(occupied, 0, sizeof(occupied));
+    memset(lists, 0, sizeof(lists));
+}
+
+TimingWheel::~TimingWheel()
+{
+    clear();
+}
+
+void TimingWheel::push(WheelTimer* timer, int place)
+{
+    timer->place = place;
+    timer->next = lists[place];
+    timer->link = &lists[place];
+    if (timer->next != NULL) {
+        timer->next->link = &timer->next;
+    }
+    lists[place] = timer;
+    if (place < LEVEL_PLACES) {
+        occupied[place / TIMING_WHEEL_SLOTS] |= 1ULL << (place % TIMING_WHEEL_SLOTS);
+    }
+}
+
+void TimingWheel::unlink(WheelTimer* timer)
+{
+    *timer->link = timer->next;
+    if (timer->next != NULL) {
+        timer->next->link = timer->link;
+    }
+    if (timer->place < LEVEL_PLACES && lists[timer->place] == NULL) {
+        occupied[timer->place / TIMING_WHEEL_SLOTS] &= ~(1ULL << (timer->place % TIMING_WHEEL_SLOTS));
+    }
+}
+
+void TimingWheel::arm(WheelTimer* timer)
+{
+    if (timer->deadline <= current) {
+        push(timer, DUE_PLACE);
+        return;
+    }
+    uint64_t deadline = (uint64_t)timer->deadline;
+    uint64_t clock = (uint64_t)current;
+    for (int level = 0; level < TIMING_WHEEL_LEVELS; level++) {
+        int shift = TIMING_WHEEL_BITS * (level + 1);
+        if ((deadline >> shift) == (clock >> shift)) {
+            int slot = (int)(deadline >> (shift - TIMING_WHEEL_BITS)) & (TIMING_WHEEL_SLOTS - 1);
+            push(timer, level * TIMING_WHEEL_SLOTS + slot);
+            return;
+        }
+    }
+    push(timer, OVERFLOW_PLACE);
+}
+
+void TimingWheel::cascade(int place)
+{
+    WheelTimer* timer = lists[place];
+    lists[place] = NULL;
+    if (place < LEVEL_PLACES) {
+        occupied[place / TIMING_WHEEL_SLOTS] &= ~(1ULL << (place % TIMING_WHEEL_SLOTS));
+    }
+    while (timer != NULL) {
+        WheelTimer* next = timer->next;
+        arm(timer);
+        timer = next;
+    }
+}
+
+void TimingWheel::schedule(WheelTimer* timer, Order* order, int64_t deadline)
+{
+    timer->deadline = deadline;
+    timer->order = order;
+    order->timer = timer;
+    armed++;
+    if (deadline == ORDER_EXPIRES_SESSION_CLOSE) {
+        push(timer, SESSION_PLACE);
+    } else {
+        arm(timer);
+    }
+}
+
+void TimingWheel::cancel(WheelTimer* timer)
+{
+    unlink(timer);
+    timer->order->timer = NULL;
+    delete timer;
+    armed--;
+}
+
+void TimingWheel::advance(int64_t now)
+{
+    while (current < now) {
+        // The next clock reading with work: the first occupied slot of the
+        // lowest occupied level, which lies ahead of the clock's digit there
+        // and within the turn of the level above, so no higher level can
+        // need anything sooner
+        int level = 0;
+        while (level < TIMING_WHEEL_LEVELS && occupied[level] == 0) {
+            level++;
+        }
+        uint64_t next;
+        int place;
+        if (level < TIMING_WHEEL_LEVELS) {
+            int slot = __builtin_ctzll(occupied[level]);
+            int shift = TIMING_WHEEL_BITS * (level + 1);
+            next = ((uint64_t)current >> shift << shift) | ((uint64_t)slot << (shift - TIMING_WHEEL_BITS));
+            place = level * TIMING_WHEEL_SLOTS + slot;
+        } else if (lists[OVERFLOW_PLACE] != NULL) {
+            // Overflowed deadlines get placed again as the top level turns
+            int shift = TIMING_WHEEL_BITS * TIMING_WHEEL_LEVELS;
+            next = (((uint64_t)current >> shift) + 1) << shift;
+            place = OVERFLOW_PLACE;
+        } else {
+            break;
+        }
+        if ((int64_t)next > now) {
+            break;
+        }
+        // A level-0 slot holds exactly this second's deadlines, so it all falls due
+        current = (int64_t)next;
+        cascade(place);
+    }
+    if (now > current) {
+        current = now;
+    }
+}
+
+void TimingWheel::close_session()
+{
+    while (lists[SESSION_PLACE] != NULL) {
+        WheelTimer* timer = lists[SESSION_PLACE];
+        unlink(timer);
+        push(timer, DUE_PLACE);
+    }
+}
+
+Order* TimingWheel::take_due()
+{
+    WheelTimer* timer = lists[DUE_PLACE];
+    if (timer == NULL) {
+        return NULL;
+    }
+    Order* order = timer->order;
+    cancel(timer);
+    return order;
+}
+
+void TimingWheel::clear()
+{
+    for (int place = 0; place < PLACE_COUNT; place++) {
+        while (lists[place] != NULL) {
+            cancel(lists[place]);
+        }
+    }
+}
+
+void TimingWheel::measure(memory_usage_t* usage) const
+{
+    usage->count += armed;
+    usage->bytes += armed * sizeof(WheelTimer);
+}
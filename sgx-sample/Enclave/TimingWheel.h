@@ -0,0 +1,103 @@
+#ifndef _ENCLAVE_TIMING_WHEEL_H_
+#define _ENCLAVE_TIMING_WHEEL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "OrderBook.h"
+#include "user_types.h"
+
+// Slots per level, one bit of an occupancy word each
+#define TIMING_WHEEL_BITS 6
+#define TIMING_WHEEL_SLOTS (1 << TIMING_WHEEL_BITS)
+
+// Levels of one-second, 64-second, ~68-minute and ~3-day slots: deadlines
+// up to 2^24 seconds (194 days) ahead; later ones wait in an overflow list
+#define TIMING_WHEEL_LEVELS 4
+
+// The expiry of one resting order
+struct WheelTimer {
+    WheelTimer* next;
+    WheelTimer** link;             // The pointer that points at this timer
+    int place;                     // List it is on; see TimingWheel
+    int64_t deadline;              // Clock reading it expires at, or ORDER_EXPIRES_SESSION_CLOSE
+    Order* order;                  // Its entry in the book's orders map
+};
+
+/*
+ * Expiry timers of a book's GTT and day orders, in whole seconds of the
+ * clock the ECALLs are given
+ *
+ * A timer waits on the level where its deadline first agrees with the
+ * wheel's clock in every higher digit, in the slot of its own digit there,
+ * so arming or disarming one is a list link or unlink. Advancing the clock
+ * jumps straight to the next occupied slot of the lowest occupied level,
+ * found with a bit scan: a level-0 slot is due whole, and a higher one is
+ * placed again a level or more further down. Slots and seconds with
+ * nothing in them cost nothing, so a long quiet spell is a few scans.
+ * Day orders wait in a list of their own until the session closes.
+ *
+ * Timers that fall due are handed out one at a time by take_due. Used
+ * with the book lock held.
+ */
+class TimingWheel {
+public:
+    TimingWheel();
+    ~TimingWheel();
+
+    // The latest clock reading the wheel was advanced to
+    int64_t now() const { return current; }
+
+    // Arm timer, made with new, for order, which keeps it in order->timer
+    // until it is taken or disarmed; the wheel frees it. A deadline already
+    // reached is due at once.
+    void schedule(WheelTimer* timer, Order* order, int64_t deadline);
+
+    // Disarm and free a timer that has not been taken
+    void cancel(WheelTimer* timer);
+
+    // Move the clock to now, making every deadline up to it due; an
+    // earlier reading than the wheel's is ignored
+    void advance(int64_t now);
+
+    // Make every session-close timer due
+    void close_session();
+
+    // Free the next due timer and return its order, or NULL
+    Order* take_due();
+
+    // Free every timer; the clock stays where it is
+    void clear();
+
+    // Add the armed timers' heap use to usage
+    void measure(memory_usage_t* usage) const;
+
+private:
+    // Lists after the level slots: deadlines beyond the top level, day
+    // orders, and timers due
+    enum {
+        LEVEL_PLACES = TIMING_WHEEL_LEVELS * TIMING_WHEEL_SLOTS,
+        OVERFLOW_PLACE = LEVEL_PLACES,
+        SESSION_PLACE,
+        DUE_PLACE,
+        PLACE_COUNT
+    };
+
+    int64_t current;
+    uint64_t armed;
+    uint64_t occupied[TIMING_WHEEL_LEVELS];
+    WheelTimer* lists[PLACE_COUNT];
+
+    void push(WheelTimer* timer, int place);
+    void unlink(WheelTimer* timer);
+
+    // Put a timer with a deadline on the list the deadline belongs to
+    void arm(WheelTimer* timer);
+
+    // Detach the whole list at place and arm each of its timers again
+    void cascade(int place);
+
+    TimingWheel(const TimingWheel&);
+    TimingWheel& operator=(const TimingWheel&);
+};
+
+#endif /* !_ENCLAVE_TIMING_WHEEL_H_ */
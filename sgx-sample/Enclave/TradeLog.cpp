@@ -0,0 +1,207 @@
+#include "TradeLog.h"
+#include "Epoch.h"
+#include "Memory.h"
+#include <string.h>
+
+// ============================
+// Published trade log
+// ============================
+
+// Slots of a fresh user table; it doubles past half full
+#define USER_TABLE_INITIAL_SLOTS 16
+
+// Trades within which a new log segment counts as imminent
+#define TRADE_LOG_GROWTH_SLACK 64
+
+// FNV-1a
+static size_t hash_user(const char* user, size_t length)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)user[i];
+        hash *= 1099511628211ULL;
+    }
+    return (size_t)hash;
+}
+
+TradeLog::TradeLog(uint64_t first_seq) : first(first_seq), users(new UserTable), user_count(0)
+{
+    users->slots.assign(USER_TABLE_INITIAL_SLOTS, NULL);
+}
+
+TradeLog::~TradeLog()
+{
+    for (size_t i = 0; i < users->slots.size(); i++) {
+        delete users->slots[i];
+    }
+    delete users;
+}
+
+void TradeLog::destroy(void* log)
+{
+    delete static_cast<TradeLog*>(log);
+}
+
+void TradeLog::destroy_table(void* table)
+{
+    delete static_cast<UserTable*>(table);
+}
+
+size_t TradeLog::index_of_seq(uint64_t seq, size_t count) const
+{
+    if (seq <= first) {
+        return 0;
+    }
+    return seq - first < count ? (size_t)(seq - first) : count;
+}
+
+size_t TradeLog::first_at_or_after(int64_t timestamp, size_t count) const
+{
+    size_t low = 0;
+    size_t high = count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if ((int64_t)trades[middle].timestamp < timestamp) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+size_t TradeLog::first_after(int64_t timestamp, size_t count) const
+{
+    size_t low = 0;
+    size_t high = count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if ((int64_t)trades[middle].timestamp <= timestamp) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+const UserTrades* TradeLog::find_user(const char* user) const
+{
+    const UserTable* table = __atomic_load_n(&users, __ATOMIC_ACQUIRE);
+    size_t length = strlen(user);
+    size_t mask = table->slots.size() - 1;
+    for (size_t i = hash_user(user, length) & mask;; i = (i + 1) & mask) {
+        const UserTrades* entry = __atomic_load_n(&table->slots[i], __ATOMIC_ACQUIRE);
+        if (entry == NULL) {
+            return NULL;
+        }
+        if (entry->user.length() == length && memcmp(entry->user.data(), user, length) == 0) {
+            return entry;
+        }
+    }
+}
+
+// Writer side: readers probing the old table keep it until they leave
+void TradeLog::grow_users()
+{
+    UserTable* table = new UserTable;
+    table->slots.assign(users->slots.size() * 2, NULL);
+    size_t mask = table->slots.size() - 1;
+    for (size_t i = 0; i < users->slots.size(); i++) {
+        UserTrades* entry = users->slots[i];
+        if (entry == NULL) {
+            continue;
+        }
+        size_t slot = hash_user(entry->user.data(), entry->user.length()) & mask;
+        while (table->slots[slot] != NULL) {
+            slot = (slot + 1) & mask;
+        }
+        table->slots[slot] = entry;
+    }
+
+    UserTable* old = users;
+    __atomic_store_n(&users, table, __ATOMIC_RELEASE);
+    epoch_retire(destroy_table, old);
+}
+
+UserTrades* TradeLog::user_entry(const std::string& user)
+{
+    size_t mask = users->slots.size() - 1;
+    size_t slot = hash_user(user.data(), user.length()) & mask;
+    for (; users->slots[slot] != NULL; slot = (slot + 1) & mask) {
+        if (users->slots[slot]->user == user) {
+            return users->slots[slot];
+        }
+    }
+
+    if ((user_count + 1) * 2 > users->slots.size()) {
+        grow_users();
+        return user_entry(user);
+    }
+
+    UserTrades* entry = new UserTrades(user);
+    __atomic_store_n(&users->slots[slot], entry, __ATOMIC_RELEASE);
+    user_count++;
+    return entry;
+}
+
+// Everything that can throw happens before the first publish, and the trade
+// itself is published last, so a reader that sees it also sees its index
+// entries
+void TradeLog::record(Trade& trade)
+{
+    size_t count = trades.size();
+    trades.reserve();
+    UserTrades* maker = user_entry(trade.maker_address);
+    UserTrades* taker = trade.taker_address != trade.maker_address ? user_entry(trade.taker_address) : NULL;
+    maker->seqs.reserve();
+    if (taker != NULL) {
+        taker->seqs.reserve();
+    }
+
+    trade.seq = first + count;
+    if (count > 0 && trade.timestamp < trades[count - 1].timestamp) {
+        trade.timestamp = trades[count - 1].timestamp;
+    }
+    trades.stage(trade);
+
+    maker->seqs.stage(trade.seq);
+    maker->seqs.publish();
+    if (taker != NULL) {
+        taker->seqs.stage(trade.seq);
+        taker->seqs.publish();
+    }
+    trades.publish();
+}
+
+size_t TradeLog::growth_bytes() const
+{
+    size_t bytes = trades.growth_bytes(TRADE_LOG_GROWTH_SLACK);
+    if ((user_count + 2) * 2 > users->slots.size()) {
+        bytes += users->slots.size() * 2 * sizeof(UserTrades*);
+    }
+    return bytes;
+}
+
+void TradeLog::measure(memory_usage_t* trade_usage, memory_usage_t* index_usage, uint64_t* indexed_users) const
+{
+    size_t count = trades.size();
+    trade_usage->count += count;
+    trade_usage->bytes += trades.allocated_bytes();
+    for (size_t i = 0; i < count; i++) {
+        const Trade& trade = trades[i];
+        trade_usage->bytes += string_heap_bytes(trade.id) + string_heap_bytes(trade.maker_address) +
+                              string_heap_bytes(trade.taker_address);
+    }
+
+    *indexed_users += user_count;
+    index_usage->bytes += sizeof(UserTable) + users->slots.size() * sizeof(UserTrades*);
+    for (size_t i = 0; i < users->slots.size(); i++) {
+        const UserTrades* entry = users->slots[i];
+        if (entry == NULL) {
+            continue;
+        }
+        index_usage->count += entry->seqs.size();
+        index_usage->bytes += sizeof(UserTrades) + string_heap_bytes(entry->user) + entry->seqs.allocated_bytes();
+    }
+}
@@ -0,0 +1,168 @@
+#ifndef _ENCLAVE_TRADE_LOG_H_
+#define _ENCLAVE_TRADE_LOG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <new>
+#include "OrderBook.h"
+#include "user_types.h"
+
+/*
+ * Append-only array that readers on other threads walk while the writer
+ * appends. Segment k holds (1 << BASE_BITS) << k elements, so the array
+ * doubles without moving an element, and everything below the count a
+ * reader loaded stays where it is. Only the writer, under the book lock,
+ * calls reserve, stage, publish and push.
+ */
+template <class T, unsigned BASE_BITS, unsigned SEGMENTS>
+class PublishedLog {
+public:
+    PublishedLog() : count(0) {
+        for (unsigned k = 0; k < SEGMENTS; k++) {
+            segments[k] = NULL;
+        }
+    }
+
+    ~PublishedLog() {
+        for (size_t i = 0; i < count; i++) {
+            slot(i)->~T();
+        }
+        for (unsigned k = 0; k < SEGMENTS; k++) {
+            operator delete(segments[k]);
+        }
+    }
+
+    // Elements published so far; a reader indexes only below this
+    size_t size() const { return __atomic_load_n(&count, __ATOMIC_ACQUIRE); }
+
+    const T& operator[](size_t index) const { return *slot(index); }
+
+    // Make room for one more element; throws std::bad_alloc and changes nothing
+    void reserve() {
+        unsigned k = segment_of(count);
+        if (k >= SEGMENTS) {
+            throw std::bad_alloc();
+        }
+        if (segments[k] == NULL) {
+            segments[k] = static_cast<T*>(operator new(segment_size(k) * sizeof(T)));
+        }
+    }
+
+    // Construct the next element, still hidden from readers; needs reserve
+    void stage(const T& value) { new (slot(count)) T(value); }
+
+    // Show the staged element to readers, together with every write before it
+    void publish() { __atomic_store_n(&count, count + 1, __ATOMIC_RELEASE); }
+
+    void push(const T& value) {
+        reserve();
+        stage(value);
+        publish();
+    }
+
+    // Bytes allocated for elements, used or not
+    size_t allocated_bytes() const {
+        size_t bytes = 0;
+        for (unsigned k = 0; k < SEGMENTS && segments[k] != NULL; k++) {
+            bytes += segment_size(k) * sizeof(T);
+        }
+        return bytes;
+    }
+
+    // Bytes reserve allocates within the next slack appends
+    size_t growth_bytes(size_t slack) const {
+        unsigned k = segment_of(count + slack);
+        return k < SEGMENTS && segments[k] == NULL ? segment_size(k) * sizeof(T) : 0;
+    }
+
+private:
+    size_t count;
+    T* segments[SEGMENTS];
+
+    static unsigned segment_of(size_t index) {
+        return 63 - __builtin_clzll((unsigned long long)(index >> BASE_BITS) + 1);
+    }
+
+    static size_t segment_size(unsigned k) { return ((size_t)1 << BASE_BITS) << k; }
+
+    T* slot(size_t index) const {
+        unsigned k = segment_of(index);
+        return segments[k] + (index - (segment_size(k) - ((size_t)1 << BASE_BITS)));
+    }
+
+    PublishedLog(const PublishedLog&);
+    PublishedLog& operator=(const PublishedLog&);
+};
+
+// Sequence numbers of one user's trades, as maker or taker
+struct UserTrades {
+    explicit UserTrades(const std::string& name) : user(name) {}
+
+    std::string user;
+    PublishedLog<uint64_t, 2, 28> seqs;
+};
+
+/*
+ * The trade log and its per-user index, as readers see them
+ *
+ * The writer appends under the book lock; readers hold only an epoch (see
+ * Epoch.h) and take a snapshot by loading size() once, after which every
+ * trade below it and every index entry pointing below it stays unchanged.
+ * Clearing the book publishes a fresh TradeLog and retires this one.
+ */
+class TradeLog {
+public:
+    explicit TradeLog(uint64_t first_seq);
+    ~TradeLog();
+
+    static void destroy(void* log);
+
+    size_t size() const { return trades.size(); }
+    const Trade& operator[](size_t index) const { return trades[index]; }
+    uint64_t first_seq() const { return first; }
+
+    // Index of the first trade with a sequence number >= seq, among the first count
+    size_t index_of_seq(uint64_t seq, size_t count) const;
+
+    // Index of the first trade stamped at or after timestamp, among the first count
+    size_t first_at_or_after(int64_t timestamp, size_t count) const;
+
+    // Index of the first trade stamped after timestamp, among the first count
+    size_t first_after(int64_t timestamp, size_t count) const;
+
+    // The user's trades, or NULL if they have none
+    const UserTrades* find_user(const char* user) const;
+
+    // Append a trade and index it, assigning its sequence number and holding
+    // timestamps monotonic. Throws std::bad_alloc and then records nothing.
+    void record(Trade& trade);
+
+    // Bytes the next few trades may allocate at once
+    size_t growth_bytes() const;
+
+    // Add the log's heap use to the totals
+    void measure(memory_usage_t* trade_usage, memory_usage_t* index_usage, uint64_t* indexed_users) const;
+
+private:
+    // Open addressing on user name; the writer publishes a doubled table and
+    // retires the old one instead of rehashing in place
+    struct UserTable {
+        std::vector<UserTrades*> slots;
+    };
+
+    PublishedLog<Trade, 6, 40> trades;
+    uint64_t first;
+    UserTable* users;
+    size_t user_count;
+
+    static void destroy_table(void* table);
+    UserTrades* user_entry(const std::string& user);
+    void grow_users();
+
+    TradeLog(const TradeLog&);
+    TradeLog& operator=(const TradeLog&);
+};
+
+#endif /* !_ENCLAVE_TRADE_LOG_H_ */
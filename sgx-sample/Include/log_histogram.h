@@ -0,0 +1,95 @@
+/*
+ * log_histogram.h - HDR-style log-bucketed histogram.
+ *
+ * Values are grouped by power of two, and every power of two is split into
+ * 2^(sub_bits-1) linear sub-buckets, so a recorded value is reported with a
+ * relative error of at most 2^-(sub_bits-1). The counts live in a plain
+ * caller-owned uint64_t array, which keeps the layout trivially copyable
+ * across the enclave boundary and cheap to merge.
+ *
+ * Values at or above 2^LOG_HIST_MAX_BITS are clamped into the last bucket.
+ */
+
+#ifndef _LOG_HISTOGRAM_H_
+#define _LOG_HISTOGRAM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define LOG_HIST_MAX_BITS 40
+
+/* Number of buckets needed for a given sub_bits precision */
+#define LOG_HIST_BUCKETS(sub_bits) \
+    ((size_t)((LOG_HIST_MAX_BITS) - (sub_bits) + 2) << ((sub_bits) - 1))
+
+static inline size_t log_hist_index(uint64_t value, unsigned sub_bits)
+{
+    const uint64_t limit = ((uint64_t)1 << LOG_HIST_MAX_BITS) - 1;
+    if (value > limit)
+        value = limit;
+    if (value < ((uint64_t)1 << sub_bits))
+        return (size_t)value;
+
+    unsigned msb = 63u - (unsigned)__builtin_clzll(value);
+    unsigned shift = msb - (sub_bits - 1);
+    return ((size_t)shift << (sub_bits - 1)) + (size_t)(value >> shift);
+}
+
+/* Highest value that maps to the bucket, as HdrHistogram reports it */
+static inline uint64_t log_hist_upper(size_t index, unsigned sub_bits)
+{
+    size_t half = (size_t)1 << (sub_bits - 1);
+    if (index < 2 * half)
+        return (uint64_t)index;
+
+    unsigned shift = (unsigned)(index / half) - 1;
+    uint64_t mantissa = (uint64_t)(index - ((size_t)shift << (sub_bits - 1)));
+    return ((mantissa + 1) << shift) - 1;
+}
+
+static inline void log_hist_record(uint64_t* counts, unsigned sub_bits, uint64_t value)
+{
+    counts[log_hist_index(value, sub_bits)]++;
+}
+
+static inline uint64_t log_hist_total(const uint64_t* counts, size_t buckets)
+{
+    uint64_t total = 0;
+    for (size_t i = 0; i < buckets; i++)
+        total += counts[i];
+    return total;
+}
+
+/* Value at the given percentile (0..100); 0 when the histogram is empty */
+static inline uint64_t log_hist_percentile(const uint64_t* counts, size_t buckets,
+                                           unsigned sub_bits, double percentile)
+{
+    uint64_t total = log_hist_total(counts, buckets);
+    if (total == 0)
+        return 0;
+
+    uint64_t rank = (uint64_t)((percentile / 100.0) * (double)total + 0.5);
+    if (rank < 1)
+        rank = 1;
+    if (rank > total)
+        rank = total;
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets; i++) {
+        seen += counts[i];
+        if (seen >= rank)
+            return log_hist_upper(i, sub_bits);
+    }
+    return log_hist_upper(buckets - 1, sub_bits);
+}
+
+static inline uint64_t log_hist_max(const uint64_t* counts, size_t buckets, unsigned sub_bits)
+{
+    for (size_t i = buckets; i > 0; i--) {
+        if (counts[i - 1] != 0)
+            return log_hist_upper(i - 1, sub_bits);
+    }
+    return 0;
+}
+
+#endif /* !_LOG_HISTOGRAM_H_ */
@@ -0,0 +1,137 @@
+#ifndef _ORDER_ENTRY_H_
+#define _ORDER_ENTRY_H_
+
+#include <stdint.h>
+
+/*
+ * Binary order-entry protocol
+ *
+ * A TCP session carries fixed-layout messages in x86 (little-endian) byte
+ * order, each starting with oe_header_t. header.length is the size of the
+ * whole message, which must equal the size of the struct for its type, so a
+ * receiver needs no text parsing: it reads the header, waits for length
+ * bytes and uses the struct in place.
+ *
+ * Each direction numbers its messages from 1 with header.seq. A client
+ * message out of sequence is answered with OE_REJECT_SEQUENCE_GAP and the
+ * session is closed. The first client message must be OE_LOGON; every order
+ * of the session is entered for its user.
+ *
+ * An OE_NEW_ORDER is answered with one OE_ACK carrying the order state after
+ * matching, followed by ack.fill_count OE_FILL messages, whose trade_seq
+ * counts within the order's market. An OE_CANCEL is answered with an OE_ACK
+ * whose status is cancelled; the order ID says which market it is in.
+ * Anything else that fails gets an OE_REJECT naming the sequence number it
+ * refers to.
+ */
+
+#define ORDER_ENTRY_USER_SIZE 64
+#define ORDER_ENTRY_ORDER_ID_SIZE 32
+#define ORDER_ENTRY_MAX_FILLS 64        /* Fill messages sent per order at most */
+#define ORDER_ENTRY_MAX_MESSAGE 128
+
+enum oe_message_type_t {
+    /* Client to server */
+    OE_LOGON = 'L',
+    OE_NEW_ORDER = 'N',
+    OE_CANCEL = 'C',
+    /* Server to client */
+    OE_LOGON_ACK = 'l',
+    OE_ACK = 'A',
+    OE_FILL = 'F',
+    OE_REJECT = 'R'
+};
+
+enum oe_reject_reason_t {
+    OE_REJECT_SEQUENCE_GAP = 1,     /* The session is closed after this reject */
+    OE_REJECT_NOT_LOGGED_ON,
+    OE_REJECT_INVALID_MESSAGE,      /* Unknown type, wrong length or bad field */
+    OE_REJECT_UNKNOWN_ORDER,
+    OE_REJECT_ORDER_NOT_OPEN,
+    OE_REJECT_ENCLAVE_ERROR,
+    OE_REJECT_BOOK_FULL,            /* Enclave memory budget used up; retry later */
+    OE_REJECT_INSUFFICIENT_FUNDS,   /* The ledger is on and the balance does not cover the order */
+    OE_REJECT_EXPIRED               /* expire_time has passed */
+};
+
+enum oe_time_in_force_t {
+    OE_GOOD_TILL_CANCEL = 0,
+    OE_GOOD_TILL_TIME,              /* Rests until expire_time */
+    OE_DAY                          /* Rests until its market's session closes */
+};
+
+typedef struct _oe_header_t {
+    uint16_t length;
+    uint8_t type;                   /* oe_message_type_t */
+    uint8_t reserved;
+    uint32_t seq;
+} oe_header_t;
+
+typedef struct _oe_logon_t {
+    oe_header_t header;
+    char user_address[ORDER_ENTRY_USER_SIZE];   /* NUL-padded */
+} oe_logon_t;
+
+typedef struct _oe_logon_ack_t {
+    oe_header_t header;
+    uint32_t expected_seq;          /* Next client sequence number */
+    uint32_t reserved;
+} oe_logon_ack_t;
+
+typedef struct _oe_new_order_t {
+    oe_header_t header;
+    uint64_t client_order_id;       /* Echoed in every reply, never interpreted */
+    uint8_t side;                   /* 0 = buy, 1 = sell */
+    uint8_t type;                   /* 0 = limit, 1 = market */
+    uint8_t market;                 /* Book to match in, below MARKET_COUNT (user_types.h) */
+    uint8_t time_in_force;          /* oe_time_in_force_t */
+    uint32_t expire_time;           /* Unix time, for OE_GOOD_TILL_TIME */
+    double price;                   /* Ignored for market orders */
+    double quantity;
+} oe_new_order_t;
+
+typedef struct _oe_cancel_t {
+    oe_header_t header;
+    uint64_t client_order_id;
+    char order_id[ORDER_ENTRY_ORDER_ID_SIZE];   /* From the OE_ACK of the order */
+} oe_cancel_t;
+
+typedef struct _oe_ack_t {
+    oe_header_t header;
+    uint64_t client_order_id;
+    char order_id[ORDER_ENTRY_ORDER_ID_SIZE];
+    uint8_t status;                 /* 0 open, 1 filled, 2 partially filled, 3 cancelled */
+    uint8_t reserved[3];
+    uint32_t fill_count;            /* OE_FILL messages that follow */
+    double filled_quantity;         /* Includes fills beyond ORDER_ENTRY_MAX_FILLS */
+    double remaining_quantity;
+} oe_ack_t;
+
+typedef struct _oe_fill_t {
+    oe_header_t header;
+    uint64_t client_order_id;
+    uint64_t trade_seq;             /* The trade's "seq" in GET /trades */
+    double price;
+    double quantity;
+} oe_fill_t;
+
+typedef struct _oe_reject_t {
+    oe_header_t header;
+    uint64_t client_order_id;       /* 0 when the message carried none */
+    uint32_t ref_seq;               /* Sequence number of the rejected message */
+    uint16_t reason;                /* oe_reject_reason_t */
+    uint16_t reserved;
+} oe_reject_t;
+
+#if defined(__cplusplus)
+static_assert(sizeof(oe_header_t) == 8, "oe_header_t layout");
+static_assert(sizeof(oe_logon_t) == 72, "oe_logon_t layout");
+static_assert(sizeof(oe_logon_ack_t) == 16, "oe_logon_ack_t layout");
+static_assert(sizeof(oe_new_order_t) == 40, "oe_new_order_t layout");
+static_assert(sizeof(oe_cancel_t) == 48, "oe_cancel_t layout");
+static_assert(sizeof(oe_ack_t) == 72, "oe_ack_t layout");
+static_assert(sizeof(oe_fill_t) == 40, "oe_fill_t layout");
+static_assert(sizeof(oe_reject_t) == 24, "oe_reject_t layout");
+#endif
+
+#endif /* !_ORDER_ENTRY_H_ */
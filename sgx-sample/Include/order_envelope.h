@@ -0,0 +1,93 @@
+#ifndef _ORDER_ENVELOPE_H_
+#define _ORDER_ENVELOPE_H_
+
+#include <stdint.h>
+#include "user_types.h"
+
+/*
+ * Encrypted order envelopes
+ *
+ * An order sent in plaintext is read by the host before the enclave
+ * matches it. An envelope carries it encrypted to the enclave instead:
+ *
+ * - The client opens a session by sending an ephemeral P-256 public key
+ *   (ecall_open_order_session). The enclave answers with its own public
+ *   key and a session ID. The session key is the first 16 bytes of the
+ *   SHA-256 of the ECDH shared secret's X coordinate, big-endian.
+ * - Each envelope holds one order_payload_t sealed with AES-128-GCM under
+ *   the session key. The 8 bytes of the session ID, little-endian, are the
+ *   additional authenticated data, and the last 8 bytes of the nonce are a
+ *   big-endian counter from 1. The counter must rise from one envelope of
+ *   a session to the next, so a nonce is never reused and the host can
+ *   neither replay nor reorder a session's orders, only drop them.
+ *
+ * Public keys are X then Y, 32 bytes each, big-endian. Every envelope has
+ * the same size whatever the order, and its market is only inside. Layouts
+ * are fixed and little-endian, like the binary order-entry protocol.
+ *
+ * The enclave key lasts as long as the enclave, and sessions only as long
+ * as the enclave and ORDER_SESSION_SLOTS newer sessions: a client whose
+ * session is unknown opens a new one. Neither is bound to an attestation
+ * report yet.
+ *
+ * A standby journal (--standby) holds every order it carries in the clear,
+ * in untrusted memory, so while one is attached sessions are refused and
+ * envelopes are not opened.
+ */
+
+#define ORDER_ENVELOPE_KEY_SIZE 64          /* A P-256 public key, X then Y */
+#define ORDER_ENVELOPE_NONCE_SIZE 12
+#define ORDER_ENVELOPE_TAG_SIZE 16
+#define ORDER_ENVELOPE_USER_SIZE 64
+#define ORDER_ENVELOPE_ORDER_ID_SIZE 64
+#define ORDER_ENVELOPE_BATCH 32             /* Envelopes opened, then matched, at a time */
+
+/* Sessions the enclave holds, a power of two; opening one more replaces the oldest */
+#define ORDER_SESSION_SLOTS 1024
+
+/* The order inside an envelope; strings are NUL-terminated */
+typedef struct _order_payload_t {
+    int32_t market;
+    int32_t order_type;                     /* LIMIT or MARKET */
+    int32_t order_side;                     /* BUY or SELL */
+    uint32_t reserved;
+    double price;                           /* Ignored for market orders */
+    double quantity;
+    int64_t expires;                        /* Expiry time or ORDER_EXPIRES_* */
+    char user_address[ORDER_ENVELOPE_USER_SIZE];
+    char client_key[CLIENT_KEY_SIZE];       /* Empty for none */
+} order_payload_t;
+
+typedef struct _order_envelope_t {
+    uint64_t session;
+    uint8_t nonce[ORDER_ENVELOPE_NONCE_SIZE];
+    uint8_t tag[ORDER_ENVELOPE_TAG_SIZE];
+    uint32_t reserved;
+    uint8_t payload[sizeof(order_payload_t)];   /* The sealed order_payload_t */
+} order_envelope_t;
+
+typedef struct _order_envelope_result_t {
+    int32_t result;                         /* ORDER_ADD_*, or ORDER_ENVELOPE_* below */
+    uint32_t reserved;
+    char order_id[ORDER_ENVELOPE_ORDER_ID_SIZE];
+    order_result_t outcome;                 /* Set for ORDER_ADD_OK */
+} order_envelope_result_t;
+
+/* Results of an envelope that never reached a book */
+#define ORDER_ENVELOPE_INVALID -1           /* Opened, but not a valid order */
+#define ORDER_ENVELOPE_UNKNOWN_SESSION -2   /* No such session, or it was replaced */
+#define ORDER_ENVELOPE_REJECTED -3          /* Failed to authenticate, or its counter did not rise */
+#define ORDER_ENVELOPE_JOURNALED -4         /* A standby journal would hold it in the clear */
+
+/* Results of ecall_open_order_session */
+#define ORDER_SESSION_OK 0
+#define ORDER_SESSION_INVALID_KEY 1         /* Not a point of P-256 */
+#define ORDER_SESSION_FAILED 2
+#define ORDER_SESSION_JOURNALED 3           /* Refused: a standby journal would hold its orders in the clear */
+
+#if defined(__cplusplus)
+static_assert(sizeof(order_payload_t) == 200, "order_payload_t layout");
+static_assert(sizeof(order_envelope_t) == 240, "order_envelope_t layout");
+#endif
+
+#endif /* !_ORDER_ENVELOPE_H_ */
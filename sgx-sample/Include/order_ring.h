@@ -0,0 +1,88 @@
+#ifndef _ORDER_RING_H_
+#define _ORDER_RING_H_
+
+#include <stdint.h>
+#include "user_types.h"
+
+/*
+ * Order ring shared by the App and the enclave matching threads
+ *
+ * The App allocates one order_ring_t in untrusted memory and hands it to
+ * ring->workers calls of ecall_run_order_ring, each of which keeps a thread
+ * inside the enclave matching orders from it until ring->stop is set.
+ *
+ * Every market has its own request queue. Any App thread may submit to
+ * any of them: a queue is a bounded multi-producer, single-consumer queue
+ * in which each cell carries a sequence number that says whose turn it is
+ * (D. Vyukov's bounded queue), so producers claim cells with one CAS on tail
+ * and the consumer needs no atomic read-modify-write at all. The consumer
+ * of a market's queue is whichever matching thread holds that market's book
+ * lock in the enclave, so its orders are matched one at a time, in queue
+ * order, whichever thread runs them.
+ *
+ * Each producer has its own reply slot and at most one request in flight.
+ * The enclave fills the slot and then publishes the request's ticket in
+ * reply.done, which the producer polls.
+ *
+ * When every queue stays empty a matching thread counts itself in
+ * ring->sleeping and blocks on an sgx_thread condition variable, leaving the
+ * enclave only then. A producer that sees ring->sleeping after publishing a
+ * request calls ecall_wake_order_ring, so a busy ring costs no enclave
+ * transition at all.
+ *
+ * Everything here is untrusted: the enclave copies each request before
+ * looking at it and validates every field.
+ */
+
+#define ORDER_RING_SIZE 512                 /* Request cells per market, a power of two */
+#define ORDER_RING_PRODUCERS 64             /* Reply slots, one per submitting thread */
+#define ORDER_RING_MAX_FILLS 64             /* Fills reported per order at most */
+#define ORDER_RING_USER_SIZE 64
+#define ORDER_RING_ORDER_ID_SIZE 64
+#define ORDER_RING_CLIENT_KEY_SIZE CLIENT_KEY_SIZE
+
+#define ORDER_RING_CACHE_LINE 64
+
+typedef struct _order_ring_request_t {
+    uint64_t sequence;                      /* Cell turn; see above */
+    uint64_t ticket;                        /* Echoed in the reply's done */
+    uint32_t producer;                      /* Reply slot */
+    int32_t order_type;
+    int32_t order_side;
+    uint32_t reserved;
+    double price;
+    double quantity;
+    int64_t expires;                        /* Expiry time or ORDER_EXPIRES_* */
+    char user_address[ORDER_RING_USER_SIZE];
+    char client_key[ORDER_RING_CLIENT_KEY_SIZE];     /* Empty for none */
+} order_ring_request_t;
+
+typedef struct _order_ring_reply_t {
+    uint64_t done;                          /* Ticket of the request answered last */
+    int32_t result;                         /* ORDER_ADD_*, or ORDER_RING_INVALID */
+    uint32_t reserved;
+    char order_id[ORDER_RING_ORDER_ID_SIZE];
+    order_result_t outcome;
+    order_fill_t fills[ORDER_RING_MAX_FILLS];
+} __attribute__((aligned(ORDER_RING_CACHE_LINE))) order_ring_reply_t;
+
+/* Result of a request the enclave refused to read */
+#define ORDER_RING_INVALID -1
+
+typedef struct _order_ring_queue_t {
+    /* Next cell to claim; shared by the producers */
+    uint64_t tail __attribute__((aligned(ORDER_RING_CACHE_LINE)));
+    /* Next cell to match, for the depth gauge; the enclave keeps its own copy */
+    uint64_t head __attribute__((aligned(ORDER_RING_CACHE_LINE)));
+    order_ring_request_t requests[ORDER_RING_SIZE] __attribute__((aligned(ORDER_RING_CACHE_LINE)));
+} order_ring_queue_t;
+
+typedef struct _order_ring_t {
+    uint32_t sleeping __attribute__((aligned(ORDER_RING_CACHE_LINE)));  /* Matching threads asleep */
+    uint32_t stop;
+    uint32_t workers;                       /* Matching threads, 1 to MARKET_COUNT */
+    order_ring_queue_t queues[MARKET_COUNT];
+    order_ring_reply_t replies[ORDER_RING_PRODUCERS];
+} order_ring_t;
+
+#endif /* !_ORDER_RING_H_ */
@@ -0,0 +1,79 @@
+#ifndef _REPLICA_JOURNAL_H_
+#define _REPLICA_JOURNAL_H_
+
+#include <stdint.h>
+#include "user_types.h"
+
+/*
+ * Input journal shared by the primary enclave and the App's standby feed
+ *
+ * Every input that changes a book (an order added, a cancel, a deposit, a
+ * clear, a settlement batch, orders expiring) is appended to its market's queue by the
+ * primary enclave once it has been applied, with the book lock still held,
+ * so each queue is the exact sequence of inputs its book went through. The
+ * App copies the entries out and hands them to the standby enclave through
+ * ecall_apply_inputs, which applies them in the same order and must land on
+ * the same state: every entry carries the primary's state hash after it,
+ * and the standby compares its own.
+ *
+ * Each queue has a single producer (whoever holds the book lock in the
+ * primary) and a single consumer (the App's replication thread): the
+ * producer publishes tail with a release store, the consumer advances head
+ * once it has copied entries out. The journal lives in untrusted memory, so
+ * it outlives a primary enclave that is lost. It holds what the App already
+ * saw in the requests, except for orders that came in encrypted envelopes
+ * (order_envelope.h): those are journaled in the clear.
+ *
+ * A queue that fills up because the standby fell behind is marked
+ * overflowed and no longer written to: the standby has missed an input and
+ * can no longer take over.
+ */
+
+#define REPLICA_JOURNAL_SIZE 4096           /* Entries per market, a power of two */
+#define REPLICA_KEY_SIZE CLIENT_KEY_SIZE
+
+#define REPLICA_JOURNAL_CACHE_LINE 64
+
+/* Kinds of replica_input_t */
+#define REPLICA_INPUT_ORDER 0               /* ecall_add_order that returned ORDER_ADD_OK */
+#define REPLICA_INPUT_CANCEL 1              /* ecall_cancel_order that returned ORDER_CANCEL_OK */
+#define REPLICA_INPUT_DEPOSIT 2             /* ecall_credit_account that returned LEDGER_OK */
+#define REPLICA_INPUT_CLEAR 3               /* ecall_clear_order_book, per market */
+#define REPLICA_INPUT_SETTLEMENT 4          /* ecall_close_settlement that returned SETTLEMENT_OK */
+#define REPLICA_INPUT_EXPIRY 5              /* The clock reached time and orders expired */
+#define REPLICA_INPUT_SESSION_CLOSE 6       /* ecall_close_session that expired day orders */
+#define REPLICA_INPUT_SETTLEMENT_ACK 7      /* ecall_ack_settlement that released the pending batch */
+
+typedef struct _replica_input_t {
+    uint64_t seq;                           /* Position in the market's input stream, from 1 */
+    uint64_t state_hash;                    /* The primary's state hash once the input was applied */
+    /* Everything below is folded into the state hash */
+    int64_t time;                           /* Clock reading the primary used for IDs and timestamps */
+    int32_t kind;                           /* REPLICA_INPUT_* */
+    int32_t order_type;                     /* ORDER: LIMIT or MARKET; DEPOSIT: SETTLEMENT_TOKEN_* */
+    int32_t order_side;                     /* ORDER */
+    uint32_t reserved;
+    double price;                           /* ORDER */
+    double quantity;                        /* ORDER: quantity; DEPOSIT: amount */
+    uint64_t batch_number;                  /* SETTLEMENT, SETTLEMENT_ACK */
+    uint64_t batch_last_seq;                /* SETTLEMENT */
+    int64_t expires;                        /* ORDER: expiry time or ORDER_EXPIRES_* */
+    char user_address[64];                  /* ORDER, CANCEL, DEPOSIT */
+    char key[REPLICA_KEY_SIZE];             /* ORDER: client key; CANCEL: order ID; DEPOSIT: deposit ID;
+                                               SETTLEMENT, SETTLEMENT_ACK: the batch digest */
+} replica_input_t;
+
+typedef struct _replica_journal_queue_t {
+    /* Entries published; written by the enclave only */
+    uint64_t tail __attribute__((aligned(REPLICA_JOURNAL_CACHE_LINE)));
+    uint32_t overflowed;
+    /* Entries copied out; written by the App only */
+    uint64_t head __attribute__((aligned(REPLICA_JOURNAL_CACHE_LINE)));
+    replica_input_t inputs[REPLICA_JOURNAL_SIZE] __attribute__((aligned(REPLICA_JOURNAL_CACHE_LINE)));
+} replica_journal_queue_t;
+
+typedef struct _replica_journal_t {
+    replica_journal_queue_t queues[MARKET_COUNT];
+} replica_journal_t;
+
+#endif /* !_REPLICA_JOURNAL_H_ */
@@ -47,5 +47,293 @@ typedef long time_t;
 #define _TIME_T_DEFINED
 #endif
 
+#include <stdint.h>
+#include "log_histogram.h"
+
+/* Matching path statistics returned by ecall_get_stats */
+#define ENCLAVE_STATS_SUB_BITS 5
+#define ENCLAVE_STATS_BUCKETS LOG_HIST_BUCKETS(ENCLAVE_STATS_SUB_BITS)
+
+typedef struct _enclave_histogram_t {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[ENCLAVE_STATS_BUCKETS];
+} enclave_histogram_t;
+
+typedef struct _enclave_stats_t {
+    uint64_t interval_cycles;                /* TSC cycles since the last reset */
+    enclave_histogram_t add_order_cycles;    /* Service time of add_order */
+    enclave_histogram_t fills_per_order;     /* Trades produced per incoming order */
+    enclave_histogram_t levels_swept;        /* Distinct price levels hit per order */
+    enclave_histogram_t json_export_cycles;  /* Time spent building one trades JSON chunk */
+} enclave_stats_t;
+
+/* Markets with a book of their own, numbered from 0. Market 0 is the default
+ * wherever a request does not name one. Each market numbers its trades from
+ * 1, and order and trade IDs outside market 0 start with "m<market>-". */
+#define MARKET_COUNT 8
+
+/* Cursor returned by ecall_export_trades once the last trade has been exported */
+#define TRADE_EXPORT_END UINT64_MAX
+
+/* Range and filters of a trade export; zero leaves a bound open */
+typedef struct _trade_query_t {
+    uint64_t since_seq;     /* First trade sequence number, inclusive */
+    uint64_t until_seq;     /* Last trade sequence number, inclusive */
+    int64_t from_ts;        /* Earliest trade timestamp, inclusive */
+    int64_t to_ts;          /* Latest trade timestamp, inclusive */
+    uint64_t limit;         /* Trades still wanted by the caller */
+    int side;               /* Taker side (0 = buy, 1 = sell), -1 for both */
+    int market;             /* Book whose trades to export */
+} trade_query_t;
+
+/* Progress of one ecall_export_trades chunk */
+typedef struct _trade_export_t {
+    uint64_t next_cursor;   /* Sequence number to resume from, or TRADE_EXPORT_END */
+    uint64_t count;         /* Trades written into this chunk */
+} trade_export_t;
+
+/* One execution of an incoming order, reported by ecall_add_order */
+typedef struct _order_fill_t {
+    uint64_t trade_seq;
+    double price;
+    double quantity;
+} order_fill_t;
+
+/* Outcome of ecall_add_order; fill_count may exceed the fills reported */
+typedef struct _order_result_t {
+    uint64_t fill_count;
+    double filled_quantity;
+    double remaining_quantity;
+    int status;             /* OrderStatus after matching */
+} order_result_t;
+
+/* Results of ecall_add_order */
+#define ORDER_ADD_OK 0
+#define ORDER_ADD_INVALID -1            /* Rejected: unknown type or side, or a price or quantity out of range */
+#define ORDER_ADD_BOOK_FULL 1           /* Rejected: the enclave memory budget is used up */
+#define ORDER_ADD_UNKNOWN_MARKET 2      /* Rejected: market is not below MARKET_COUNT */
+#define ORDER_ADD_INSUFFICIENT_FUNDS 3  /* Rejected: the ledger is on and the user cannot pay */
+#define ORDER_ADD_DUPLICATE 4           /* Not added again: order_id is the order first sent under the client key */
+#define ORDER_ADD_EXPIRED 5             /* Rejected: expires has passed, or is not a time or ORDER_EXPIRES_* */
+
+/* expires of ecall_add_order: the clock reading (unix seconds) a resting
+ * order expires at, or one of these */
+#define ORDER_EXPIRES_NEVER 0           /* Good till cancelled */
+#define ORDER_EXPIRES_SESSION_CLOSE -1  /* Day order: expires when its market's session closes */
+
+/* Longest client key of an order, NUL included; "<tx hash>-<log index>" fits */
+#define CLIENT_KEY_SIZE 96
+
+/* Results of ecall_cancel_order */
+#define ORDER_CANCEL_OK 0
+#define ORDER_CANCEL_UNKNOWN_ORDER 1    /* No such order for this user, or it expired */
+#define ORDER_CANCEL_NOT_OPEN 2         /* Already filled or cancelled */
+
+/* Price tick of a market whose tick ecall_set_price_tick has not set */
+#define PRICE_TICK_DEFAULT 0.01
+
+/* Results of ecall_set_price_tick */
+#define PRICE_TICK_OK 0
+#define PRICE_TICK_UNKNOWN_MARKET 1     /* market is not below MARKET_COUNT */
+#define PRICE_TICK_INVALID 2            /* Not a positive price */
+#define PRICE_TICK_BOOK_NOT_EMPTY 3     /* Orders rest in the market already */
+
+/* Results of ecall_close_session */
+#define SESSION_CLOSE_OK 0
+#define SESSION_CLOSE_UNKNOWN_MARKET 1  /* market is not below MARKET_COUNT */
+#define SESSION_CLOSE_INVALID 2         /* No count to write to */
+
+/* Book occupancy returned by ecall_get_book_stats, indexed by side (0 = buy),
+ * and the heap counters that cost nothing to read */
+typedef struct _book_stats_t {
+    uint64_t open_orders[2];
+    uint64_t price_levels[2];
+    uint64_t trade_count;
+    uint64_t heap_in_use;
+    uint64_t heap_budget;
+    uint64_t heap_high_water;               /* Since the enclave started */
+    uint64_t allocations_total;             /* operator new calls since the enclave started */
+} book_stats_t;
+
+/* One structure in memory_stats_t */
+typedef struct _memory_usage_t {
+    uint64_t count;         /* Entries */
+    uint64_t bytes;         /* Estimated heap bytes: entries, string buffers, tree nodes, spare capacity */
+} memory_usage_t;
+
+/* Enclave heap breakdown returned by ecall_get_memory_stats */
+typedef struct _memory_stats_t {
+    uint64_t heap_in_use;
+    uint64_t heap_high_water;               /* Since the enclave started */
+    uint64_t heap_budget;
+    uint64_t allocations;                   /* operator new calls since the last reset */
+    uint64_t allocations_total;             /* operator new calls since the enclave started */
+    memory_usage_t resting_orders;          /* Orders queued at a price; bytes are the levels and their index */
+    memory_usage_t open_order_records;      /* Order map entries still open */
+    memory_usage_t terminal_order_records;  /* Order map entries filled or cancelled; expired ones are dropped */
+    memory_usage_t trades;                  /* Trade log */
+    memory_usage_t user_index;              /* Per-user trade sequence numbers */
+    memory_usage_t accounts;                /* Ledger accounts and credited deposit IDs */
+    memory_usage_t client_keys;             /* Client keys of recent orders and their order IDs */
+    memory_usage_t batch_commitments;       /* Signed settlement batches kept for trade proofs */
+    memory_usage_t order_timers;            /* Expiry timers of resting GTT and day orders */
+    uint64_t indexed_users;                 /* Users with an entry in the index */
+} memory_stats_t;
+
+/* Settlement: every market trades a base token against a quote token, and
+ * a batch nets each user's trades into at most one transfer per token */
+#define SETTLEMENT_TOKEN_BASE 0
+#define SETTLEMENT_TOKEN_QUOTE 1
+#define SETTLEMENT_ADDRESS_SIZE 64
+#define SETTLEMENT_DIGEST_SIZE 32
+#define COMMITMENT_KEY_SIZE 64              /* P-256 public key: X then Y, big-endian */
+#define COMMITMENT_SIGNATURE_SIZE 64        /* ECDSA signature: r then s, big-endian */
+
+/* What one user receives (amount > 0) or pays (amount < 0) in one token */
+typedef struct _settlement_transfer_t {
+    char user_address[SETTLEMENT_ADDRESS_SIZE];    /* NUL-padded */
+    int token;                                      /* SETTLEMENT_TOKEN_* */
+    double amount;
+} settlement_transfer_t;
+
+/* A settlement window closed by ecall_close_settlement. Batches of a market
+ * cover consecutive trade sequence numbers, and each digest chains the one
+ * before it, so a gap or a replayed batch shows. digest is the SHA-256 of
+ * previous_digest, then market as 4 bytes, number, first_seq, last_seq and
+ * transfer_count as 8 bytes each, then per transfer its 64 address bytes,
+ * token as 4 bytes and the IEEE 754 bits of amount as 8 bytes, all
+ * integers little-endian.
+ *
+ * merkle_root is the root of an RFC 6962 tree over the batch's trades in
+ * sequence order (see trade_proof_t), and signature the enclave's ECDSA
+ * P-256 signature, over SHA-256, of the batch commitment: market as 4
+ * bytes, number, first_seq, last_seq and trade_count as 8 bytes each, then
+ * merkle_root and digest. ecall_get_signing_key returns the public key. */
+typedef struct _settlement_batch_t {
+    char batch_id[64];          /* "<market prefix>batch-<first_seq>-<last_seq>" */
+    int market;
+    uint64_t number;            /* Batches closed in this market, this one included */
+    uint64_t first_seq;         /* First trade settled, inclusive */
+    uint64_t last_seq;          /* Last trade settled, inclusive */
+    uint64_t trade_count;
+    uint64_t transfer_count;    /* Transfers written, none with a zero amount */
+    uint64_t pending_trades;    /* Trades left for the next batch */
+    uint8_t previous_digest[SETTLEMENT_DIGEST_SIZE];
+    uint8_t digest[SETTLEMENT_DIGEST_SIZE];
+    uint8_t merkle_root[SETTLEMENT_DIGEST_SIZE];
+    uint8_t signature[COMMITMENT_SIGNATURE_SIZE];
+} settlement_batch_t;
+
+/* Results of ecall_close_settlement and ecall_ack_settlement; only
+ * SETTLEMENT_OK from a close closes a batch */
+#define SETTLEMENT_OK 0
+#define SETTLEMENT_EMPTY 1                  /* No trades since the last batch */
+#define SETTLEMENT_UNKNOWN_MARKET 2         /* market is not below MARKET_COUNT */
+#define SETTLEMENT_BUFFER_TOO_SMALL 3       /* Not even one trade's transfers fit */
+#define SETTLEMENT_ADDRESS_TOO_LONG 4       /* A user address does not fit a transfer */
+#define SETTLEMENT_OUT_OF_MEMORY 5
+#define SETTLEMENT_PENDING 6                /* Close: the last batch, returned again until it is acknowledged */
+#define SETTLEMENT_UNKNOWN_BATCH 7          /* Ack: no batch of that number and digest */
+
+/* Levels of a trade proof's path; a batch holds at most 2^MERKLE_MAX_DEPTH trades */
+#define MERKLE_MAX_DEPTH 48
+
+/* Inclusion of one trade in its settlement batch, from ecall_get_trade_proof.
+ * A leaf is the SHA-256 of a 0 byte, seq as 8 bytes, id, maker and taker
+ * address each as a 4-byte length and its bytes, taker_side as 4 bytes, the
+ * IEEE 754 bits of price and quantity as 8 bytes each and timestamp as 8
+ * bytes, integers little-endian; a node is the SHA-256 of a 1 byte and its
+ * two children. The left subtree of n leaves holds the largest power of two
+ * below n. Hashing the leaf with each path entry in turn, the entry on the
+ * left where path_left says so, gives the batch's merkle_root. */
+typedef struct _trade_proof_t {
+    settlement_batch_t batch;               /* The batch as closed, without its transfers */
+    uint64_t leaf_index;                    /* Position of the trade in the batch */
+    uint8_t leaf[SETTLEMENT_DIGEST_SIZE];
+    uint32_t path_length;
+    uint8_t path[MERKLE_MAX_DEPTH][SETTLEMENT_DIGEST_SIZE];    /* Sibling hashes, from the leaf up */
+    uint8_t path_left[MERKLE_MAX_DEPTH];                    /* 1 where the sibling is the left child */
+    char trade_json[512];                   /* The trade as /trades shows it, every digit kept */
+} trade_proof_t;
+
+/* Results of ecall_get_trade_proof */
+#define PROOF_OK 0
+#define PROOF_UNKNOWN_MARKET 1
+#define PROOF_UNKNOWN_TRADE 2               /* No trade with that sequence number yet */
+#define PROOF_NOT_SETTLED 3                 /* The trade is in no closed batch yet */
+#define PROOF_UNAVAILABLE 4                 /* A clear dropped the trade */
+#define PROOF_FAILED 5                      /* Hashing failed or the enclave is out of memory */
+
+/* A user's balances in one market, indexed by SETTLEMENT_TOKEN_* */
+typedef struct _account_balance_t {
+    double total[2];        /* Deposits, plus what trades bought, minus what they paid */
+    double reserved[2];     /* Held back by resting orders; the rest is available */
+} account_balance_t;
+
+/* Results of ecall_credit_account and ecall_get_account */
+#define LEDGER_OK 0
+#define LEDGER_DISABLED 1               /* The App did not enable the ledger */
+#define LEDGER_UNKNOWN_MARKET 2
+#define LEDGER_INVALID 3                /* Bad token, amount, user or deposit ID */
+#define LEDGER_DUPLICATE_DEPOSIT 4      /* Credited before; nothing changed */
+#define LEDGER_UNKNOWN_ACCOUNT 5        /* The user never deposited */
+#define LEDGER_OUT_OF_MEMORY 6
+
+/* Results of ecall_apply_inputs; anything but REPLICA_OK means the standby
+ * stopped following its primary and can no longer take over */
+#define REPLICA_OK 0
+#define REPLICA_UNKNOWN_MARKET 1
+#define REPLICA_GAP 2                   /* An input before this batch is missing */
+#define REPLICA_DIVERGED 3              /* An input did not reproduce the primary's state hash */
+#define REPLICA_INVALID 4               /* An input could not be read */
+
+/* Where a standby stands in one market's input stream */
+typedef struct _replica_status_t {
+    uint64_t applied_seq;                   /* Last input applied */
+    uint64_t state_hash;                    /* State hash after it */
+} replica_status_t;
+
+/* Interfaces tracked by the ECALL/OCALL boundary profiler */
+enum ecall_id_t {
+    ECALL_ID_ADD_ORDER = 0,
+    ECALL_ID_EXPORT_TRADES,
+    ECALL_ID_CLEAR_ORDER_BOOK,
+    ECALL_ID_GET_STATS,
+    ECALL_ID_GET_BOOK_STATS,
+    ECALL_ID_CANCEL_ORDER,
+    ECALL_ID_GET_MEMORY_STATS,
+    ECALL_ID_WAKE_ORDER_RING,
+    ECALL_ID_CLOSE_SETTLEMENT,
+    ECALL_ID_CREDIT_ACCOUNT,
+    ECALL_ID_GET_ACCOUNT,
+    ECALL_ID_GET_TRADE_PROOF,
+    ECALL_ID_GET_SIGNING_KEY,
+    ECALL_ID_OPEN_ORDER_SESSION,
+    ECALL_ID_ADD_ORDER_ENVELOPES,
+    ECALL_ID_CLOSE_SESSION,
+    ECALL_ID_EXPIRE_ORDERS,
+    ECALL_ID_RUN_ORDER_RING,
+    ECALL_ID_ACK_SETTLEMENT,
+    ECALL_ID_APPLY_INPUTS,
+    ECALL_ID_COUNT
+};
+
+enum ocall_id_t {
+    OCALL_ID_PRINT_STRING = 0,
+    OCALL_ID_GET_CURRENT_TIME,
+    OCALL_ID_LOG_MESSAGE,
+    OCALL_ID_COUNT
+};
+
+/* Enclave-side view of the boundary, returned by ecall_get_boundary_stats */
+typedef struct _boundary_stats_t {
+    uint64_t ecall_calls[ECALL_ID_COUNT];
+    uint64_t ecall_inside_cycles[ECALL_ID_COUNT];   /* Entry to exit, including nested OCALLs */
+    uint64_t ocall_calls[OCALL_ID_COUNT];
+    uint64_t ocall_outside_cycles[OCALL_ID_COUNT];  /* Exit to re-entry, as seen from inside */
+} boundary_stats_t;
+
 #endif /* USER_TYPES_H */
 
@@ -0,0 +1,652 @@
+/*
+ * LoadGen.cpp - HTTP load generator for the order book App.
+ *
+ * Drives POST /order and GET /trades from a configurable number of
+ * connections, either closed-loop (each connection sends its next request as
+ * soon as the previous response arrives) or open-loop (requests are issued on
+ * a fixed or Poisson schedule at a target aggregate rate).
+ *
+ * In open-loop mode latency is measured from the *intended* send time of each
+ * request, not from when the connection got around to sending it, so a
+ * stalled server is charged for every request it delayed (coordinated
+ * omission correction). The uncorrected service time is reported alongside.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <signal.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "log_histogram.h"
+
+#define HIST_SUB_BITS 7
+#define HIST_BUCKETS LOG_HIST_BUCKETS(HIST_SUB_BITS)
+#define RESPONSE_BUFFER_SIZE 65536
+
+typedef std::chrono::steady_clock clock_type;
+
+enum { PRICE_UNIFORM = 0, PRICE_NORMAL = 1, PRICE_EXPONENTIAL = 2 };
+enum { ENDPOINT_ORDER = 0, ENDPOINT_TRADES = 1, ENDPOINT_COUNT = 2 };
+
+static const char* endpoint_names[ENDPOINT_COUNT] = { "/order", "/trades" };
+
+typedef struct _loadgen_config_t {
+    const char* host;
+    int port;
+    int connections;
+    double duration_s;
+    double warmup_s;
+    double rate;               // Aggregate requests per second, 0 = closed loop
+    bool poisson;              // Exponential inter-arrival times in open loop
+    bool keepalive;            // Reuse the connection when the server allows it
+    double trades_ratio;       // Fraction of requests that are GET /trades
+    double user_trades_ratio;  // Fraction of /trades requests filtered by user
+    double market_ratio;       // Fraction of orders that are market orders
+    double crossing_ratio;     // Fraction of limit orders priced through mid
+    int price_dist;            // PRICE_UNIFORM, PRICE_NORMAL or PRICE_EXPONENTIAL
+    double mid_price;
+    double tick_size;
+    double price_spread;       // Spread of the price distribution, in ticks
+    double quantity_min;
+    double quantity_max;
+    int users;
+    unsigned seed;
+    const char* hist_out;
+} loadgen_config_t;
+
+// Per-connection results, merged once the run is over
+struct worker_stats_t {
+    std::vector<uint64_t> latency[ENDPOINT_COUNT];   // Corrected, in ns
+    std::vector<uint64_t> service[ENDPOINT_COUNT];   // Send to response, in ns
+    uint64_t status_2xx;
+    uint64_t status_4xx;
+    uint64_t status_5xx;
+    uint64_t errors;
+    uint64_t connects;
+    uint64_t completed;
+    uint64_t max_lag_ns;
+
+    worker_stats_t() : status_2xx(0), status_4xx(0), status_5xx(0), errors(0),
+                       connects(0), completed(0), max_lag_ns(0) {
+        for (int i = 0; i < ENDPOINT_COUNT; i++) {
+            latency[i].assign(HIST_BUCKETS, 0);
+            service[i].assign(HIST_BUCKETS, 0);
+        }
+    }
+};
+
+static loadgen_config_t config;
+static struct sockaddr_in server_address;
+static std::atomic<bool> stop_requested(false);
+
+static void handle_signal(int sig)
+{
+    (void)sig;
+    stop_requested.store(true);
+}
+
+static uint64_t elapsed_ns(clock_type::time_point from, clock_type::time_point to)
+{
+    if (to <= from)
+        return 0;
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count();
+}
+
+static int connect_to_server(void)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    struct timeval timeout;
+    timeout.tv_sec = 10;
+    timeout.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    if (connect(fd, (struct sockaddr*)&server_address, sizeof(server_address)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool send_all(int fd, const char* data, size_t length)
+{
+    while (length > 0) {
+        ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += sent;
+        length -= (size_t)sent;
+    }
+    return true;
+}
+
+// Read one HTTP response. Returns the status code, or -1 on a transport error.
+// *server_closes is set when the server announced or performed a close.
+static int read_response(int fd, char* buffer, size_t buffer_size, bool* server_closes)
+{
+    size_t used = 0;
+    char* header_end = NULL;
+    *server_closes = true;
+
+    while (header_end == NULL) {
+        if (used + 1 >= buffer_size)
+            return -1;
+        ssize_t received = recv(fd, buffer + used, buffer_size - used - 1, 0);
+        if (received <= 0) {
+            if (received < 0 && errno == EINTR)
+                continue;
+            return -1;
+        }
+        used += (size_t)received;
+        buffer[used] = '\0';
+        header_end = strstr(buffer, "\r\n\r\n");
+    }
+
+    int minor_version = 0;
+    int status = 0;
+    if (sscanf(buffer, "HTTP/1.%d %d", &minor_version, &status) != 2)
+        return -1;
+
+    // HTTP/1.1 connections persist unless the server says otherwise
+    *server_closes = minor_version == 0;
+
+    // Headers are matched case-insensitively on their conventional spelling
+    long content_length = -1;
+    bool chunked = false;
+    for (char* line = strstr(buffer, "\r\n"); line != NULL && line < header_end;
+         line = strstr(line + 2, "\r\n")) {
+        const char* field = line + 2;
+        if (strncasecmp(field, "Content-Length:", 15) == 0)
+            content_length = strtol(field + 15, NULL, 10);
+        else if (strncasecmp(field, "Transfer-Encoding:", 18) == 0 && strstr(field, "chunked") != NULL)
+            chunked = true;
+        else if (strncasecmp(field, "Connection:", 11) == 0)
+            *server_closes = strncasecmp(field + 11, " keep-alive", 11) != 0;
+    }
+
+    size_t body_received = used - (size_t)(header_end + 4 - buffer);
+    if (chunked) {
+        // The body is not inspected, only drained up to the terminating chunk
+        std::string tail(header_end + 4, body_received);
+        while (tail.find("\r\n0\r\n\r\n") == std::string::npos &&
+               !(tail.size() >= 5 && tail.compare(0, 5, "0\r\n\r\n") == 0)) {
+            ssize_t received = recv(fd, buffer, buffer_size - 1, 0);
+            if (received <= 0)
+                return -1;
+            tail.append(buffer, (size_t)received);
+            if (tail.size() > 16)
+                tail.erase(0, tail.size() - 16);
+        }
+    } else if (content_length >= 0) {
+        while (body_received < (size_t)content_length) {
+            ssize_t received = recv(fd, buffer, buffer_size - 1, 0);
+            if (received <= 0)
+                return -1;
+            body_received += (size_t)received;
+        }
+    } else {
+        // No framing: the body ends when the server closes
+        while (recv(fd, buffer, buffer_size - 1, 0) > 0) {
+        }
+        *server_closes = true;
+    }
+
+    return status;
+}
+
+class RequestMix {
+private:
+    std::mt19937_64 rng;
+    std::uniform_real_distribution<double> unit;
+    std::normal_distribution<double> normal;
+    std::exponential_distribution<double> exponential;
+    std::vector<std::string> user_addresses;
+
+    double price_offset_ticks() {
+        double offset;
+        switch (config.price_dist) {
+        case PRICE_NORMAL:
+            offset = fabs(normal(rng)) * config.price_spread;
+            break;
+        case PRICE_EXPONENTIAL:
+            offset = exponential(rng) * config.price_spread;
+            break;
+        default:
+            offset = unit(rng) * config.price_spread;
+            break;
+        }
+        return floor(offset);
+    }
+
+public:
+    RequestMix(unsigned seed) : rng(seed), unit(0.0, 1.0), normal(0.0, 1.0), exponential(1.0) {
+        for (int i = 0; i < config.users; i++) {
+            char address[43];
+            snprintf(address, sizeof(address), "0x%040x", i + 1);
+            user_addresses.push_back(address);
+        }
+    }
+
+    double next_gap_ns(double mean_gap_ns) {
+        if (!config.poisson)
+            return mean_gap_ns;
+        return exponential(rng) * mean_gap_ns;
+    }
+
+    // Build the next request into buffer; returns the endpoint it targets
+    int build(char* buffer, size_t buffer_size, size_t* length) {
+        const std::string& user = user_addresses[(size_t)(unit(rng) * (double)user_addresses.size())];
+        const char* connection = config.keepalive ? "keep-alive" : "close";
+
+        if (unit(rng) < config.trades_ratio) {
+            int n;
+            if (unit(rng) < config.user_trades_ratio) {
+                n = snprintf(buffer, buffer_size,
+                             "GET /trades?user=%s HTTP/1.1\r\nHost: %s\r\nConnection: %s\r\n\r\n",
+                             user.c_str(), config.host, connection);
+            } else {
+                n = snprintf(buffer, buffer_size,
+                             "GET /trades HTTP/1.1\r\nHost: %s\r\nConnection: %s\r\n\r\n",
+                             config.host, connection);
+            }
+            *length = (size_t)n;
+            return ENDPOINT_TRADES;
+        }
+
+        bool buy = unit(rng) < 0.5;
+        double quantity = config.quantity_min + unit(rng) * (config.quantity_max - config.quantity_min);
+        char params[256];
+
+        if (unit(rng) < config.market_ratio) {
+            snprintf(params, sizeof(params), "user=%s&type=market&side=%s&quantity=%.4f",
+                     user.c_str(), buy ? "buy" : "sell", quantity);
+        } else {
+            // Passive orders rest one or more ticks away from mid on their own
+            // side; crossing orders are priced through mid into the other side
+            double ticks = 1.0 + price_offset_ticks();
+            bool crossing = unit(rng) < config.crossing_ratio;
+            double direction = (buy == crossing) ? 1.0 : -1.0;
+            double price = config.mid_price + direction * ticks * config.tick_size;
+            if (price < config.tick_size)
+                price = config.tick_size;
+            snprintf(params, sizeof(params), "user=%s&type=limit&side=%s&price=%.4f&quantity=%.4f",
+                     user.c_str(), buy ? "buy" : "sell", price, quantity);
+        }
+
+        int n = snprintf(buffer, buffer_size,
+                         "POST /order?%s HTTP/1.1\r\nHost: %s\r\nContent-Length: 0\r\nConnection: %s\r\n\r\n",
+                         params, config.host, connection);
+        *length = (size_t)n;
+        return ENDPOINT_ORDER;
+    }
+};
+
+static void run_connection(int index, clock_type::time_point start, worker_stats_t* stats)
+{
+    RequestMix mix(config.seed + (unsigned)index * 7919u);
+    std::vector<char> response(RESPONSE_BUFFER_SIZE);
+    char request[1024];
+    int fd = -1;
+
+    clock_type::time_point measure_from = start + std::chrono::nanoseconds((int64_t)(config.warmup_s * 1e9));
+    clock_type::time_point end = measure_from + std::chrono::nanoseconds((int64_t)(config.duration_s * 1e9));
+
+    // Each connection carries rate/connections of the open-loop load; the
+    // merge of independent Poisson streams is again Poisson at the full rate
+    bool open_loop = config.rate > 0;
+    double mean_gap_ns = open_loop ? 1e9 * config.connections / config.rate : 0;
+    clock_type::time_point intended = start;
+    if (open_loop)
+        intended += std::chrono::nanoseconds((int64_t)(mean_gap_ns * index / config.connections));
+
+    while (!stop_requested.load(std::memory_order_relaxed)) {
+        clock_type::time_point now = clock_type::now();
+        if (open_loop) {
+            if (intended >= end)
+                break;
+            if (intended > now) {
+                std::this_thread::sleep_until(intended);
+                now = clock_type::now();
+            }
+        } else {
+            if (now >= end)
+                break;
+            intended = now;
+        }
+
+        size_t length = 0;
+        int endpoint = mix.build(request, sizeof(request), &length);
+
+        if (fd < 0) {
+            fd = connect_to_server();
+            stats->connects++;
+        }
+
+        clock_type::time_point sent_at = clock_type::now();
+        bool server_closes = true;
+        int status = -1;
+        if (fd >= 0 && send_all(fd, request, length))
+            status = read_response(fd, response.data(), response.size(), &server_closes);
+        clock_type::time_point done = clock_type::now();
+
+        if (status < 0 || server_closes || !config.keepalive) {
+            if (fd >= 0)
+                close(fd);
+            fd = -1;
+        }
+
+        if (intended >= measure_from) {
+            if (status < 0) {
+                stats->errors++;
+            } else {
+                log_hist_record(stats->latency[endpoint].data(), HIST_SUB_BITS, elapsed_ns(intended, done));
+                log_hist_record(stats->service[endpoint].data(), HIST_SUB_BITS, elapsed_ns(sent_at, done));
+                stats->completed++;
+                if (status < 400)
+                    stats->status_2xx++;
+                else if (status < 500)
+                    stats->status_4xx++;
+                else
+                    stats->status_5xx++;
+            }
+            uint64_t lag = elapsed_ns(intended, sent_at);
+            if (lag > stats->max_lag_ns)
+                stats->max_lag_ns = lag;
+        }
+
+        if (open_loop)
+            intended += std::chrono::nanoseconds((int64_t)mix.next_gap_ns(mean_gap_ns));
+    }
+
+    if (fd >= 0)
+        close(fd);
+}
+
+static void print_histogram(const char* label, const std::vector<uint64_t>& counts)
+{
+    uint64_t total = log_hist_total(counts.data(), counts.size());
+    if (total == 0) {
+        printf("  %-22s no samples\n", label);
+        return;
+    }
+
+    static const double percentiles[] = { 50.0, 90.0, 99.0, 99.9, 99.99 };
+    printf("  %-22s n=%-9llu", label, (unsigned long long)total);
+    for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++) {
+        uint64_t value = log_hist_percentile(counts.data(), counts.size(), HIST_SUB_BITS, percentiles[i]);
+        printf(" p%g=%.1fus", percentiles[i], (double)value / 1000.0);
+    }
+    printf(" max=%.1fus\n", (double)log_hist_max(counts.data(), counts.size(), HIST_SUB_BITS) / 1000.0);
+}
+
+// Percentile distribution in the HdrHistogram .hgrm text layout
+static void write_histogram_file(const char* path, const std::vector<uint64_t>& counts)
+{
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        perror("Failed to open histogram output");
+        return;
+    }
+
+    uint64_t total = log_hist_total(counts.data(), counts.size());
+    uint64_t seen = 0;
+    fprintf(file, "%12s %14s %10s %14s\n\n", "Value(us)", "Percentile", "TotalCount", "1/(1-Percentile)");
+    for (size_t i = 0; i < counts.size() && total > 0; i++) {
+        if (counts[i] == 0)
+            continue;
+        seen += counts[i];
+        double fraction = (double)seen / (double)total;
+        double inverse = fraction < 1.0 ? 1.0 / (1.0 - fraction) : INFINITY;
+        fprintf(file, "%12.3f %14.12f %10llu %14.2f\n",
+                (double)log_hist_upper(i, HIST_SUB_BITS) / 1000.0, fraction,
+                (unsigned long long)seen, inverse);
+    }
+    fclose(file);
+}
+
+static void usage(const char* program)
+{
+    printf("Usage: %s [options]\n"
+           "  --host H              Server address (default 127.0.0.1)\n"
+           "  --port P              Server port (default 8080)\n"
+           "  --connections N       Concurrent connections (default 8)\n"
+           "  --duration S          Measured seconds (default 10)\n"
+           "  --warmup S            Unmeasured warmup seconds (default 2)\n"
+           "  --rate R              Open-loop aggregate requests/s; 0 = closed loop (default 0)\n"
+           "  --poisson             Exponential inter-arrival times in open loop\n"
+           "  --keepalive           Reuse connections when the server allows it\n"
+           "  --trades-ratio F      Fraction of requests that are GET /trades (default 0.1)\n"
+           "  --user-trades-ratio F Fraction of /trades requests with ?user= (default 0.5)\n"
+           "  --market-ratio F      Fraction of orders that are market orders (default 0.1)\n"
+           "  --crossing-ratio F    Fraction of limit orders priced through mid (default 0.3)\n"
+           "  --price-dist D        uniform, normal or exponential (default uniform)\n"
+           "  --mid P               Mid price (default 100)\n"
+           "  --tick T              Tick size (default 0.01)\n"
+           "  --spread N            Price distribution spread in ticks (default 50)\n"
+           "  --qty-min Q           Minimum quantity (default 1)\n"
+           "  --qty-max Q           Maximum quantity (default 10)\n"
+           "  --users N             Distinct user addresses (default 100)\n"
+           "  --seed N              Random seed (default 1)\n"
+           "  --hist-out FILE       Write the corrected latency distribution of all requests\n",
+           program);
+}
+
+static int parse_arguments(int argc, char* argv[])
+{
+    static const struct option options[] = {
+        { "host", required_argument, NULL, 'h' },
+        { "port", required_argument, NULL, 'p' },
+        { "connections", required_argument, NULL, 'c' },
+        { "duration", required_argument, NULL, 'd' },
+        { "warmup", required_argument, NULL, 'w' },
+        { "rate", required_argument, NULL, 'r' },
+        { "poisson", no_argument, NULL, 'P' },
+        { "keepalive", no_argument, NULL, 'k' },
+        { "trades-ratio", required_argument, NULL, 't' },
+        { "user-trades-ratio", required_argument, NULL, 'u' },
+        { "market-ratio", required_argument, NULL, 'm' },
+        { "crossing-ratio", required_argument, NULL, 'x' },
+        { "price-dist", required_argument, NULL, 'D' },
+        { "mid", required_argument, NULL, 'M' },
+        { "tick", required_argument, NULL, 'T' },
+        { "spread", required_argument, NULL, 'S' },
+        { "qty-min", required_argument, NULL, 'q' },
+        { "qty-max", required_argument, NULL, 'Q' },
+        { "users", required_argument, NULL, 'U' },
+        { "seed", required_argument, NULL, 's' },
+        { "hist-out", required_argument, NULL, 'o' },
+        { "help", no_argument, NULL, '?' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    config.host = "127.0.0.1";
+    config.port = 8080;
+    config.connections = 8;
+    config.duration_s = 10;
+    config.warmup_s = 2;
+    config.rate = 0;
+    config.poisson = false;
+    config.keepalive = false;
+    config.trades_ratio = 0.1;
+    config.user_trades_ratio = 0.5;
+    config.market_ratio = 0.1;
+    config.crossing_ratio = 0.3;
+    config.price_dist = PRICE_UNIFORM;
+    config.mid_price = 100.0;
+    config.tick_size = 0.01;
+    config.price_spread = 50;
+    config.quantity_min = 1;
+    config.quantity_max = 10;
+    config.users = 100;
+    config.seed = 1;
+    config.hist_out = NULL;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (opt) {
+        case 'h': config.host = optarg; break;
+        case 'p': config.port = atoi(optarg); break;
+        case 'c': config.connections = atoi(optarg); break;
+        case 'd': config.duration_s = atof(optarg); break;
+        case 'w': config.warmup_s = atof(optarg); break;
+        case 'r': config.rate = atof(optarg); break;
+        case 'P': config.poisson = true; break;
+        case 'k': config.keepalive = true; break;
+        case 't': config.trades_ratio = atof(optarg); break;
+        case 'u': config.user_trades_ratio = atof(optarg); break;
+        case 'm': config.market_ratio = atof(optarg); break;
+        case 'x': config.crossing_ratio = atof(optarg); break;
+        case 'D':
+            if (strcmp(optarg, "normal") == 0) {
+                config.price_dist = PRICE_NORMAL;
+            } else if (strcmp(optarg, "exponential") == 0) {
+                config.price_dist = PRICE_EXPONENTIAL;
+            } else if (strcmp(optarg, "uniform") == 0) {
+                config.price_dist = PRICE_UNIFORM;
+            } else {
+                fprintf(stderr, "Unknown price distribution: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'M': config.mid_price = atof(optarg); break;
+        case 'T': config.tick_size = atof(optarg); break;
+        case 'S': config.price_spread = atof(optarg); break;
+        case 'q': config.quantity_min = atof(optarg); break;
+        case 'Q': config.quantity_max = atof(optarg); break;
+        case 'U': config.users = atoi(optarg); break;
+        case 's': config.seed = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'o': config.hist_out = optarg; break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (config.connections < 1 || config.users < 1 || config.duration_s <= 0 ||
+        config.tick_size <= 0 || config.quantity_max < config.quantity_min) {
+        fprintf(stderr, "Invalid configuration\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int resolve_server(void)
+{
+    struct addrinfo hints;
+    struct addrinfo* result = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(config.host, NULL, &hints, &result) != 0 || result == NULL) {
+        fprintf(stderr, "Cannot resolve %s\n", config.host);
+        return -1;
+    }
+    memcpy(&server_address, result->ai_addr, sizeof(server_address));
+    server_address.sin_port = htons((uint16_t)config.port);
+    freeaddrinfo(result);
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    if (parse_arguments(argc, argv) < 0 || resolve_server() < 0)
+        return 1;
+
+    signal(SIGINT, handle_signal);
+
+    printf("Load: %s:%d, %d connections, %s", config.host, config.port, config.connections,
+           config.rate > 0 ? "open loop" : "closed loop");
+    if (config.rate > 0)
+        printf(" at %.0f req/s (%s arrivals)", config.rate, config.poisson ? "poisson" : "uniform");
+    printf(", %.0fs warmup + %.0fs measured\n", config.warmup_s, config.duration_s);
+    printf("Mix: %.0f%% trades, %.0f%% market, %.0f%% crossing limits, %s prices +/-%.0f ticks around %.4f\n",
+           config.trades_ratio * 100, config.market_ratio * 100, config.crossing_ratio * 100,
+           config.price_dist == PRICE_NORMAL ? "normal" :
+           config.price_dist == PRICE_EXPONENTIAL ? "exponential" : "uniform",
+           config.price_spread, config.mid_price);
+
+    std::vector<worker_stats_t> stats((size_t)config.connections);
+    std::vector<std::thread> workers;
+    clock_type::time_point start = clock_type::now() + std::chrono::milliseconds(50);
+
+    for (int i = 0; i < config.connections; i++)
+        workers.push_back(std::thread(run_connection, i, start, &stats[(size_t)i]));
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+
+    worker_stats_t total;
+    for (size_t w = 0; w < stats.size(); w++) {
+        for (int e = 0; e < ENDPOINT_COUNT; e++) {
+            for (size_t b = 0; b < HIST_BUCKETS; b++) {
+                total.latency[e][b] += stats[w].latency[e][b];
+                total.service[e][b] += stats[w].service[e][b];
+            }
+        }
+        total.status_2xx += stats[w].status_2xx;
+        total.status_4xx += stats[w].status_4xx;
+        total.status_5xx += stats[w].status_5xx;
+        total.errors += stats[w].errors;
+        total.connects += stats[w].connects;
+        total.completed += stats[w].completed;
+        if (stats[w].max_lag_ns > total.max_lag_ns)
+            total.max_lag_ns = stats[w].max_lag_ns;
+    }
+
+    std::vector<uint64_t> all(HIST_BUCKETS, 0);
+    for (int e = 0; e < ENDPOINT_COUNT; e++) {
+        for (size_t b = 0; b < HIST_BUCKETS; b++)
+            all[b] += total.latency[e][b];
+    }
+
+    double throughput = (double)total.completed / config.duration_s;
+    printf("\nThroughput: %.1f req/s sustained (%llu completed, %llu transport errors, %llu connects)\n",
+           throughput, (unsigned long long)total.completed, (unsigned long long)total.errors,
+           (unsigned long long)total.connects);
+    printf("Status: 2xx/3xx=%llu 4xx=%llu 5xx=%llu\n", (unsigned long long)total.status_2xx,
+           (unsigned long long)total.status_4xx, (unsigned long long)total.status_5xx);
+
+    printf("Latency (%s):\n", config.rate > 0 ? "corrected for coordinated omission" : "closed loop");
+    print_histogram("all", all);
+    for (int e = 0; e < ENDPOINT_COUNT; e++)
+        print_histogram(endpoint_names[e], total.latency[e]);
+
+    if (config.rate > 0) {
+        printf("Service time (send to response, uncorrected):\n");
+        for (int e = 0; e < ENDPOINT_COUNT; e++)
+            print_histogram(endpoint_names[e], total.service[e]);
+        printf("Max schedule lag: %.1fms\n", (double)total.max_lag_ns / 1e6);
+        if (throughput < 0.95 * config.rate)
+            printf("SATURATED: achieved %.1f of %.1f req/s target\n", throughput, config.rate);
+    }
+
+    if (config.hist_out != NULL)
+        write_histogram_file(config.hist_out, all);
+
+    return 0;
+}